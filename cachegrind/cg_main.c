@@ -41,6 +41,7 @@
 #include "pub_tool_oset.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_xarray.h"
+#include "pub_tool_wordfm.h"
 #include "pub_tool_clientstate.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
 
@@ -62,6 +63,10 @@
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
+static Bool  clo_binary_out = False; /* --cachegrind-out-format=binary? */
+static ULong clo_sample_period  = 0;     /* 0: no sampling */
+static ULong clo_sample_detail  = 10000;
+static ULong clo_sample_warming = 0;
 
 /*------------------------------------------------------------*/
 /*--- Cachesim configuration                               ---*/
@@ -77,7 +82,10 @@ typedef
    struct {
       ULong a;  /* total # memory accesses of this kind */
       ULong m1; /* misses in the first level cache */
-      ULong mL; /* misses in the second level cache */
+      ULong m2; /* misses in the mid-level cache, if simulated */
+      ULong mL; /* misses in the last level cache */
+      ULong mT; /* misses in the data TLB, if simulated */
+      ULong pf; /* lines prefetched into D1, if simulated */
    }
    CacheCC;
 
@@ -267,13 +275,22 @@ static LineCC* get_lineCC(Addr origAddr)
       lineCC->loc.line = loc.line;
       lineCC->Ir.a     = 0;
       lineCC->Ir.m1    = 0;
+      lineCC->Ir.m2    = 0;
       lineCC->Ir.mL    = 0;
+      lineCC->Ir.mT    = 0;
+      lineCC->Ir.pf    = 0;
       lineCC->Dr.a     = 0;
       lineCC->Dr.m1    = 0;
+      lineCC->Dr.m2    = 0;
       lineCC->Dr.mL    = 0;
+      lineCC->Dr.mT    = 0;
+      lineCC->Dr.pf    = 0;
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
+      lineCC->Dw.m2    = 0;
       lineCC->Dw.mL    = 0;
+      lineCC->Dw.mT    = 0;
+      lineCC->Dw.pf    = 0;
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
@@ -332,7 +349,8 @@ void log_1IrGen_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 }
 
@@ -342,7 +360,8 @@ void log_1IrNoX_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 }
 
@@ -354,10 +373,12 @@ void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
    //            n,  n->instr_addr,  n->instr_len,
    //            n2, n2->instr_addr, n2->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir.m1, &n2->parent->Ir.m2,
+			 &n2->parent->Ir.mL);
    n2->parent->Ir.a++;
 }
 
@@ -371,44 +392,72 @@ void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
    //            n2, n2->instr_addr, n2->instr_len,
    //            n3, n3->instr_addr, n3->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir.m1, &n2->parent->Ir.m2,
+			 &n2->parent->Ir.mL);
    n2->parent->Ir.a++;
    cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
-			 &n3->parent->Ir.m1, &n3->parent->Ir.mL);
+			 &n3->parent->Ir.m1, &n3->parent->Ir.m2,
+			 &n3->parent->Ir.mL);
    n3->parent->Ir.a++;
 }
 
+/* Simulates the data TLB and the prefetcher, if enabled, for a data
+ * access of instruction 'n'. */
+__attribute__((always_inline))
+static __inline__
+void D_extras_doref(InstrInfo* n, Addr data_addr, Word data_size,
+                    Bool D1_miss, CacheCC* cc)
+{
+   if (LIKELY(!cachesim_D_extras))
+      return;
+   if (cachesim_has_DTLB && cachesim_DTLB_ref_is_miss(data_addr, data_size))
+      cc->mT++;
+   if (cachesim_pf != CachePf_None)
+      cc->pf += cachesim_prefetch(n->instr_addr, data_addr, D1_miss);
+}
+
 static VG_REGPARM(3)
 void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
+   Bool D1_miss;
+
    //VG_(printf)("1IrNoX_1Dr:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+   D1_miss = cachesim_D1_doref(data_addr, data_size,
+                               &n->parent->Dr.m1, &n->parent->Dr.m2,
+                               &n->parent->Dr.mL);
    n->parent->Dr.a++;
+   D_extras_doref(n, data_addr, data_size, D1_miss, &n->parent->Dr);
 }
 
 static VG_REGPARM(3)
 void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
+   Bool D1_miss;
+
    //VG_(printf)("1IrNoX_1Dw:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.m2,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+   D1_miss = cachesim_D1_doref(data_addr, data_size,
+                               &n->parent->Dw.m1, &n->parent->Dw.m2,
+                               &n->parent->Dw.mL);
    n->parent->Dw.a++;
+   D_extras_doref(n, data_addr, data_size, D1_miss, &n->parent->Dw);
 }
 
 /* Note that addEvent_D_guarded assumes that log_0Ir_1Dr_cache_access
@@ -417,22 +466,30 @@ void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 static VG_REGPARM(3)
 void log_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
+   Bool D1_miss;
+
    //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+   D1_miss = cachesim_D1_doref(data_addr, data_size,
+                               &n->parent->Dr.m1, &n->parent->Dr.m2,
+                               &n->parent->Dr.mL);
    n->parent->Dr.a++;
+   D_extras_doref(n, data_addr, data_size, D1_miss, &n->parent->Dr);
 }
 
 /* See comment on log_0Ir_1Dr_cache_access. */
 static VG_REGPARM(3)
 void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
+   Bool D1_miss;
+
    //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+   D1_miss = cachesim_D1_doref(data_addr, data_size,
+                               &n->parent->Dw.m1, &n->parent->Dw.m2,
+                               &n->parent->Dw.mL);
    n->parent->Dw.a++;
+   D_extras_doref(n, data_addr, data_size, D1_miss, &n->parent->Dw);
 }
 
 /* For branches, we consult two different predictors, one which
@@ -461,10 +518,219 @@ void log_ind_branch(InstrInfo* n, UWord actual_dst)
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Sampling                                             ---*/
+/*------------------------------------------------------------*/
+
+/* With --sample-period=P, the run is split into periods of P
+ * instructions, each made of up to three phases:
+ *  - warming:      --sample-warming instructions whose references update
+ *                  the caches and branch predictors but are not counted;
+ *  - detail:       --sample-detail instructions simulated and counted as
+ *                  usual;
+ *  - fast-forward: the rest of the period, where nothing but the
+ *                  instruction count is maintained.
+ * The generated code reads sample_phase at the start of each superblock
+ * and guards the calls to the simulation helpers with it, and subtracts
+ * the number of instructions of the superblock from sample_left.  When
+ * that reaches zero it calls sample_next_phase().  The phases are thus
+ * switched at superblock granularity.  At the end, the counts of the
+ * detailed windows are scaled up to the whole run. */
+
+#define SAMPLE_FAST_FORWARD  0
+#define SAMPLE_WARMING       1
+#define SAMPLE_DETAIL        2
+
+static UInt  sample_phase     = SAMPLE_DETAIL;
+static Word  sample_left      = 0;
+static Word  sample_phase_len = 0;
+static ULong sample_instrs[3] = { 0, 0, 0 };   // instrs run in each phase
+
+// Statistics of the per-window miss rates, for the confidence intervals:
+// I1, D1 and LL misses per instruction.
+#define SAMPLE_N_STATS 3
+static ULong  sample_windows = 0;
+static ULong  sample_win_start[SAMPLE_N_STATS];
+static double sample_sum [SAMPLE_N_STATS];
+static double sample_sum2[SAMPLE_N_STATS];
+
+static void sample_misses(ULong* misses)
+{
+   misses[0] = cachesim_I1_misses;
+   misses[1] = cachesim_D1_misses;
+   misses[2] = cachesim_LL_misses;
+}
+
+// Starts a new phase.  The first period starts with its warming (or
+// detail) phase, so that even short runs get a detailed window.
+static void sample_start_phase(UInt phase)
+{
+   sample_phase = phase;
+   switch (phase) {
+      case SAMPLE_WARMING:
+         sample_phase_len = (Word)clo_sample_warming;
+         break;
+      case SAMPLE_DETAIL:
+         sample_phase_len = (Word)clo_sample_detail;
+         sample_misses(sample_win_start);
+         break;
+      default:
+         sample_phase_len = (Word)(clo_sample_period - clo_sample_warming
+                                   - clo_sample_detail);
+         break;
+   }
+   sample_left = sample_phase_len;
+}
+
+// Accounts for the instructions run in the current phase, which may be
+// more than its length as phases are switched between superblocks.
+static void sample_end_phase(void)
+{
+   ULong done = (ULong)(sample_phase_len - sample_left);
+   ULong misses[SAMPLE_N_STATS];
+   Int   k;
+
+   sample_instrs[sample_phase] += done;
+   if (sample_phase == SAMPLE_DETAIL && done > 0) {
+      sample_misses(misses);
+      for (k = 0; k < SAMPLE_N_STATS; k++) {
+         double r = (double)(misses[k] - sample_win_start[k]) / done;
+         sample_sum [k] += r;
+         sample_sum2[k] += r * r;
+      }
+      sample_windows++;
+   }
+}
+
+static VG_REGPARM(0)
+void sample_next_phase(void)
+{
+   sample_end_phase();
+   switch (sample_phase) {
+      case SAMPLE_FAST_FORWARD:
+         sample_start_phase(clo_sample_warming > 0 ? SAMPLE_WARMING
+                                                   : SAMPLE_DETAIL);
+         break;
+      case SAMPLE_WARMING:
+         sample_start_phase(SAMPLE_DETAIL);
+         break;
+      default:
+         if (clo_sample_period > clo_sample_warming + clo_sample_detail)
+            sample_start_phase(SAMPLE_FAST_FORWARD);
+         else
+            sample_start_phase(clo_sample_warming > 0 ? SAMPLE_WARMING
+                                                      : SAMPLE_DETAIL);
+         break;
+   }
+}
+
+// Factor by which the counts of the detailed windows are multiplied.
+static double sample_scale(void)
+{
+   ULong total = sample_instrs[0] + sample_instrs[1] + sample_instrs[2];
+   if (sample_instrs[SAMPLE_DETAIL] == 0)
+      return 1.0;
+   return (double)total / sample_instrs[SAMPLE_DETAIL];
+}
+
+static double sample_sqrt(double x)
+{
+   double r = x;
+   Int    i;
+
+   if (x <= 0.0)
+      return 0.0;
+   for (i = 0; i < 64; i++)
+      r = 0.5 * (r + x / r);
+   return r;
+}
+
+// Returns the half-width of the 95% confidence interval of statistic k,
+// relative to its mean, in percent; or -1 if it cannot be computed.
+static double sample_rel_ci95(Int k)
+{
+   double n = (double)sample_windows;
+   double mean, var;
+
+   if (sample_windows < 2)
+      return -1.0;
+   mean = sample_sum[k] / n;
+   if (mean <= 0.0)
+      return -1.0;
+   var = (sample_sum2[k] - n * mean * mean) / (n - 1.0);
+   if (var < 0.0)
+      var = 0.0;
+   return 1.96 * sample_sqrt(var / n) / mean * 100.0;
+}
+
+/* Warming helpers.  They take the same arguments as the corresponding
+   log_* helpers, and update the simulated state without counting. */
+static CacheCC sample_sink;
+
+static VG_REGPARM(1)
+void warm_1Ir(InstrInfo* n)
+{
+   cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
+                         &sample_sink.m1, &sample_sink.m2, &sample_sink.mL);
+}
+
+static VG_REGPARM(2)
+void warm_2Ir(InstrInfo* n, InstrInfo* n2)
+{
+   warm_1Ir(n);
+   warm_1Ir(n2);
+}
+
+static VG_REGPARM(3)
+void warm_3Ir(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
+{
+   warm_1Ir(n);
+   warm_1Ir(n2);
+   warm_1Ir(n3);
+}
+
+static VG_REGPARM(3)
+void warm_0Ir_1D(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   Bool D1_miss;
+
+   D1_miss = cachesim_D1_doref(data_addr, data_size,
+                               &sample_sink.m1, &sample_sink.m2,
+                               &sample_sink.mL);
+   D_extras_doref(n, data_addr, data_size, D1_miss, &sample_sink);
+}
+
+static VG_REGPARM(3)
+void warm_1Ir_1D(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   warm_1Ir(n);
+   warm_0Ir_1D(n, data_addr, data_size);
+}
+
+static VG_REGPARM(2)
+void warm_cond_branch(InstrInfo* n, Word taken)
+{
+   do_cond_branch_predict(n->instr_addr, taken);
+}
+
+static VG_REGPARM(2)
+void warm_ind_branch(InstrInfo* n, UWord actual_dst)
+{
+   do_ind_branch_predict(n->instr_addr, actual_dst);
+}
+
 /*------------------------------------------------------------*/
 /*--- Instrumentation types and structures                 ---*/
 /*------------------------------------------------------------*/
 
+#if defined(VG_BIGENDIAN)
+# define CGEndness Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define CGEndness Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
 /* Maintain an ordered list of memory events which are outstanding, in
    the sense that no IR has yet been generated to do the relevant
    helper calls.  The BB is scanned top to bottom and memory events
@@ -587,6 +853,11 @@ typedef
 
       /* The output SB being constructed. */
       IRSB* sbOut;
+
+      /* With sampling, the Ity_I1 guards of the helper calls made in the
+         detail and warming phases, else NULL. */
+      IRAtom* detail_guard;
+      IRAtom* warm_guard;
    }
    CgState;
 
@@ -695,6 +966,8 @@ static void flushEvents ( CgState* cgs )
    Int        i, regparms;
    const HChar* helperName;
    void*      helperAddr;
+   const HChar* warmName;
+   void*      warmAddr;
    IRExpr**   argv;
    IRExpr*    i_node_expr;
    IRDirty*   di;
@@ -707,6 +980,8 @@ static void flushEvents ( CgState* cgs )
 
       helperName = NULL;
       helperAddr = NULL;
+      warmName   = NULL;
+      warmAddr   = NULL;
       argv       = NULL;
       regparms   = 0;
 
@@ -742,6 +1017,8 @@ static void flushEvents ( CgState* cgs )
                tl_assert(ev2->inode == ev->inode);
                helperName = "log_1IrNoX_1Dr_cache_access";
                helperAddr = &log_1IrNoX_1Dr_cache_access;
+               warmName   = "warm_1Ir_1D";
+               warmAddr   = &warm_1Ir_1D;
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -754,6 +1031,8 @@ static void flushEvents ( CgState* cgs )
                tl_assert(ev2->inode == ev->inode);
                helperName = "log_1IrNoX_1Dw_cache_access";
                helperAddr = &log_1IrNoX_1Dw_cache_access;
+               warmName   = "warm_1Ir_1D";
+               warmAddr   = &warm_1Ir_1D;
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -767,6 +1046,8 @@ static void flushEvents ( CgState* cgs )
                if (clo_cache_sim) {
                   helperName = "log_3IrNoX_0D_cache_access";
                   helperAddr = &log_3IrNoX_0D_cache_access;
+                  warmName   = "warm_3Ir";
+                  warmAddr   = &warm_3Ir;
                } else {
                   helperName = "log_3Ir";
                   helperAddr = &log_3Ir;
@@ -783,6 +1064,8 @@ static void flushEvents ( CgState* cgs )
                if (clo_cache_sim) {
                   helperName = "log_2IrNoX_0D_cache_access";
                   helperAddr = &log_2IrNoX_0D_cache_access;
+                  warmName   = "warm_2Ir";
+                  warmAddr   = &warm_2Ir;
                } else {
                   helperName = "log_2Ir";
                   helperAddr = &log_2Ir;
@@ -797,6 +1080,8 @@ static void flushEvents ( CgState* cgs )
                if (clo_cache_sim) {
                   helperName = "log_1IrNoX_0D_cache_access";
                   helperAddr = &log_1IrNoX_0D_cache_access;
+                  warmName   = "warm_1Ir";
+                  warmAddr   = &warm_1Ir;
                } else {
                   helperName = "log_1Ir";
                   helperAddr = &log_1Ir;
@@ -810,6 +1095,8 @@ static void flushEvents ( CgState* cgs )
             if (clo_cache_sim) {
 	       helperName = "log_1IrGen_0D_cache_access";
 	       helperAddr = &log_1IrGen_0D_cache_access;
+	       warmName   = "warm_1Ir";
+	       warmAddr   = &warm_1Ir;
 	    } else {
 	       helperName = "log_1Ir";
 	       helperAddr = &log_1Ir;
@@ -823,6 +1110,8 @@ static void flushEvents ( CgState* cgs )
             /* Data read or modify */
             helperName = "log_0Ir_1Dr_cache_access";
             helperAddr = &log_0Ir_1Dr_cache_access;
+            warmName   = "warm_0Ir_1D";
+            warmAddr   = &warm_0Ir_1D;
             argv = mkIRExprVec_3( i_node_expr, 
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -833,6 +1122,8 @@ static void flushEvents ( CgState* cgs )
             /* Data write */
             helperName = "log_0Ir_1Dw_cache_access";
             helperAddr = &log_0Ir_1Dw_cache_access;
+            warmName   = "warm_0Ir_1D";
+            warmAddr   = &warm_0Ir_1D;
             argv = mkIRExprVec_3( i_node_expr,
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -843,6 +1134,8 @@ static void flushEvents ( CgState* cgs )
             /* Conditional branch */
             helperName = "log_cond_branch";
             helperAddr = &log_cond_branch;
+            warmName   = "warm_cond_branch";
+            warmAddr   = &warm_cond_branch;
             argv = mkIRExprVec_2( i_node_expr, ev->Ev.Bc.taken );
             regparms = 2;
             i++;
@@ -851,6 +1144,8 @@ static void flushEvents ( CgState* cgs )
             /* Branch to an unknown destination */
             helperName = "log_ind_branch";
             helperAddr = &log_ind_branch;
+            warmName   = "warm_ind_branch";
+            warmAddr   = &warm_ind_branch;
             argv = mkIRExprVec_2( i_node_expr, ev->Ev.Bi.dst );
             regparms = 2;
             i++;
@@ -866,7 +1161,18 @@ static void flushEvents ( CgState* cgs )
       di = unsafeIRDirty_0_N( regparms, 
                               helperName, VG_(fnptr_to_fnentry)( helperAddr ), 
                               argv );
+      if (cgs->detail_guard)
+         di->guard = cgs->detail_guard;
       addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+
+      /* And the helper which only warms the simulated state up. */
+      if (cgs->warm_guard && warmAddr) {
+         di = unsafeIRDirty_0_N( regparms,
+                                 warmName, VG_(fnptr_to_fnentry)( warmAddr ),
+                                 shallowCopyIRExprVec(argv) );
+         di->guard = cgs->warm_guard;
+         addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+      }
    }
 
    cgs->events_used = 0;
@@ -948,6 +1254,30 @@ void addEvent_Dw ( CgState* cgs, InstrInfo* inode, Int datasize, IRAtom* ea )
    cgs->events_used++;
 }
 
+/* Returns an Ity_I1 atom which is the conjunction of the Ity_I1 atoms
+   g1 and g2. */
+static IRAtom* and_guards ( CgState* cgs, IRAtom* g1, IRAtom* g2 )
+{
+   IRTemp w1 = newIRTemp(cgs->sbOut->tyenv, Ity_I32);
+   IRTemp w2 = newIRTemp(cgs->sbOut->tyenv, Ity_I32);
+   IRTemp w  = newIRTemp(cgs->sbOut->tyenv, Ity_I32);
+   IRTemp g  = newIRTemp(cgs->sbOut->tyenv, Ity_I1);
+
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(w1, IRExpr_Unop(Iop_1Uto32, g1)) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(w2, IRExpr_Unop(Iop_1Uto32, g2)) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(w, IRExpr_Binop(Iop_And32,
+                                               IRExpr_RdTmp(w1),
+                                               IRExpr_RdTmp(w2))) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(g, IRExpr_Binop(Iop_CmpNE32,
+                                               IRExpr_RdTmp(w),
+                                               IRExpr_Const(IRConst_U32(0)))) );
+   return IRExpr_RdTmp(g);
+}
+
 static
 void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
                           Int datasize, IRAtom* ea, IRAtom* guard,
@@ -989,8 +1319,17 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
                     regparms, 
                     helperName, VG_(fnptr_to_fnentry)( helperAddr ), 
                     argv );
-   di->guard = guard;
+   di->guard = cgs->detail_guard ? and_guards(cgs, guard, cgs->detail_guard)
+                                 : guard;
    addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+
+   if (cgs->warm_guard) {
+      di = unsafeIRDirty_0_N( regparms, "warm_0Ir_1D",
+                              VG_(fnptr_to_fnentry)( &warm_0Ir_1D ),
+                              shallowCopyIRExprVec(argv) );
+      di->guard = and_guards(cgs, guard, cgs->warm_guard);
+      addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+   }
 }
 
 
@@ -1034,6 +1373,61 @@ void addEvent_Bi ( CgState* cgs, InstrInfo* inode, IRAtom* whereTo )
    cgs->events_used++;
 }
 
+/* Emits the code run at the start of a superblock when sampling: read
+   the phase, to guard the helper calls, then count the instructions of
+   the superblock, and switch phase if the current one is over.  The new
+   phase thus applies from the next superblock on. */
+static void add_sampling_prologue ( CgState* cgs, IRType hWordTy )
+{
+   IRTypeEnv* tyenv = cgs->sbOut->tyenv;
+   Bool   is64  = hWordTy == Ity_I64;
+   IRTemp phase = newIRTemp(tyenv, Ity_I32);
+   IRTemp left0 = newIRTemp(tyenv, hWordTy);
+   IRTemp left1 = newIRTemp(tyenv, hWordTy);
+   IRTemp due   = newIRTemp(tyenv, Ity_I1);
+   IRTemp g;
+   IRDirty* di;
+
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(phase, IRExpr_Load(CGEndness, Ity_I32,
+                                      mkIRExpr_HWord((HWord)&sample_phase))) );
+
+   g = newIRTemp(tyenv, Ity_I1);
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(g, IRExpr_Binop(Iop_CmpEQ32, IRExpr_RdTmp(phase),
+                                   IRExpr_Const(IRConst_U32(SAMPLE_DETAIL)))) );
+   cgs->detail_guard = IRExpr_RdTmp(g);
+
+   if (clo_sample_warming > 0) {
+      g = newIRTemp(tyenv, Ity_I1);
+      addStmtToIRSB( cgs->sbOut,
+         IRStmt_WrTmp(g, IRExpr_Binop(Iop_CmpEQ32, IRExpr_RdTmp(phase),
+                                      IRExpr_Const(IRConst_U32(SAMPLE_WARMING)))) );
+      cgs->warm_guard = IRExpr_RdTmp(g);
+   }
+
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(left0, IRExpr_Load(CGEndness, hWordTy,
+                                      mkIRExpr_HWord((HWord)&sample_left))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(left1, IRExpr_Binop(is64 ? Iop_Sub64 : Iop_Sub32,
+                                       IRExpr_RdTmp(left0),
+                                       mkIRExpr_HWord(cgs->sbInfo->n_instrs))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_Store(CGEndness, mkIRExpr_HWord((HWord)&sample_left),
+                   IRExpr_RdTmp(left1)) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(due, IRExpr_Binop(is64 ? Iop_CmpLE64S : Iop_CmpLE32S,
+                                     IRExpr_RdTmp(left1),
+                                     mkIRExpr_HWord(0))) );
+
+   di = unsafeIRDirty_0_N( 0, "sample_next_phase",
+                           VG_(fnptr_to_fnentry)( &sample_next_phase ),
+                           mkIRExprVec_0() );
+   di->guard = IRExpr_RdTmp(due);
+   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+}
+
 ////////////////////////////////////////////////////////////
 
 
@@ -1082,9 +1476,14 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 
    // Set up running state and get block info
    tl_assert(closure->readdr == vge->base[0]);
-   cgs.events_used = 0;
-   cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
-   cgs.sbInfo_i    = 0;
+   cgs.events_used  = 0;
+   cgs.sbInfo       = get_SB_info(sbIn, (Addr)closure->readdr);
+   cgs.sbInfo_i     = 0;
+   cgs.detail_guard = NULL;
+   cgs.warm_guard   = NULL;
+
+   if (clo_sample_period > 0)
+      add_sampling_prologue(&cgs, hWordTy);
 
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
@@ -1356,8 +1755,18 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
+static cache_t clo_ML_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
 
+static cachesim_repl      clo_cache_repl = CacheRepl_LRU;
+static cachesim_repl      clo_LL_repl    = CacheRepl_LRU;
+static Bool               clo_LL_repl_set = False;
+static cachesim_LL_policy clo_LL_policy  = CacheLL_NonInclusive;
+
+static cachesim_prefetcher clo_prefetch  = CachePf_None;
+static cache_t             clo_DTLB      = UNDEFINED_CACHE;
+static Int                 clo_page_size = 4096;
+
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
 /*------------------------------------------------------------*/
@@ -1370,10 +1779,328 @@ static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
 
+// The mid-level cache events only appear in the output if there is one.
+static const HChar* ML_event(const HChar* ev)
+{
+   return cachesim_has_ML ? ev : "";
+}
+
+// The largest number of events a line can have: Ir, 4 x 3 cache events,
+// 2 D TLB events, Dpf and 4 branch events.
+#define CG_MAX_EVENTS 20
+
+// Stores the counts of one line (or the totals) in v[], in the order given
+// by the "events:" line, and returns how many there are.
+static Int get_counts(ULong* v, const CacheCC* Ir, const CacheCC* Dr,
+                      const CacheCC* Dw, const BranchCC* Bc,
+                      const BranchCC* Bi)
+{
+   Int n = 0;
+   v[n++] = Ir->a;
+   if (clo_cache_sim) {
+      v[n++] = Ir->m1;
+      if (cachesim_has_ML) v[n++] = Ir->m2;
+      v[n++] = Ir->mL;
+      v[n++] = Dr->a;
+      v[n++] = Dr->m1;
+      if (cachesim_has_ML) v[n++] = Dr->m2;
+      v[n++] = Dr->mL;
+      v[n++] = Dw->a;
+      v[n++] = Dw->m1;
+      if (cachesim_has_ML) v[n++] = Dw->m2;
+      v[n++] = Dw->mL;
+      if (cachesim_has_DTLB) {
+         v[n++] = Dr->mT;
+         v[n++] = Dw->mT;
+      }
+      if (cachesim_pf != CachePf_None)
+         v[n++] = Dr->pf + Dw->pf;
+   }
+   if (clo_branch_sim) {
+      v[n++] = Bc->b;
+      v[n++] = Bc->mp;
+      v[n++] = Bi->b;
+      v[n++] = Bi->mp;
+   }
+   tl_assert(n <= CG_MAX_EVENTS);
+   return n;
+}
+
+/*------------------------------------------------------------*/
+/*--- Output file writing                                  ---*/
+/*------------------------------------------------------------*/
+
+// The profile is written either as text through a VgFile or, with
+// --cachegrind-out-format=binary, in the compact format described in the
+// manual.  A binary file is the 8 byte magic CG_BIN_MAGIC followed by
+// records, each being a tag byte, the payload length as a varint, and the
+// payload:
+//
+//   'h'  a header line ("desc:", "cmd:" or "events:"), as text
+//   's'  a file or function name; the n-th 's' record defines string id n
+//   'b'  a block of lines, made of CG_BIN_OP_* operations
+//   't'  the summary counts
+//
+// All numbers are unsigned LEB128 varints; line number deltas are zigzag
+// encoded.  A block never refers to a string defined after it, and starts
+// by setting both the file and the function, so each block can be decoded
+// on its own and a reader never needs more than one block in memory.  A
+// block is flushed once it exceeds CG_BIN_CHUNK bytes.
+
+#define CG_BIN_MAGIC      "CGBIN01\n"
+#define CG_BIN_MAGIC_LEN  8
+#define CG_BIN_CHUNK      32768
+#define CG_BIN_MAX_OPS    (3 * 11 + CG_MAX_EVENTS * 10)
+
+#define CG_BIN_OP_FL      0     // <string id>: set the current file
+#define CG_BIN_OP_FN      1     // <string id>: set the current function
+#define CG_BIN_OP_LINE    2     // <zigzag line delta> <count>*: one line
+
+static VgFile* out_fp;          // text output
+static Int     out_fd = -1;     // binary output
+static Bool    out_error = False;
+
+static UChar   out_buf[4096];   // buffered binary output
+static Int     out_buf_used = 0;
+static XArray* out_hdr;         // header line being built (binary)
+
+static UChar   bin_block[CG_BIN_CHUNK + CG_BIN_MAX_OPS];
+static Int     bin_block_used = 0;
+static WordFM* bin_strings;     // interned name -> string id
+static UWord   bin_n_strings = 0;
+static const HChar* bin_fl;     // current file and function, and whether
+static const HChar* bin_fn;     // they still have to be set in the block
+static Bool    bin_fl_pending, bin_fn_pending;
+static Int     bin_line;        // last line number written in the block
+
+static void out_flush(void)
+{
+   if (out_buf_used > 0 && VG_(write)(out_fd, out_buf, out_buf_used)
+                           != out_buf_used)
+      out_error = True;
+   out_buf_used = 0;
+}
+
+static void out_raw(const void* p, Int len)
+{
+   if (out_buf_used + len > sizeof(out_buf)) {
+      out_flush();
+      if (len > sizeof(out_buf)) {
+         if (VG_(write)(out_fd, p, len) != len)
+            out_error = True;
+         return;
+      }
+   }
+   VG_(memcpy)(out_buf + out_buf_used, p, len);
+   out_buf_used += len;
+}
+
+static Int put_varint(UChar* p, ULong v)
+{
+   Int n = 0;
+   while (v >= 0x80) {
+      p[n++] = (UChar)(v | 0x80);
+      v >>= 7;
+   }
+   p[n++] = (UChar)v;
+   return n;
+}
+
+static void bin_record(UChar tag, const void* payload, Int len)
+{
+   UChar hdr[11];
+   Int   n;
+   hdr[0] = tag;
+   n = 1 + put_varint(hdr + 1, len);
+   out_raw(hdr, n);
+   out_raw(payload, len);
+}
+
+static void bin_flush_block(void)
+{
+   if (bin_block_used > 0)
+      bin_record('b', bin_block, bin_block_used);
+   bin_block_used = 0;
+   bin_fl_pending = bin_fn_pending = True;
+   bin_line = 0;
+}
+
+// Returns the id of a file or function name, defining it if necessary.
+// Names are interned in the string table, so the pointer identifies them.
+static UWord bin_string_id(const HChar* s)
+{
+   UWord id;
+   if (VG_(lookupFM)(bin_strings, NULL, &id, (UWord)s))
+      return id;
+   id = bin_n_strings++;
+   VG_(addToFM)(bin_strings, (UWord)s, id);
+   bin_record('s', s, VG_(strlen)(s));
+   return id;
+}
+
+static void bin_op(UInt op, ULong arg)
+{
+   bin_block_used += put_varint(bin_block + bin_block_used, op);
+   bin_block_used += put_varint(bin_block + bin_block_used, arg);
+}
+
+static void out_hdr_char(HChar c, void* opaque)
+{
+   if (c == '\n') {
+      Word len = VG_(sizeXA)(out_hdr);
+      bin_record('h', len > 0 ? VG_(indexXA)(out_hdr, 0) : NULL, len);
+      VG_(dropTailXA)(out_hdr, len);
+   } else {
+      VG_(addToXA)(out_hdr, &c);
+   }
+}
+
+// Header lines are written as they are in both formats.
+static void out_printf(const HChar* format, ...)
+{
+   va_list vargs;
+   va_start(vargs, format);
+   if (clo_binary_out)
+      VG_(vcbprintf)(out_hdr_char, NULL, format, vargs);
+   else
+      VG_(vfprintf)(out_fp, format, vargs);
+   va_end(vargs);
+}
+
+static void out_file(const HChar* file)
+{
+   if (clo_binary_out) {
+      bin_fl = file;
+      bin_fl_pending = True;
+   } else {
+      VG_(fprintf)(out_fp, "fl=%s\n", file);
+   }
+}
+
+static void out_fn(const HChar* fn)
+{
+   if (clo_binary_out) {
+      bin_fn = fn;
+      bin_fn_pending = True;
+   } else {
+      VG_(fprintf)(out_fp, "fn=%s\n", fn);
+   }
+}
+
+// Writes the counts of one line, or of the summary if 'line' is -1.
+static void out_counts(Int line, const CacheCC* Ir, const CacheCC* Dr,
+                       const CacheCC* Dw, const BranchCC* Bc,
+                       const BranchCC* Bi)
+{
+   ULong v[CG_MAX_EVENTS];
+   UChar tmp[CG_MAX_EVENTS * 10];
+   Int   i, n, len;
+
+   n = get_counts(v, Ir, Dr, Dw, Bc, Bi);
+
+   if (!clo_binary_out) {
+      if (line < 0)
+         VG_(fprintf)(out_fp, "summary:");
+      else
+         VG_(fprintf)(out_fp, "%d", line);
+      for (i = 0; i < n; i++)
+         VG_(fprintf)(out_fp, " %llu", v[i]);
+      VG_(fprintf)(out_fp, "\n");
+
+   } else if (line < 0) {
+      bin_flush_block();
+      for (len = 0, i = 0; i < n; i++)
+         len += put_varint(tmp + len, v[i]);
+      bin_record('t', tmp, len);
+
+   } else {
+      Long delta;
+      if (bin_block_used >= CG_BIN_CHUNK)
+         bin_flush_block();
+      if (bin_fl_pending) {
+         bin_op(CG_BIN_OP_FL, bin_string_id(bin_fl));
+         bin_fl_pending = False;
+         bin_line = 0;
+      }
+      if (bin_fn_pending) {
+         bin_op(CG_BIN_OP_FN, bin_string_id(bin_fn));
+         bin_fn_pending = False;
+         bin_line = 0;
+      }
+      delta = (Long)line - bin_line;
+      bin_op(CG_BIN_OP_LINE, ((ULong)delta << 1) ^ (ULong)(delta >> 63));
+      for (i = 0; i < n; i++)
+         bin_block_used += put_varint(bin_block + bin_block_used, v[i]);
+      bin_line = line;
+   }
+}
+
+// Opens the output file in the chosen format.  Returns False on failure.
+static Bool out_open(const HChar* name)
+{
+   if (!clo_binary_out) {
+      out_fp = VG_(fopen)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                VKI_S_IRUSR|VKI_S_IWUSR);
+      return out_fp != NULL;
+   } else {
+      SysRes sres = VG_(open)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                    VKI_S_IRUSR|VKI_S_IWUSR);
+      if (sr_isError(sres))
+         return False;
+      out_fd = sr_Res(sres);
+      out_hdr = VG_(newXA)(VG_(malloc), "cg.out_open.1", VG_(free),
+                           sizeof(HChar));
+      bin_strings = VG_(newFM)(VG_(malloc), "cg.out_open.2", VG_(free), NULL);
+      bin_fl = bin_fn = NULL;
+      bin_flush_block();
+      out_raw(CG_BIN_MAGIC, CG_BIN_MAGIC_LEN);
+      return True;
+   }
+}
+
+static void out_close(void)
+{
+   if (!clo_binary_out) {
+      VG_(fclose)(out_fp);
+   } else {
+      out_flush();
+      VG_(close)(out_fd);
+      VG_(deleteXA)(out_hdr);
+      VG_(deleteFM)(bin_strings, NULL, NULL);
+      if (out_error)
+         VG_(umsg)("error: writing the cache simulation output file failed\n");
+   }
+}
+
+static void scale_CacheCC(CacheCC* cc, double f)
+{
+   cc->a  = (ULong)(cc->a  * f + 0.5);
+   cc->m1 = (ULong)(cc->m1 * f + 0.5);
+   cc->m2 = (ULong)(cc->m2 * f + 0.5);
+   cc->mL = (ULong)(cc->mL * f + 0.5);
+   cc->mT = (ULong)(cc->mT * f + 0.5);
+   cc->pf = (ULong)(cc->pf * f + 0.5);
+}
+
+static void scale_BranchCC(BranchCC* cc, double f)
+{
+   cc->b  = (ULong)(cc->b  * f + 0.5);
+   cc->mp = (ULong)(cc->mp * f + 0.5);
+}
+
+static void scale_LineCC(LineCC* lineCC, double f)
+{
+   scale_CacheCC(&lineCC->Ir, f);
+   scale_CacheCC(&lineCC->Dr, f);
+   scale_CacheCC(&lineCC->Dw, f);
+   scale_BranchCC(&lineCC->Bc, f);
+   scale_BranchCC(&lineCC->Bi, f);
+}
+
 static void fprint_CC_table_and_calc_totals(void)
 {
    Int     i;
-   VgFile  *fp;
+   double  scale = sample_scale();
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
    LineCC* lineCC;
@@ -1386,9 +2113,7 @@ static void fprint_CC_table_and_calc_totals(void)
    HChar* cachegrind_out_file =
       VG_(expand_file_name)("--cachegrind-out-file", clo_cachegrind_out_file);
 
-   fp = VG_(fopen)(cachegrind_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                        VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
+   if (!out_open(cachegrind_out_file)) {
       // If the file can't be opened for whatever reason (conflict
       // between multiple cachegrinded processes?), give up now.
       VG_(umsg)("error: can't open cache simulation output file '%s'\n",
@@ -1402,32 +2127,49 @@ static void fprint_CC_table_and_calc_totals(void)
 
    // "desc:" lines (giving I1/D1/LL cache configuration).  The spaces after
    // the 2nd colon makes cg_annotate's output look nicer.
-   VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
-                     "desc: D1 cache:         %s\n"
-                     "desc: LL cache:         %s\n",
-                     I1.desc_line, D1.desc_line, LL.desc_line);
+   out_printf("desc: I1 cache:         %s\n"
+              "desc: D1 cache:         %s\n",
+              I1.desc_line, D1.desc_line);
+   if (cachesim_has_ML)
+      out_printf("desc: ML cache:         %s\n", ML.desc_line);
+   out_printf("desc: LL cache:         %s%s\n",
+              LL.desc_line,
+              clo_LL_policy == CacheLL_Inclusive ? ", inclusive" :
+              clo_LL_policy == CacheLL_Exclusive ? ", exclusive" : "");
+   if (clo_sample_period > 0)
+      out_printf("desc: Sampling:         %llu of every %llu instructions "
+                 "(%llu windows), counts scaled by %.2f\n",
+                 clo_sample_detail, clo_sample_period,
+                 sample_windows, scale);
+   if (cachesim_has_DTLB)
+      out_printf("desc: D TLB:            %s\n", DTLB.desc_line);
+   if (cachesim_pf != CachePf_None)
+      out_printf("desc: D1 prefetcher:    %s\n",
+                 cachesim_pf == CachePf_NextLine ? "next-line" :
+                 cachesim_pf == CachePf_Stride   ? "stride" : "stream");
 
    // "cmd:" line
-   VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
+   out_printf("cmd: %s", VG_(args_the_exename));
    for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
       HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
-      VG_(fprintf)(fp, " %s", arg);
+      out_printf(" %s", arg);
    }
    // "events:" line
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
-   }
-   else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+   out_printf("\nevents: Ir");
+   if (clo_cache_sim) {
+      out_printf(" I1mr %sILmr Dr D1mr %sDLmr Dw D1mw %sDLmw",
+                 ML_event("IMmr "), ML_event("DMmr "),
+                 ML_event("DMmw "));
+      if (cachesim_has_DTLB)
+         out_printf(" DTmr DTmw");
+      if (cachesim_pf != CachePf_None)
+         out_printf(" Dpf");
    }
+   if (clo_branch_sim)
+      out_printf(" Bc Bcm Bi Bim");
+   else if (clo_cache_sim)
+      out_printf(" ");   // as always written by older versions
+   out_printf("\n");
 
    // Traverse every lineCC
    VG_(OSetGen_ResetIter)(CC_table);
@@ -1440,7 +2182,7 @@ static void fprint_CC_table_and_calc_totals(void)
       // the whole strings would have to be checked.
       if ( lineCC->loc.file != currFile ) {
          currFile = lineCC->loc.file;
-         VG_(fprintf)(fp, "fl=%s\n", currFile);
+         out_file(currFile);
          distinct_files++;
          just_hit_a_new_file = True;
       }
@@ -1450,56 +2192,36 @@ static void fprint_CC_table_and_calc_totals(void)
       // in the old file, hence the just_hit_a_new_file test).
       if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
          currFn = lineCC->loc.fn;
-         VG_(fprintf)(fp, "fn=%s\n", currFn);
+         out_fn(currFn);
          distinct_fns++;
       }
 
+      // With sampling, the counts are those of the detailed windows, so
+      // scale them up to the whole run.  The table is not used after this.
+      if (clo_sample_period > 0)
+         scale_LineCC(lineCC, scale);
+
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
-      }
+      out_counts(lineCC->loc.line, &lineCC->Ir, &lineCC->Dr, &lineCC->Dw,
+                                   &lineCC->Bc, &lineCC->Bi);
 
       // Update summary stats
       Ir_total.a  += lineCC->Ir.a;
       Ir_total.m1 += lineCC->Ir.m1;
+      Ir_total.m2 += lineCC->Ir.m2;
       Ir_total.mL += lineCC->Ir.mL;
       Dr_total.a  += lineCC->Dr.a;
       Dr_total.m1 += lineCC->Dr.m1;
+      Dr_total.m2 += lineCC->Dr.m2;
       Dr_total.mL += lineCC->Dr.mL;
+      Dr_total.mT += lineCC->Dr.mT;
+      Dr_total.pf += lineCC->Dr.pf;
       Dw_total.a  += lineCC->Dw.a;
       Dw_total.m1 += lineCC->Dw.m1;
+      Dw_total.m2 += lineCC->Dw.m2;
       Dw_total.mL += lineCC->Dw.mL;
+      Dw_total.mT += lineCC->Dw.mT;
+      Dw_total.pf += lineCC->Dw.pf;
       Bc_total.b  += lineCC->Bc.b;
       Bc_total.mp += lineCC->Bc.mp;
       Bi_total.b  += lineCC->Bi.b;
@@ -1510,42 +2232,9 @@ static void fprint_CC_table_and_calc_totals(void)
 
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
-   }
+   out_counts(-1, &Ir_total, &Dr_total, &Dw_total, &Bc_total, &Bi_total);
 
-   VG_(fclose)(fp);
+   out_close();
 }
 
 static UInt ULong_width(ULong n)
@@ -1569,6 +2258,9 @@ static void cg_fini(Int exitcode)
          LL_total, LL_total_r, LL_total_w;
    Int l1, l2, l3;
 
+   if (clo_sample_period > 0)
+      sample_end_phase();
+
    fprint_CC_table_and_calc_totals();
 
    if (VG_(clo_verbosity) == 0) 
@@ -1593,11 +2285,16 @@ static void cg_fini(Int exitcode)
       miss numbers */
    if (clo_cache_sim) {
       VG_(umsg)(fmt, "I1  misses:   ", Ir_total.m1);
+      if (cachesim_has_ML)
+         VG_(umsg)(fmt, "MLi misses:   ", Ir_total.m2);
       VG_(umsg)(fmt, "LLi misses:   ", Ir_total.mL);
 
       if (0 == Ir_total.a) Ir_total.a = 1;
       VG_(umsg)("I1  miss rate: %*.2f%%\n", l1,
                 Ir_total.m1 * 100.0 / Ir_total.a);
+      if (cachesim_has_ML)
+         VG_(umsg)("MLi miss rate: %*.2f%%\n", l1,
+                   Ir_total.m2 * 100.0 / Ir_total.a);
       VG_(umsg)("LLi miss rate: %*.2f%%\n", l1,
                 Ir_total.mL * 100.0 / Ir_total.a);
       VG_(umsg)("\n");
@@ -1606,6 +2303,7 @@ static void cg_fini(Int exitcode)
        * determine the width of columns 2 & 3. */
       D_total.a  = Dr_total.a  + Dw_total.a;
       D_total.m1 = Dr_total.m1 + Dw_total.m1;
+      D_total.m2 = Dr_total.m2 + Dw_total.m2;
       D_total.mL = Dr_total.mL + Dw_total.mL;
 
       /* Make format string, getting width right for numbers */
@@ -1616,6 +2314,9 @@ static void cg_fini(Int exitcode)
                      D_total.a, Dr_total.a, Dw_total.a);
       VG_(umsg)(fmt, "D1  misses:   ",
                      D_total.m1, Dr_total.m1, Dw_total.m1);
+      if (cachesim_has_ML)
+         VG_(umsg)(fmt, "MLd misses:   ",
+                        D_total.m2, Dr_total.m2, Dw_total.m2);
       VG_(umsg)(fmt, "LLd misses:   ",
                      D_total.mL, Dr_total.mL, Dw_total.mL);
 
@@ -1626,17 +2327,40 @@ static void cg_fini(Int exitcode)
                 l1, D_total.m1  * 100.0 / D_total.a,
                 l2, Dr_total.m1 * 100.0 / Dr_total.a,
                 l3, Dw_total.m1 * 100.0 / Dw_total.a);
+      if (cachesim_has_ML)
+         VG_(umsg)("MLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, D_total.m2  * 100.0 / D_total.a,
+                   l2, Dr_total.m2 * 100.0 / Dr_total.a,
+                   l3, Dw_total.m2 * 100.0 / Dw_total.a);
       VG_(umsg)("LLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
                 l1, D_total.mL  * 100.0 / D_total.a,
                 l2, Dr_total.mL * 100.0 / Dr_total.a,
                 l3, Dw_total.mL * 100.0 / Dw_total.a);
       VG_(umsg)("\n");
 
-      /* LL overall results */
-
+      /* ML overall results.  The ML misses are the LL references. */
       LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
       LL_total_r = Dr_total.m1 + Ir_total.m1;
       LL_total_w = Dw_total.m1;
+
+      if (cachesim_has_ML) {
+         VG_(umsg)(fmt, "ML refs:      ",
+                        LL_total, LL_total_r, LL_total_w);
+
+         LL_total   = Dr_total.m2 + Dw_total.m2 + Ir_total.m2;
+         LL_total_r = Dr_total.m2 + Ir_total.m2;
+         LL_total_w = Dw_total.m2;
+         VG_(umsg)(fmt, "ML misses:    ",
+                        LL_total, LL_total_r, LL_total_w);
+
+         VG_(umsg)("ML miss rate:  %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, LL_total   * 100.0 / (Ir_total.a + D_total.a),
+                   l2, LL_total_r * 100.0 / (Ir_total.a + Dr_total.a),
+                   l3, LL_total_w * 100.0 / Dw_total.a);
+         VG_(umsg)("\n");
+      }
+
+      /* LL overall results */
       VG_(umsg)(fmt, "LL refs:      ",
                      LL_total, LL_total_r, LL_total_w);
 
@@ -1650,6 +2374,39 @@ static void cg_fini(Int exitcode)
                 l1, LL_total_m  * 100.0 / (Ir_total.a + D_total.a),
                 l2, LL_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
                 l3, LL_total_mw * 100.0 / Dw_total.a);
+
+      /* Data TLB and prefetcher results */
+      if (cachesim_has_DTLB) {
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "DTLB misses:  ",
+                        Dr_total.mT + Dw_total.mT, Dr_total.mT, Dw_total.mT);
+         VG_(umsg)("DTLB miss rate:%*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1 + 1, (Dr_total.mT + Dw_total.mT) * 100.0 / D_total.a,
+                   l2, Dr_total.mT * 100.0 / Dr_total.a,
+                   l3, Dw_total.mT * 100.0 / Dw_total.a);
+      }
+      if (cachesim_pf != CachePf_None) {
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "Prefetches:   ",
+                        Dr_total.pf + Dw_total.pf, Dr_total.pf, Dw_total.pf);
+      }
+   }
+
+   /* Sampling results */
+   if (clo_sample_period > 0) {
+      ULong  total = sample_instrs[0] + sample_instrs[1] + sample_instrs[2];
+      double ci[SAMPLE_N_STATS];
+      Int    k;
+
+      VG_(umsg)("\n");
+      VG_(umsg)("Sampled:      %'llu windows, %.2f%% of the instructions "
+                "in detail\n", sample_windows,
+                total ? sample_instrs[SAMPLE_DETAIL] * 100.0 / total : 0.0);
+      for (k = 0; k < SAMPLE_N_STATS; k++)
+         ci[k] = sample_rel_ci95(k);
+      if (clo_cache_sim && ci[0] >= 0 && ci[1] >= 0 && ci[2] >= 0)
+         VG_(umsg)("95%% CI:       I1 misses +-%.1f%%, D1 misses +-%.1f%%, "
+                   "LL misses +-%.1f%%\n", ci[0], ci[1], ci[2]);
    }
 
    /* If branch profiling is enabled, show branch overall results. */
@@ -1704,6 +2461,9 @@ static void cg_fini(Int exitcode)
                 VG_(OSetGen_Size)(CC_table));
       VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
                 VG_(OSetGen_Size)(instrInfoTable));
+      if (clo_LL_policy == CacheLL_Inclusive)
+         VG_(dmsg)("cachegrind: LL back-invalidations: %llu\n",
+                   cachesim_back_invalidations);
    }
 }
 
@@ -1738,14 +2498,94 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 /*--- Command line processing                                      ---*/
 /*--------------------------------------------------------------------*/
 
+// Parses "<entries>,<assoc>" for --D-TLB.
+static void parse_tlb_opt(const HChar* opt, const HChar* optval)
+{
+   Long   i1, i2;
+   HChar* endptr;
+
+   i1 = VG_(strtoll10)(optval,   &endptr); if (*endptr != ',')  goto bad;
+   i2 = VG_(strtoll10)(endptr+1, &endptr); if (*endptr != '\0') goto bad;
+   if (i1 <= 0 || i2 <= 0 || i1 > 65536 || i2 > i1 || i1 % i2 != 0 ||
+       -1 == VG_(log2)((UInt)(i1 / i2)))
+      goto bad;
+
+   clo_DTLB.size      = (Int)i1;
+   clo_DTLB.assoc     = (Int)i2;
+   clo_DTLB.line_size = 1;
+   return;
+
+  bad:
+   VG_(fmsg_bad_option)(opt, "Bad argument '%s': expected "
+                        "<entries>,<assoc> with a power of two set count\n",
+                        optval);
+}
+
 static Bool cg_process_cmd_line_option(const HChar* arg)
 {
+   const HChar* tmp_str;
+
    if (VG_(str_clo_cache_opt)(arg,
                               &clo_I1_cache,
                               &clo_D1_cache,
                               &clo_LL_cache)) {}
+   else if VG_STR_CLO(arg, "--ML", tmp_str) {
+      VG_(parse_cache_opt)(&clo_ML_cache, arg, tmp_str);
+   }
+
+   else if VG_XACT_CLO(arg, "--cache-replacement=lru",
+                            clo_cache_repl, CacheRepl_LRU) {}
+   else if VG_XACT_CLO(arg, "--cache-replacement=plru",
+                            clo_cache_repl, CacheRepl_PLRU) {}
+   else if VG_XACT_CLO(arg, "--cache-replacement=srrip",
+                            clo_cache_repl, CacheRepl_SRRIP) {}
+   else if VG_XACT_CLO(arg, "--LL-replacement=lru",
+                            clo_LL_repl, CacheRepl_LRU) {
+      clo_LL_repl_set = True;
+   }
+   else if VG_XACT_CLO(arg, "--LL-replacement=plru",
+                            clo_LL_repl, CacheRepl_PLRU) {
+      clo_LL_repl_set = True;
+   }
+   else if VG_XACT_CLO(arg, "--LL-replacement=srrip",
+                            clo_LL_repl, CacheRepl_SRRIP) {
+      clo_LL_repl_set = True;
+   }
+   else if VG_BINT_CLO(arg, "--sample-period",  clo_sample_period,
+                       0, 2000000000) {}
+   else if VG_BINT_CLO(arg, "--sample-detail",  clo_sample_detail,
+                       1, 2000000000) {}
+   else if VG_BINT_CLO(arg, "--sample-warming", clo_sample_warming,
+                       0, 2000000000) {}
+   else if VG_XACT_CLO(arg, "--prefetch=none",
+                            clo_prefetch, CachePf_None) {}
+   else if VG_XACT_CLO(arg, "--prefetch=next-line",
+                            clo_prefetch, CachePf_NextLine) {}
+   else if VG_XACT_CLO(arg, "--prefetch=stride",
+                            clo_prefetch, CachePf_Stride) {}
+   else if VG_XACT_CLO(arg, "--prefetch=stream",
+                            clo_prefetch, CachePf_Stream) {}
+   else if VG_STR_CLO(arg, "--D-TLB", tmp_str) {
+      parse_tlb_opt(arg, tmp_str);
+   }
+   else if VG_INT_CLO(arg, "--page-size", clo_page_size) {
+      if (-1 == VG_(log2)(clo_page_size) || clo_page_size < 1024)
+         VG_(fmsg_bad_option)(arg,
+            "--page-size must be a power of two of at least 1024.\n");
+   }
+
+   else if VG_XACT_CLO(arg, "--LL-policy=non-inclusive",
+                            clo_LL_policy, CacheLL_NonInclusive) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=inclusive",
+                            clo_LL_policy, CacheLL_Inclusive) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=exclusive",
+                            clo_LL_policy, CacheLL_Exclusive) {}
 
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
+   else if VG_XACT_CLO(arg, "--cachegrind-out-format=text",
+                            clo_binary_out, False) {}
+   else if VG_XACT_CLO(arg, "--cachegrind-out-format=binary",
+                            clo_binary_out, True) {}
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
    else
@@ -1758,9 +2598,26 @@ static void cg_print_usage(void)
 {
    VG_(print_cache_clo_opts)();
    VG_(printf)(
+"    --ML=<size>,<assoc>,<line_size>  simulate a private mid-level (L2) cache\n"
+"    --LL-policy=non-inclusive|inclusive|exclusive\n"
+"                                     LL relation to the upper levels\n"
+"                                     [non-inclusive]\n"
+"    --cache-replacement=lru|plru|srrip  replacement policy [lru]\n"
+"    --LL-replacement=lru|plru|srrip  LL replacement policy\n"
+"                                     [same as --cache-replacement]\n"
+"    --prefetch=none|next-line|stride|stream  D1 prefetcher [none]\n"
+"    --D-TLB=<entries>,<assoc>        simulate a data TLB\n"
+"    --page-size=<number>             page size for --D-TLB and\n"
+"                                     --prefetch [4096]\n"
+"    --sample-period=<number>         sample: simulate in detail only part\n"
+"                                     of each <number> instructions [0=off]\n"
+"    --sample-detail=<number>         instrs simulated per period [10000]\n"
+"    --sample-warming=<number>        instrs warming the caches before\n"
+"                                     each detailed window [0]\n"
 "    --cache-sim=yes|no  [yes]        collect cache stats?\n"
 "    --branch-sim=yes|no [no]         collect branch prediction stats?\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
+"    --cachegrind-out-format=text|binary  output file format [text]\n"
    );
 }
 
@@ -1801,9 +2658,24 @@ static void cg_pre_clo_init(void)
                                    cg_print_debug_usage);
 }
 
+// Exits if 'c' cannot use replacement policy 'repl'.
+static void check_cache_repl(const HChar* desc, cache_t* c,
+                             cachesim_repl repl)
+{
+   // The PLRU tree bits of a set are kept in a single word.
+   if (repl == CacheRepl_PLRU && c->assoc > 1 &&
+       (-1 == VG_(log2)(c->assoc) || c->assoc > (Int)(8 * sizeof(UWord)))) {
+      VG_(umsg)("Cachegrind: cannot continue: PLRU replacement needs a "
+                "power of two\n");
+      VG_(umsg)("  associativity of at most %d, but the %s cache is "
+                "%d-way.\n", (Int)(8 * sizeof(UWord)), desc, c->assoc);
+      VG_(exit)(1);
+   }
+}
+
 static void cg_post_clo_init(void)
 {
-   cache_t I1c, D1c, LLc; 
+   cache_t I1c, D1c, MLc, LLc; 
 
    CC_table =
       VG_(OSetGen_Create)(offsetof(LineCC, loc),
@@ -1832,6 +2704,11 @@ static void cg_post_clo_init(void)
    min_line_size = (I1c.line_size < D1c.line_size) ? I1c.line_size : D1c.line_size;
    min_line_size = (LLc.line_size < min_line_size) ? LLc.line_size : min_line_size;
 
+   // The mid-level cache is never auto-detected.
+   MLc = clo_ML_cache;
+   if (MLc.size != -1 && MLc.line_size < min_line_size)
+      min_line_size = MLc.line_size;
+
    Int largest_load_or_store_size
       = VG_(machine_get_size_of_largest_guest_register)();
    if (min_line_size < largest_load_or_store_size) {
@@ -1846,7 +2723,48 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   if (!clo_LL_repl_set)
+      clo_LL_repl = clo_cache_repl;
+   check_cache_repl("I1", &I1c, clo_cache_repl);
+   check_cache_repl("D1", &D1c, clo_cache_repl);
+   if (MLc.size != -1)
+      check_cache_repl("ML", &MLc, clo_cache_repl);
+   check_cache_repl("LL", &LLc, clo_LL_repl);
+
+   // Anything but the historical I1/D1 + LL LRU model is simulated one
+   // line at a time, using the line number as the tag at every level.
+   if (MLc.size != -1 || clo_cache_repl != CacheRepl_LRU ||
+       clo_LL_repl != CacheRepl_LRU || clo_LL_policy != CacheLL_NonInclusive) {
+      if (I1c.line_size != LLc.line_size || D1c.line_size != LLc.line_size ||
+          (MLc.size != -1 && MLc.line_size != LLc.line_size)) {
+         VG_(umsg)("Cachegrind: cannot continue: --ML, --LL-policy and "
+                   "non-LRU replacement\n");
+         VG_(umsg)("  need the same line size at every cache level, "
+                   "but it is not.\n");
+         VG_(exit)(1);
+      }
+   }
+
+   if (VG_(clo_verbosity) >= 2 && MLc.size != -1)
+      VG_(umsg)("  ML: %'d B, %d-way, %d B lines\n",
+                MLc.size, MLc.assoc, MLc.line_size);
+
+   cachesim_initcaches(I1c, D1c, MLc, LLc,
+                       clo_cache_repl, clo_LL_repl, clo_LL_policy);
+
+   if (clo_sample_period > 0) {
+      if (clo_sample_detail + clo_sample_warming > clo_sample_period) {
+         VG_(fmsg_bad_option)("--sample-period",
+            "--sample-detail plus --sample-warming must not exceed "
+            "--sample-period.\n");
+      }
+      sample_start_phase(clo_sample_warming > 0 ? SAMPLE_WARMING
+                                                : SAMPLE_DETAIL);
+   }
+
+   // The prefetcher and the TLB are driven by the cache simulation.
+   if (clo_cache_sim)
+      cachesim_init_D_extras(clo_prefetch, clo_DTLB, clo_page_size);
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
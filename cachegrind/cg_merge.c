@@ -39,6 +39,7 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 typedef  signed long   Word;
 typedef  unsigned long UWord;
@@ -47,6 +48,7 @@ typedef  unsigned char Bool;
 #define False ((Bool)0)
 typedef  signed int    Int;
 typedef  unsigned int  UInt;
+typedef  unsigned char UChar;
 typedef  unsigned long long int ULong;
 typedef  signed char   Char;
 typedef  size_t        SizeT;
@@ -118,14 +120,18 @@ static const char* argv0 = "cg_merge";
 typedef
    struct {
       FILE* fp;
-      UInt  lno;
-      char* filename;
+      UInt  lno;       // line, or record for a binary file
+      const char* filename;
+      Bool  binary;
+      char* buf;       // line or record buffer, see readline()
+      size_t bufsiz;
    }
    SOURCE;
 
 static void printSrcLoc ( SOURCE* s )
 {
-   fprintf(stderr, "%s: near %s line %u\n", argv0, s->filename, s->lno-1);
+   fprintf(stderr, "%s: near %s %s %u\n", argv0, s->filename,
+                   s->binary ? "record" : "line", s->lno-1);
 }
 
 __attribute__((noreturn))
@@ -153,28 +159,26 @@ static void barf ( SOURCE* s, const char* msg )
 }
 
 // Read a line. Return the line read, or NULL if at EOF.
-// The line is allocated dynamically but will be overwritten with
+// The line is allocated dynamically (in s->buf, so that several
+// inputs can be read at once) but will be overwritten with
 // every invocation. Caller must not free it.
 static const char *readline ( SOURCE* s )
 {
-   static char  *line = NULL;
-   static size_t linesiz = 0;
-
    int ch, i = 0;
 
    while (1) {
       ch = getc(s->fp);
       if (ch != EOF) {
-          if (i + 1 >= linesiz) {
-             linesiz += 500;
-             line = realloc(line, linesiz * sizeof *line);
-             if (line == NULL)
+          if (i + 1 >= s->bufsiz) {
+             s->bufsiz += 500;
+             s->buf = realloc(s->buf, s->bufsiz);
+             if (s->buf == NULL)
                 mallocFail(s, "readline:");
           }
-          line[i++] = ch;
-          line[i] = 0;
+          s->buf[i++] = ch;
+          s->buf[i] = 0;
           if (ch == '\n') {
-             line[i-1] = 0;
+             s->buf[i-1] = 0;
              s->lno++;
              break;
           }
@@ -188,7 +192,7 @@ static const char *readline ( SOURCE* s )
          }
       }
    }
-   return i == 0 ? NULL : line;
+   return i == 0 ? NULL : s->buf;
 }
 
 static Bool streqn ( const char* s1, const char* s2, size_t n )
@@ -218,6 +222,27 @@ typedef
    }
    Counts;
 
+/* Hash index of the FileFn -> innerMap bindings of an outerMap.  The
+   lookups done for every counts line go here: hashing the two names is
+   much cheaper than the strcmp()s of a WordFM search, and needs no key
+   to be allocated.  The outerMap still owns the bindings and gives the
+   sorted order for output. */
+typedef
+   struct {
+      UWord   hash;
+      FileFn* key;        // NULL for an empty slot
+      WordFM* innerMap;
+   }
+   FFHashEnt;
+
+typedef
+   struct {
+      FFHashEnt* tab;
+      UWord      size;    // a power of 2
+      UWord      used;
+   }
+   FFHash;
+
 typedef
    struct {
       // null-terminated vector of desc_lines
@@ -238,6 +263,9 @@ typedef
          where innerMap is   WordFM line-number=UWord Counts */
       WordFM* outerMap;
 
+      // Index of outerMap
+      FFHash* index;
+
       // Summary counts (computed whilst parsing)
       // should match .summary_line
       Counts* summary;
@@ -356,10 +384,88 @@ CacheProfFile* new_CacheProfFile ( char**  desc_lines,
    cpf->n_events     = n_events;
    cpf->summary_line = summary_line;
    cpf->outerMap     = outerMap;
+   cpf->index        = NULL;
    cpf->summary      = summary;
    return cpf;
 }
 
+// FNV-1a
+static UWord hash_FileFn ( const char* fi, const char* fn )
+{
+   UWord h = 2166136261UL;
+   for (; *fi; fi++)
+      h = (h ^ (UChar)*fi) * 16777619UL;
+   h = (h ^ '/') * 16777619UL;
+   for (; *fn; fn++)
+      h = (h ^ (UChar)*fn) * 16777619UL;
+   return h;
+}
+
+static FFHash* new_FFHash ( void )
+{
+   FFHash* h = malloc(sizeof(FFHash));
+   if (h == NULL)
+      return NULL;
+   h->size = 64;
+   h->used = 0;
+   h->tab  = calloc(h->size, sizeof(FFHashEnt));
+   if (h->tab == NULL) {
+      free(h);
+      return NULL;
+   }
+   return h;
+}
+
+static void ddel_FFHash ( FFHash* h )
+{
+   free(h->tab);
+   free(h);
+}
+
+static WordFM* lookup_FFHash ( FFHash* h, UWord hash,
+                               const char* fi, const char* fn )
+{
+   UWord i;
+   for (i = hash & (h->size-1); h->tab[i].key; i = (i+1) & (h->size-1)) {
+      if (h->tab[i].hash == hash
+          && streq(h->tab[i].key->fi_name, fi)
+          && streq(h->tab[i].key->fn_name, fn))
+         return h->tab[i].innerMap;
+   }
+   return NULL;
+}
+
+// Adds a binding, which must not be present already.  Returns False if
+// out of memory.
+static Bool add_FFHash ( FFHash* h, UWord hash, FileFn* key, WordFM* innerMap )
+{
+   UWord i;
+   if (2 * (h->used + 1) > h->size) {
+      // keep the load factor below 1/2
+      FFHashEnt* old = h->tab;
+      UWord      oldsize = h->size;
+      h->tab = calloc(2 * oldsize, sizeof(FFHashEnt));
+      if (h->tab == NULL) {
+         h->tab = old;
+         return False;
+      }
+      h->size = 2 * oldsize;
+      h->used = 0;
+      for (i = 0; i < oldsize; i++) {
+         if (old[i].key)
+            add_FFHash( h, old[i].hash, old[i].key, old[i].innerMap );
+      }
+      free(old);
+   }
+   for (i = hash & (h->size-1); h->tab[i].key; i = (i+1) & (h->size-1))
+      ;
+   h->tab[i].hash     = hash;
+   h->tab[i].key      = key;
+   h->tab[i].innerMap = innerMap;
+   h->used++;
+   return True;
+}
+
 static WordFM* dopy_InnerMap ( WordFM* innerMap )
 {
    return dopyFM ( innerMap, NULL,
@@ -388,6 +494,8 @@ static void ddel_CacheProfFile ( CacheProfFile* cpf )
    if (cpf->outerMap)
       deleteFM( cpf->outerMap, (void(*)(Word))ddel_FileFn, 
                                (void(*)(Word))ddel_InnerMap );
+   if (cpf->index)
+      ddel_FFHash(cpf->index);
    if (cpf->summary)
       ddel_Counts(cpf->summary);
 
@@ -459,13 +567,29 @@ static Word cmp_unboxed_UWord ( Word s1, Word s2 )
    return 0;
 }
 
+// Adds the binding key->innerMap to both the outer map and its index.
+static void add_binding ( SOURCE* s, CacheProfFile* cpf, UWord hash,
+                          FileFn* key, WordFM* innerMap )
+{
+   addToFM( cpf->outerMap, (Word)key, (Word)innerMap );
+   if (!add_FFHash( cpf->index, hash, key, innerMap ))
+      mallocFail(s, "add_binding:");
+}
+
 ////////////////////////////////////////////////////////////////
 
+// Negative numbers, as written by --diff, are accepted and wrap around,
+// which keeps sums of them right.
 static Bool parse_ULong ( /*OUT*/ULong* res, /*INOUT*/const char** pptr)
 {
    ULong u64;
+   Bool  neg = False;
    const char* ptr = *pptr;
    while (isspace(*ptr)) ptr++;
+   if (ptr[0] == '-' && isdigit(ptr[1])) {
+      neg = True;
+      ptr++;
+   }
    if (!isdigit(*ptr)) {
       *pptr = ptr;
       return False; /* end of string, or junk */
@@ -475,7 +599,7 @@ static Bool parse_ULong ( /*OUT*/ULong* res, /*INOUT*/const char** pptr)
       u64 = (u64 * 10) + (ULong)(*ptr - '0');
       ptr++;
    }
-   *res = u64;
+   *res = neg ? -u64 : u64;
    *pptr = ptr;
    return True;
 }
@@ -547,46 +671,40 @@ static Bool addCountsToMap ( SOURCE* s,
    }
 }
 
+// Adds the counts of a line of function fn in file fi to the profile.
 static
-void handle_counts ( SOURCE* s,
-                     CacheProfFile* cpf, 
-                     const char* fi, const char* fn, const char* newCountsStr )
+void add_line_counts ( SOURCE* s,
+                       CacheProfFile* cpf, 
+                       const char* fi, const char* fn,
+                       UWord lnno, Counts* newCounts )
 {
    WordFM* countsMap;
    Bool    freeNewCounts;
-   UWord   lnno;
-   Counts* newCounts;
    FileFn* topKey; 
-
-   if (0)  printf("%s %s %s\n", fi, fn, newCountsStr );
-
-   // parse the numbers
-   newCounts = splitUpCountsLine( s, &lnno, newCountsStr );
+   UWord   hash = hash_FileFn( fi, fn );
 
    // Did we get the right number?
    if (newCounts->n_counts != cpf->n_events)
       goto oom;
 
-   // allocate the key
-   topKey = malloc(sizeof(FileFn));
-   if (topKey) {
-      topKey->fi_name = strdup(fi);
-      topKey->fn_name = strdup(fn);
-   }
-   if (! (topKey && topKey->fi_name && topKey->fn_name))
-      mallocFail(s, "handle_counts:");
-
    // search for it
-   if (lookupFM( cpf->outerMap, (Word*)(&countsMap), (Word)topKey )) {
+   countsMap = lookup_FFHash( cpf->index, hash, fi, fn );
+   if (countsMap) {
       // found it.  Merge in new counts
       freeNewCounts = addCountsToMap( s, countsMap, lnno, newCounts );
-      ddel_FileFn(topKey);
    } else {
       // not found in the top map.  Create new entry
+      topKey = malloc(sizeof(FileFn));
+      if (topKey) {
+         topKey->fi_name = strdup(fi);
+         topKey->fn_name = strdup(fn);
+      }
+      if (! (topKey && topKey->fi_name && topKey->fn_name))
+         mallocFail(s, "handle_counts:");
       countsMap = newFM( malloc, free, cmp_unboxed_UWord );
       if (!countsMap)
-         goto oom;
-      addToFM( cpf->outerMap, (Word)topKey, (Word)countsMap );
+         mallocFail(s, "handle_counts:");
+      add_binding( s, cpf, hash, topKey, countsMap );
       freeNewCounts = addCountsToMap( s, countsMap, lnno, newCounts );
    }
 
@@ -603,6 +721,71 @@ void handle_counts ( SOURCE* s,
    parseError(s, "# counts doesn't match # events");
 }
 
+static
+void handle_counts ( SOURCE* s,
+                     CacheProfFile* cpf, 
+                     const char* fi, const char* fn, const char* newCountsStr )
+{
+   UWord   lnno;
+   Counts* newCounts;
+
+   if (0)  printf("%s %s %s\n", fi, fn, newCountsStr );
+
+   // parse the numbers
+   newCounts = splitUpCountsLine( s, &lnno, newCountsStr );
+
+   add_line_counts( s, cpf, fi, fn, lnno, newCounts );
+}
+
+// Sets the "events:" line, and creates the data structures whose size
+// depends on the number of events.
+static void set_events_line ( SOURCE* s, CacheProfFile* cpf, const char* line )
+{
+   char* p;
+
+   // figure out how many events there are by counting the number
+   // of space-alphanum transitions in the events_line
+   cpf->events_line = strdup(line);
+   if (cpf->events_line == NULL)
+      mallocFail(s, "set_events_line(1)");
+
+   cpf->n_events = 0;
+   assert(cpf->events_line[6] == ':');
+   for (p = &cpf->events_line[6]; *p; p++) {
+      if (p[0] == ' ' && isalpha(p[1]))
+         cpf->n_events++;
+   }
+
+   // create the running cross-check summary
+   cpf->summary = new_Counts_Zeroed( cpf->n_events );
+   if (cpf->summary == NULL)
+      mallocFail(s, "set_events_line(2)");
+
+   // create the outer map (file+fn name --> inner map)
+   cpf->outerMap = newFM ( malloc, free, cmp_FileFn );
+   if (cpf->outerMap == NULL)
+      mallocFail(s, "set_events_line(3)");
+   cpf->index = new_FFHash();
+   if (cpf->index == NULL)
+      mallocFail(s, "set_events_line(4)");
+}
+
+// Checks the summary counts read from the file against those computed
+// whilst parsing.
+static void check_summary ( SOURCE* s, CacheProfFile* cpf,
+                            Counts* summaryRead )
+{
+   Int i;
+   if (summaryRead->n_counts != cpf->n_events)
+      parseError(s, "parse_CacheProfFile: wrong # counts in SUMMARY line");
+   for (i = 0; i < summaryRead->n_counts; i++) {
+      if (summaryRead->counts[i] != cpf->summary->counts[i]) {
+         parseError(s, "parse_CacheProfFile: "
+                       "computed vs stated SUMMARY counts mismatch");
+      }
+   }
+}
+
 
 /* Parse a complete file from the stream in 's'.  If a parse error
    happens, do not return; instead exit via parseError().  If an
@@ -614,7 +797,6 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
    Int            i;
    char**         tmp_desclines = NULL;
    unsigned       tmp_desclines_size = 0;
-   char*          p;
    int            n_tmp_desclines = 0;
    CacheProfFile* cpf;
    Counts*        summaryRead; 
@@ -669,28 +851,7 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
    if (!streqn(line, "events: ", 8))
       parseError(s, "parse_CacheProfFile: no EVENTS line present");
 
-   // figure out how many events there are by counting the number
-   // of space-alphanum transitions in the events_line
-   cpf->events_line = strdup(line);
-   if (cpf->events_line == NULL)
-      mallocFail(s, "parse_CacheProfFile(3)");
-
-   cpf->n_events = 0;
-   assert(cpf->events_line[6] == ':');
-   for (p = &cpf->events_line[6]; *p; p++) {
-      if (p[0] == ' ' && isalpha(p[1]))
-         cpf->n_events++;
-   }
-
-   // create the running cross-check summary
-   cpf->summary = new_Counts_Zeroed( cpf->n_events );
-   if (cpf->summary == NULL)
-      mallocFail(s, "parse_CacheProfFile(4)");
-
-   // create the outer map (file+fn name --> inner map)
-   cpf->outerMap = newFM ( malloc, free, cmp_FileFn );
-   if (cpf->outerMap == NULL)
-      mallocFail(s, "parse_CacheProfFile(5)");
+   set_events_line( s, cpf, line );
 
    // process count lines
    while (1) {
@@ -740,14 +901,7 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
    summaryRead = splitUpCountsLine( s, NULL, &cpf->summary_line[8] );
    if (summaryRead == NULL)
       mallocFail(s, "parse_CacheProfFile(7)");
-   if (summaryRead->n_counts != cpf->n_events)
-      parseError(s, "parse_CacheProfFile: wrong # counts in SUMMARY line");
-   for (i = 0; i < summaryRead->n_counts; i++) {
-      if (summaryRead->counts[i] != cpf->summary->counts[i]) {
-         parseError(s, "parse_CacheProfFile: "
-                       "computed vs stated SUMMARY counts mismatch");
-      }
-   }
+   check_summary( s, cpf, summaryRead );
    free(summaryRead->counts);
    sdel_Counts(summaryRead);
 
@@ -765,6 +919,364 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
 }
 
 
+////////////////////////////////////////////////////////////////
+// The binary format, as written by --cachegrind-out-format=binary.
+// See the "Cachegrind Output File Format" section of the manual; the
+// constants must match those in cg_main.c.
+
+#define CG_BIN_MAGIC      "CGBIN01\n"
+#define CG_BIN_MAGIC_LEN  8
+#define CG_BIN_CHUNK      32768
+
+#define CG_BIN_OP_FL      0
+#define CG_BIN_OP_FN      1
+#define CG_BIN_OP_LINE    2
+
+// Read a record.  Return its tag, or EOF at the end of the file.  As
+// with readline(), the payload is in s->buf and will be overwritten with
+// every invocation.  Caller must not free it.
+static int read_record ( SOURCE* s, /*OUT*/const UChar** payload,
+                         /*OUT*/size_t* len )
+{
+   int   tag, ch, shift = 0;
+   ULong n = 0;
+
+   tag = getc(s->fp);
+   if (tag == EOF)
+      return EOF;
+   do {
+      ch = getc(s->fp);
+      if (ch == EOF || shift > 35)
+         parseError(s, "truncated or bad record length");
+      n |= (ULong)(ch & 0x7F) << shift;
+      shift += 7;
+   } while (ch & 0x80);
+
+   if (n + 1 > s->bufsiz) {
+      s->bufsiz = n + 1;
+      s->buf = realloc(s->buf, s->bufsiz);
+      if (s->buf == NULL)
+         mallocFail(s, "read_record:");
+   }
+   if (fread(s->buf, 1, n, s->fp) != n) {
+      if (ferror(s->fp)) {
+         perror(argv0);
+         barf(s, "I/O error while reading input file");
+      }
+      parseError(s, "truncated record");
+   }
+   s->buf[n] = 0;
+   s->lno++;
+
+   *payload = (const UChar*)s->buf;
+   *len     = n;
+   return tag;
+}
+
+static ULong get_varint ( SOURCE* s, /*INOUT*/const UChar** pp,
+                          const UChar* end )
+{
+   ULong v = 0;
+   int   shift = 0;
+   UChar b;
+   do {
+      if (*pp >= end || shift > 63)
+         parseError(s, "truncated or bad number in record");
+      b = *(*pp)++;
+      v |= (ULong)(b & 0x7F) << shift;
+      shift += 7;
+   } while (b & 0x80);
+   return v;
+}
+
+static Counts* get_counts ( SOURCE* s, CacheProfFile* cpf,
+                            /*INOUT*/const UChar** pp, const UChar* end )
+{
+   Int     i;
+   Counts* counts = new_Counts_Zeroed( cpf->n_events );
+   if (counts == NULL)
+      mallocFail(s, "get_counts:");
+   for (i = 0; i < cpf->n_events; i++)
+      counts->counts[i] = get_varint( s, pp, end );
+   return counts;
+}
+
+/* Parse a complete binary file from the stream in 's', whose magic has
+   already been read.  Errors are handled as in parse_CacheProfFile(). */
+static CacheProfFile* parse_CacheProfFile_binary ( SOURCE* s )
+{
+   CacheProfFile* cpf;
+   Counts*        summaryRead = NULL;
+   char**         desclines = NULL;
+   int            n_desclines = 0;
+   char**         strings = NULL;
+   UWord          n_strings = 0, strings_size = 0;
+   const UChar*   payload;
+   const UChar*   p;
+   const UChar*   end;
+   size_t         len;
+   int            tag;
+   UWord          i;
+
+   cpf = new_CacheProfFile( NULL, NULL, NULL, 0, NULL, NULL, NULL );
+   if (cpf == NULL)
+      mallocFail(s, "parse_CacheProfFile_binary(1)");
+
+   while ((tag = read_record( s, &payload, &len )) != EOF) {
+      p   = payload;
+      end = payload + len;
+
+      if (summaryRead)
+         parseError(s, "parse_CacheProfFile_binary: "
+                       "extraneous content after SUMMARY record");
+
+      switch (tag) {
+      case 'h':
+         if (cpf->events_line)
+            parseError(s, "parse_CacheProfFile_binary: "
+                          "header record after EVENTS record");
+         if (strlen((const char*)payload) != len)
+            parseError(s, "parse_CacheProfFile_binary: NUL in header record");
+         if (streqn((const char*)payload, "desc: ", 6) && !cpf->cmd_line) {
+            desclines = realloc(desclines,
+                                (n_desclines + 2) * sizeof *desclines);
+            if (desclines == NULL)
+               mallocFail(s, "parse_CacheProfFile_binary(2)");
+            desclines[n_desclines++] = strdup((const char*)payload);
+            desclines[n_desclines]   = NULL;
+         } else if (streqn((const char*)payload, "cmd: ", 5)
+                    && !cpf->cmd_line) {
+            if (n_desclines == 0)
+               parseError(s, "parse_CacheProfFile_binary: "
+                             "no DESC lines present");
+            cpf->cmd_line = strdup((const char*)payload);
+            if (cpf->cmd_line == NULL)
+               mallocFail(s, "parse_CacheProfFile_binary(3)");
+         } else if (streqn((const char*)payload, "events: ", 8)
+                    && cpf->cmd_line) {
+            set_events_line( s, cpf, (const char*)payload );
+         } else {
+            parseError(s, "parse_CacheProfFile_binary: "
+                          "unexpected header record");
+         }
+         break;
+
+      case 's':
+         if (n_strings >= strings_size) {
+            strings_size += 1000;
+            strings = realloc(strings, strings_size * sizeof *strings);
+            if (strings == NULL)
+               mallocFail(s, "parse_CacheProfFile_binary(4)");
+         }
+         strings[n_strings] = malloc(len + 1);
+         if (strings[n_strings] == NULL)
+            mallocFail(s, "parse_CacheProfFile_binary(5)");
+         memcpy(strings[n_strings], payload, len + 1);
+         n_strings++;
+         break;
+
+      case 'b': {
+         // Each block sets the file and function before its first line.
+         const char* curr_fl = NULL;
+         const char* curr_fn = NULL;
+         ULong       op, arg;
+         UWord       lnno = 0;
+         if (!cpf->events_line)
+            parseError(s, "parse_CacheProfFile_binary: "
+                          "data before EVENTS record");
+         while (p < end) {
+            op  = get_varint( s, &p, end );
+            arg = get_varint( s, &p, end );
+            switch (op) {
+            case CG_BIN_OP_FL:
+            case CG_BIN_OP_FN:
+               if (arg >= n_strings)
+                  parseError(s, "parse_CacheProfFile_binary: "
+                                "undefined string");
+               if (op == CG_BIN_OP_FL)
+                  curr_fl = strings[arg];
+               else
+                  curr_fn = strings[arg];
+               lnno = 0;
+               break;
+            case CG_BIN_OP_LINE:
+               if (!curr_fl || !curr_fn)
+                  parseError(s, "parse_CacheProfFile_binary: "
+                                "line without file or function");
+               // undo the zigzag encoding of the delta
+               lnno += (UWord)((arg >> 1) ^ -(arg & 1));
+               add_line_counts( s, cpf, curr_fl, curr_fn, lnno,
+                                get_counts( s, cpf, &p, end ) );
+               break;
+            default:
+               parseError(s, "parse_CacheProfFile_binary: "
+                             "unknown block operation");
+            }
+         }
+         break;
+      }
+
+      case 't':
+         if (!cpf->events_line)
+            parseError(s, "parse_CacheProfFile_binary: "
+                          "eof before EVENTS record");
+         summaryRead = get_counts( s, cpf, &p, end );
+         if (p != end)
+            parseError(s, "parse_CacheProfFile_binary: "
+                          "wrong # counts in SUMMARY record");
+         break;
+
+      default:
+         parseError(s, "parse_CacheProfFile_binary: unknown record");
+      }
+   }
+
+   if (!summaryRead)
+      parseError(s, "parse_CacheProfFile_binary: missing SUMMARY record");
+   check_summary( s, cpf, summaryRead );
+   ddel_Counts(summaryRead);
+
+   cpf->desc_lines = desclines;
+
+   for (i = 0; i < n_strings; i++)
+      free(strings[i]);
+   free(strings);
+
+   // All looks OK
+   return cpf;
+}
+
+/* The writer.  Blocks are accumulated in 'blk' and written once they
+   exceed CG_BIN_CHUNK bytes. */
+typedef
+   struct {
+      FILE*   f;
+      UChar*  blk;
+      size_t  blk_used;
+      size_t  blk_size;
+      WordFM* strings;   // name -> string id
+      UWord   n_strings;
+   }
+   BinWriter;
+
+static size_t put_varint ( UChar* p, ULong v )
+{
+   size_t n = 0;
+   while (v >= 0x80) {
+      p[n++] = (UChar)(v | 0x80);
+      v >>= 7;
+   }
+   p[n++] = (UChar)v;
+   return n;
+}
+
+static void write_record ( BinWriter* w, int tag, const void* payload,
+                           size_t len )
+{
+   UChar hdr[11];
+   hdr[0] = (UChar)tag;
+   fwrite(hdr, 1, 1 + put_varint(hdr + 1, len), w->f);
+   fwrite(payload, 1, len, w->f);
+}
+
+static void flush_block ( BinWriter* w )
+{
+   if (w->blk_used > 0)
+      write_record( w, 'b', w->blk, w->blk_used );
+   w->blk_used = 0;
+}
+
+static Word cmp_string ( Word s1, Word s2 )
+{
+   return strcmp((const char*)s1, (const char*)s2);
+}
+
+// Returns the id of a file or function name, defining it if necessary.
+static UWord string_id ( BinWriter* w, const char* str )
+{
+   UWord id;
+   if (lookupFM( w->strings, (Word*)&id, (Word)str ))
+      return id;
+   id = w->n_strings++;
+   addToFM( w->strings, (Word)str, (Word)id );
+   write_record( w, 's', str, strlen(str) );
+   return id;
+}
+
+static void put_op ( BinWriter* w, UWord op, ULong arg )
+{
+   w->blk_used += put_varint( w->blk + w->blk_used, op );
+   w->blk_used += put_varint( w->blk + w->blk_used, arg );
+}
+
+static void show_CacheProfFile_binary ( FILE* f, CacheProfFile* cpf )
+{
+   Int       i;
+   char**    d;
+   FileFn*   topKey;
+   WordFM*   topVal;
+   UWord     subKey, prevKey;
+   Counts*   subVal;
+   BinWriter w;
+
+   w.f         = f;
+   w.blk_used  = 0;
+   // room for a full chunk plus one line
+   w.blk_size  = CG_BIN_CHUNK + 3 * 11 + cpf->n_events * 10;
+   w.blk       = malloc(w.blk_size);
+   w.strings   = newFM( malloc, free, cmp_string );
+   w.n_strings = 0;
+   if (w.blk == NULL || w.strings == NULL) {
+      fprintf(stderr, "%s: out of memory writing the output\n", argv0);
+      exit(2);
+   }
+
+   fwrite(CG_BIN_MAGIC, 1, CG_BIN_MAGIC_LEN, f);
+   for (d = cpf->desc_lines; *d; d++)
+      write_record( &w, 'h', *d, strlen(*d) );
+   write_record( &w, 'h', cpf->cmd_line, strlen(cpf->cmd_line) );
+   write_record( &w, 'h', cpf->events_line, strlen(cpf->events_line) );
+
+   initIterFM( cpf->outerMap );
+   while (nextIterFM( cpf->outerMap, (Word*)(&topKey), (Word*)(&topVal) )) {
+      // Every file/function starts with both being set, so a new block
+      // can only start here.
+      if (w.blk_used >= CG_BIN_CHUNK)
+         flush_block( &w );
+      put_op( &w, CG_BIN_OP_FL, string_id( &w, topKey->fi_name ) );
+      put_op( &w, CG_BIN_OP_FN, string_id( &w, topKey->fn_name ) );
+      prevKey = 0;
+      initIterFM( topVal );
+      while (nextIterFM( topVal, (Word*)(&subKey), (Word*)(&subVal) )) {
+         if (w.blk_used >= CG_BIN_CHUNK) {
+            flush_block( &w );
+            put_op( &w, CG_BIN_OP_FL, string_id( &w, topKey->fi_name ) );
+            put_op( &w, CG_BIN_OP_FN, string_id( &w, topKey->fn_name ) );
+            prevKey = 0;
+         }
+         // line numbers are ascending, so the zigzag encoding of the
+         // delta is just twice the difference
+         put_op( &w, CG_BIN_OP_LINE, (ULong)(subKey - prevKey) << 1 );
+         for (i = 0; i < subVal->n_counts; i++)
+            w.blk_used += put_varint( w.blk + w.blk_used, subVal->counts[i] );
+         prevKey = subKey;
+      }
+      doneIterFM( topVal );
+   }
+   doneIterFM( cpf->outerMap );
+   flush_block( &w );
+
+   // the block buffer is empty now, and has room for the summary
+   for (i = 0; i < cpf->summary->n_counts; i++)
+      w.blk_used += put_varint( w.blk + w.blk_used,
+                                cpf->summary->counts[i] );
+   write_record( &w, 't', w.blk, w.blk_used );
+
+   deleteFM( w.strings, NULL, NULL );
+   free(w.blk);
+}
+
+
 static void merge_CacheProfInfo ( SOURCE* s,
                                   /*MOD*/CacheProfFile* dst,
                                   CacheProfFile* src )
@@ -786,6 +1298,7 @@ static void merge_CacheProfInfo ( SOURCE* s,
    FileFn* soKey;
    WordFM* soVal;
    WordFM* doVal;
+   UWord   hash;
    UWord   siKey;
    Counts* siVal;
    Counts* diVal;
@@ -802,13 +1315,16 @@ static void merge_CacheProfInfo ( SOURCE* s,
    while (nextIterFM( src->outerMap, (Word*)&soKey, (Word*)&soVal )) {
 
       // is filefn in dst?   
-      if (! lookupFM( dst->outerMap, (Word*)&doVal, (Word)soKey )) {
+      hash  = hash_FileFn( soKey->fi_name, soKey->fn_name );
+      doVal = lookup_FFHash( dst->index, hash,
+                             soKey->fi_name, soKey->fn_name );
+      if (! doVal) {
 
          // no .. add dopy(filefn) -> dopy(innerMap) to src
          FileFn* c_soKey = dopy_FileFn(soKey);
          WordFM* c_soVal = dopy_InnerMap(soVal);
          if ((!c_soKey) || (!c_soVal)) goto oom;
-         addToFM( dst->outerMap, (Word)c_soKey, (Word)c_soVal );
+         add_binding( s, dst, hash, c_soKey, c_soVal );
 
       } else {
 
@@ -847,12 +1363,383 @@ static void merge_CacheProfInfo ( SOURCE* s,
    mallocFail(s, "merge_CacheProfInfo");
 }
 
+/* Read an input file, text or binary, into a new CacheProfFile.  's'
+   is left describing the file, for error messages. */
+static CacheProfFile* read_CacheProfFile ( /*OUT*/SOURCE* s, char* filename )
+{
+   CacheProfFile* cpf;
+   char           magic[CG_BIN_MAGIC_LEN];
+
+   fprintf(stderr, "%s: parsing %s\n", argv0, filename);
+   s->lno      = 1;
+   s->filename = filename;
+   s->binary   = False;
+   s->buf      = NULL;
+   s->bufsiz   = 0;
+   s->fp       = fopen(s->filename, "rb");
+   if (!s->fp) {
+      perror(argv0);
+      barf(s, "Cannot open input file");
+   }
+   assert(s->fp);
+
+   /* Binary files are recognised by their magic. */
+   if (fread(magic, 1, CG_BIN_MAGIC_LEN, s->fp) == CG_BIN_MAGIC_LEN
+       && 0 == memcmp(magic, CG_BIN_MAGIC, CG_BIN_MAGIC_LEN))
+      s->binary = True;
+   else
+      rewind(s->fp);
+
+   cpf = s->binary ? parse_CacheProfFile_binary( s )
+                   : parse_CacheProfFile( s );
+   fclose(s->fp);
+   free(s->buf);
+   s->fp  = NULL;
+   s->buf = NULL;
+   return cpf;
+}
+
+// Merges the inner map src into dst, moving the counts over, and
+// deletes src.
+static void merge_InnerMaps ( SOURCE* s, WordFM* dst, WordFM* src )
+{
+   UWord   lno;
+   Counts* sCounts;
+   Counts* dCounts;
+
+   initIterFM( src );
+   while (nextIterFM( src, (Word*)&lno, (Word*)&sCounts )) {
+      if (lookupFM( dst, (Word*)&dCounts, (Word)lno )) {
+         addCounts( s, dCounts, sCounts );
+         ddel_Counts( sCounts );
+      } else {
+         addToFM( dst, (Word)lno, (Word)sCounts );
+      }
+   }
+   doneIterFM( src );
+   deleteFM( src, NULL, NULL );
+}
+
+
+////////////////////////////////////////////////////////////////
+// The parallel merge (-j).  The input files are shared out between the
+// threads, each of which parses them in turn and merges them into its
+// own profile.  Then the bindings of these partial profiles are
+// partitioned by source file, and each thread merges one partition.  No
+// two threads ever touch the same map, and the bindings are looked up
+// in FFHashes, so the WordFM iterators (whose state is in the WordFM)
+// are never shared either.
+
+typedef
+   struct {
+      char**          inputs;
+      Int             n_inputs;
+      Int             next_input;   // protected by lock
+      Int             first;        // thread which read inputs[0]
+      pthread_mutex_t lock;
+      Int             n_threads;
+      CacheProfFile** partial;      // one per thread
+      FFHash**        bindings;     // those of partial[], one per thread
+      Int**           part_of;      // the partition of each binding
+      FFHash**        parts;        // merged partitions, one per thread
+   }
+   MergeJob;
+
+typedef
+   struct {
+      MergeJob* job;
+      Int       tid;
+   }
+   MergeThread;
+
+static void* merge_parse_worker ( void* v )
+{
+   MergeThread*   mt  = v;
+   MergeJob*      job = mt->job;
+   CacheProfFile* cpf = NULL;
+   CacheProfFile* cpfTmp;
+   SOURCE         src;
+   Int            i;
+
+   while (1) {
+      pthread_mutex_lock( &job->lock );
+      i = job->next_input++;
+      if (i == 0)
+         job->first = mt->tid;
+      pthread_mutex_unlock( &job->lock );
+      if (i >= job->n_inputs)
+         break;
+
+      cpfTmp = read_CacheProfFile( &src, job->inputs[i] );
+      if (cpf == NULL) {
+         cpf = cpfTmp;
+      } else {
+         fprintf(stderr, "%s: merging %s\n", argv0, job->inputs[i]);
+         merge_CacheProfInfo( &src, cpf, cpfTmp );
+         ddel_CacheProfFile( cpfTmp );
+      }
+   }
+   job->partial[mt->tid] = cpf;
+   return NULL;
+}
+
+static void* merge_partition_worker ( void* v )
+{
+   MergeThread* mt  = v;
+   MergeJob*    job = mt->job;
+   FFHash*      part = new_FFHash();
+   FFHashEnt*   e;
+   WordFM*      innerMap;
+   SOURCE       src = { NULL, 1, "(merged profiles)", False, NULL, 0 };
+   Int          t;
+   UWord        i;
+
+   if (part == NULL)
+      mallocFail(&src, "merge_partition_worker");
+   for (t = 0; t < job->n_threads; t++) {
+      if (job->bindings[t] == NULL)
+         continue;
+      for (i = 0; i < job->bindings[t]->size; i++) {
+         // e->key may be freed by another worker, so only the
+         // precomputed partition may be looked at
+         if (job->part_of[t][i] != mt->tid)
+            continue;
+         e = &job->bindings[t]->tab[i];
+         innerMap = lookup_FFHash( part, e->hash,
+                                   e->key->fi_name, e->key->fn_name );
+         if (innerMap) {
+            merge_InnerMaps( &src, innerMap, e->innerMap );
+            ddel_FileFn( e->key );
+         } else if (!add_FFHash( part, e->hash, e->key, e->innerMap )) {
+            mallocFail(&src, "merge_partition_worker");
+         }
+      }
+   }
+   job->parts[mt->tid] = part;
+   return NULL;
+}
+
+static void run_threads ( MergeJob* job, void* (*fn)(void*) )
+{
+   pthread_t   tids[job->n_threads];
+   MergeThread mts[job->n_threads];
+   Int         t;
+
+   for (t = 0; t < job->n_threads; t++) {
+      mts[t].job = job;
+      mts[t].tid = t;
+      if (pthread_create( &tids[t], NULL, fn, &mts[t] ) != 0) {
+         fprintf(stderr, "%s: can't create thread\n", argv0);
+         exit(1);
+      }
+   }
+   for (t = 0; t < job->n_threads; t++)
+      pthread_join( tids[t], NULL );
+}
+
+static CacheProfFile* merge_inputs ( char** inputs, Int n_inputs,
+                                     Int n_threads )
+{
+   MergeJob       job;
+   CacheProfFile* cpf;
+   CacheProfFile* other;
+   SOURCE         src;
+   Int            t;
+   UWord          i;
+
+   if (n_threads > n_inputs)
+      n_threads = n_inputs;
+   if (n_threads <= 1) {
+      cpf = NULL;
+      for (t = 0; t < n_inputs; t++) {
+         other = read_CacheProfFile( &src, inputs[t] );
+         if (cpf == NULL) {
+            cpf = other;
+         } else {
+            fprintf(stderr, "%s: merging %s\n", argv0, inputs[t]);
+            merge_CacheProfInfo( &src, cpf, other );
+            ddel_CacheProfFile( other );
+         }
+      }
+      return cpf;
+   }
+
+   job.inputs     = inputs;
+   job.n_inputs   = n_inputs;
+   job.next_input = 0;
+   job.first      = 0;
+   job.n_threads  = n_threads;
+   job.partial    = calloc(n_threads, sizeof(CacheProfFile*));
+   job.bindings   = calloc(n_threads, sizeof(FFHash*));
+   job.parts      = calloc(n_threads, sizeof(FFHash*));
+   job.part_of    = calloc(n_threads, sizeof(Int*));
+   if (!job.partial || !job.bindings || !job.parts || !job.part_of) {
+      fprintf(stderr, "%s: out of memory in merge_inputs\n", argv0);
+      exit(2);
+   }
+   pthread_mutex_init( &job.lock, NULL );
+
+   run_threads( &job, merge_parse_worker );
+
+   /* The output takes its desc, cmd and events lines from the first
+      input, as a sequential merge would. */
+   cpf = job.partial[job.first];
+   src.lno      = 1;
+   src.filename = "(merged profiles)";
+   src.binary   = False;
+   for (t = 0; t < n_threads; t++) {
+      other = job.partial[t];
+      if (other == NULL)
+         continue;
+      if (!streq( cpf->events_line, other->events_line ))
+         barf(&src, "\"events:\" lines of the input files do not match");
+      if (other != cpf)
+         addCounts( &src, cpf->summary, other->summary );
+      /* Hand the bindings over to the partition workers, partitioned
+         by source file. */
+      job.bindings[t] = other->index;
+      job.part_of[t]  = malloc(other->index->size * sizeof(Int));
+      if (job.part_of[t] == NULL)
+         mallocFail(&src, "merge_inputs");
+      for (i = 0; i < other->index->size; i++) {
+         FFHashEnt* e = &other->index->tab[i];
+         job.part_of[t][i] = e->key == NULL ? -1
+            : (Int)(hash_FileFn( e->key->fi_name, "" ) % n_threads);
+      }
+      deleteFM( other->outerMap, NULL, NULL );
+      other->outerMap = NULL;
+      other->index    = NULL;
+   }
+
+   run_threads( &job, merge_partition_worker );
+
+   cpf->outerMap = newFM( malloc, free, cmp_FileFn );
+   cpf->index    = new_FFHash();
+   if (cpf->outerMap == NULL || cpf->index == NULL)
+      mallocFail(&src, "merge_inputs");
+   for (t = 0; t < n_threads; t++) {
+      for (i = 0; i < job.parts[t]->size; i++) {
+         FFHashEnt* e = &job.parts[t]->tab[i];
+         if (e->key)
+            add_binding( &src, cpf, e->hash, e->key, e->innerMap );
+      }
+      ddel_FFHash( job.parts[t] );
+      if (job.bindings[t]) {
+         ddel_FFHash( job.bindings[t] );
+         free(job.part_of[t]);
+      }
+      if (job.partial[t] && job.partial[t] != cpf)
+         ddel_CacheProfFile( job.partial[t] );
+   }
+
+   pthread_mutex_destroy( &job.lock );
+   free(job.partial);
+   free(job.bindings);
+   free(job.parts);
+   free(job.part_of);
+   return cpf;
+}
+
+
+////////////////////////////////////////////////////////////////
+// The differences between two profiles (--diff), as cg_diff computes
+// them: per function, file2 minus file1.  Line numbers are not compared,
+// since they change between the two versions of a program being
+// compared, so the counts of each function are put on line 0.
+
+// Adds (or subtracts, if 'negate') the total counts of each function of
+// cpf into the line 0 counts of the same function in res.
+static void add_function_totals ( SOURCE* s, CacheProfFile* res,
+                                  CacheProfFile* cpf, Bool negate )
+{
+   FFHashEnt* e;
+   WordFM*    innerMap;
+   FileFn*    key;
+   Counts*    total;
+   Counts*    counts;
+   UWord      lno, i;
+   Int        j;
+
+   for (i = 0; i < cpf->index->size; i++) {
+      e = &cpf->index->tab[i];
+      if (e->key == NULL)
+         continue;
+      innerMap = lookup_FFHash( res->index, e->hash,
+                                e->key->fi_name, e->key->fn_name );
+      if (innerMap == NULL) {
+         key      = dopy_FileFn( e->key );
+         innerMap = newFM( malloc, free, cmp_unboxed_UWord );
+         total    = new_Counts_Zeroed( res->n_events );
+         if (!key || !innerMap || !total)
+            mallocFail(s, "add_function_totals");
+         addToFM( innerMap, 0, (Word)total );
+         add_binding( s, res, e->hash, key, innerMap );
+      } else {
+         lookupFM( innerMap, (Word*)&total, 0 );
+      }
+      initIterFM( e->innerMap );
+      while (nextIterFM( e->innerMap, (Word*)&lno, (Word*)&counts )) {
+         for (j = 0; j < total->n_counts; j++) {
+            if (negate) {
+               total->counts[j]        -= counts->counts[j];
+               res->summary->counts[j] -= counts->counts[j];
+            } else {
+               total->counts[j]        += counts->counts[j];
+               res->summary->counts[j] += counts->counts[j];
+            }
+         }
+      }
+      doneIterFM( e->innerMap );
+   }
+}
+
+static CacheProfFile* diff_CacheProfFiles ( SOURCE* s,
+                                            CacheProfFile* cpf1, char* name1,
+                                            CacheProfFile* cpf2, char* name2 )
+{
+   CacheProfFile* res;
+   size_t         len;
+
+   if (!streq( cpf1->events_line, cpf2->events_line ))
+     barf(s, "\"events:\" lines of the two files do not match");
+
+   res = new_CacheProfFile( NULL, NULL, NULL, 0, NULL, NULL, NULL );
+   if (res == NULL)
+      mallocFail(s, "diff_CacheProfFiles(1)");
+
+   len = strlen(name1) + strlen(name2) + 32;
+   res->desc_lines = calloc(2, sizeof(char*));
+   if (res->desc_lines)
+      res->desc_lines[0] = malloc(len);
+   if (!res->desc_lines || !res->desc_lines[0])
+      mallocFail(s, "diff_CacheProfFiles(2)");
+   sprintf(res->desc_lines[0], "desc: Files compared:   %s; %s", name1, name2);
+
+   // the "cmd:" lines always start with "cmd: "
+   len = strlen(cpf1->cmd_line) + strlen(cpf2->cmd_line) + 8;
+   res->cmd_line = malloc(len);
+   if (!res->cmd_line)
+      mallocFail(s, "diff_CacheProfFiles(3)");
+   sprintf(res->cmd_line, "cmd:  %s; %s", cpf1->cmd_line + 5,
+                                          cpf2->cmd_line + 5);
+
+   set_events_line( s, res, cpf1->events_line );
+   add_function_totals( s, res, cpf2, False );
+   add_function_totals( s, res, cpf1, True );
+   return res;
+}
+
 static void usage ( void )
 {
-   fprintf(stderr, "%s: Merges multiple cachegrind output files into one\n", 
-                   argv0);
-   fprintf(stderr, "%s: usage: %s [-o outfile] [files-to-merge]\n", 
+   fprintf(stderr, "%s: Merges multiple cachegrind output files into one,\n"
+                   "%s: or gives the differences between two of them\n",
                    argv0, argv0);
+   fprintf(stderr, "%s: usage: %s [--binary] [-j jobs] [-o outfile] "
+                   "[files-to-merge]\n", argv0, argv0);
+   fprintf(stderr, "%s:        %s --diff [--binary] [-o outfile] "
+                   "file1 file2\n", argv0, argv0);
+   fprintf(stderr, "%s: inputs may be text or binary; the output is text "
+                   "unless --binary is given\n", argv0);
    exit(1);
 }
 
@@ -860,11 +1747,15 @@ int main ( int argc, char** argv )
 {
    Int            i;
    SOURCE         src;
-   CacheProfFile  *cpf, *cpfTmp;
+   CacheProfFile  *cpf, *cpf1, *cpf2;
 
    FILE*          outfile = NULL;
    char*          outfilename = NULL;
-   Int            outfileix = 0;
+   Bool           binary_out = False;
+   Bool           diff = False;
+   Int            n_jobs = 1;
+   char**         inputs;
+   Int            n_inputs = 0;
 
    if (argv[0])
       argv0 = argv[0];
@@ -872,58 +1763,50 @@ int main ( int argc, char** argv )
    if (argc < 2)
       usage();
 
-   for (i = 1; i < argc; i++) {
-      if (streq(argv[i], "-h") || streq(argv[i], "--help"))
-         usage();
+   inputs = malloc(argc * sizeof(char*));
+   if (inputs == NULL) {
+      fprintf(stderr, "%s: out of memory\n", argv0);
+      exit(2);
    }
 
-   /* Scan args, looking for '-o outfilename'. */
+   /* Scan args, looking for options; the rest are input files. */
    for (i = 1; i < argc; i++) {
-      if (streq(argv[i], "-o")) {
-         if (i+1 < argc) {
+      if (streq(argv[i], "-h") || streq(argv[i], "--help"))
+         usage();
+      else if (streq(argv[i], "--binary"))
+         binary_out = True;
+      else if (streq(argv[i], "--diff"))
+         diff = True;
+      else if (streq(argv[i], "-o") || streq(argv[i], "-j")) {
+         if (i+1 >= argc)
+            usage();
+         if (streq(argv[i], "-o")) {
             outfilename = argv[i+1];
-            outfileix   = i;
-            break;
          } else {
-            usage();
+            n_jobs = atoi(argv[i+1]);
+            if (n_jobs < 1)
+               usage();
          }
-      }
-   }
-
-   cpf = NULL;
-
-   for (i = 1; i < argc; i++) {
-
-      if (i == outfileix) {
-         /* Skip '-o' and whatever follows it */
-         i += 1;
-         continue;
-      }
-
-      fprintf(stderr, "%s: parsing %s\n", argv0, argv[i]);
-      src.lno      = 1;
-      src.filename = argv[i];
-      src.fp       = fopen(src.filename, "r");
-      if (!src.fp) {
-         perror(argv0);
-         barf(&src, "Cannot open input file");
-      }
-      assert(src.fp);
-      cpfTmp = parse_CacheProfFile( &src );
-      fclose(src.fp);
-
-      /* If this isn't the first file, merge */
-      if (cpf == NULL) {
-         /* this is the first file */
-         cpf = cpfTmp;
+         i++;
       } else {
-         /* not the first file; merge */
-         fprintf(stderr, "%s: merging %s\n", argv0, argv[i]);
-         merge_CacheProfInfo( &src, cpf, cpfTmp );
-         ddel_CacheProfFile( cpfTmp );
+         inputs[n_inputs++] = argv[i];
       }
+   }
 
+   if (diff) {
+      if (n_inputs != 2)
+         usage();
+      cpf1 = read_CacheProfFile( &src, inputs[0] );
+      cpf2 = read_CacheProfFile( &src, inputs[1] );
+      fprintf(stderr, "%s: comparing %s and %s\n",
+                      argv0, inputs[0], inputs[1]);
+      cpf = diff_CacheProfFiles( &src, cpf1, inputs[0], cpf2, inputs[1] );
+      ddel_CacheProfFile( cpf1 );
+      ddel_CacheProfFile( cpf2 );
+   } else {
+      cpf = n_inputs > 0 ? merge_inputs( inputs, n_inputs, n_jobs ) : NULL;
    }
+   free(inputs);
 
    /* Now create the output file. */
 
@@ -934,7 +1817,7 @@ int main ( int argc, char** argv )
 
       /* Write the output. */
       if (outfilename) {
-         outfile = fopen(outfilename, "w");
+         outfile = fopen(outfilename, binary_out ? "wb" : "w");
          if (!outfile) {
             fprintf(stderr, "%s: can't create output file %s\n", 
                             argv0, outfilename);
@@ -945,7 +1828,10 @@ int main ( int argc, char** argv )
          outfile = stdout;
       }
 
-      show_CacheProfFile( outfile, cpf );
+      if (binary_out)
+         show_CacheProfFile_binary( outfile, cpf );
+      else
+         show_CacheProfFile( outfile, cpf );
       if (ferror(outfile)) {
          fprintf(stderr, "%s: error writing output file %s\n", 
                          argv0, outfilename ? outfilename : "(stdout)" );
@@ -38,6 +38,55 @@
       - both blocks miss                 --> one miss (not two)
 */
 
+/* Simulator kernels.  The generic kernel reads the associativity and
+ * line size from the cache_t2 on every reference.  For the geometries
+ * found in most current CPUs, specialised kernels are compiled in which
+ * these are constants, so that the compiler can unroll the tag search,
+ * turn the set index multiplication into shifts and fold the line size
+ * shifts.  The kernel is picked once, when the cache is initialised;
+ * after that a reference costs one well-predicted switch.
+ */
+typedef enum {
+   CacheSim_Generic,
+   CacheSim_8way_64B,
+   CacheSim_12way_64B,
+   CacheSim_16way_64B
+} cachesim_kernel;
+
+/* Replacement policies.  LRU is what the kernels above implement, keeping
+ * each set ordered from MRU to LRU.  The other policies keep every tag at
+ * a fixed way and hold their state in a separate per-set array:
+ *  - PLRU:  tree pseudo-LRU, one bit per inner node of a binary tree over
+ *           the ways (so the associativity must be a power of two);
+ *  - SRRIP: static re-reference interval prediction with 2-bit RRPVs;
+ *           lines are inserted with a "long" interval (2), promoted to 0
+ *           on a hit, and a line with the "distant" interval (3) is
+ *           evicted.
+ */
+typedef enum {
+   CacheRepl_LRU,
+   CacheRepl_PLRU,
+   CacheRepl_SRRIP
+} cachesim_repl;
+
+/* How the LL cache relates to the levels above it.
+ *  - non-inclusive: every level allocates on a miss, nothing is kept
+ *                   consistent between the levels (the historical model);
+ *  - inclusive:     a line evicted from LL is also removed from the
+ *                   levels above ("back-invalidation");
+ *  - exclusive:     LL is a victim cache, it only receives lines evicted
+ *                   from the level directly above it, and gives up a line
+ *                   when it hits on it.
+ */
+typedef enum {
+   CacheLL_NonInclusive,
+   CacheLL_Inclusive,
+   CacheLL_Exclusive
+} cachesim_LL_policy;
+
+#define CACHESIM_RRPV_LONG     2
+#define CACHESIM_RRPV_DISTANT  3
+
 typedef struct {
    Int          size;                   /* bytes */
    Int          assoc;
@@ -46,14 +95,20 @@ typedef struct {
    Int          sets_min_1;
    Int          line_size_bits;
    Int          tag_shift;
+   cachesim_kernel kernel;
+   cachesim_repl   repl;
    HChar        desc_line[128];         /* large enough */
    UWord*       tags;
+   UWord*       plru;                   /* PLRU: tree bits, one per set */
+   UChar*       rrpv;                   /* SRRIP: one RRPV per line */
 } cache_t2;
 
 /* By this point, the size/assoc/line_size has been checked. */
-static void cachesim_initcache(cache_t config, cache_t2* c)
+static void cachesim_initcache(cache_t config, cachesim_repl repl,
+                               cache_t2* c)
 {
    Int i;
+   const HChar* repl_desc = "";
 
    c->size      = config.size;
    c->assoc     = config.assoc;
@@ -64,12 +119,31 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
    c->line_size_bits = VG_(log2)(c->line_size);
    c->tag_shift      = c->line_size_bits + VG_(log2)(c->sets);
 
+   c->kernel = CacheSim_Generic;
+   if (c->line_size == 64) {
+      switch (c->assoc) {
+         case 8:  c->kernel = CacheSim_8way_64B;  break;
+         case 12: c->kernel = CacheSim_12way_64B; break;
+         case 16: c->kernel = CacheSim_16way_64B; break;
+         default: break;
+      }
+   }
+
+   /* A direct-mapped cache has nothing to choose. */
+   c->repl = (c->assoc == 1) ? CacheRepl_LRU : repl;
+
+   switch (c->repl) {
+      case CacheRepl_PLRU:  repl_desc = ", PLRU";  break;
+      case CacheRepl_SRRIP: repl_desc = ", SRRIP"; break;
+      default: break;
+   }
+
    if (c->assoc == 1) {
       VG_(sprintf)(c->desc_line, "%d B, %d B, direct-mapped", 
                                  c->size, c->line_size);
    } else {
-      VG_(sprintf)(c->desc_line, "%d B, %d B, %d-way associative",
-                                 c->size, c->line_size, c->assoc);
+      VG_(sprintf)(c->desc_line, "%d B, %d B, %d-way associative%s",
+                                 c->size, c->line_size, c->assoc, repl_desc);
    }
 
    c->tags = VG_(malloc)("cg.sim.ci.1",
@@ -77,21 +151,31 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
 
    for (i = 0; i < c->sets * c->assoc; i++)
       c->tags[i] = 0;
+
+   c->plru = NULL;
+   c->rrpv = NULL;
+   if (c->repl == CacheRepl_PLRU) {
+      c->plru = VG_(calloc)("cg.sim.ci.2", c->sets, sizeof(UWord));
+   } else if (c->repl == CacheRepl_SRRIP) {
+      c->rrpv = VG_(malloc)("cg.sim.ci.3", c->sets * c->assoc);
+      for (i = 0; i < c->sets * c->assoc; i++)
+         c->rrpv[i] = CACHESIM_RRPV_DISTANT;
+   }
 }
 
-/* This attribute forces GCC to inline the function, getting rid of a
+/* LRU lookup and update of one set.  'assoc' is a compile-time constant
+ * in the specialised kernels, so there the loops below are unrolled.
+ *
+ * This attribute forces GCC to inline the function, getting rid of a
  * lot of indirection around the cache_t2 pointer, if it is known to be
  * constant in the caller (the caller is inlined itself).
  * Without inlining of simulator functions, cachegrind can get 40% slower.
  */
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
+Bool cachesim_lru_is_miss(UWord* set, UWord tag, const Int assoc)
 {
    int i, j;
-   UWord *set;
-
-   set = &(c->tags[set_no * c->assoc]);
 
    /* This loop is unrolled for just the first case, which is the most */
    /* common.  We can't unroll any further because it would screw up   */
@@ -101,7 +185,7 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
 
    /* If the tag is one other than the MRU, move it into the MRU spot  */
    /* and shuffle the rest down.                                       */
-   for (i = 1; i < c->assoc; i++) {
+   for (i = 1; i < assoc; i++) {
       if (tag == set[i]) {
          for (j = i; j > 0; j--) {
             set[j] = set[j - 1];
@@ -113,7 +197,7 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
    }
 
    /* A miss;  install this tag as MRU, shuffle rest down. */
-   for (j = c->assoc - 1; j > 0; j--) {
+   for (j = assoc - 1; j > 0; j--) {
       set[j] = set[j - 1];
    }
    set[0] = tag;
@@ -123,11 +207,31 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
 
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
+Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
+{
+   switch (c->kernel) {
+      case CacheSim_8way_64B:
+         return cachesim_lru_is_miss(&c->tags[set_no * 8],  tag, 8);
+      case CacheSim_12way_64B:
+         return cachesim_lru_is_miss(&c->tags[set_no * 12], tag, 12);
+      case CacheSim_16way_64B:
+         return cachesim_lru_is_miss(&c->tags[set_no * 16], tag, 16);
+      default:
+         return cachesim_lru_is_miss(&c->tags[set_no * c->assoc], tag,
+                                     c->assoc);
+   }
+}
+
+/* 'line_size_bits' is a compile-time constant in the specialised
+ * kernels. */
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_ref_is_miss_k(cache_t2* c, Addr a, UChar size,
+                            const Int assoc, const Int line_size_bits)
 {
    /* A memory block has the size of a cache line */
-   UWord block1 =  a         >> c->line_size_bits;
-   UWord block2 = (a+size-1) >> c->line_size_bits;
+   UWord block1 =  a         >> line_size_bits;
+   UWord block2 = (a+size-1) >> line_size_bits;
    UInt  set1   = block1 & c->sets_min_1;
 
    /* Tags used in real caches are minimal to save space.
@@ -141,7 +245,7 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
 
    /* Access entirely within line. */
    if (block1 == block2)
-      return cachesim_setref_is_miss(c, set1, tag1);
+      return cachesim_lru_is_miss(&c->tags[set1 * assoc], tag1, assoc);
 
    /* Access straddles two lines. */
    else if (block1 + 1 == block2) {
@@ -149,11 +253,11 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
       UWord tag2 = block2;
 
       /* always do both, as state is updated as side effect */
-      if (cachesim_setref_is_miss(c, set1, tag1)) {
-         cachesim_setref_is_miss(c, set2, tag2);
+      if (cachesim_lru_is_miss(&c->tags[set1 * assoc], tag1, assoc)) {
+         cachesim_lru_is_miss(&c->tags[set2 * assoc], tag2, assoc);
          return True;
       }
-      return cachesim_setref_is_miss(c, set2, tag2);
+      return cachesim_lru_is_miss(&c->tags[set2 * assoc], tag2, assoc);
    }
    VG_(printf)("addr: %lx  size: %u  blocks: %lu %lu",
                a, size, block1, block2);
@@ -162,56 +266,590 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
    return True;
 }
 
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
+{
+   switch (c->kernel) {
+      case CacheSim_8way_64B:
+         return cachesim_ref_is_miss_k(c, a, size, 8, 6);
+      case CacheSim_12way_64B:
+         return cachesim_ref_is_miss_k(c, a, size, 12, 6);
+      case CacheSim_16way_64B:
+         return cachesim_ref_is_miss_k(c, a, size, 16, 6);
+      default:
+         return cachesim_ref_is_miss_k(c, a, size, c->assoc,
+                                       c->line_size_bits);
+   }
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Multi-level simulation                               ---*/
+/*------------------------------------------------------------*/
+
+/* The functions in this section simulate one memory block at a time and
+ * report the tag each miss displaced, so that the levels can be kept
+ * inclusive or exclusive.  Empty ways hold tag 0, which no real block
+ * has (it would be the first line of the address space).  They are only
+ * used when the configuration is something else than the historical
+ * I1/D1 + non-inclusive LRU LL one, which keeps using the kernels above.
+ */
+
+/* LRU reference that returns the displaced tag on a miss. */
+static Bool cachesim_lru_ref(UWord* set, UWord tag, Int assoc, UWord* victim)
+{
+   Int i, j;
+
+   for (i = 0; i < assoc; i++) {
+      if (tag == set[i]) {
+         for (j = i; j > 0; j--)
+            set[j] = set[j - 1];
+         set[0] = tag;
+         return False;
+      }
+   }
+
+   *victim = set[assoc - 1];
+   for (j = assoc - 1; j > 0; j--)
+      set[j] = set[j - 1];
+   set[0] = tag;
+   return True;
+}
+
+/* Point the PLRU tree of a set away from 'way'.  Node n has its children
+ * at 2n and 2n+1, the ways are the leaves assoc..2*assoc-1, and a set
+ * bit at node n means "the next victim is in the right subtree". */
+static __inline__ void cachesim_plru_touch(UWord* bits, Int assoc, Int way)
+{
+   UWord node = assoc + way;
+
+   while (node > 1) {
+      UWord parent = node >> 1;
+      if (node & 1)
+         *bits &= ~((UWord)1 << parent);
+      else
+         *bits |=  ((UWord)1 << parent);
+      node = parent;
+   }
+}
+
+static Bool cachesim_plru_ref(cache_t2* c, UInt set_no, UWord tag,
+                              UWord* victim)
+{
+   UWord* set  = &c->tags[set_no * c->assoc];
+   UWord* bits = &c->plru[set_no];
+   Int    i, way = -1;
+   UWord  node;
+
+   for (i = 0; i < c->assoc; i++) {
+      if (tag == set[i]) {
+         cachesim_plru_touch(bits, c->assoc, i);
+         return False;
+      }
+      if (way == -1 && set[i] == 0)
+         way = i;
+   }
+
+   /* Fill an empty way before evicting anything. */
+   if (way == -1) {
+      node = 1;
+      while (node < (UWord)c->assoc)
+         node = 2 * node + ((*bits >> node) & 1);
+      way = node - c->assoc;
+   }
+
+   *victim  = set[way];
+   set[way] = tag;
+   cachesim_plru_touch(bits, c->assoc, way);
+   return True;
+}
+
+static Bool cachesim_srrip_ref(cache_t2* c, UInt set_no, UWord tag,
+                               UWord* victim)
+{
+   UWord* set  = &c->tags[set_no * c->assoc];
+   UChar* rrpv = &c->rrpv[set_no * c->assoc];
+   Int    i, way;
+   UChar  max;
+
+   for (i = 0; i < c->assoc; i++) {
+      if (tag == set[i]) {
+         rrpv[i] = 0;
+         return False;
+      }
+   }
+
+   /* Age the whole set until some line has the distant interval; empty
+    * ways always have it.  Doing it in one step is equivalent to the
+    * usual "increment all and retry" loop. */
+   max = 0;
+   way = 0;
+   for (i = 0; i < c->assoc; i++) {
+      if (rrpv[i] > max) {
+         max = rrpv[i];
+         way = i;
+      }
+   }
+   if (max < CACHESIM_RRPV_DISTANT) {
+      for (i = 0; i < c->assoc; i++)
+         rrpv[i] += CACHESIM_RRPV_DISTANT - max;
+   }
+
+   *victim   = set[way];
+   set[way]  = tag;
+   rrpv[way] = CACHESIM_RRPV_LONG;
+   return True;
+}
+
+/* References 'block' in 'c', allocating it on a miss.  Returns True on a
+ * miss, in which case *victim is the tag that was displaced (0 if the
+ * way was empty). */
+static Bool cachesim_block_ref(cache_t2* c, UWord block, UWord* victim)
+{
+   UInt set_no = block & c->sets_min_1;
+
+   switch (c->repl) {
+      case CacheRepl_PLRU:
+         return cachesim_plru_ref(c, set_no, block, victim);
+      case CacheRepl_SRRIP:
+         return cachesim_srrip_ref(c, set_no, block, victim);
+      default:
+         return cachesim_lru_ref(&c->tags[set_no * c->assoc], block,
+                                 c->assoc, victim);
+   }
+}
+
+/* Removes 'block' from 'c'.  Returns True if it was present. */
+static Bool cachesim_block_invalidate(cache_t2* c, UWord block)
+{
+   UInt   set_no = block & c->sets_min_1;
+   UWord* set    = &c->tags[set_no * c->assoc];
+   Int    i, j;
+
+   for (i = 0; i < c->assoc; i++) {
+      if (set[i] != block)
+         continue;
+      if (c->repl == CacheRepl_LRU) {
+         /* Keep the set ordered: the empty way becomes the LRU one. */
+         for (j = i; j < c->assoc - 1; j++)
+            set[j] = set[j + 1];
+         set[c->assoc - 1] = 0;
+      } else {
+         set[i] = 0;
+         if (c->repl == CacheRepl_SRRIP)
+            c->rrpv[set_no * c->assoc + i] = CACHESIM_RRPV_DISTANT;
+      }
+      return True;
+   }
+   return False;
+}
+
 
 static cache_t2 LL;
+static cache_t2 ML;
 static cache_t2 I1;
 static cache_t2 D1;
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+/* Is there a private mid-level cache between I1/D1 and LL? */
+static Bool cachesim_has_ML = False;
+static cachesim_LL_policy cachesim_LL_pol = CacheLL_NonInclusive;
+
+/* Use the multi-level simulation instead of the I1/D1 + LL kernels? */
+static Bool cachesim_hier = False;
+
+/* Lines removed from the upper levels by LL evictions (inclusive LL). */
+static ULong cachesim_back_invalidations = 0;
+
+/* Misses over all the references, for the sampling statistics. */
+static ULong cachesim_I1_misses = 0;
+static ULong cachesim_D1_misses = 0;
+static ULong cachesim_LL_misses = 0;
+
+#define CacheSim_MissL1  1
+#define CacheSim_MissML  2
+#define CacheSim_MissLL  4
+
+/* Simulates a reference to 'block' that starts at the first level cache
+ * 'L1c'.  All levels have the same line size here, so the block number
+ * is also the tag at every level.  Returns the CacheSim_Miss* levels
+ * that missed. */
+static UInt cachesim_hier_block_ref(cache_t2* L1c, UWord block)
 {
-   cachesim_initcache(I1c, &I1);
-   cachesim_initcache(D1c, &D1);
-   cachesim_initcache(LLc, &LL);
+   UWord victim, LL_victim;
+   UInt  missed;
+
+   if (!cachesim_block_ref(L1c, block, &victim))
+      return 0;
+   missed = CacheSim_MissL1;
+
+   if (cachesim_has_ML) {
+      if (!cachesim_block_ref(&ML, block, &victim))
+         return missed;
+      missed |= CacheSim_MissML;
+   }
+
+   switch (cachesim_LL_pol) {
+      case CacheLL_Inclusive:
+         if (cachesim_block_ref(&LL, block, &LL_victim)) {
+            missed |= CacheSim_MissLL;
+            if (LL_victim != 0) {
+               if (cachesim_block_invalidate(&I1, LL_victim))
+                  cachesim_back_invalidations++;
+               if (cachesim_block_invalidate(&D1, LL_victim))
+                  cachesim_back_invalidations++;
+               if (cachesim_has_ML &&
+                   cachesim_block_invalidate(&ML, LL_victim))
+                  cachesim_back_invalidations++;
+            }
+         }
+         break;
+
+      case CacheLL_Exclusive:
+         /* A hit moves the line up, a miss fills the upper levels only.
+          * Either way, the line displaced from the level above goes to
+          * LL.  Look the block up first, so that inserting the victim
+          * cannot evict it. */
+         if (!cachesim_block_invalidate(&LL, block))
+            missed |= CacheSim_MissLL;
+         if (victim != 0)
+            cachesim_block_ref(&LL, victim, &LL_victim);
+         break;
+
+      default:
+         if (cachesim_block_ref(&LL, block, &LL_victim))
+            missed |= CacheSim_MissLL;
+         break;
+   }
+
+   return missed;
+}
+
+static void cachesim_hier_doref(cache_t2* L1c, Addr a, UChar size,
+                                ULong* m1, ULong* m2, ULong* mL)
+{
+   UWord block1 =  a         >> L1c->line_size_bits;
+   UWord block2 = (a+size-1) >> L1c->line_size_bits;
+   UInt  missed;
+
+   /* As in the kernels, a reference straddling two lines counts as a
+    * single access at each level. */
+   missed = cachesim_hier_block_ref(L1c, block1);
+   if (block1 != block2)
+      missed |= cachesim_hier_block_ref(L1c, block2);
+
+   if (missed & CacheSim_MissL1) {
+      (*m1)++;
+      if (L1c == &I1) cachesim_I1_misses++; else cachesim_D1_misses++;
+   }
+   if (missed & CacheSim_MissML) (*m2)++;
+   if (missed & CacheSim_MissLL) {
+      (*mL)++;
+      cachesim_LL_misses++;
+   }
+}
+
+/* MLc.size is -1 if there is no mid-level cache.  The configuration has
+ * been checked by the caller: with a mid-level cache, a non-LRU policy or
+ * an inclusive/exclusive LL, all the line sizes are equal. */
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t MLc,
+                                cache_t LLc, cachesim_repl L1_repl,
+                                cachesim_repl LL_repl,
+                                cachesim_LL_policy LL_pol)
+{
+   cachesim_initcache(I1c, L1_repl, &I1);
+   cachesim_initcache(D1c, L1_repl, &D1);
+   cachesim_initcache(LLc, LL_repl, &LL);
+
+   cachesim_has_ML = (MLc.size != -1);
+   if (cachesim_has_ML)
+      cachesim_initcache(MLc, L1_repl, &ML);
+
+   cachesim_LL_pol = LL_pol;
+   cachesim_hier   = cachesim_has_ML
+                     || I1.repl != CacheRepl_LRU || D1.repl != CacheRepl_LRU
+                     || LL.repl != CacheRepl_LRU
+                     || LL_pol != CacheLL_NonInclusive;
 }
 
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_Gen(Addr a, UChar size,
+                           ULong* m1, ULong* m2, ULong *mL)
 {
+   if (UNLIKELY(cachesim_hier)) {
+      cachesim_hier_doref(&I1, a, size, m1, m2, mL);
+      return;
+   }
    if (cachesim_ref_is_miss(&I1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      cachesim_I1_misses++;
+      if (cachesim_ref_is_miss(&LL, a, size)) {
          (*mL)++;
+         cachesim_LL_misses++;
+      }
    }
 }
 
 // common special case IrNoX
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_NoX(Addr a, UChar size,
+                           ULong* m1, ULong* m2, ULong *mL)
 {
    UWord block  = a >> I1.line_size_bits;
    UInt  I1_set = block & I1.sets_min_1;
 
+   if (UNLIKELY(cachesim_hier)) {
+      cachesim_hier_doref(&I1, a, size, m1, m2, mL);
+      return;
+   }
+
    // use block as tag
    if (cachesim_setref_is_miss(&I1, I1_set, block)) {
       UInt  LL_set = block & LL.sets_min_1;
       (*m1)++;
+      cachesim_I1_misses++;
       // can use block as tag as L1I and LL cache line sizes are equal
-      if (cachesim_setref_is_miss(&LL, LL_set, block))
+      if (cachesim_setref_is_miss(&LL, LL_set, block)) {
          (*mL)++;
+         cachesim_LL_misses++;
+      }
    }
 }
 
+/* Returns True if the reference missed in D1, for the prefetchers. */
 __attribute__((always_inline))
 static __inline__
-void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
+Bool cachesim_D1_doref(Addr a, UChar size,
+                       ULong* m1, ULong* m2, ULong *mL)
 {
+   if (UNLIKELY(cachesim_hier)) {
+      ULong m1_before = *m1;
+      cachesim_hier_doref(&D1, a, size, m1, m2, mL);
+      return *m1 != m1_before;
+   }
    if (cachesim_ref_is_miss(&D1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      cachesim_D1_misses++;
+      if (cachesim_ref_is_miss(&LL, a, size)) {
          (*mL)++;
+         cachesim_LL_misses++;
+      }
+      return True;
    }
+   return False;
+}
+
+/*------------------------------------------------------------*/
+/*--- Prefetchers and data TLB                             ---*/
+/*------------------------------------------------------------*/
+
+/* The prefetchers watch the data references and bring lines into D1
+ * (and, as for a demand miss, into the levels below it) before they are
+ * used.  A prefetch is never counted as a miss; the number of lines it
+ * actually brought into D1 is counted instead.  Like real prefetchers,
+ * they never cross a page boundary.
+ *  - next-line: a D1 miss on line L prefetches L+1;
+ *  - stride:    a table indexed by the instruction address learns the
+ *               distance between consecutive references of each load or
+ *               store, and once the same stride has been seen twice,
+ *               prefetches one stride ahead;
+ *  - stream:    a few stream trackers follow D1 misses to consecutive
+ *               lines, in either direction, and once a stream is
+ *               confirmed prefetch the next CACHESIM_STREAM_DEGREE lines.
+ */
+typedef enum {
+   CachePf_None,
+   CachePf_NextLine,
+   CachePf_Stride,
+   CachePf_Stream
+} cachesim_prefetcher;
+
+#define CACHESIM_STRIDE_ENTRIES  256     /* must be a power of two */
+#define CACHESIM_STREAMS         16
+#define CACHESIM_STREAM_DEGREE   4
+
+typedef struct {
+   Addr  pc;
+   Addr  last_addr;
+   Word  stride;
+   UInt  conf;
+} cachesim_stride_ent;
+
+typedef struct {
+   UWord last_block;
+   Word  dir;           /* +1, -1, or 0 if not yet known */
+   UInt  conf;
+   ULong lru;           /* time of the last update */
+} cachesim_stream_ent;
+
+static cachesim_prefetcher cachesim_pf = CachePf_None;
+static cachesim_stride_ent cachesim_stride_tab[CACHESIM_STRIDE_ENTRIES];
+static cachesim_stream_ent cachesim_streams[CACHESIM_STREAMS];
+static ULong               cachesim_stream_clock = 0;
+
+/* The data TLB is simulated as a cache of page numbers, ie. one whose
+ * "lines" are a single byte long and which is referenced with
+ * address >> DTLB_page_bits. */
+static Bool     cachesim_has_DTLB = False;
+static cache_t2 DTLB;
+static Int      DTLB_page_bits;
+
+/* Simulate the prefetcher and/or the data TLB at all? */
+static Bool cachesim_D_extras = False;
+
+/* Brings the line holding 'a' into D1 like a demand reference does,
+ * without counting anything.  Returns True if it was not in D1. */
+static Bool cachesim_D1_prefetch(Addr a)
+{
+   if (cachesim_hier)
+      return cachesim_hier_block_ref(&D1, a >> D1.line_size_bits) != 0;
+   if (!cachesim_ref_is_miss(&D1, a, 1))
+      return False;
+   cachesim_ref_is_miss(&LL, a, 1);
+   return True;
+}
+
+static __inline__ Bool cachesim_same_page(Addr a1, Addr a2)
+{
+   return (a1 >> DTLB_page_bits) == (a2 >> DTLB_page_bits);
+}
+
+/* Returns the number of lines brought into D1. */
+static UInt cachesim_stride_prefetch(Addr pc, Addr a)
+{
+   cachesim_stride_ent* e =
+      &cachesim_stride_tab[(pc ^ (pc >> 8)) & (CACHESIM_STRIDE_ENTRIES-1)];
+   Word stride;
+
+   if (e->pc != pc) {
+      e->pc        = pc;
+      e->last_addr = a;
+      e->stride    = 0;
+      e->conf      = 0;
+      return 0;
+   }
+
+   stride = (Word)(a - e->last_addr);
+   e->last_addr = a;
+   if (stride != 0 && stride == e->stride) {
+      if (e->conf < 3) e->conf++;
+   } else {
+      e->stride = stride;
+      e->conf   = 0;
+      return 0;
+   }
+
+   if (e->conf >= 2 && cachesim_same_page(a, a + stride))
+      return cachesim_D1_prefetch(a + stride);
+   return 0;
+}
+
+/* Returns the number of lines brought into D1. */
+static UInt cachesim_stream_prefetch(Addr a)
+{
+   UWord block = a >> D1.line_size_bits;
+   cachesim_stream_ent* e = NULL;
+   UInt i, n = 0;
+
+   cachesim_stream_clock++;
+
+   for (i = 0; i < CACHESIM_STREAMS; i++) {
+      cachesim_stream_ent* s = &cachesim_streams[i];
+      if (s->lru == 0)
+         continue;
+      if ((s->dir >= 0 && block == s->last_block + 1) ||
+          (s->dir <= 0 && block == s->last_block - 1)) {
+         e = s;
+         break;
+      }
+   }
+
+   if (e == NULL) {
+      /* Start tracking a new stream in the least recently used slot. */
+      e = &cachesim_streams[0];
+      for (i = 1; i < CACHESIM_STREAMS; i++)
+         if (cachesim_streams[i].lru < e->lru)
+            e = &cachesim_streams[i];
+      e->last_block = block;
+      e->dir        = 0;
+      e->conf       = 0;
+      e->lru        = cachesim_stream_clock;
+      return 0;
+   }
+
+   e->dir        = (block == e->last_block + 1) ? 1 : -1;
+   e->last_block = block;
+   e->lru        = cachesim_stream_clock;
+   if (e->conf < 3) e->conf++;
+
+   if (e->conf >= 2) {
+      for (i = 1; i <= CACHESIM_STREAM_DEGREE; i++) {
+         Addr pa = (Addr)(block + e->dir * (Word)i) << D1.line_size_bits;
+         if (!cachesim_same_page(a, pa))
+            break;
+         n += cachesim_D1_prefetch(pa);
+         /* The next miss of this stream will be past the prefetched
+          * lines. */
+         e->last_block = pa >> D1.line_size_bits;
+      }
+   }
+   return n;
+}
+
+/* Runs the prefetcher for a data reference of instruction 'pc' to 'a'.
+ * Returns the number of lines brought into D1. */
+static UInt cachesim_prefetch(Addr pc, Addr a, Bool D1_miss)
+{
+   switch (cachesim_pf) {
+      case CachePf_NextLine: {
+         Addr pa = ((a >> D1.line_size_bits) + 1) << D1.line_size_bits;
+         if (D1_miss && cachesim_same_page(a, pa))
+            return cachesim_D1_prefetch(pa);
+         return 0;
+      }
+      case CachePf_Stride:
+         return cachesim_stride_prefetch(pc, a);
+      case CachePf_Stream:
+         return D1_miss ? cachesim_stream_prefetch(a) : 0;
+      default:
+         return 0;
+   }
+}
+
+/* Returns True if the reference misses in the data TLB.  A reference
+ * straddling two pages needs both translations, but counts as a single
+ * miss, as for the caches. */
+static Bool cachesim_DTLB_ref_is_miss(Addr a, UChar size)
+{
+   UWord page1 =  a         >> DTLB_page_bits;
+   UWord page2 = (a+size-1) >> DTLB_page_bits;
+   Bool  miss  = cachesim_setref_is_miss(&DTLB, page1 & DTLB.sets_min_1,
+                                         page1);
+
+   if (page2 != page1)
+      miss |= cachesim_setref_is_miss(&DTLB, page2 & DTLB.sets_min_1,
+                                      page2);
+   return miss;
+}
+
+/* DTLBc.size is the number of entries, or -1 for no TLB simulation. */
+static void cachesim_init_D_extras(cachesim_prefetcher pf, cache_t DTLBc,
+                                   Int page_size)
+{
+   cachesim_pf    = pf;
+   DTLB_page_bits = VG_(log2)(page_size);
+
+   cachesim_has_DTLB = (DTLBc.size != -1);
+   if (cachesim_has_DTLB) {
+      DTLBc.line_size = 1;
+      cachesim_initcache(DTLBc, CacheRepl_LRU, &DTLB);
+      VG_(sprintf)(DTLB.desc_line, "%d entries, %d-way, %d B pages",
+                   DTLBc.size, DTLBc.assoc, page_size);
+   }
+
+   cachesim_D_extras = cachesim_has_DTLB || pf != CachePf_None;
 }
 
 /* Check for special case IrNoX. Called at instrumentation time.
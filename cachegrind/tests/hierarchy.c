@@ -0,0 +1,21 @@
+/* Sweeps an array which is much bigger than D1, but fits in the
+   mid-level cache, several times.  After the first sweep, the D1 misses
+   hit in the mid-level cache. */
+
+#include <stdlib.h>
+
+#define SIZE   (512 * 1024)
+#define LINE   64
+#define SWEEPS 8
+
+int main(void)
+{
+   volatile char* a = calloc(SIZE, 1);
+   int i, s, sum = 0;
+
+   for (s = 0; s < SWEEPS; s++)
+      for (i = 0; i < SIZE; i += LINE)
+         sum += a[i];
+
+   return sum;
+}
@@ -0,0 +1,22 @@
+/* Reads an array much bigger than D1 line by line, which a stream
+   prefetcher follows, then writes one byte of each of its pages, which
+   does not fit in a small data TLB. */
+
+#include <stdlib.h>
+
+#define SIZE   (16 * 1024 * 1024)
+#define LINE   64
+#define PAGE   4096
+
+int main(void)
+{
+   volatile char* a = calloc(SIZE, 1);
+   int i, sum = 0;
+
+   for (i = 0; i < SIZE; i += LINE)
+      sum += a[i];
+   for (i = 0; i < SIZE; i += PAGE)
+      a[i] = 1;
+
+   return sum;
+}
@@ -0,0 +1,21 @@
+/* A long, regular loop, for which the counts of a sampled run scaled up
+   to the whole run are close to those of a complete run. */
+
+#define N      1024
+#define ROUNDS 1000
+
+static int a[N];
+
+int main(void)
+{
+   int i, r;
+   unsigned sum = 0;
+
+   for (r = 0; r < ROUNDS; r++)
+      for (i = 0; i < N; i++) {
+         a[i] += i ^ r;
+         sum += a[i];
+      }
+
+   return sum == 1;
+}
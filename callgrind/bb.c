@@ -147,6 +147,7 @@ static BB* new_bb(obj_node* obj, PtrdiffT offset,
    bb->is_entry    = 0;
    bb->bbcc_list   = 0;
    bb->last_bbcc   = 0;
+   bb->prev_bbcc   = 0;
 
    /* insert into BB hash table */
    idx = bb_hash_idx(obj, offset, bbs.size);
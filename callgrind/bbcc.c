@@ -35,7 +35,8 @@
 /*--- BBCC operations                                      ---*/
 /*------------------------------------------------------------*/
 
-#define N_BBCC_INITIAL_ENTRIES  10437
+/* Must be a power of 2 */
+#define N_BBCC_INITIAL_ENTRIES  16384
 
 /* BBCC table (key is BB/Context), per thread, resizable */
 bbcc_hash current_bbccs;
@@ -45,6 +46,7 @@ void CLG_(init_bbcc_hash)(bbcc_hash* bbccs)
    Int i;
 
    CLG_ASSERT(bbccs != 0);
+   CLG_ASSERT((N_BBCC_INITIAL_ENTRIES & (N_BBCC_INITIAL_ENTRIES-1)) == 0);
 
    bbccs->size    = N_BBCC_INITIAL_ENTRIES;
    bbccs->entries = 0;
@@ -139,44 +141,73 @@ void CLG_(forall_bbccs)(void (*func)(BBCC*))
  *
  * The hash is used in setup_bb(), i.e. to find the cost
  * counters to be changed in the execution of a BB.
+ *
+ * The table size is a power of 2. Both keys are heap pointers with
+ * their low bits zero, so they are scrambled before masking. Chains
+ * are kept in most-recently-used order.
  */
 
 static __inline__
 UInt bbcc_hash_idx(BB* bb, Context* cxt, UInt size)
 {
+   UWord h;
+
    CLG_ASSERT(bb != 0);
    CLG_ASSERT(cxt != 0);
 
-   return ((Addr)bb + (Addr)cxt) % size;
+   h = ((Addr)bb >> 3) ^ (((Addr)cxt >> 3) * 0x9E3779B1);
+   h ^= h >> 16;
+   return h & (size - 1);
+}
+
+
+/* Does a cached BBCC of this BB belong to context cxt? */
+static __inline__
+Bool bbcc_matches(BBCC* bbcc, Context* cxt)
+{
+   if (!bbcc || bbcc->cxt != cxt) return False;
+
+   /* if we don't dump threads separate, tid doesn't have to match */
+   return !CLG_(clo).separate_threads || (bbcc->tid == CLG_(current_tid));
 }
- 
 
 /* Lookup for a BBCC in hash.
+ *
+ * Every BB caches the BBCCs of the two contexts it was last executed
+ * in, which covers a BB alternately called from two call sites.
  */ 
 static
 BBCC* lookup_bbcc(BB* bb, Context* cxt)
 {
-   BBCC* bbcc = bb->last_bbcc;
+   BBCC *bbcc, *prev;
    UInt  idx;
 
    /* check LRU */
-   if (bbcc->cxt == cxt) {
-       if (!CLG_(clo).separate_threads) {
-	   /* if we don't dump threads separate, tid doesn't have to match */
-	   return bbcc;
-       }
-       if (bbcc->tid == CLG_(current_tid)) return bbcc;
+   if (bbcc_matches(bb->last_bbcc, cxt)) return bb->last_bbcc;
+   if (bbcc_matches(bb->prev_bbcc, cxt)) {
+       CLG_(stat).bbcc_lru2_hits++;
+       return bb->prev_bbcc;
    }
 
    CLG_(stat).bbcc_lru_misses++;
 
    idx = bbcc_hash_idx(bb, cxt, current_bbccs.size);
    bbcc = current_bbccs.table[idx];
+   prev = 0;
    while (bbcc &&
 	  (bb      != bbcc->bb ||
 	   cxt     != bbcc->cxt)) {
+       CLG_(stat).bbcc_hash_probes++;
+       prev = bbcc;
        bbcc = bbcc->next;
    }
+
+   /* move to front */
+   if (bbcc && prev) {
+       prev->next = bbcc->next;
+       bbcc->next = current_bbccs.table[idx];
+       current_bbccs.table[idx] = bbcc;
+   }
    
    CLG_DEBUG(2,"  lookup_bbcc(BB %#lx, Cxt %u, fn '%s'): %p (tid %u)\n",
 	    bb_addr(bb), cxt->base_number, cxt->fn[0]->name, 
@@ -189,15 +220,20 @@ BBCC* lookup_bbcc(BB* bb, Context* cxt)
 }
 
 
-/* double size of hash table 1 (addr->BBCC) */
+/* double size of hash table 1 (addr->BBCC)
+ *
+ * As the size is a power of 2, chain i is split into the chains i
+ * and i+size of the new table, keeping the MRU order of each. */
 static void resize_bbcc_hash(void)
 {
     Int i, new_size, conflicts1 = 0, conflicts2 = 0;
     BBCC** new_table;
+    BBCC **tail[2];
+    Int len[2], hi;
     UInt new_idx;
     BBCC *curr_BBCC, *next_BBCC;
 
-    new_size = 2*current_bbccs.size+3;
+    new_size = 2*current_bbccs.size;
     new_table = (BBCC**) CLG_MALLOC("cl.bbcc.rbh.1",
                                     new_size * sizeof(BBCC*));
  
@@ -207,6 +243,9 @@ static void resize_bbcc_hash(void)
     for (i = 0; i < current_bbccs.size; i++) {
 	if (current_bbccs.table[i] == NULL) continue;
  
+	tail[0] = &new_table[i];
+	tail[1] = &new_table[i + current_bbccs.size];
+	len[0] = len[1] = 0;
 	curr_BBCC = current_bbccs.table[i];
 	while (NULL != curr_BBCC) {
 	    next_BBCC = curr_BBCC->next;
@@ -214,14 +253,18 @@ static void resize_bbcc_hash(void)
 	    new_idx = bbcc_hash_idx(curr_BBCC->bb,
 				    curr_BBCC->cxt,
 				    new_size);
+	    CLG_ASSERT((new_idx & (current_bbccs.size-1)) == i);
 
-	    curr_BBCC->next = new_table[new_idx];
-	    new_table[new_idx] = curr_BBCC;
-	    if (curr_BBCC->next) {
+	    hi = (new_idx != i);
+	    len[hi]++;
+	    if (len[hi] > 1) {
 		conflicts1++;
-		if (curr_BBCC->next->next)
+		if (len[hi] > 2)
 		    conflicts2++;
 	    }
+	    *tail[hi] = curr_BBCC;
+	    tail[hi] = &curr_BBCC->next;
+	    curr_BBCC->next = NULL;
 
 	    curr_BBCC = next_BBCC;
 	}
@@ -323,9 +366,9 @@ void insert_bbcc_into_hash(BBCC* bbcc)
     CLG_DEBUG(3,"+ insert_bbcc_into_hash(BB %#lx, fn '%s')\n",
 	     bb_addr(bbcc->bb), bbcc->cxt->fn[0]->name);
 
-    /* check fill degree of hash and resize if needed (>90%) */
+    /* check fill degree of hash and resize if needed (>75%) */
     current_bbccs.entries++;
-    if (100 * current_bbccs.entries / current_bbccs.size > 90)
+    if (100 * current_bbccs.entries / current_bbccs.size > 75)
 	resize_bbcc_hash();
 
     idx = bbcc_hash_idx(bbcc->bb, bbcc->cxt, current_bbccs.size);
@@ -812,12 +855,17 @@ void CLG_(setup_bbcc)(BB* bb)
     else
       bbcc = 0;
 
-    if (!bbcc)
+    if (!bbcc) {
+      CLG_(stat).bbcc_next_misses++;
       bbcc = lookup_bbcc(bb, CLG_(current_state).cxt);
+    }
     if (!bbcc)
       bbcc = clone_bbcc(bb->bbcc_list, CLG_(current_state).cxt, 0);
     
-    bb->last_bbcc = bbcc;
+    if (bb->last_bbcc != bbcc) {
+      bb->prev_bbcc = bb->last_bbcc;
+      bb->last_bbcc = bbcc;
+    }
   }
 
   /* save for fast lookup */
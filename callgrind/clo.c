@@ -523,6 +523,9 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--dump-bb",    CLG_(clo).dump_bb) {}
 
    else if VG_INT_CLO( arg, "--dump-every-bb", CLG_(clo).dump_every_bb) {}
+   else if VG_BOOL_CLO(arg, "--dump-async", CLG_(clo).dump_async) {}
+
+   else if VG_INT_CLO( arg, "--sample-period", CLG_(clo).sample_period) {}
 
    else if VG_BOOL_CLO(arg, "--collect-alloc",   CLG_(clo).collect_alloc) {}
    else if VG_BOOL_CLO(arg, "--collect-systime", CLG_(clo).collect_systime) {}
@@ -566,6 +569,7 @@ void CLG_(print_usage)(void)
 
 "\n   activity options (for interactivity use callgrind_control):\n"
 "    --dump-every-bb=<count>   Dump every <count> basic blocks [0=never]\n"
+"    --dump-async=no|yes       Write dumps without stopping the program? [no]\n"
 "    --dump-before=<func>      Dump when entering function\n"
 "    --zero-before=<func>      Zero all costs when entering function\n"
 "    --dump-after=<func>       Dump when leaving function\n"
@@ -583,6 +587,8 @@ void CLG_(print_usage)(void)
 "    --collect-alloc=no|yes    Collect memory allocation info? [no]\n"
 #endif
 "    --collect-systime=no|yes  Collect system call time info? [no]\n"
+"    --sample-period=<n>       Only sample call stacks every <n> instructions\n"
+"                              instead of exact collection [0=off]\n"
 
 "\n   cost entity separation options:\n"
 "    --separate-threads=no|yes Separate data per thread [no]\n"
@@ -642,6 +648,8 @@ void CLG_(set_clo_defaults)(void)
   CLG_(clo).dump_bbs         = False;
 
   CLG_(clo).dump_every_bb    = 0;
+  CLG_(clo).dump_async       = False;
+  CLG_(clo).sample_period    = 0;
 
   /* Collection */
   CLG_(clo).separate_threads = False;
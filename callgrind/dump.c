@@ -39,6 +39,10 @@ static Int out_counter = 0;
 static HChar* out_file = 0;
 static Bool dumps_initialized = False;
 
+/* PID of the client, written into dumps; dumps written by a child
+ * (--dump-async=yes) are of the client */
+static Int dump_pid = 0;
+
 /* Command */
 static HChar *cmdbuf;
 
@@ -1222,7 +1226,7 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
 	VG_(fprintf)(fp, "creator: callgrind-" VERSION "\n");
 
 	/* "pid:" line */
-	VG_(fprintf)(fp, "pid: %d\n", VG_(getpid)());
+	VG_(fprintf)(fp, "pid: %d\n", dump_pid);
 
 	/* "cmd:" line */
 	VG_(fprintf)(fp, "cmd: %s", cmdbuf);
@@ -1447,6 +1451,104 @@ static void print_bbccs_of_thread(thread_info* ti)
 }
 
 
+/* Samples (--sample-period) are printed like BBCCs of thread 1 */
+
+static sample_cc** sample_array;
+static Int sample_count;
+
+static void collect_sample_cc(sample_cc* scc)
+{
+  if (scc->cost == 0) return;
+  sample_array[sample_count++] = scc;
+}
+
+/* Group by function, self cost first, then calls by line */
+static Int my_cmp_sample_cc(const void* p1, const void* p2)
+{
+  const sample_cc* c1 = *(sample_cc* const *)p1;
+  const sample_cc* c2 = *(sample_cc* const *)p2;
+
+  if (c1->fn != c2->fn)
+    return (c1->fn->number < c2->fn->number) ? -1 : 1;
+  if ((c1->cfn == 0) != (c2->cfn == 0))
+    return (c1->cfn == 0) ? -1 : 1;
+  if (c1->line != c2->line)
+    return (c1->line < c2->line) ? -1 : 1;
+  if (c1->cfn != c2->cfn)
+    return (c1->cfn->number < c2->cfn->number) ? -1 : 1;
+  return 0;
+}
+
+static void print_samples(void)
+{
+  VgFile* fp;
+  sample_cc *scc, *next;
+  fn_node* fn = 0;
+  ULong cost, calls;
+  Int i;
+
+  fp = new_dumpfile(1, print_trigger);
+  if (fp == NULL) return;
+
+  sample_array = (sample_cc**) CLG_MALLOC("cl.dump.ps.1",
+					  (CLG_(stat).distinct_samples+1) *
+					  sizeof(sample_cc*));
+  sample_count = 0;
+  CLG_(forall_sample_ccs)(collect_sample_cc);
+  VG_(ssort)(sample_array, sample_count, sizeof(sample_cc*),
+	     my_cmp_sample_cc);
+
+  for (i = 0; i < sample_count; i++) {
+    scc = sample_array[i];
+
+    /* different addresses can have the same position */
+    cost  = scc->cost;
+    calls = scc->calls;
+    while (i+1 < sample_count &&
+	   my_cmp_sample_cc(&scc, &sample_array[i+1]) == 0) {
+      next = sample_array[++i];
+      cost  += next->cost;
+      calls += next->calls;
+      next->cost  = 0;
+      next->calls = 0;
+    }
+
+    if (scc->fn != fn) {
+      if (fn) VG_(fprintf)(fp, "\n");
+      fn = scc->fn;
+      print_obj(fp, "ob=", fn->file->obj);
+      print_file(fp, "fl=", fn->file);
+      print_fn(fp, "fn", fn);
+    }
+
+    if (scc->cfn) {
+      if (scc->cfn->file->obj != fn->file->obj)
+	print_obj(fp, "cob=", scc->cfn->file->obj);
+      if (scc->cfn->file != fn->file)
+	print_file(fp, "cfi=", scc->cfn->file);
+      print_fn(fp, "cfn", scc->cfn);
+      VG_(fprintf)(fp, "calls=%llu 0\n", calls);
+    }
+    else
+      dump_total_cost[ fullOffset(EG_IR) ] += cost;
+
+    VG_(fprintf)(fp, "%u %llu\n", scc->line, cost);
+    scc->cost  = 0;
+    scc->calls = 0;
+  }
+  if (fn) VG_(fprintf)(fp, "\n");
+
+  close_dumpfile(fp);
+  VG_(free)(sample_array);
+}
+
+static void set_lastdump_cost(thread_info* ti)
+{
+  CLG_(copy_cost)( CLG_(sets).full, ti->lastdump_cost,
+		  CLG_(current_state).cost );
+}
+
+
 static void print_bbccs(const HChar* trigger, Bool only_current_thread)
 {
   init_dump_array();
@@ -1454,7 +1556,11 @@ static void print_bbccs(const HChar* trigger, Bool only_current_thread)
 
   print_trigger = trigger;
 
-  if (!CLG_(clo).separate_threads) {
+  if (CLG_(clo).sample_period > 0) {
+    print_samples();
+    CLG_(forall_threads)(set_lastdump_cost);
+  }
+  else if (!CLG_(clo).separate_threads) {
     /* All BBCC/JCC costs is stored for thread 1 */
     Int orig_tid = CLG_(current_tid);
 
@@ -1471,12 +1577,125 @@ static void print_bbccs(const HChar* trigger, Bool only_current_thread)
 }
 
 
+/* Asynchronous dumps (--dump-async=yes)
+ *
+ * Writing a dump walks all BBCCs, sorts them and formats every cost,
+ * all while the client is held up. Instead, we fork: the child gets a
+ * copy-on-write snapshot of all cost arrays, writes the dump exactly
+ * as print_bbccs() would, and exits. The parent only resets the
+ * counters, as writing the dump would have done, and lets the client
+ * continue.
+ *
+ * At most one dump is in flight: every dump, including the final one,
+ * first waits for the previous child. This also keeps the order of
+ * dumps appended with --combine-dumps=yes.
+ *
+ * The child is created with VG_(fork_quiet), so the client gets no
+ * SIGCHLD for it and cannot reap it with wait(). Where this is not
+ * available, dumps are written directly.
+ */
+
+static Int dump_child = 0;
+
+static void wait_for_dump_child(void)
+{
+   Int status;
+
+   if (dump_child <= 0) return;
+
+#if defined(VGO_linux)
+   VG_(waitpid)(dump_child, &status, __VKI_WCLONE);
+#endif
+   dump_child = 0;
+}
+
+/* The costs a dump of thread ti writes out are added to the total */
+static void add_dump_total(thread_info* ti)
+{
+   CLG_(add_diff_cost_lz)( CLG_(sets).full, &CLG_(total_cost),
+			   ti->lastdump_cost, ti->states.entry[0]->cost );
+}
+
+/* In the parent, reset the counters as writing the dump of thread ti
+ * would have, see cs_addCount(), fprint_jcc() and fprint_bbcc(). In
+ * contrast to CLG_(zero_all_cost), this also resets the call counters
+ * of all dumped calls, not only those of active calls. */
+static void reset_dumped_bbcc(BBCC* bbcc)
+{
+   Int i;
+   jCC* jcc;
+
+   if ((bbcc->ecounter_sum == 0) && (bbcc->ret_counter == 0)) return;
+
+   for(i = 0; i <= bbcc->bb->cjmp_count; i++)
+      for(jcc = bbcc->jmp[i].jcc_list; jcc; jcc = jcc->next_from)
+	 jcc->call_counter = 0;
+   CLG_(zero_bbcc)(bbcc);
+}
+
+static void reset_dumped_thread(thread_info* ti)
+{
+   Int i;
+
+   /* The child wrote the cost of active calls up to now */
+   for(i = 0; i < CLG_(current_call_stack).sp; i++) {
+      call_entry* e = &(CLG_(current_call_stack).entry[i]);
+      if (e->jcc == 0) continue;
+
+      CLG_(copy_cost_lz)( CLG_(sets).full, &(e->enter_cost),
+			  CLG_(current_state).cost );
+      e->jcc->call_counter = 0;
+   }
+   CLG_(forall_bbccs)(reset_dumped_bbcc);
+   set_lastdump_cost(ti);
+}
+
+/* Returns False if no child could be created */
+static Bool dump_async(const HChar* trigger, Bool only_current_thread)
+{
+   Int pid = VG_(fork_quiet)();
+
+   if (pid < 0) return False;
+
+   if (pid == 0) {
+      /* Child: write the snapshot. Do not call CLG_(init_dumps), which
+       * would choose file names for the new PID; dump_pid still is the
+       * PID of the client. */
+      print_bbccs(trigger, only_current_thread);
+      VG_(exit)(0);
+   }
+
+   dump_child = pid;
+
+   /* Without --separate-threads or with samples, the dump is of all
+    * threads */
+   if (!CLG_(clo).separate_threads || CLG_(clo).sample_period > 0)
+      only_current_thread = False;
+   if (only_current_thread)
+      add_dump_total( CLG_(get_current_thread)() );
+   else
+      CLG_(forall_threads)(add_dump_total);
+
+   if (CLG_(clo).sample_period > 0) {
+      CLG_(zero_samples)();
+      CLG_(forall_threads)(set_lastdump_cost);
+   }
+   else if (only_current_thread)
+      reset_dumped_thread( CLG_(get_current_thread)() );
+   else
+      CLG_(forall_threads)(reset_dumped_thread);
+
+   return True;
+}
+
+
 void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 {
    CLG_DEBUG(2, "+ dump_profile(Trigger '%s')\n",
 	    trigger ? trigger : "Prg.Term.");
 
    CLG_(init_dumps)();
+   wait_for_dump_child();
 
    if (VG_(clo_verbosity) > 1)
        VG_(message)(Vg_DebugMsg, "Start dumping at BB %llu (%s)...\n",
@@ -1485,7 +1704,10 @@ void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 
    out_counter++;
 
-   print_bbccs(trigger, only_current_thread);
+   /* The dump at program termination is always written directly */
+   if (!CLG_(clo).dump_async || !trigger ||
+       !dump_async(trigger, only_current_thread))
+     print_bbccs(trigger, only_current_thread);
 
    bbs_done = CLG_(stat).bb_executions++;
 
@@ -1571,6 +1793,7 @@ void CLG_(init_dumps)()
        return;
    }
    thisPID = currentPID;
+   dump_pid = currentPID;
    
    if (!CLG_(clo).out_format)
      CLG_(clo).out_format = DEFAULT_OUTFORMAT;
@@ -598,6 +598,31 @@ fn_node* CLG_(get_fn_node)(BB* bb)
     return fn;
 }
 
+/* Get the function node and source line of an instruction address,
+ * without a BB. This is used for addresses found on the stack when
+ * sampling (--sample-period).
+ */
+fn_node* CLG_(get_fn_node_of_addr)(Addr addr, UInt* line)
+{
+    const HChar *fnname, *filename, *dirname;
+    DebugInfo* di;
+    HChar buf[32];  // for sure large enough
+
+    CLG_(get_debug_info)(addr, &dirname, &filename, &fnname, line, &di);
+
+    if (0 == VG_(strcmp)(fnname, "???")) {
+	/* Use address as found in library */
+	Addr offset = addr - (di ? VG_(DebugInfo_get_text_bias)(di) : 0);
+	if (sizeof(Addr) == 4)
+	    VG_(sprintf)(buf, "%#08lx", (UWord)offset);
+	else
+	    VG_(sprintf)(buf, "%#016lx", (UWord)offset);
+	fnname = buf;
+    }
+
+    return get_fn_node_inseg( di, dirname, filename, fnname);
+}
+
 
 /*------------------------------------------------------------*/
 /*--- Active function array operations                     ---*/
@@ -90,6 +90,8 @@ struct _CommandLineOptions {
   
   /* Dump generation options */
   ULong dump_every_bb;     /* Dump every xxx BBs. */
+  Bool dump_async;         /* Write dumps from a forked child? */
+  ULong sample_period;     /* Statistical profiling: sample every xxx instrs */
   
   /* Collection options */
   Bool separate_threads; /* Separate threads in dump? */
@@ -170,6 +172,14 @@ struct _Statistics {
   Int  jcc_lru_misses;
   Int  cxt_lru_misses;
   Int  bbcc_clones;
+
+  /* BBCC lookup in setup_bbcc() */
+  ULong bbcc_next_misses;  /* lru_next_bbcc of last BBCC does not match */
+  ULong bbcc_lru2_hits;    /* found as prev_bbcc of the BB */
+  ULong bbcc_hash_probes;  /* chain entries skipped in the BBCC hash */
+
+  ULong samples;
+  Int   distinct_samples;
 };
 
 
@@ -295,6 +305,7 @@ struct _BB {
         
   BBCC*      bbcc_list;  /* BBCCs for same BB (see next_bbcc in BBCC) */
   BBCC*      last_bbcc;  /* Temporary: Cached for faster access (LRU) */
+  BBCC*      prev_bbcc;  /* BBCC used before last_bbcc */
 
   /* filled by CLG_(instrument) if not seen before */
   UInt       cjmp_count;  /* number of side exits */
@@ -716,6 +727,20 @@ obj_node* CLG_(get_obj_node)(DebugInfo* si);
 file_node* CLG_(get_file_node)(obj_node*, const HChar *dirname,
                                const HChar* filename);
 fn_node*  CLG_(get_fn_node)(BB* bb);
+fn_node*  CLG_(get_fn_node_of_addr)(Addr addr, UInt* line);
+
+/* Sampled cost (--sample-period) of a source line, which is the self
+ * cost if cfn is 0, or the inclusive cost of calls from there to cfn.
+ */
+typedef struct _sample_cc sample_cc;
+struct _sample_cc {
+  fn_node* fn;
+  UInt     line;
+  fn_node* cfn;
+  ULong    calls;       /* number of samples this call was seen in */
+  ULong    cost;        /* instructions executed */
+  ULong    last_sample; /* to count a call only once per sample */
+};
 
 /* from bbcc.c */
 void CLG_(init_bbcc_hash)(bbcc_hash* bbccs);
@@ -773,6 +798,12 @@ void CLG_(run_post_signal_on_call_stack_bottom)(void);
 /* from dump.c */
 void CLG_(init_dumps)(void);
 
+/* from sample.c */
+void CLG_(init_samples)(void);
+void CLG_(take_sample)(void) VG_REGPARM(0);
+void CLG_(forall_sample_ccs)(void (*func)(sample_cc*));
+void CLG_(zero_samples)(void);
+
 /*------------------------------------------------------------*/
 /*--- Exported global variables                            ---*/
 /*------------------------------------------------------------*/
@@ -790,6 +821,7 @@ extern call_stack CLG_(current_call_stack);
 extern fn_stack   CLG_(current_fn_stack);
 extern exec_state CLG_(current_state);
 extern ThreadId   CLG_(current_tid);
+extern Word       CLG_(sample_left);
 extern FullCost   CLG_(total_cost);
 extern struct cachesim_if CLG_(cachesim);
 extern struct event_sets  CLG_(sets);
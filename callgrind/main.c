@@ -99,6 +99,13 @@ static void CLG_(init_statistics)(Statistics* s)
   s->jcc_lru_misses      = 0;
   s->cxt_lru_misses      = 0;
   s->bbcc_clones         = 0;
+
+  s->bbcc_next_misses    = 0;
+  s->bbcc_lru2_hits      = 0;
+  s->bbcc_hash_probes    = 0;
+
+  s->samples             = 0;
+  s->distinct_samples    = 0;
 }
 
 
@@ -948,6 +955,43 @@ void addBBSetupCall(ClgState* clgs)
    addStmtToIRSB( clgs->sbOut, IRStmt_Dirty(di) );
 }
 
+/*
+ * With --sample-period, this is the only instrumentation: count down
+ * the instructions of the SB, and take a sample when the period is
+ * over. This is added before any statement of the SB, where the
+ * guest state is up to date for the stack walk.
+ */
+static
+void addSampleCall(IRSB* sbOut, UInt n_instrs, IRType hWordTy)
+{
+   Bool     is64  = (hWordTy == Ity_I64);
+   IRTemp   left0 = newIRTemp(sbOut->tyenv, hWordTy);
+   IRTemp   left1 = newIRTemp(sbOut->tyenv, hWordTy);
+   IRTemp   due   = newIRTemp(sbOut->tyenv, Ity_I1);
+   IRExpr*  addr  = mkIRExpr_HWord( (HWord)&CLG_(sample_left) );
+   IRDirty* di;
+
+   addStmtToIRSB( sbOut,
+		  IRStmt_WrTmp(left0, IRExpr_Load(CLGEndness, hWordTy, addr)) );
+   addStmtToIRSB( sbOut,
+		  IRStmt_WrTmp(left1, IRExpr_Binop(is64 ? Iop_Sub64 : Iop_Sub32,
+						   IRExpr_RdTmp(left0),
+						   mkIRExpr_HWord(n_instrs))) );
+   addStmtToIRSB( sbOut,
+		  IRStmt_Store(CLGEndness, addr, IRExpr_RdTmp(left1)) );
+   addStmtToIRSB( sbOut,
+		  IRStmt_WrTmp(due, IRExpr_Binop(is64 ? Iop_CmpLE64S
+						      : Iop_CmpLE32S,
+						 IRExpr_RdTmp(left1),
+						 mkIRExpr_HWord(0))) );
+
+   di = unsafeIRDirty_0_N( 0, "take_sample",
+			   VG_(fnptr_to_fnentry)( & CLG_(take_sample) ),
+			   mkIRExprVec_0() );
+   di->guard = IRExpr_RdTmp(due);
+   addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
+}
+
 
 static
 IRSB* CLG_(instrument)( VgCallbackClosure* closure,
@@ -995,6 +1039,20 @@ IRSB* CLG_(instrument)( VgCallbackClosure* closure,
    st = sbIn->stmts[i];
    CLG_ASSERT(Ist_IMark == st->tag);
 
+   if (CLG_(clo).sample_period > 0) {
+      UInt n_instrs = 0;
+      Int  j;
+
+      for (j = i; j < sbIn->stmts_used; j++)
+	 if (sbIn->stmts[j]->tag == Ist_IMark) n_instrs++;
+
+      addSampleCall(clgs.sbOut, n_instrs, hWordTy);
+      for (/*use current i*/; i < sbIn->stmts_used; i++)
+	 addStmtToIRSB( clgs.sbOut, sbIn->stmts[i] );
+
+      return clgs.sbOut;
+   }
+
    origAddr = st->Ist.IMark.addr + st->Ist.IMark.delta;
    CLG_ASSERT(origAddr == st->Ist.IMark.addr 
                           + st->Ist.IMark.delta);  // XXX: check no overflow
@@ -1423,6 +1481,10 @@ void CLG_(zero_all_cost)(Bool only_current_thread)
   else
     CLG_(forall_threads)(zero_thread_cost);
 
+  /* samples are not separated by thread */
+  if (CLG_(clo).sample_period > 0)
+    CLG_(zero_samples)();
+
   if (VG_(clo_verbosity) > 1)
     VG_(message)(Vg_DebugMsg, "  ...done\n");
 }
@@ -1858,10 +1920,28 @@ void clg_print_stats(void)
 		CLG_(stat).cxt_lru_misses);
    VG_(message)(Vg_DebugMsg, "LRU BBCC Misses:   %d\n",
 		CLG_(stat).bbcc_lru_misses);
+   if (CLG_(stat).bb_executions > 0) {
+      ULong bb_exe = CLG_(stat).bb_executions;
+      ULong bb_hits = CLG_(stat).bbcc_next_misses
+		      - CLG_(stat).bbcc_lru_misses;
+
+      VG_(message)(Vg_DebugMsg, "BBCC lookups via next BBCC:%3llu%%\n",
+		   (bb_exe - CLG_(stat).bbcc_next_misses) * 100 / bb_exe);
+      VG_(message)(Vg_DebugMsg, "BBCC lookups via BB cache: %3llu%% "
+		   "(2nd entry %llu)\n",
+		   bb_hits * 100 / bb_exe, CLG_(stat).bbcc_lru2_hits);
+      VG_(message)(Vg_DebugMsg, "BBCC lookups via hash:     %3llu%% "
+		   "(probes %llu)\n",
+		   (ULong)CLG_(stat).bbcc_lru_misses * 100 / bb_exe,
+		   CLG_(stat).bbcc_hash_probes);
+   }
    VG_(message)(Vg_DebugMsg, "LRU JCC Misses:    %d\n",
 		CLG_(stat).jcc_lru_misses);
    VG_(message)(Vg_DebugMsg, "BBs Executed:      %llu\n",
 		CLG_(stat).bb_executions);
+   if (CLG_(clo).sample_period > 0)
+      VG_(message)(Vg_DebugMsg, "Samples:           %llu (distinct %d)\n",
+		   CLG_(stat).samples, CLG_(stat).distinct_samples);
    VG_(message)(Vg_DebugMsg, "Calls:             %llu\n",
 		CLG_(stat).call_counter);
    VG_(message)(Vg_DebugMsg, "CondJMP followed:  %llu\n",
@@ -2001,6 +2081,32 @@ void CLG_(post_clo_init)(void)
    CLG_DEBUG(1, "  call sep. : %d\n", CLG_(clo).separate_callers);
    CLG_DEBUG(1, "  rec. sep. : %d\n", CLG_(clo).separate_recursions);
 
+   if (CLG_(clo).sample_period > 0) {
+      /* Samples only give Ir cost, attributed to source lines, and
+       * are not separated by thread */
+      if (CLG_(clo).simulate_cache || CLG_(clo).simulate_branch ||
+	  CLG_(clo).collect_bus || CLG_(clo).collect_jumps ||
+	  CLG_(clo).separate_threads) {
+	 VG_(message)(Vg_UserMsg,
+		      "--sample-period: ignoring simulation, --collect-jumps,"
+		      " --collect-bus and --separate-threads\n");
+	 CLG_(clo).simulate_cache   = False;
+	 CLG_(clo).simulate_branch  = False;
+	 CLG_(clo).collect_bus      = False;
+	 CLG_(clo).collect_jumps    = False;
+	 CLG_(clo).separate_threads = False;
+      }
+      /* Basic blocks are not counted when sampling */
+      if (CLG_(clo).dump_every_bb > 0) {
+	 VG_(message)(Vg_UserMsg,
+		      "--sample-period: ignoring --dump-every-bb\n");
+	 CLG_(clo).dump_every_bb = 0;
+      }
+      CLG_(clo).dump_line  = True;
+      CLG_(clo).dump_instr = False;
+      CLG_(clo).dump_bb    = False;
+   }
+
    if (!CLG_(clo).dump_line && !CLG_(clo).dump_instr && !CLG_(clo).dump_bb) {
        VG_(message)(Vg_UserMsg, "Using source line as position.\n");
        CLG_(clo).dump_line = True;
@@ -2022,6 +2128,9 @@ void CLG_(post_clo_init)(void)
    CLG_(init_threads)();
    CLG_(run_thread)(1);
 
+   if (CLG_(clo).sample_period > 0)
+      CLG_(init_samples)();
+
    CLG_(instrument_state) = CLG_(clo).instrument_atstart;
 
    if (VG_(clo_verbosity) > 0) {
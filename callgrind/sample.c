@@ -0,0 +1,219 @@
+/*--------------------------------------------------------------------*/
+/*--- Callgrind                                                    ---*/
+/*---                                                     sample.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Callgrind, a Valgrind tool for call tracing.
+
+   Copyright (C) 2002-2015, Josef Weidendorfer (Josef.Weidendorfer@gmx.de)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+#include "pub_tool_threadstate.h"
+#include "pub_tool_stacktrace.h"
+#include "pub_tool_wordfm.h"
+
+/*------------------------------------------------------------*/
+/*--- Statistical profiling (--sample-period)              ---*/
+/*------------------------------------------------------------*/
+
+/* With --sample-period=<n>, no BB is set up and no event is counted.
+ * Instead, the instrumented code of each superblock only subtracts its
+ * instruction count from CLG_(sample_left), and calls
+ * CLG_(take_sample) when that is used up, on average every <n> guest
+ * instructions. The period is randomized a bit to avoid aliasing with
+ * loops in the program.
+ *
+ * A sample is a stack trace of the running thread. The instructions
+ * executed since the previous sample are attributed as Ir cost
+ * - as self cost to the source line of the innermost frame, and
+ * - as inclusive cost to every call found on the stack, i.e. to the
+ *   pair (calling function and line, called function).
+ * The call count of a call is the number of samples it was seen in.
+ *
+ * As the sampling helper is called before any statement of a
+ * superblock, the guest state is up to date, and the stack trace
+ * is exact.
+ */
+
+#define N_SAMPLE_IPS  256
+
+Word CLG_(sample_left) = 0;
+
+static UInt   sample_seed = 1;
+static ULong  sample_number = 0;
+/* Length of the current sampling interval, as set in CLG_(sample_left) */
+static Word   sample_len = 0;
+
+/* All sample_cc's, for iteration */
+static XArray* sample_ccs = 0;
+/* Address => self cost sample_cc of the position */
+static WordFM* sample_pos = 0;
+/* Call arcs, keyed by (fn, line, cfn) */
+static WordFM* sample_calls = 0;
+
+static Word cmp_sample_calls(UWord k1, UWord k2)
+{
+   sample_cc* c1 = (sample_cc*) k1;
+   sample_cc* c2 = (sample_cc*) k2;
+
+   if (c1->fn != c2->fn)     return (c1->fn < c2->fn) ? -1 : 1;
+   if (c1->line != c2->line) return (c1->line < c2->line) ? -1 : 1;
+   if (c1->cfn != c2->cfn)   return (c1->cfn < c2->cfn) ? -1 : 1;
+   return 0;
+}
+
+static sample_cc* new_sample_cc(fn_node* fn, UInt line, fn_node* cfn)
+{
+   sample_cc* scc = (sample_cc*) CLG_MALLOC("cl.sample.nsc.1",
+                                            sizeof(sample_cc));
+   scc->fn    = fn;
+   scc->line  = line;
+   scc->cfn   = cfn;
+   scc->calls = 0;
+   scc->cost  = 0;
+   scc->last_sample = 0;
+
+   VG_(addToXA)(sample_ccs, &scc);
+   CLG_(stat).distinct_samples++;
+
+   return scc;
+}
+
+void CLG_(init_samples)(void)
+{
+   sample_ccs   = VG_(newXA)(VG_(malloc), "cl.sample.is.1",
+                             VG_(free), sizeof(sample_cc*));
+   sample_pos   = VG_(newFM)(VG_(malloc), "cl.sample.is.2",
+                             VG_(free), NULL);
+   sample_calls = VG_(newFM)(VG_(malloc), "cl.sample.is.3",
+                             VG_(free), cmp_sample_calls);
+   sample_len = CLG_(clo).sample_period;
+   CLG_(sample_left) = sample_len;
+}
+
+/* Self cost entry of a code address; debug info is only looked up
+ * the first time an address is sampled */
+static sample_cc* get_sample_pos(Addr addr)
+{
+   UWord val;
+   sample_cc* scc;
+   fn_node* fn;
+   UInt line;
+
+   if (VG_(lookupFM)(sample_pos, NULL, &val, addr))
+      return (sample_cc*) val;
+
+   fn = CLG_(get_fn_node_of_addr)(addr, &line);
+   scc = new_sample_cc(fn, line, 0);
+   VG_(addToFM)(sample_pos, addr, (UWord)scc);
+
+   return scc;
+}
+
+static sample_cc* get_sample_call(sample_cc* from, fn_node* cfn)
+{
+   sample_cc key, *scc;
+   UWord keyW;
+
+   key.fn   = from->fn;
+   key.line = from->line;
+   key.cfn  = cfn;
+   if (VG_(lookupFM)(sample_calls, &keyW, NULL, (UWord)&key))
+      return (sample_cc*) keyW;
+
+   scc = new_sample_cc(from->fn, from->line, cfn);
+   VG_(addToFM)(sample_calls, (UWord)scc, 0);
+
+   return scc;
+}
+
+VG_REGPARM(0)
+void CLG_(take_sample)(void)
+{
+   Addr  ips[N_SAMPLE_IPS];
+   UInt  n_ips, i;
+   ULong cost;
+   ThreadId tid;
+   sample_cc *callee, *caller, *call;
+
+   /* CLG_(sample_left) is 0 or negative here */
+   cost = (ULong)(sample_len - CLG_(sample_left));
+   sample_len = CLG_(clo).sample_period / 2 +
+                VG_(random)(&sample_seed) % CLG_(clo).sample_period;
+   if (sample_len == 0) sample_len = 1;
+   CLG_(sample_left) = sample_len;
+
+   tid = VG_(get_running_tid)();
+   if (UNLIKELY(tid != CLG_(current_tid)))
+      CLG_(switch_thread)(tid);
+
+   if (!CLG_(current_state).collect) return;
+
+   sample_number++;
+   CLG_(stat).samples++;
+
+   n_ips = VG_(get_StackTrace)(tid, ips, N_SAMPLE_IPS, NULL, NULL, 0);
+   if (n_ips == 0) return;
+
+   callee = get_sample_pos(ips[0]);
+   callee->cost += cost;
+   CLG_(current_state).cost[ fullOffset(EG_IR) ] += cost;
+
+   for (i = 1; i < n_ips; i++) {
+      /* ips[i] is a return address; use the call instruction before
+       * it, which may be on another source line */
+      caller = get_sample_pos(ips[i] - 1);
+      call = get_sample_call(caller, callee->fn);
+
+      /* with recursion, a call can be found multiple times on the
+       * stack, but its inclusive cost is only taken once */
+      if (call->last_sample != sample_number) {
+	 call->last_sample = sample_number;
+	 call->calls++;
+	 call->cost += cost;
+      }
+      callee = caller;
+   }
+}
+
+void CLG_(forall_sample_ccs)(void (*func)(sample_cc*))
+{
+   Word i, n;
+
+   if (!sample_ccs) return;
+
+   n = VG_(sizeXA)(sample_ccs);
+   for (i = 0; i < n; i++)
+      (*func)( *(sample_cc**) VG_(indexXA)(sample_ccs, i) );
+}
+
+static void zero_sample_cc(sample_cc* scc)
+{
+   scc->calls = 0;
+   scc->cost  = 0;
+}
+
+void CLG_(zero_samples)(void)
+{
+   CLG_(forall_sample_ccs)(zero_sample_cc);
+}
@@ -152,7 +152,10 @@
    order, giving account of every byte of it.  Free spaces are
    represented explicitly as this makes many operations simpler.
    Mergeable adjacent segments are aggressively merged so as to create
-   a "normalised" representation (preen_nsegments).
+   a "normalised" representation (preen_nsegments).  The array is
+   stored in chunks, so that it can grow and so that processes with
+   hundreds of thousands of mappings don't make every change to it
+   expensive; NSEG(i) gives the i'th segment.
 
    There are 7 (mutually-exclusive) segment kinds, the meaning of
    which is important:
@@ -277,18 +280,28 @@
 
 /* ------ start of STATE for the address-space manager ------ */
 
-/* Max number of segments we can track.  On Android, virtual address
-   space is limited, so keep a low limit -- 5000 x sizef(NSegment) is
-   360KB. */
+/* Number of segments the statically allocated part of the segment
+   table can hold, before it has to be grown with memory mapped from
+   the kernel.  On Android, virtual address space is limited, so keep
+   a low limit -- 5000 x sizef(NSegment) is 360KB.  This also sizes
+   the buffers used to read the Solaris /proc mappings. */
 #if defined(VGPV_arm_linux_android) \
     || defined(VGPV_x86_linux_android) \
     || defined(VGPV_mips32_linux_android) \
     || defined(VGPV_arm64_linux_android)
 # define VG_N_SEGMENTS 5000
+# define VG_N_SEGS_PER_CHUNK 64
+# define VG_N_SEGCHUNKS 1024
 #else
 # define VG_N_SEGMENTS 30000
+# define VG_N_SEGS_PER_CHUNK 256
+# define VG_N_SEGCHUNKS 16384
 #endif
 
+/* Number of chunks in the static pool. */
+#define VG_N_SEGCHUNKS_INITIAL \
+   ((VG_N_SEGMENTS + VG_N_SEGS_PER_CHUNK - 1) / VG_N_SEGS_PER_CHUNK)
+
 /* Array [0 .. nsegments_used-1] of all mappings. */
 /* Sorted by .addr field. */
 /* I: len may not be zero. */
@@ -296,8 +309,33 @@
 /* I: the segments cover the entire address space precisely. */
 /* Each segment can optionally hold an index into the filename table. */
 
-static NSegment nsegments[VG_N_SEGMENTS];
-static Int      nsegments_used = 0;
+/* The array is not stored contiguously.  It is cut into a sequence
+   of chunks, segchunk[0 .. nsegchunks_used-1], each holding
+   segchunk_n[] (1 .. VG_N_SEGS_PER_CHUNK) consecutive segments.
+   Inserting or removing a segment thus only moves segments within
+   one chunk, and splits a full chunk in two, or joins two sparse
+   neighbours, when needed.  A Fenwick tree over segchunk_n[]
+   (segchunk_bit[1 .. nsegchunks_used]) maps a segment index to its
+   chunk, and back, in O(log n).  All that is hidden behind NSEG(i),
+   so the rest of this file can carry on treating the table as the
+   array it used to be.
+
+   Chunks come from segchunk_pool at startup.  Later on, when free
+   chunks run low, a batch of new ones is mapped with
+   VG_(am_mmap_anon_float_valgrind) (see maybe_refill_segchunks). */
+
+static NSegment  segchunk_pool[VG_N_SEGCHUNKS_INITIAL][VG_N_SEGS_PER_CHUNK];
+static NSegment* segchunk[VG_N_SEGCHUNKS];
+static Int       segchunk_n[VG_N_SEGCHUNKS];
+static Int       segchunk_bit[VG_N_SEGCHUNKS+1];
+static Int       nsegchunks_used = 0;
+
+/* Stack of unused chunks, and the number of chunks ever made. */
+static NSegment* segchunk_free[VG_N_SEGCHUNKS];
+static Int       nsegchunks_free = 0;
+static Int       nsegchunks_total = 0;
+
+static Int       nsegments_used = 0;
 
 #define Addr_MIN ((Addr)0)
 #define Addr_MAX ((Addr)(-1ULL))
@@ -371,6 +409,267 @@ static void parse_procselfmaps (
 
 
 
+/*-----------------------------------------------------------------*/
+/*---                                                           ---*/
+/*--- Storage of the segment array.                             ---*/
+/*---                                                           ---*/
+/*-----------------------------------------------------------------*/
+
+/* Fenwick tree helpers.  segchunk_bit[x] holds the sum of
+   segchunk_n[] over the (x & -x) chunks ending with chunk x-1. */
+
+static void segchunk_bit_rebuild ( void )
+{
+   Int x, p;
+   for (x = 1; x <= nsegchunks_used; x++)
+      segchunk_bit[x] = segchunk_n[x-1];
+   for (x = 1; x <= nsegchunks_used; x++) {
+      p = x + (x & -x);
+      if (p <= nsegchunks_used)
+         segchunk_bit[p] += segchunk_bit[x];
+   }
+}
+
+static void segchunk_bit_add ( Int c, Int delta )
+{
+   Int x;
+   for (x = c+1; x <= nsegchunks_used; x += x & -x)
+      segchunk_bit[x] += delta;
+}
+
+/* Index of the first segment in chunk c. */
+static Int segchunk_first ( Int c )
+{
+   Int x, sum = 0;
+   for (x = c; x > 0; x -= x & -x)
+      sum += segchunk_bit[x];
+   return sum;
+}
+
+/* Find the chunk holding segment i, and i's offset in it. */
+static Int find_segchunk ( Int i, /*OUT*/Int* offset )
+{
+   Int step, x, pos = 0;
+   for (step = VG_N_SEGCHUNKS; step > 0; step >>= 1) {
+      x = pos + step;
+      if (x <= nsegchunks_used && segchunk_bit[x] <= i) {
+         pos = x;
+         i  -= segchunk_bit[x];
+      }
+   }
+   aspacem_assert(pos < nsegchunks_used && i < segchunk_n[pos]);
+   *offset = i;
+   return pos;
+}
+
+/* The chunk last looked up by nseg_ptr, and the index of its first
+   segment.  Walks over the array hit this nearly all the time.  Must
+   be invalidated by anything which changes segchunk_n[]. */
+static Int segchunk_cache_c     = -1;
+static Int segchunk_cache_first = 0;
+
+__attribute__((noinline))
+static NSegment* nseg_ptr_WRK ( Int i )
+{
+   Int c, offset;
+   aspacem_assert(i >= 0 && i < nsegments_used);
+   c = find_segchunk(i, &offset);
+   segchunk_cache_c     = c;
+   segchunk_cache_first = i - offset;
+   return &segchunk[c][offset];
+}
+
+inline static NSegment* nseg_ptr ( Int i )
+{
+   Int c = segchunk_cache_c;
+   if (LIKELY(c >= 0
+              && i >= segchunk_cache_first
+              && i < segchunk_cache_first + segchunk_n[c]))
+      return &segchunk[c][i - segchunk_cache_first];
+   return nseg_ptr_WRK(i);
+}
+
+/* Segment i of the array, as an lvalue. */
+#define NSEG(i) (*nseg_ptr(i))
+
+static void init_segchunks ( const NSegment* seg )
+{
+   Int c;
+   nsegchunks_free = 0;
+   for (c = VG_N_SEGCHUNKS_INITIAL-1; c >= 0; c--)
+      segchunk_free[nsegchunks_free++] = segchunk_pool[c];
+   nsegchunks_total = VG_N_SEGCHUNKS_INITIAL;
+
+   segchunk[0]      = segchunk_free[--nsegchunks_free];
+   segchunk[0][0]   = *seg;
+   segchunk_n[0]    = 1;
+   nsegchunks_used  = 1;
+   nsegments_used   = 1;
+   segchunk_bit_rebuild();
+   segchunk_cache_c = -1;
+}
+
+/* Give chunk c an empty successor, holding the upper half of c's
+   segments. */
+static void split_segchunk ( Int c )
+{
+   Int j, half;
+   NSegment *lo, *hi;
+
+   if (nsegchunks_free == 0 || nsegchunks_used >= VG_N_SEGCHUNKS)
+      ML_(am_barf_toolow)("VG_N_SEGCHUNKS");
+
+   for (j = nsegchunks_used; j > c+1; j--) {
+      segchunk[j]   = segchunk[j-1];
+      segchunk_n[j] = segchunk_n[j-1];
+   }
+   nsegchunks_used++;
+
+   lo   = segchunk[c];
+   hi   = segchunk_free[--nsegchunks_free];
+   half = segchunk_n[c] / 2;
+   for (j = half; j < segchunk_n[c]; j++)
+      hi[j - half] = lo[j];
+   segchunk[c+1]   = hi;
+   segchunk_n[c+1] = segchunk_n[c] - half;
+   segchunk_n[c]   = half;
+
+   segchunk_bit_rebuild();
+   segchunk_cache_c = -1;
+}
+
+/* Remove chunk c, which must be empty, from the directory. */
+static void remove_segchunk ( Int c )
+{
+   Int j;
+   aspacem_assert(segchunk_n[c] == 0);
+   aspacem_assert(nsegchunks_used > 1);
+
+   segchunk_free[nsegchunks_free++] = segchunk[c];
+   for (j = c; j < nsegchunks_used-1; j++) {
+      segchunk[j]   = segchunk[j+1];
+      segchunk_n[j] = segchunk_n[j+1];
+   }
+   nsegchunks_used--;
+
+   segchunk_bit_rebuild();
+   segchunk_cache_c = -1;
+}
+
+/* Join chunk c with its neighbours if they have become so sparse that
+   they fit in one chunk with room to spare.  This keeps the number of
+   chunks, and so the cost of restructuring the directory, bounded by
+   the number of segments. */
+static void maybe_join_segchunks ( Int c )
+{
+   Int j, lim = VG_N_SEGS_PER_CHUNK * 3 / 4;
+
+   if (c > 0 && segchunk_n[c-1] + segchunk_n[c] <= lim)
+      c--;
+   else if (!(c+1 < nsegchunks_used && segchunk_n[c] + segchunk_n[c+1] <= lim))
+      return;
+
+   for (j = 0; j < segchunk_n[c+1]; j++)
+      segchunk[c][segchunk_n[c] + j] = segchunk[c+1][j];
+   segchunk_n[c]  += segchunk_n[c+1];
+   segchunk_n[c+1] = 0;
+   remove_segchunk(c+1);
+}
+
+/* Insert *seg into the array so that it becomes segment i, moving
+   segments i .. nsegments_used-1 up by one. */
+static void insert_nsegment_at ( Int i, const NSegment* seg )
+{
+   Int c, offset, j;
+
+   aspacem_assert(i > 0 && i <= nsegments_used);
+
+   /* Put it just after segment i-1, which may then be at the end of
+      a chunk. */
+   c = find_segchunk(i-1, &offset);
+   offset++;
+   if (segchunk_n[c] == VG_N_SEGS_PER_CHUNK) {
+      split_segchunk(c);
+      if (offset > segchunk_n[c]) {
+         offset -= segchunk_n[c];
+         c++;
+      }
+   }
+
+   for (j = segchunk_n[c]; j > offset; j--)
+      segchunk[c][j] = segchunk[c][j-1];
+   segchunk[c][offset] = *seg;
+   segchunk_n[c]++;
+   nsegments_used++;
+   segchunk_bit_add(c, 1);
+   segchunk_cache_c = -1;
+}
+
+/* Delete segments i .. i+n-1, moving the ones above down by n. */
+static void delete_nsegments ( Int i, Int n )
+{
+   Int c, offset, m, j;
+
+   aspacem_assert(i >= 0 && n >= 0 && i + n <= nsegments_used);
+   aspacem_assert(n < nsegments_used);
+
+   while (n > 0) {
+      c = find_segchunk(i, &offset);
+      m = segchunk_n[c] - offset;
+      if (m > n)
+         m = n;
+      for (j = offset; j + m < segchunk_n[c]; j++)
+         segchunk[c][j] = segchunk[c][j+m];
+      segchunk_n[c]  -= m;
+      nsegments_used -= m;
+      n              -= m;
+      if (segchunk_n[c] == 0)
+         remove_segchunk(c);
+      else
+         segchunk_bit_add(c, -m);
+   }
+   segchunk_cache_c = -1;
+
+   c = find_segchunk(i < nsegments_used ? i : nsegments_used-1, &offset);
+   maybe_join_segchunks(c);
+}
+
+/* Find the index of the segment containing 'a', by binary search
+   over the chunks and then within the chunk. */
+static Int find_nsegment_idx_in_segchunks ( Addr a )
+{
+   Int lo, hi, mid, c;
+   NSegment* chunk;
+
+   /* Last chunk whose first segment starts at or below a. */
+   lo = 0;
+   hi = nsegchunks_used-1;
+   while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if (segchunk[mid][0].start <= a)
+         lo = mid;
+      else
+         hi = mid-1;
+   }
+   c     = lo;
+   chunk = segchunk[c];
+
+   lo = 0;
+   hi = segchunk_n[c]-1;
+   while (True) {
+      /* current unsearched space is from lo to hi, inclusive. */
+      if (lo > hi) {
+         /* Not found.  This can't happen. */
+         ML_(am_barf)("find_nsegment_idx: not found");
+      }
+      mid = (lo + hi) / 2;
+      if (a < chunk[mid].start) { hi = mid-1; continue; }
+      if (a > chunk[mid].end)   { lo = mid+1; continue; }
+      return segchunk_first(c) + mid;
+   }
+}
+
+
 /*-----------------------------------------------------------------*/
 /*---                                                           ---*/
 /*--- Displaying the segment array.                             ---*/
@@ -534,7 +833,7 @@ void VG_(am_show_nsegments) ( Int logLevel, const HChar* who )
                  who, nsegments_used);
    ML_(am_show_segnames)( logLevel, who);
    for (i = 0; i < nsegments_used; i++)
-     show_nsegment( logLevel, i, &nsegments[i] );
+     show_nsegment( logLevel, i, &NSEG(i) );
    VG_(debugLog)(logLevel, "aspacem",
                  ">>>\n");
 }
@@ -572,7 +871,7 @@ Int VG_(am_get_segment_starts)( UInt kind_mask, Addr* starts, Int nStarts )
 
    nSegs = 0;
    for (i = 0; i < nsegments_used; i++) {
-      if ((nsegments[i].kind & kind_mask) != 0)
+      if ((NSEG(i).kind & kind_mask) != 0)
          nSegs++;
    }
 
@@ -587,8 +886,8 @@ Int VG_(am_get_segment_starts)( UInt kind_mask, Addr* starts, Int nStarts )
 
    j = 0;
    for (i = 0; i < nsegments_used; i++) {
-      if ((nsegments[i].kind & kind_mask) != 0)
-         starts[j++] = nsegments[i].start;
+      if ((NSEG(i).kind & kind_mask) != 0)
+         starts[j++] = NSEG(i).start;
    }
 
    aspacem_assert(j == nSegs); /* this should not fail */
@@ -710,42 +1009,68 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
 }
 
 
-/* Sanity-check and canonicalise the segment array (merge mergable
-   segments).  Returns True if any segments were merged. */
+/* Sanity-check the segment array: it must cover the entire address
+   space exactly once, and each segment must be sane. */
 
-static Bool preen_nsegments ( void )
+static void check_nsegments ( void )
 {
-   Int i, r, w, nsegments_used_old = nsegments_used;
+   Int i;
 
-   /* Pass 1: check the segment array covers the entire address space
-      exactly once, and also that each segment is sane. */
    aspacem_assert(nsegments_used > 0);
-   aspacem_assert(nsegments[0].start == Addr_MIN);
-   aspacem_assert(nsegments[nsegments_used-1].end == Addr_MAX);
+   aspacem_assert(NSEG(0).start == Addr_MIN);
+   aspacem_assert(NSEG(nsegments_used-1).end == Addr_MAX);
 
-   aspacem_assert(sane_NSegment(&nsegments[0]));
+   aspacem_assert(sane_NSegment(&NSEG(0)));
    for (i = 1; i < nsegments_used; i++) {
-      aspacem_assert(sane_NSegment(&nsegments[i]));
-      aspacem_assert(nsegments[i-1].end+1 == nsegments[i].start);
+      aspacem_assert(sane_NSegment(&NSEG(i)));
+      aspacem_assert(NSEG(i-1).end+1 == NSEG(i).start);
+   }
+}
+
+
+/* Canonicalise the segment array (merge mergable segments) after
+   segments iLo .. iHi have been changed.  The rest of the array is
+   assumed to be canonical already, so only these and their immediate
+   neighbours can be merged; a merge with a neighbour cannot enable a
+   further one, since the neighbour was not mergable with its own
+   neighbour before, and the merged segment has the neighbour's
+   attributes.  Returns True if any segments were merged. */
+
+static Bool preen_nsegments ( Int iLo, Int iHi )
+{
+   Int i, r, w, lo, hi;
+
+   aspacem_assert(0 <= iLo && iLo <= iHi && iHi < nsegments_used);
+   lo = iLo > 0 ? iLo-1 : iLo;
+   hi = iHi < nsegments_used-1 ? iHi+1 : iHi;
+
+   /* Pass 1: check the changed segments are sane and still cover
+      their part of the address space exactly once. */
+   aspacem_assert(NSEG(0).start == Addr_MIN);
+   aspacem_assert(NSEG(nsegments_used-1).end == Addr_MAX);
+   aspacem_assert(sane_NSegment(&NSEG(lo)));
+   for (i = lo+1; i <= hi; i++) {
+      aspacem_assert(sane_NSegment(&NSEG(i)));
+      aspacem_assert(NSEG(i-1).end+1 == NSEG(i).start);
    }
 
    /* Pass 2: merge as much as possible, using
       maybe_merge_segments. */
-   w = 0;
-   for (r = 1; r < nsegments_used; r++) {
-      if (maybe_merge_nsegments(&nsegments[w], &nsegments[r])) {
+   w = lo;
+   for (r = lo+1; r <= hi; r++) {
+      if (maybe_merge_nsegments(&NSEG(w), &NSEG(r))) {
          /* nothing */
       } else {
          w++;
          if (w != r) 
-            nsegments[w] = nsegments[r];
+            NSEG(w) = NSEG(r);
       }
    }
-   w++;
-   aspacem_assert(w > 0 && w <= nsegments_used);
-   nsegments_used = w;
+   if (w == hi)
+      return False;
 
-   return nsegments_used != nsegments_used_old;
+   delete_nsegments(w+1, hi-w);
+   return True;
 }
 
 
@@ -805,8 +1130,8 @@ static void sync_check_mapping_callback ( Addr addr, SizeT len, UInt prot,
    aspacem_assert(0 <= iLo && iLo < nsegments_used);
    aspacem_assert(0 <= iHi && iHi < nsegments_used);
    aspacem_assert(iLo <= iHi);
-   aspacem_assert(nsegments[iLo].start <= addr );
-   aspacem_assert(nsegments[iHi].end   >= addr + len - 1 );
+   aspacem_assert(NSEG(iLo).start <= addr );
+   aspacem_assert(NSEG(iHi).end   >= addr + len - 1 );
 
    /* x86 doesn't differentiate 'x' and 'r' (at least, all except the
       most recent NX-bit enabled CPUs) and so recent kernels attempt
@@ -843,22 +1168,22 @@ static void sync_check_mapping_callback ( Addr addr, SizeT len, UInt prot,
       UInt seg_prot;
    
       /* compare the kernel's offering against ours. */
-      same = nsegments[i].kind == SkAnonC
-             || nsegments[i].kind == SkAnonV
-             || nsegments[i].kind == SkFileC
-             || nsegments[i].kind == SkFileV
-             || nsegments[i].kind == SkShmC;
+      same = NSEG(i).kind == SkAnonC
+             || NSEG(i).kind == SkAnonV
+             || NSEG(i).kind == SkFileC
+             || NSEG(i).kind == SkFileV
+             || NSEG(i).kind == SkShmC;
 
       seg_prot = 0;
-      if (nsegments[i].hasR) seg_prot |= VKI_PROT_READ;
-      if (nsegments[i].hasW) seg_prot |= VKI_PROT_WRITE;
-      if (nsegments[i].hasX) seg_prot |= VKI_PROT_EXEC;
+      if (NSEG(i).hasR) seg_prot |= VKI_PROT_READ;
+      if (NSEG(i).hasW) seg_prot |= VKI_PROT_WRITE;
+      if (NSEG(i).hasX) seg_prot |= VKI_PROT_EXEC;
 
       cmp_offsets
-         = nsegments[i].kind == SkFileC || nsegments[i].kind == SkFileV;
+         = NSEG(i).kind == SkFileC || NSEG(i).kind == SkFileV;
 
       cmp_devino
-         = nsegments[i].dev != 0 || nsegments[i].ino != 0;
+         = NSEG(i).dev != 0 || NSEG(i).ino != 0;
 
       /* Consider other reasons to not compare dev/inode */
 #if defined(VGO_linux)
@@ -897,10 +1222,10 @@ static void sync_check_mapping_callback ( Addr addr, SizeT len, UInt prot,
       same = same
              && seg_prot == prot
              && (cmp_devino
-                   ? (nsegments[i].dev == dev && nsegments[i].ino == ino)
+                   ? (NSEG(i).dev == dev && NSEG(i).ino == ino)
                    : True)
              && (cmp_offsets 
-                   ? nsegments[i].start-nsegments[i].offset == addr-offset
+                   ? NSEG(i).start-NSEG(i).offset == addr-offset
                    : True);
       if (!same) {
          Addr start = addr;
@@ -913,7 +1238,7 @@ static void sync_check_mapping_callback ( Addr addr, SizeT len, UInt prot,
          VG_(debugLog)(
             0,"aspacem",
               "segment mismatch: V's seg 1st, kernel's 2nd:\n");
-         show_nsegment_full( 0, i, &nsegments[i] );
+         show_nsegment_full( 0, i, &NSEG(i) );
          VG_(debugLog)(0,"aspacem", 
             "...: .... %010lx-%010lx %s %c%c%c.. ....... "
             "d=0x%03llx i=%-7llu o=%-7lld (.) m=. %s\n",
@@ -956,8 +1281,8 @@ static void sync_check_gap_callback ( Addr addr, SizeT len )
    aspacem_assert(0 <= iLo && iLo < nsegments_used);
    aspacem_assert(0 <= iHi && iHi < nsegments_used);
    aspacem_assert(iLo <= iHi);
-   aspacem_assert(nsegments[iLo].start <= addr );
-   aspacem_assert(nsegments[iHi].end   >= addr + len - 1 );
+   aspacem_assert(NSEG(iLo).start <= addr );
+   aspacem_assert(NSEG(iHi).end   >= addr + len - 1 );
 
    /* NSegments iLo .. iHi inclusive should agree with the presented
       data. */
@@ -966,8 +1291,8 @@ static void sync_check_gap_callback ( Addr addr, SizeT len )
       Bool same;
    
       /* compare the kernel's offering against ours. */
-      same = nsegments[i].kind == SkFree
-             || nsegments[i].kind == SkResvn;
+      same = NSEG(i).kind == SkFree
+             || NSEG(i).kind == SkResvn;
 
       if (!same) {
          Addr start = addr;
@@ -980,7 +1305,7 @@ static void sync_check_gap_callback ( Addr addr, SizeT len )
          VG_(debugLog)(
             0,"aspacem",
               "segment mismatch: V's gap 1st, kernel's 2nd:\n");
-         show_nsegment_full( 0, i, &nsegments[i] );
+         show_nsegment_full( 0, i, &NSEG(i) );
          VG_(debugLog)(0,"aspacem", 
             "   : .... %010lx-%010lx %s\n",
             start, end, len_buf);
@@ -1004,6 +1329,7 @@ Bool VG_(am_do_sync_check) ( const HChar* fn,
    sync_check_ok = True;
    if (0)
       VG_(debugLog)(0,"aspacem", "do_sync_check %s:%d\n", file,line);
+   check_nsegments();
    parse_procselfmaps( sync_check_mapping_callback,
                        sync_check_gap_callback );
    if (!sync_check_ok) {
@@ -1053,26 +1379,10 @@ void ML_(am_do_sanity_check)( void )
 __attribute__((noinline))
 static Int find_nsegment_idx_WRK ( Addr a )
 {
-   Addr a_mid_lo, a_mid_hi;
-   Int  mid,
-        lo = 0,
-        hi = nsegments_used-1;
-   while (True) {
-      /* current unsearched space is from lo to hi, inclusive. */
-      if (lo > hi) {
-         /* Not found.  This can't happen. */
-         ML_(am_barf)("find_nsegment_idx: not found");
-      }
-      mid      = (lo + hi) / 2;
-      a_mid_lo = nsegments[mid].start;
-      a_mid_hi = nsegments[mid].end;
-
-      if (a < a_mid_lo) { hi = mid-1; continue; }
-      if (a > a_mid_hi) { lo = mid+1; continue; }
-      aspacem_assert(a >= a_mid_lo && a <= a_mid_hi);
-      aspacem_assert(0 <= mid && mid < nsegments_used);
-      return mid;
-   }
+   Int i = find_nsegment_idx_in_segchunks(a);
+   aspacem_assert(0 <= i && i < nsegments_used);
+   aspacem_assert(NSEG(i).start <= a && a <= NSEG(i).end);
+   return i;
 }
 
 inline static Int find_nsegment_idx ( Addr a )
@@ -1107,8 +1417,8 @@ inline static Int find_nsegment_idx ( Addr a )
    if ((a >> 12) == cache_pageno[ix]
        && cache_segidx[ix] >= 0
        && cache_segidx[ix] < nsegments_used
-       && nsegments[cache_segidx[ix]].start <= a
-       && a <= nsegments[cache_segidx[ix]].end) {
+       && NSEG(cache_segidx[ix]).start <= a
+       && a <= NSEG(cache_segidx[ix]).end) {
       /* hit */
       /* aspacem_assert( cache_segidx[ix] == find_nsegment_idx_WRK(a) ); */
       return cache_segidx[ix];
@@ -1129,12 +1439,12 @@ NSegment const * VG_(am_find_nsegment) ( Addr a )
 {
    Int i = find_nsegment_idx(a);
    aspacem_assert(i >= 0 && i < nsegments_used);
-   aspacem_assert(nsegments[i].start <= a);
-   aspacem_assert(a <= nsegments[i].end);
-   if (nsegments[i].kind == SkFree) 
+   aspacem_assert(NSEG(i).start <= a);
+   aspacem_assert(a <= NSEG(i).end);
+   if (NSEG(i).kind == SkFree) 
       return NULL;
    else
-      return &nsegments[i];
+      return &NSEG(i);
 }
 
 /* Finds an anonymous segment containing 'a'. Returned pointer is read only. */
@@ -1142,10 +1452,10 @@ NSegment const *VG_(am_find_anon_segment) ( Addr a )
 {
    Int i = find_nsegment_idx(a);
    aspacem_assert(i >= 0 && i < nsegments_used);
-   aspacem_assert(nsegments[i].start <= a);
-   aspacem_assert(a <= nsegments[i].end);
-   if (nsegments[i].kind == SkAnonC || nsegments[i].kind == SkAnonV)
-      return &nsegments[i];
+   aspacem_assert(NSEG(i).start <= a);
+   aspacem_assert(a <= NSEG(i).end);
+   if (NSEG(i).kind == SkAnonC || NSEG(i).kind == SkAnonV)
+      return &NSEG(i);
    else
       return NULL;
 }
@@ -1153,9 +1463,10 @@ NSegment const *VG_(am_find_anon_segment) ( Addr a )
 /* Map segment pointer to segment index. */
 static Int segAddr_to_index ( const NSegment* seg )
 {
-   aspacem_assert(seg >= &nsegments[0] && seg < &nsegments[nsegments_used]);
+   Int i = find_nsegment_idx(seg->start);
+   aspacem_assert(seg == &NSEG(i));
 
-   return seg - &nsegments[0];
+   return i;
 }
 
 
@@ -1173,10 +1484,10 @@ NSegment const * VG_(am_next_nsegment) ( const NSegment* here, Bool fwds )
       if (i < 0)
          return NULL;
    }
-   if (nsegments[i].kind == SkFree) 
+   if (NSEG(i).kind == SkFree) 
       return NULL;
    else
-      return &nsegments[i];
+      return &NSEG(i);
 }
 
 
@@ -1188,9 +1499,9 @@ ULong VG_(am_get_anonsize_total)( void )
    Int   i;
    ULong total = 0;
    for (i = 0; i < nsegments_used; i++) {
-      if (nsegments[i].kind == SkAnonC || nsegments[i].kind == SkAnonV) {
-         total += (ULong)nsegments[i].end 
-                  - (ULong)nsegments[i].start + 1ULL;
+      if (NSEG(i).kind == SkAnonC || NSEG(i).kind == SkAnonV) {
+         total += (ULong)NSEG(i).end 
+                  - (ULong)NSEG(i).start + 1ULL;
       }
    }
    return total;
@@ -1218,9 +1529,9 @@ Bool is_valid_for( UInt kinds, Addr start, SizeT len, UInt prot )
    needX = toBool(prot & VKI_PROT_EXEC);
 
    iLo = find_nsegment_idx(start);
-   aspacem_assert(start >= nsegments[iLo].start);
+   aspacem_assert(start >= NSEG(iLo).start);
 
-   if (start+len-1 <= nsegments[iLo].end) {
+   if (start+len-1 <= NSEG(iLo).end) {
       /* This is a speedup hack which avoids calling find_nsegment_idx
          a second time when possible.  It is always correct to just
          use the "else" clause below, but is_valid_for_client is
@@ -1232,10 +1543,10 @@ Bool is_valid_for( UInt kinds, Addr start, SizeT len, UInt prot )
    }
 
    for (i = iLo; i <= iHi; i++) {
-      if ( (nsegments[i].kind & kinds) != 0
-           && (needR ? nsegments[i].hasR : True)
-           && (needW ? nsegments[i].hasW : True)
-           && (needX ? nsegments[i].hasX : True) ) {
+      if ( (NSEG(i).kind & kinds) != 0
+           && (needR ? NSEG(i).hasR : True)
+           && (needW ? NSEG(i).hasW : True)
+           && (needX ? NSEG(i).hasX : True) ) {
          /* ok */
       } else {
          return False;
@@ -1298,7 +1609,7 @@ static Bool any_Ts_in_range ( Addr start, SizeT len )
    iLo = find_nsegment_idx(start);
    iHi = find_nsegment_idx(start + len - 1);
    for (i = iLo; i <= iHi; i++) {
-      if (nsegments[i].hasT)
+      if (NSEG(i).hasT)
          return True;
    }
    return False;
@@ -1312,7 +1623,7 @@ static Bool any_Ts_in_range ( Addr start, SizeT len )
        segment can be extended. */
 Bool VG_(am_addr_is_in_extensible_client_stack)( Addr addr )
 {
-   const NSegment *seg = nsegments + find_nsegment_idx(addr);
+   const NSegment *seg = &NSEG(find_nsegment_idx(addr));
 
    switch (seg->kind) {
    case SkFree:
@@ -1361,7 +1672,8 @@ Bool VG_(am_addr_is_in_extensible_client_stack)( Addr addr )
 
 static void split_nsegment_at ( Addr a )
 {
-   Int i, j;
+   Int      i;
+   NSegment upper;
 
    aspacem_assert(a > 0);
    aspacem_assert(VG_IS_PAGE_ALIGNED(a));
@@ -1369,30 +1681,26 @@ static void split_nsegment_at ( Addr a )
    i = find_nsegment_idx(a);
    aspacem_assert(i >= 0 && i < nsegments_used);
 
-   if (nsegments[i].start == a)
+   if (NSEG(i).start == a)
       /* 'a' is already the start point of a segment, so nothing to be
          done. */
       return;
 
-   /* else we have to slide the segments upwards to make a hole */
-   if (nsegments_used >= VG_N_SEGMENTS)
-      ML_(am_barf_toolow)("VG_N_SEGMENTS");
-   for (j = nsegments_used-1; j > i; j--)
-      nsegments[j+1] = nsegments[j];
-   nsegments_used++;
+   /* else we have to insert the upper part as a new segment */
+   upper       = NSEG(i);
+   upper.start = a;
 
-   nsegments[i+1]       = nsegments[i];
-   nsegments[i+1].start = a;
-   nsegments[i].end     = a-1;
+   if (upper.kind == SkFileV || upper.kind == SkFileC)
+      upper.offset 
+         += ((ULong)upper.start) - ((ULong)NSEG(i).start);
 
-   if (nsegments[i].kind == SkFileV || nsegments[i].kind == SkFileC)
-      nsegments[i+1].offset 
-         += ((ULong)nsegments[i+1].start) - ((ULong)nsegments[i].start);
+   NSEG(i).end = a-1;
+   insert_nsegment_at(i+1, &upper);
 
-   ML_(am_inc_refcount)(nsegments[i].fnIdx);
+   ML_(am_inc_refcount)(NSEG(i).fnIdx);
 
-   aspacem_assert(sane_NSegment(&nsegments[i]));
-   aspacem_assert(sane_NSegment(&nsegments[i+1]));
+   aspacem_assert(sane_NSegment(&NSEG(i)));
+   aspacem_assert(sane_NSegment(&NSEG(i+1)));
 }
 
 
@@ -1420,12 +1728,56 @@ void split_nsegments_lo_and_hi ( Addr sLo, Addr sHi,
    aspacem_assert(0 <= *iLo && *iLo < nsegments_used);
    aspacem_assert(0 <= *iHi && *iHi < nsegments_used);
    aspacem_assert(*iLo <= *iHi);
-   aspacem_assert(nsegments[*iLo].start == sLo);
-   aspacem_assert(nsegments[*iHi].end == sHi);
+   aspacem_assert(NSEG(*iLo).start == sLo);
+   aspacem_assert(NSEG(*iHi).end == sHi);
    /* Not that I'm overly paranoid or anything, definitely not :-) */
 }
 
 
+/* Refill the pool of free segment chunks when it runs low.  This maps
+   memory for Valgrind and so recurses into add_segment, which is why
+   it must only be done once add_segment has brought the segment array
+   back in line with the kernel, and why the low water mark leaves
+   enough free chunks for that nested call to split a few.  Until
+   VG_(am_startup) has read in the initial mappings the array does not
+   yet know where the free space is, so the static pool has to do. */
+
+#define SEGCHUNK_LOW_WATER  8
+#define SEGCHUNK_REFILL     64
+
+static Bool segchunk_refill_ok = False;
+
+static void maybe_refill_segchunks ( void )
+{
+   static Bool refilling = False;
+   SysRes sres;
+   Int    n, c;
+   NSegment* chunks;
+
+   if (LIKELY(nsegchunks_free >= SEGCHUNK_LOW_WATER)
+       || !segchunk_refill_ok || refilling)
+      return;
+
+   n = VG_N_SEGCHUNKS - nsegchunks_total;
+   if (n > SEGCHUNK_REFILL)
+      n = SEGCHUNK_REFILL;
+   if (n <= 0)
+      return; /* split_segchunk barfs if we really run out */
+
+   refilling = True;
+   sres = VG_(am_mmap_anon_float_valgrind)
+             ( VG_PGROUNDUP(n * VG_N_SEGS_PER_CHUNK * sizeof(NSegment)) );
+   refilling = False;
+   if (sr_isError(sres))
+      return;
+
+   chunks = (NSegment*)(Addr)sr_Res(sres);
+   for (c = n-1; c >= 0; c--)
+      segchunk_free[nsegchunks_free++] = chunks + c * VG_N_SEGS_PER_CHUNK;
+   nsegchunks_total += n;
+}
+
+
 /* Add SEG to the collection, deleting/truncating any it overlaps.
    This deals with all the tricky cases of splitting up segments as
    needed. */
@@ -1459,23 +1811,22 @@ static void add_segment ( const NSegment* seg )
 
    /* Now iLo .. iHi inclusive is the range of segment indices which
       seg will replace.  If we're replacing more than one segment,
-      slide those above the range down to fill the hole. Before doing
-      that decrement the reference counters for the segments names of
-      the replaced segments. */
+      delete all but the first of them. Before doing that decrement
+      the reference counters for the segments names of the replaced
+      segments. */
    for (i = iLo; i <= iHi; ++i)
-      ML_(am_dec_refcount)(nsegments[i].fnIdx);
+      ML_(am_dec_refcount)(NSEG(i).fnIdx);
    delta = iHi - iLo;
    aspacem_assert(delta >= 0);
-   if (delta > 0) {
-      for (i = iLo; i < nsegments_used-delta; i++)
-         nsegments[i] = nsegments[i+delta];
-      nsegments_used -= delta;
-   }
+   if (delta > 0)
+      delete_nsegments(iLo+1, delta);
 
-   nsegments[iLo] = *seg;
+   NSEG(iLo) = *seg;
 
-   (void)preen_nsegments();
+   (void)preen_nsegments(iLo, iLo);
    if (0) VG_(am_show_nsegments)(0,"AFTER preen (add_segment)");
+
+   maybe_refill_segchunks();
 }
 
 
@@ -1615,8 +1966,7 @@ Addr VG_(am_startup) ( Addr sp_at_startup )
    seg.kind        = SkFree;
    seg.start       = Addr_MIN;
    seg.end         = Addr_MAX;
-   nsegments[0]    = seg;
-   nsegments_used  = 1;
+   init_segchunks(&seg);
 
    aspacem_minAddr = VG_(clo_aspacem_minAddr);
 
@@ -1814,6 +2164,10 @@ Addr VG_(am_startup) ( Addr sp_at_startup )
 
    VG_(am_show_nsegments)(2, "With contents of /proc/self/maps");
 
+   /* From now on, the segment array can grow. */
+   segchunk_refill_ok = True;
+   maybe_refill_segchunks();
+
    AM_SANITY_CHECK;
    return suggested_clstack_end;
 }
@@ -1924,11 +2278,11 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
       Int  iHi   = find_nsegment_idx(reqEnd);
       Bool allow = True;
       for (i = iLo; i <= iHi; i++) {
-         if (nsegments[i].kind == SkFree
-             || nsegments[i].kind == SkFileC
-             || nsegments[i].kind == SkAnonC
-             || nsegments[i].kind == SkShmC
-             || nsegments[i].kind == SkResvn) {
+         if (NSEG(i).kind == SkFree
+             || NSEG(i).kind == SkFileC
+             || NSEG(i).kind == SkAnonC
+             || NSEG(i).kind == SkShmC
+             || NSEG(i).kind == SkResvn) {
             /* ok */
          } else {
             allow = False;
@@ -1952,8 +2306,8 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
       Int  iHi   = find_nsegment_idx(reqEnd);
       Bool allow = True;
       for (i = iLo; i <= iHi; i++) {
-         if (nsegments[i].kind == SkFree
-             || nsegments[i].kind == SkResvn) {
+         if (NSEG(i).kind == SkFree
+             || NSEG(i).kind == SkResvn) {
             /* ok */
          } else {
             allow = False;
@@ -2002,13 +2356,13 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
       satisfy the request. */
    for (j = 0; j < nsegments_used; j++) {
 
-      if (nsegments[i].kind != SkFree) {
+      if (NSEG(i).kind != SkFree) {
          UPDATE_INDEX(i);
          continue;
       }
 
-      holeStart = nsegments[i].start;
-      holeEnd   = nsegments[i].end;
+      holeStart = NSEG(i).start;
+      holeEnd   = NSEG(i).end;
 
       /* Stay sane .. */
       aspacem_assert(holeStart <= holeEnd);
@@ -2042,11 +2396,11 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
 
    aspacem_assert(fixedIdx >= -1 && fixedIdx < nsegments_used);
    if (fixedIdx >= 0) 
-      aspacem_assert(nsegments[fixedIdx].kind == SkFree);
+      aspacem_assert(NSEG(fixedIdx).kind == SkFree);
 
    aspacem_assert(floatIdx >= -1 && floatIdx < nsegments_used);
    if (floatIdx >= 0) 
-      aspacem_assert(nsegments[floatIdx].kind == SkFree);
+      aspacem_assert(NSEG(floatIdx).kind == SkFree);
 
    AM_SANITY_CHECK;
 
@@ -2068,21 +2422,21 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
          }
          if (floatIdx >= 0) {
             *ok = True;
-            return ADVISE_ADDRESS(&nsegments[floatIdx]);
+            return ADVISE_ADDRESS(&NSEG(floatIdx));
          }
          *ok = False;
          return 0;
       case MAny:
          if (floatIdx >= 0) {
             *ok = True;
-            return ADVISE_ADDRESS(&nsegments[floatIdx]);
+            return ADVISE_ADDRESS(&NSEG(floatIdx));
          }
          *ok = False;
          return 0;
       case MAlign:
          if (floatIdx >= 0) {
             *ok = True;
-            return ADVISE_ADDRESS_ALIGNED(&nsegments[floatIdx]);
+            return ADVISE_ADDRESS_ALIGNED(&NSEG(floatIdx));
          }
          *ok = False;
          return 0;
@@ -2120,10 +2474,10 @@ static NSegment const * VG_(am_find_free_nsegment) ( Addr a )
 {
    Int i = find_nsegment_idx(a);
    aspacem_assert(i >= 0 && i < nsegments_used);
-   aspacem_assert(nsegments[i].start <= a);
-   aspacem_assert(a <= nsegments[i].end);
-   if (nsegments[i].kind == SkFree) 
-      return &nsegments[i];
+   aspacem_assert(NSEG(i).start <= a);
+   aspacem_assert(a <= NSEG(i).end);
+   if (NSEG(i).kind == SkFree) 
+      return &NSEG(i);
    else
       return NULL;
 }
@@ -2251,12 +2605,12 @@ Bool VG_(am_notify_mprotect)( Addr start, SizeT len, UInt prot )
 
    for (i = iLo; i <= iHi; i++) {
       /* Apply the permissions to all relevant segments. */
-      switch (nsegments[i].kind) {
+      switch (NSEG(i).kind) {
          case SkAnonC: case SkAnonV: case SkFileC: case SkFileV: case SkShmC:
-            nsegments[i].hasR = newR;
-            nsegments[i].hasW = newW;
-            nsegments[i].hasX = newX;
-            aspacem_assert(sane_NSegment(&nsegments[i]));
+            NSEG(i).hasR = newR;
+            NSEG(i).hasW = newW;
+            NSEG(i).hasX = newX;
+            aspacem_assert(sane_NSegment(&NSEG(i)));
             break;
          default:
             break;
@@ -2265,7 +2619,7 @@ Bool VG_(am_notify_mprotect)( Addr start, SizeT len, UInt prot )
 
    /* Changing permissions could have made previously un-mergable
       segments mergeable.  Therefore have to re-preen them. */
-   (void)preen_nsegments();
+   (void)preen_nsegments(iLo, iHi);
    AM_SANITY_CHECK;
    return needDiscard;
 }
@@ -2645,11 +2999,115 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
    return sres;
 }
 
-/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
+/* The size of the huge pages asked for by
+   VG_(am_mmap_anon_float_valgrind_huge).  This is the size of a
+   transparent huge page, i.e. what one page middle directory entry
+   maps. */
+#if defined(VGA_ppc64be) || defined(VGA_ppc64le)
+#  define AM_HUGE_PAGE_SZB (16 * 1024 * 1024)
+#elif defined(VGA_s390x)
+#  define AM_HUGE_PAGE_SZB (1024 * 1024)
+#else
+#  define AM_HUGE_PAGE_SZB (2 * 1024 * 1024)
+#endif
+
+SizeT VG_(am_huge_page_szB) ( void )
+{
+#if defined(VGO_linux)
+   if (VG_(clo_huge_pages) != Vg_HugePagesNo)
+      return AM_HUGE_PAGE_SZB;
+#endif
+   return 0;
+}
+
+/* Like VG_(am_mmap_anon_float_valgrind), but for large areas which
+   are accessed all over, such as shadow memory and the translation
+   cache: with --huge-pages=transparent or explicit, the mapping is
+   aligned to a huge page and its length rounded up to a multiple of
+   the huge page size, and it is backed by huge pages if the kernel
+   can, to reduce TLB misses.  Such a mapping should only be unmapped
+   as a whole. */
+
+SysRes VG_(am_mmap_anon_float_valgrind_huge)( SizeT length )
+{
+#if defined(VGO_linux)
+   SysRes     sres;
+   NSegment   seg;
+   Addr       advised, start;
+   Bool       ok;
+   MapRequest req;
+   const UInt prot  = VKI_PROT_READ|VKI_PROT_WRITE|VKI_PROT_EXEC;
+   const UInt flags = VKI_MAP_FIXED|VKI_MAP_PRIVATE|VKI_MAP_ANONYMOUS;
+
+   /* Not worth it for less than a huge page. */
+   if (VG_(clo_huge_pages) == Vg_HugePagesNo || length < AM_HUGE_PAGE_SZB)
+      return VG_(am_mmap_anon_float_valgrind)( length );
+
+   length = VG_ROUNDUP(length, AM_HUGE_PAGE_SZB);
+
+   /* Ask for an advisory big enough to hold a huge page aligned
+      mapping of length bytes. */
+   req.rkind = MAny;
+   req.start = 0;
+   req.len   = length + AM_HUGE_PAGE_SZB - VKI_PAGE_SIZE;
+   advised = VG_(am_get_advisory)( &req, False/*forClient*/, &ok );
+   if (!ok)
+      return VG_(mk_SysRes_Error)( VKI_EINVAL );
+   start = VG_ROUNDUP(advised, AM_HUGE_PAGE_SZB);
+
+   sres = VG_(mk_SysRes_Error)( VKI_ENOMEM );
+#  if defined(VKI_MAP_HUGETLB)
+   if (VG_(clo_huge_pages) == Vg_HugePagesExplicit) {
+      sres = VG_(am_do_mmap_NO_NOTIFY)( start, length, prot,
+                                        flags|VKI_MAP_HUGETLB, 0, 0 );
+      /* Most likely, the pool of huge pages (/proc/sys/vm/nr_hugepages)
+         is empty.  Fall back to transparent huge pages. */
+      if (sr_isError(sres))
+         VG_(debugLog)(1, "aspacem",
+                       "MAP_HUGETLB of %lu bytes failed, using "
+                       "transparent huge pages\n", length);
+   }
+#  endif
+   if (sr_isError(sres)) {
+      sres = VG_(am_do_mmap_NO_NOTIFY)( start, length, prot, flags, 0, 0 );
+      /* As in VG_(am_mmap_anon_float_valgrind), an inner valgrind can
+         find the advised space taken by the outer one.  Give up on
+         huge pages for this mapping then. */
+      if (sr_isError(sres))
+         return VG_(am_mmap_anon_float_valgrind)( length );
+      /* This is only a hint: it fails if the kernel has no transparent
+         huge pages, and may be ignored if they are disabled. */
+      (void)VG_(do_syscall3)(__NR_madvise, start, length, VKI_MADV_HUGEPAGE);
+   }
+
+   if (sr_Res(sres) != start) {
+      /* See the same check in VG_(am_mmap_anon_float_valgrind). */
+      (void)ML_(am_do_munmap_NO_NOTIFY)( sr_Res(sres), length );
+      return VG_(mk_SysRes_Error)( VKI_EINVAL );
+   }
+
+   /* Ok, the mapping succeeded.  Now notify the interval map. */
+   init_nsegment( &seg );
+   seg.kind  = SkAnonV;
+   seg.start = start;
+   seg.end   = seg.start + length - 1;
+   seg.hasR  = True;
+   seg.hasW  = True;
+   seg.hasX  = True;
+   add_segment( &seg );
+
+   AM_SANITY_CHECK;
+   return sres;
+#else
+   return VG_(am_mmap_anon_float_valgrind)( length );
+#endif
+}
+
+/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind_huge). */
 
 void* VG_(am_shadow_alloc)(SizeT size)
 {
-   SysRes sres = VG_(am_mmap_anon_float_valgrind)( size );
+   SysRes sres = VG_(am_mmap_anon_float_valgrind_huge)( size );
    return sr_isError(sres) ? NULL : (void*)sr_Res(sres);
 }
 
@@ -2857,26 +3315,26 @@ Bool VG_(am_change_ownership_v_to_c)( Addr start, SizeT len )
       return False;
 
    i = find_nsegment_idx(start);
-   if (nsegments[i].kind != SkFileV && nsegments[i].kind != SkAnonV)
+   if (NSEG(i).kind != SkFileV && NSEG(i).kind != SkAnonV)
       return False;
-   if (start+len-1 > nsegments[i].end)
+   if (start+len-1 > NSEG(i).end)
       return False;
 
-   aspacem_assert(start >= nsegments[i].start);
-   aspacem_assert(start+len-1 <= nsegments[i].end);
+   aspacem_assert(start >= NSEG(i).start);
+   aspacem_assert(start+len-1 <= NSEG(i).end);
 
    /* This scheme is like how mprotect works: split the to-be-changed
       range into its own segment(s), then mess with them (it).  There
       should be only one. */
    split_nsegments_lo_and_hi( start, start+len-1, &iLo, &iHi );
    aspacem_assert(iLo == iHi);
-   switch (nsegments[iLo].kind) {
-      case SkFileV: nsegments[iLo].kind = SkFileC; break;
-      case SkAnonV: nsegments[iLo].kind = SkAnonC; break;
+   switch (NSEG(iLo).kind) {
+      case SkFileV: NSEG(iLo).kind = SkFileC; break;
+      case SkAnonV: NSEG(iLo).kind = SkAnonC; break;
       default: aspacem_assert(0); /* can't happen - guarded above */
    }
 
-   preen_nsegments();
+   preen_nsegments(iLo, iLo);
    return True;
 }
 
@@ -2886,9 +3344,9 @@ Bool VG_(am_change_ownership_v_to_c)( Addr start, SizeT len )
 void VG_(am_set_segment_hasT)( Addr addr )
 {
    Int i = find_nsegment_idx(addr);
-   SegKind kind = nsegments[i].kind;
+   SegKind kind = NSEG(i).kind;
    aspacem_assert(kind == SkAnonC || kind == SkFileC || kind == SkShmC);
-   nsegments[i].hasT = True;
+   NSEG(i).hasT = True;
 }
 
 
@@ -2935,12 +3393,12 @@ Bool VG_(am_create_reservation) ( Addr start, SizeT length,
    if (startI != endI)
       return False;
 
-   if (nsegments[startI].kind != SkFree)
+   if (NSEG(startI).kind != SkFree)
       return False;
 
    /* Looks good - make the reservation. */
-   aspacem_assert(nsegments[startI].start <= start2);
-   aspacem_assert(end2 <= nsegments[startI].end);
+   aspacem_assert(NSEG(startI).start <= start2);
+   aspacem_assert(end2 <= NSEG(startI).end);
 
    init_nsegment( &seg );
    seg.kind  = SkResvn;
@@ -2977,14 +3435,14 @@ const NSegment *VG_(am_extend_into_adjacent_reservation_client)( Addr addr,
    *overflow = False;
 
    segA = find_nsegment_idx(addr);
-   aspacem_assert(nsegments[segA].kind == SkAnonC);
+   aspacem_assert(NSEG(segA).kind == SkAnonC);
 
    if (delta == 0)
-      return nsegments + segA;
+      return &NSEG(segA);
 
-   prot =   (nsegments[segA].hasR ? VKI_PROT_READ : 0)
-          | (nsegments[segA].hasW ? VKI_PROT_WRITE : 0)
-          | (nsegments[segA].hasX ? VKI_PROT_EXEC : 0);
+   prot =   (NSEG(segA).hasR ? VKI_PROT_READ : 0)
+          | (NSEG(segA).hasW ? VKI_PROT_WRITE : 0)
+          | (NSEG(segA).hasX ? VKI_PROT_EXEC : 0);
 
    aspacem_assert(VG_IS_PAGE_ALIGNED(delta<0 ? -delta : delta));
 
@@ -2993,12 +3451,12 @@ const NSegment *VG_(am_extend_into_adjacent_reservation_client)( Addr addr,
       /* Extending the segment forwards. */
       segR = segA+1;
       if (segR >= nsegments_used
-          || nsegments[segR].kind != SkResvn
-          || nsegments[segR].smode != SmLower)
+          || NSEG(segR).kind != SkResvn
+          || NSEG(segR).smode != SmLower)
          return NULL;
 
       if (delta + VKI_PAGE_SIZE 
-                > (nsegments[segR].end - nsegments[segR].start + 1)) {
+                > (NSEG(segR).end - NSEG(segR).start + 1)) {
          *overflow = True;
          return NULL;
       }
@@ -3006,23 +3464,23 @@ const NSegment *VG_(am_extend_into_adjacent_reservation_client)( Addr addr,
       /* Extend the kernel's mapping. */
       // DDD: #warning GrP fixme MAP_FIXED can clobber memory!
       sres = VG_(am_do_mmap_NO_NOTIFY)( 
-                nsegments[segR].start, delta,
+                NSEG(segR).start, delta,
                 prot,
                 VKI_MAP_FIXED|VKI_MAP_PRIVATE|VKI_MAP_ANONYMOUS, 
                 0, 0 
              );
       if (sr_isError(sres))
          return NULL; /* kernel bug if this happens? */
-      if (sr_Res(sres) != nsegments[segR].start) {
+      if (sr_Res(sres) != NSEG(segR).start) {
          /* kernel bug if this happens? */
         (void)ML_(am_do_munmap_NO_NOTIFY)( sr_Res(sres), delta );
         return NULL;
       }
 
       /* Ok, success with the kernel.  Update our structures. */
-      nsegments[segR].start += delta;
-      nsegments[segA].end += delta;
-      aspacem_assert(nsegments[segR].start <= nsegments[segR].end);
+      NSEG(segR).start += delta;
+      NSEG(segA).end += delta;
+      aspacem_assert(NSEG(segR).start <= NSEG(segR).end);
 
    } else {
 
@@ -3032,12 +3490,12 @@ const NSegment *VG_(am_extend_into_adjacent_reservation_client)( Addr addr,
 
       segR = segA-1;
       if (segR < 0
-          || nsegments[segR].kind != SkResvn
-          || nsegments[segR].smode != SmUpper)
+          || NSEG(segR).kind != SkResvn
+          || NSEG(segR).smode != SmUpper)
          return NULL;
 
       if (delta + VKI_PAGE_SIZE 
-                > (nsegments[segR].end - nsegments[segR].start + 1)) {
+                > (NSEG(segR).end - NSEG(segR).start + 1)) {
          *overflow = True;
          return NULL;
       }
@@ -3045,27 +3503,27 @@ const NSegment *VG_(am_extend_into_adjacent_reservation_client)( Addr addr,
       /* Extend the kernel's mapping. */
       // DDD: #warning GrP fixme MAP_FIXED can clobber memory!
       sres = VG_(am_do_mmap_NO_NOTIFY)( 
-                nsegments[segA].start-delta, delta,
+                NSEG(segA).start-delta, delta,
                 prot,
                 VKI_MAP_FIXED|VKI_MAP_PRIVATE|VKI_MAP_ANONYMOUS, 
                 0, 0 
              );
       if (sr_isError(sres))
          return NULL; /* kernel bug if this happens? */
-      if (sr_Res(sres) != nsegments[segA].start-delta) {
+      if (sr_Res(sres) != NSEG(segA).start-delta) {
          /* kernel bug if this happens? */
         (void)ML_(am_do_munmap_NO_NOTIFY)( sr_Res(sres), delta );
         return NULL;
       }
 
       /* Ok, success with the kernel.  Update our structures. */
-      nsegments[segR].end -= delta;
-      nsegments[segA].start -= delta;
-      aspacem_assert(nsegments[segR].start <= nsegments[segR].end);
+      NSEG(segR).end -= delta;
+      NSEG(segA).start -= delta;
+      aspacem_assert(NSEG(segR).start <= NSEG(segR).end);
    }
 
    AM_SANITY_CHECK;
-   return nsegments + segA;
+   return &NSEG(segA);
 }
 
 
@@ -3089,7 +3547,7 @@ const NSegment *VG_(am_extend_map_client)( Addr addr, SizeT delta )
    Int ix = find_nsegment_idx(addr);
    aspacem_assert(ix >= 0 && ix < nsegments_used);
 
-   NSegment *seg = nsegments + ix;
+   NSegment *seg = &NSEG(ix);
 
    aspacem_assert(seg->kind == SkFileC || seg->kind == SkAnonC ||
                   seg->kind == SkShmC);
@@ -3100,7 +3558,7 @@ const NSegment *VG_(am_extend_map_client)( Addr addr, SizeT delta )
 
    /* The segment following the client segment must be a free segment and
       it must be large enough to cover the additional memory. */
-   NSegment *segf = seg + 1;
+   NSegment *segf = &NSEG(ix+1);
    aspacem_assert(segf->kind == SkFree);
    aspacem_assert(segf->start == xStart);
    aspacem_assert(xStart + delta - 1 <= segf->end);
@@ -3127,7 +3585,7 @@ const NSegment *VG_(am_extend_map_client)( Addr addr, SizeT delta )
       VG_(am_show_nsegments)(0, "VG_(am_extend_map_client) AFTER");
 
    AM_SANITY_CHECK;
-   return nsegments + find_nsegment_idx(addr);
+   return &NSEG(find_nsegment_idx(addr));
 }
 
 
@@ -3170,8 +3628,8 @@ Bool VG_(am_relocate_nooverlap_client)( /*OUT*/Bool* need_discard,
    if (iLo != iHi)
       return False;
 
-   if (nsegments[iLo].kind != SkFileC && nsegments[iLo].kind != SkAnonC &&
-       nsegments[iLo].kind != SkShmC)
+   if (NSEG(iLo).kind != SkFileC && NSEG(iLo).kind != SkAnonC &&
+       NSEG(iLo).kind != SkShmC)
       return False;
 
    sres = ML_(am_do_relocate_nooverlap_mapping_NO_NOTIFY)
@@ -3186,7 +3644,7 @@ Bool VG_(am_relocate_nooverlap_client)( /*OUT*/Bool* need_discard,
    *need_discard = any_Ts_in_range( old_addr, old_len )
                    || any_Ts_in_range( new_addr, new_len );
 
-   seg = nsegments[iLo];
+   seg = NSEG(iLo);
 
    /* Mark the new area based on the old seg. */
    if (seg.kind == SkFileC) {
@@ -3651,11 +4109,11 @@ static void add_mapping_callback(Addr addr, SizeT len, UInt prot,
 
       UInt seg_prot;
 
-      if (nsegments[i].kind == SkAnonV  ||  nsegments[i].kind == SkFileV) {
+      if (NSEG(i).kind == SkAnonV  ||  NSEG(i).kind == SkFileV) {
          /* Ignore V regions */
          continue;
       } 
-      else if (nsegments[i].kind == SkFree || nsegments[i].kind == SkResvn) {
+      else if (NSEG(i).kind == SkFree || NSEG(i).kind == SkResvn) {
          /* Add mapping for SkResvn regions */
          ChangedSeg* cs = &css_local[css_used_local];
          if (css_used_local < css_size_local) {
@@ -3671,28 +4129,28 @@ static void add_mapping_callback(Addr addr, SizeT len, UInt prot,
          return;
 
       }
-      else if (nsegments[i].kind == SkAnonC ||
-               nsegments[i].kind == SkFileC ||
-               nsegments[i].kind == SkShmC)
+      else if (NSEG(i).kind == SkAnonC ||
+               NSEG(i).kind == SkFileC ||
+               NSEG(i).kind == SkShmC)
       {
          /* Check permissions on client regions */
          // GrP fixme
          seg_prot = 0;
-         if (nsegments[i].hasR) seg_prot |= VKI_PROT_READ;
-         if (nsegments[i].hasW) seg_prot |= VKI_PROT_WRITE;
+         if (NSEG(i).hasR) seg_prot |= VKI_PROT_READ;
+         if (NSEG(i).hasW) seg_prot |= VKI_PROT_WRITE;
 #        if defined(VGA_x86)
          // GrP fixme sloppyXcheck 
          // darwin: kernel X ignored and spuriously changes? (vm_copy)
          seg_prot |= (prot & VKI_PROT_EXEC);
 #        else
-         if (nsegments[i].hasX) seg_prot |= VKI_PROT_EXEC;
+         if (NSEG(i).hasX) seg_prot |= VKI_PROT_EXEC;
 #        endif
          if (seg_prot != prot) {
              if (VG_(clo_trace_syscalls)) 
                  VG_(debugLog)(0,"aspacem","region %p..%p permission "
                                  "mismatch (kernel %x, V %x)\n", 
-                                 (void*)nsegments[i].start,
-                                 (void*)(nsegments[i].end+1), prot, seg_prot);
+                                 (void*)NSEG(i).start,
+                                 (void*)(NSEG(i).end+1), prot, seg_prot);
             /* Add mapping for regions with protection changes */
             ChangedSeg* cs = &css_local[css_used_local];
             if (css_used_local < css_size_local) {
@@ -3732,7 +4190,7 @@ static void remove_mapping_callback(Addr addr, SizeT len)
 
    /* NSegments iLo .. iHi inclusive should agree with the presented data. */
    for (i = iLo; i <= iHi; i++) {
-      if (nsegments[i].kind != SkFree && nsegments[i].kind != SkResvn) {
+      if (NSEG(i).kind != SkFree && NSEG(i).kind != SkResvn) {
          /* V has a mapping, kernel doesn't.  Add to css_local[],
             directives to chop off the part of the V mapping that
             falls within the gap that the kernel tells us is
@@ -3740,8 +4198,8 @@ static void remove_mapping_callback(Addr addr, SizeT len)
          ChangedSeg* cs = &css_local[css_used_local];
          if (css_used_local < css_size_local) {
             cs->is_added = False;
-            cs->start    = Addr__max(nsegments[i].start, addr);
-            cs->end      = Addr__min(nsegments[i].end,   addr + len - 1);
+            cs->start    = Addr__max(NSEG(i).start, addr);
+            cs->end      = Addr__min(NSEG(i).end,   addr + len - 1);
             aspacem_assert(VG_IS_PAGE_ALIGNED(cs->start));
             aspacem_assert(VG_IS_PAGE_ALIGNED(cs->end+1));
             /* I don't think the following should fail.  But if it
@@ -253,11 +253,14 @@ typedef
       Addr    addr;
       SizeT   len;
       PointKind kind;
+      Addr    max_end; // highest addr+len of this and all preceding watches
    }
    GS_Watch;
 
 /* gs_watches contains a list of all addresses+len+kind that are being
-   watched. */
+   watched, sorted by addr.  Watches can overlap, so the max_end of a
+   watch tells how far back VG_(is_watched) must look for watches
+   that can contain a given address. */
 static XArray* gs_watches = NULL;
 
 static inline GS_Watch* index_gs_watches(Word i)
@@ -265,9 +268,44 @@ static inline GS_Watch* index_gs_watches(Word i)
    return *(GS_Watch **) VG_(indexXA) (gs_watches, i);
 }
 
+/* Returns the index of the first watch with g->addr >= addr, or
+   the size of gs_watches if there is none. */
+static Word first_gs_watch_from (Addr addr)
+{
+   Word lo = 0;
+   Word hi = VG_(sizeXA) (gs_watches);
+   Word mid;
+
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (index_gs_watches(mid)->addr < addr)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+/* Recomputes max_end for the watches from index from onwards. */
+static void update_gs_watches_max_end (Word from)
+{
+   const Word n_elems = VG_(sizeXA) (gs_watches);
+   Addr max_end = from > 0 ? index_gs_watches(from - 1)->max_end : 0;
+   Word i;
+   GS_Watch *g;
+
+   for (i = from; i < n_elems; i++) {
+      g = index_gs_watches(i);
+      if (g->addr + g->len > max_end)
+         max_end = g->addr + g->len;
+      g->max_end = max_end;
+   }
+}
+
 /* Returns the GS_Watch matching addr/len/kind and sets *g_ix to its
    position in gs_watches.
-   If no matching GS_Watch is found, returns NULL and sets g_ix to -1. */
+   If no matching GS_Watch is found, returns NULL and sets g_ix to the
+   position at which such a watch must be inserted. */
 static GS_Watch* lookup_gs_watch (Addr addr, SizeT len, PointKind kind,
                                   Word* g_ix)
 {
@@ -275,11 +313,11 @@ static GS_Watch* lookup_gs_watch (Addr addr, SizeT len, PointKind kind,
    Word i;
    GS_Watch *g;
 
-   /* Linear search. If we have many watches, this might be optimised
-      by having the array sorted and using VG_(lookupXA) */
-   for (i = 0; i < n_elems; i++) {
+   for (i = first_gs_watch_from(addr); i < n_elems; i++) {
       g = index_gs_watches(i);
-      if (g->addr == addr && g->len == len && g->kind == kind) {
+      if (g->addr != addr)
+         break;
+      if (g->len == len && g->kind == kind) {
          // Found.
          *g_ix = i;
          return g;
@@ -287,10 +325,55 @@ static GS_Watch* lookup_gs_watch (Addr addr, SizeT len, PointKind kind,
    }
 
    // Not found.
-   *g_ix = -1;
+   *g_ix = i;
    return NULL;
 }
 
+/* Pre-filter for VG_(is_watched), which is called for all the
+   accesses a tool suspects to be watched (e.g. every access to
+   unaddressable memory, for memcheck).  gs_watch_pages[h] counts the
+   watches covering a page whose number hashes to h.  If all the pages
+   of an access have a zero count, the access cannot be watched.
+   Watches covering more pages than the table has entries are only
+   counted in gs_n_big_watches, and disable the filter. */
+#define GS_WATCH_PAGE_SHIFT 12
+#define N_GS_WATCH_PAGES    4096 /* power of 2 */
+
+static UInt gs_watch_pages[N_GS_WATCH_PAGES];
+static UInt gs_n_big_watches = 0;
+
+static void count_gs_watch_pages (const GS_Watch* g, Int delta)
+{
+   Addr first, last, p;
+
+   if (g->len == 0)
+      return;
+   first = g->addr >> GS_WATCH_PAGE_SHIFT;
+   last  = (g->addr + g->len - 1) >> GS_WATCH_PAGE_SHIFT;
+   if (last - first >= N_GS_WATCH_PAGES) {
+      gs_n_big_watches += delta;
+      return;
+   }
+   for (p = first; p <= last; p++)
+      gs_watch_pages[p & (N_GS_WATCH_PAGES - 1)] += delta;
+}
+
+static inline Bool may_be_watched (Addr addr, Int szB)
+{
+   Addr first, last, p;
+
+   if (gs_n_big_watches > 0)
+      return True;
+   first = addr >> GS_WATCH_PAGE_SHIFT;
+   last  = (addr + (szB > 0 ? szB - 1 : 0)) >> GS_WATCH_PAGE_SHIFT;
+   if (last - first >= N_GS_WATCH_PAGES)
+      return True;
+   for (p = first; p <= last; p++)
+      if (gs_watch_pages[p & (N_GS_WATCH_PAGES - 1)] > 0)
+         return True;
+   return False;
+}
+
 
 /* protocol spec tells the below must be idempotent. */
 static void breakpoint (Bool insert, CORE_ADDR addr)
@@ -379,7 +462,9 @@ Bool VG_(gdbserver_point) (PointKind kind, Bool insert,
          g->addr = addr;
          g->len  = len;
          g->kind = kind;
-         VG_(addToXA)(gs_watches, &g);
+         VG_(insertIndexXA)(gs_watches, g_ix, &g);
+         update_gs_watches_max_end (g_ix);
+         count_gs_watch_pages (g, +1);
       } else {
          dlog(1, 
               "VG_(gdbserver_point) addr %p len %d kind %s already inserted\n",
@@ -388,6 +473,8 @@ Bool VG_(gdbserver_point) (PointKind kind, Bool insert,
    } else {
       if (g != NULL) {
          VG_(removeIndexXA) (gs_watches, g_ix);
+         update_gs_watches_max_end (g_ix);
+         count_gs_watch_pages (g, -1);
          VG_(free) (g);
       } else {
          dlog(1, 
@@ -409,8 +496,8 @@ Bool VG_(has_gdbserver_breakpoint) (Addr addr)
 
 Bool VG_(is_watched)(PointKind kind, Addr addr, Int szB)
 {
-   Word n_elems;
    GS_Watch* g;
+   GS_Watch* hit = NULL;
    Word i;
    Bool watched = False;
    const ThreadId tid = VG_(running_tid);
@@ -418,7 +505,8 @@ Bool VG_(is_watched)(PointKind kind, Addr addr, Int szB)
    if (!gdbserver_called)
       return False;
 
-   n_elems = VG_(sizeXA) (gs_watches);
+   if (!may_be_watched (addr, szB))
+      return False;
 
    Addr to = addr + szB; // semi-open interval [addr, to[
 
@@ -428,8 +516,15 @@ Bool VG_(is_watched)(PointKind kind, Addr addr, Int szB)
    dlog(1, "tid %u VG_(is_watched) %s addr %p szB %d\n",
         tid, VG_(ppPointKind) (kind), C2v(addr), szB);
 
-   for (i = 0; i < n_elems; i++) {
+   /* The watches overlapping [addr, to[ start below to.  Examine them
+      downwards from the last of these, for as long as a watch at or
+      below the current one still ends above addr.  The watch reported
+      is the lowest matching one, as the stop address must be the first
+      watched byte read or written. */
+   for (i = first_gs_watch_from (to) - 1; i >= 0; i--) {
       g = index_gs_watches(i);
+      if (g->max_end <= addr)
+         break;
       switch (g->kind) {
       case software_breakpoint:
       case hardware_breakpoint:
@@ -443,45 +538,48 @@ Bool VG_(is_watched)(PointKind kind, Addr addr, Int szB)
 
          watched = True; /* We have an overlap */
 
-         /* call gdbserver if access kind reported by the tool
+         /* gdbserver is called if access kind reported by the tool
             matches the watchpoint kind. */
          if (kind == access_watchpoint
              || g->kind == access_watchpoint
-             || g->kind == kind) {
-            /* Watchpoint encountered.
-               If this is a read watchpoint, we directly call gdbserver
-               to report it to gdb.
-               Otherwise, for a write watchpoint, we have to finish
-               the instruction so as to modify the value.
-               If we do not finish the instruction, then gdb sees no
-               value change and continues.
-               For a read watchpoint, we better call gdbserver directly:
-               in case the current block is not gdbserved, Valgrind
-               will execute instructions till the next block. */
-
-            /* set the watchpoint stop address to the first read or written. */
-            if (g->addr <= addr) {
-               VG_(set_watchpoint_stop_address) (addr);
-            } else {
-               VG_(set_watchpoint_stop_address) (g->addr);
-            }
-
-            if (kind == write_watchpoint) {
-               /* Let Valgrind stop as early as possible after this instruction
-                  by switching to Single Stepping mode. */
-               valgrind_set_single_stepping (True);
-               invalidate_current_ip (tid, "m_gdbserver write watchpoint");
-            } else {
-               call_gdbserver (tid, watch_reason);
-               VG_(set_watchpoint_stop_address) ((Addr) 0);
-            }
-            return True; // we are watched here.
-         }
+             || g->kind == kind)
+            hit = g;
          break;
       default:
          vg_assert (0);
       }
    }
+
+   if (hit != NULL) {
+      /* Watchpoint encountered.
+         If this is a read watchpoint, we directly call gdbserver
+         to report it to gdb.
+         Otherwise, for a write watchpoint, we have to finish
+         the instruction so as to modify the value.
+         If we do not finish the instruction, then gdb sees no
+         value change and continues.
+         For a read watchpoint, we better call gdbserver directly:
+         in case the current block is not gdbserved, Valgrind
+         will execute instructions till the next block. */
+
+      /* set the watchpoint stop address to the first read or written. */
+      if (hit->addr <= addr) {
+         VG_(set_watchpoint_stop_address) (addr);
+      } else {
+         VG_(set_watchpoint_stop_address) (hit->addr);
+      }
+
+      if (kind == write_watchpoint) {
+         /* Let Valgrind stop as early as possible after this instruction
+            by switching to Single Stepping mode. */
+         valgrind_set_single_stepping (True);
+         invalidate_current_ip (tid, "m_gdbserver write watchpoint");
+      } else {
+         call_gdbserver (tid, watch_reason);
+         VG_(set_watchpoint_stop_address) ((Addr) 0);
+      }
+      return True; // we are watched here.
+   }
    return watched;
 }
 
@@ -562,7 +660,8 @@ static void clear_watched_addresses(void)
         "clear_watched_addresses: %ld elements\n", 
         n_elems);
    
-   for (i = 0; i < n_elems; i++) {
+   /* Removing a watch removes it from gs_watches, so go downwards. */
+   for (i = n_elems - 1; i >= 0; i--) {
       g = index_gs_watches(i);
       if (!VG_(gdbserver_point) (g->kind,
                                  /* insert */ False,
@@ -1339,8 +1438,14 @@ IRSB* VG_(instrument_for_gdbserver_if_needed)
    return sb_out;
 }
 
+/* VG_(gdb_printf) passes its output to monitor_output in chunks of at
+   most MON_OUT_CHUNK chars.  The chunk does not need to be as big as a
+   packet, as monitor_output collects the output of a command anyway,
+   and a smaller chunk keeps the stack usage low. */
+#define MON_OUT_CHUNK 1024
+
 struct mon_out_buf {
-   HChar buf[DATASIZ+1];
+   HChar buf[MON_OUT_CHUNK+1];
    int next;
    UInt ret;
 };
@@ -1351,7 +1456,7 @@ static void mon_out (HChar c, void *opaque)
    b->ret++;
    b->buf[b->next] = c;
    b->next++;
-   if (b->next == DATASIZ) {
+   if (b->next == MON_OUT_CHUNK) {
       b->buf[b->next] = '\0';
       monitor_output(b->buf);
       b->next = 0;
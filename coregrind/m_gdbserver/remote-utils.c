@@ -817,6 +817,10 @@ int putpkt_binary (char *buf, int cnt)
    char *p;
    int cc;
 
+   /* Monitor output still batched must reach gdb before the reply
+      that ends the command producing it. */
+   monitor_output_flush ();
+
    buf2 = malloc (PBUFSIZ+POVERHSIZ);
    // should malloc PBUFSIZ, but bypass GDB bug (see gdbserver_init in server.c)
    vg_assert (5 == POVERHSIZ);
@@ -912,27 +916,70 @@ int putpkt (char *buf)
    return putpkt_binary (buf, strlen (buf));
 }
 
+/* Every 'O' packet costs a round trip through vgdb (and an ack, when
+   not in noack mode).  Monitor commands typically produce their output
+   a line at a time, so while batching, the output is collected in
+   mon_buf and sent in packets as big as possible. */
+static char mon_buf[DATASIZ+1];
+static int  mon_buf_len = 0;
+static Bool mon_buf_batching = False;
+
+static void send_monitor_output (char *s, int len)
+{
+   char *buf = malloc(1 + 2*len + 1);
+
+   buf[0] = 'O';
+   hexify(buf+1, s, len);
+   if (putpkt (buf) < 0) {
+      /* We probably have lost the connection with vgdb. */
+      reset_valgrind_sink("Error writing monitor output");
+      /* write again after reset */
+      VG_(printf) ("%s", s);
+   }
+
+   free (buf);
+}
+
 void monitor_output (char *s)
 {
    if (remote_connected()) {
       const int len = strlen(s);
-      char *buf = malloc(1 + 2*len + 1);
-      
-      buf[0] = 'O';
-      hexify(buf+1, s, len);
-      if (putpkt (buf) < 0) {
-         /* We probably have lost the connection with vgdb. */
-         reset_valgrind_sink("Error writing monitor output");
-         /* write again after reset */
-         VG_(printf) ("%s", s);
+
+      if (mon_buf_len + len > DATASIZ)
+         monitor_output_flush();
+      if (!mon_buf_batching || len > DATASIZ) {
+         send_monitor_output (s, len);
+         return;
       }
-      
-      free (buf);
+      VG_(memcpy) (mon_buf + mon_buf_len, s, len);
+      mon_buf_len += len;
    } else {
+      monitor_output_flush();
       print_to_initial_valgrind_sink (s);
    }
 }
 
+void monitor_output_flush (void)
+{
+   const int len = mon_buf_len;
+
+   if (len == 0)
+      return;
+   mon_buf_len = 0;
+   mon_buf[len] = '\0';
+   if (remote_connected())
+      send_monitor_output (mon_buf, len);
+   else
+      print_to_initial_valgrind_sink (mon_buf);
+}
+
+void monitor_output_batch (Bool batch)
+{
+   mon_buf_batching = batch;
+   if (!batch)
+      monitor_output_flush();
+}
+
 /* Returns next char from remote GDB.  -1 if error.  */
 /* if single, only one character maximum can be read with
    read system call. Otherwise, when reading an ack character
@@ -1203,9 +1250,7 @@ void decode_m_packet (char *from, CORE_ADDR *mem_addr_ptr, unsigned int *len_ptr
       *mem_addr_ptr |= fromhex (ch) & 0x0f;
    }
 
-   for (j = 0; j < 4; j++) {
-      if ((ch = from[i++]) == 0)
-         break;
+   while ((ch = from[i++]) != 0) {
       *len_ptr = *len_ptr << 4;
       *len_ptr |= fromhex (ch) & 0x0f;
    }
@@ -774,7 +774,9 @@ void handle_query (char *arg_own_buf, int *new_packet_len_p)
       }
       cmd[cmdlen] = '\0';
        
+      monitor_output_batch (True);
       if (handle_gdb_monitor_command (cmd)) {
+         monitor_output_batch (False);
          write_ok (arg_own_buf);
          return;
       } else {
@@ -784,6 +786,7 @@ void handle_query (char *arg_own_buf, int *new_packet_len_p)
              "In gdb,     try 'monitor help'\n"
              "In a shell, try 'vgdb help'\n",
              cmd);
+         monitor_output_batch (False);
          write_ok (arg_own_buf);
          return;
       }
@@ -1107,6 +1110,7 @@ void handle_query (char *arg_own_buf, int *new_packet_len_p)
       }
       strcat (arg_own_buf, ";qXfer:exec-file:read+");
       strcat (arg_own_buf, ";qXfer:siginfo:read+");
+      strcat (arg_own_buf, ";binary-upload+");
       return;
    }
 
@@ -1325,11 +1329,34 @@ void server_main (void)
       }
       case 'm':
          decode_m_packet (&own_buf[1], &mem_addr, &len);
+         if (len > DATASIZ)
+            len = DATASIZ;
          if (valgrind_read_memory (mem_addr, mem_buf, len) == 0)
             convert_int_to_ascii (mem_buf, own_buf, len);
          else
             write_enn (own_buf);
          break;
+      case 'x': {
+         /* Like 'm', but the reply is 'b' followed by the memory
+            contents in binary (escaped) form, which is about half the
+            size of the hex encoding.  The reply may give fewer bytes
+            than asked for if they do not all fit in a packet. */
+         int out_len;
+         decode_m_packet (&own_buf[1], &mem_addr, &len);
+         if (len > PBUFSIZ - POVERHSIZ - 1)
+            len = PBUFSIZ - POVERHSIZ - 1;
+         if (valgrind_read_memory (mem_addr, mem_buf, len) == 0) {
+            own_buf[0] = 'b';
+            new_packet_len 
+               = remote_escape_output (mem_buf, len,
+                                       (unsigned char *) own_buf + 1,
+                                       &out_len,
+                                       PBUFSIZ - POVERHSIZ - 1) + 1;
+         } else {
+            write_enn (own_buf);
+         }
+         break;
+      }
       case 'M':
          decode_M_packet (&own_buf[1], &mem_addr, &len, mem_buf);
          if (valgrind_write_memory (mem_addr, mem_buf, len) == 0)
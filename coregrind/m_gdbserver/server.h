@@ -67,6 +67,13 @@ extern void gdbserver_terminate (void);
    to gdb or to log. */
 extern void monitor_output (char *s);
 
+/* While batch is True, monitor_output collects the output and sends it
+   to gdb in as few packets as possible.  The output is sent at the
+   latest when batching is switched off, or before the next packet is
+   sent to gdb.  monitor_output_flush sends what was collected so far. */
+extern void monitor_output_batch (Bool batch);
+extern void monitor_output_flush (void);
+
 /* returns 0 if there is no connection or no event on the connection
              with gdb.
    returns 1 if there are some data which has been received from gdb
@@ -359,7 +366,12 @@ void init_registers (void);
     + 2         : packet checksum
     + 1         : \0 
 
-    Max value gdb likes is 16384.
+    gdb itself limits the memory read and write packets it sends to
+    16384 bytes, unless told otherwise with e.g.
+    'set remote memory-read-packet-size 65536' and
+    'set remote memory-read-packet-size fixed'.
+    Monitor command output, qXfer replies and other clients of vgdb
+    make use of bigger packets anyway.
 
     Note that what is sent/received to/from gdb does
     not have a trailing null byte. We are adding 1 here to allow
@@ -368,7 +380,7 @@ void init_registers (void);
     => packet Packet OVERHead SIZe is 5:*/
 
 /* keep PBUFSIZ value in sync with vgdb.c */
-#define PBUFSIZ 16384
+#define PBUFSIZ 65536
 #define POVERHSIZ 5
 
 /* Max size of a string encoded in a packet. Hex Encoding can
@@ -353,11 +353,17 @@ UInt VG_(fprintf) ( VgFile *fp, const HChar *format, ... )
    return ret;
 }
 
-void VG_(fclose)( VgFile *fp )
+void VG_(fflush)( VgFile *fp )
 {
-   // Flush the buffer.
    if (fp->num_chars)
       VG_(write)(fp->fd, fp->buf, fp->num_chars);
+   fp->num_chars = 0;
+}
+
+void VG_(fclose)( VgFile *fp )
+{
+   // Flush the buffer.
+   VG_(fflush)(fp);
 
    VG_(close)(fp->fd);
    VG_(free)(fp);
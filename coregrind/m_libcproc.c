@@ -894,6 +894,28 @@ Int VG_(fork) ( void )
 #  endif
 }
 
+/* Like VG_(fork), but the parent is not sent a signal when the child
+   exits, and the child is not reported by wait()/waitpid() calls of the
+   client, unless they ask for all children with __WALL.  The child must
+   be waited for with VG_(waitpid)(pid, &status, __VKI_WCLONE).  Only
+   available on Linux; returns -1 elsewhere. */
+Int VG_(fork_quiet) ( void )
+{
+#  if defined(VGO_linux)
+   SysRes res;
+   /* No flags, hence no exit signal, and no new stack: the child runs
+      on a copy of the address space, as after a fork.  All arguments
+      are zero, so their order, which differs between the platforms,
+      does not matter. */
+   res = VG_(do_syscall5)(__NR_clone, 0, 0, 0, 0, 0);
+   if (sr_isError(res))
+      return -1;
+   return sr_Res(res);
+#  else
+   return -1;
+#  endif
+}
+
 /* ---------------------------------------------------------------------
    Timing stuff
    ------------------------------------------------------------------ */
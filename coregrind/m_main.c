@@ -191,6 +191,8 @@ static void usage_NORETURN ( Bool debug_help )
 "           android-gpu-sgx5xx android-gpu-adreno3xx none\n"
 "    --merge-recursive-frames=<number>  merge frames between identical\n"
 "           program counters in max <number> frames) [0]\n"
+"    --shadow-call-stack=no|yes  take stack traces from a shadow stack of\n"
+"           the calls made, instead of unwinding (x86/amd64 only) [no]\n"
 "    --num-transtab-sectors=<number> size of translated code cache [%d]\n"
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
@@ -200,6 +202,8 @@ static void usage_NORETURN ( Bool debug_help )
 "                               (in bytes) ["
                                 VG_STRINGIFY(VG_DEFAULT_STACK_ACTIVE_SZB) 
                                                 "]\n"
+"    --huge-pages=no|transparent|explicit  back shadow memory and the\n"
+"           translation cache with huge pages (Linux only) [no]\n"
 "    --show-emwarns=no|yes     show warnings about emulation limits? [no]\n"
 "    --require-text-symbol=:sonamepattern:symbolpattern    abort run if the\n"
 "                              stated shared object doesn't have the stated\n"
@@ -565,6 +569,23 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
                             {VG_(clo_valgrind_stacksize) 
                                   = VG_PGROUNDUP(VG_(clo_valgrind_stacksize));}
 
+      else if VG_STR_CLO(arg, "--huge-pages", tmp_str) {
+         if (VG_(strcmp)(tmp_str, "no") == 0)
+            VG_(clo_huge_pages) = Vg_HugePagesNo;
+         else if (VG_(strcmp)(tmp_str, "transparent") == 0)
+            VG_(clo_huge_pages) = Vg_HugePagesTransparent;
+         else if (VG_(strcmp)(tmp_str, "explicit") == 0)
+            VG_(clo_huge_pages) = Vg_HugePagesExplicit;
+         else
+            VG_(fmsg_bad_option)(arg,
+               "Bad argument, should be 'no', 'transparent' or 'explicit'\n");
+#        if !defined(VGO_linux)
+         if (VG_(clo_huge_pages) != Vg_HugePagesNo)
+            VG_(fmsg_bad_option)(arg,
+               "--huge-pages is only supported on Linux\n");
+#        endif
+      }
+
       /* Obsolete options. Report an error and exit */
       else if VG_STREQN(34, arg, "--vex-iropt-precise-memory-exns=no") {
          VG_(fmsg_bad_option)
@@ -698,6 +719,14 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
       else if VG_BINT_CLO(arg, "--merge-recursive-frames",
                                VG_(clo_merge_recursive_frames), 0,
                                VG_DEEPEST_BACKTRACE) {}
+      else if VG_BOOL_CLO(arg, "--shadow-call-stack",
+                               VG_(clo_shadow_call_stack)) {
+#        if !defined(VGA_x86) && !defined(VGA_amd64)
+         if (VG_(clo_shadow_call_stack))
+            VG_(fmsg_bad_option)(arg,
+               "--shadow-call-stack is only supported on x86 and amd64\n");
+#        endif
+      }
 
       else if VG_XACT_CLO(arg, "--smc-check=none", 
                           VG_(clo_smc_check), Vg_SmcNone) {}
@@ -915,6 +944,11 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
    if (VG_(clo_vex_control).guest_chase_thresh < 0)
       VG_(clo_vex_control).guest_chase_thresh = 0;
 
+   /* The shadow call stack needs to see each call at the end of a
+      block, so calls must not be chased into. */
+   if (VG_(clo_shadow_call_stack))
+      VG_(clo_vex_control).guest_chase_thresh = 0;
+
    /* Check various option values */
 
    if (VG_(clo_verbosity) < 0)
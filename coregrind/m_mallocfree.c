@@ -70,6 +70,23 @@ static void cc_analyse_alloc_arena ( ArenaId aid ); /* fwds */
 // dynamically.  This is its initial size.
 #define SBLOCKS_SIZE_INITIAL 50
 
+// Small blocks of the non-client arenas are not given back to the free
+// lists when freed, but kept aside in a quick list per payload size,
+// and handed out as they are by the next allocation of that size.
+// Tools and the core allocate lots of small objects of a few fixed
+// sizes (OSet and WordFM nodes, hash table entries, XArrays), and
+// most of these are then served without searching the free lists,
+// splitting or merging.  Blocks in a quick list stay marked as in use,
+// and are linked through the first word of their payload.  Quick list
+// qno holds blocks with a payload of (qno+1) * VG_MIN_MALLOC_SZB bytes.
+// The payload bytes kept in the quick lists of an arena are limited to
+// MAX_QUICK_SZB, and all its quick lists are flushed back to the free
+// lists before allocating a new superblock, so the arena does not grow
+// because of them.
+#define N_QUICK_LISTS      16
+#define MAX_QUICK_PSZB     (N_QUICK_LISTS * VG_MIN_MALLOC_SZB)
+#define MAX_QUICK_SZB      262144
+
 typedef UChar UByte;
 
 /* Layout of an in-use block:
@@ -206,6 +223,7 @@ typedef
       // Smaller size superblocks are splittable and can be reclaimed when all
       // their blocks are freed.
       Block*       freelist[N_MALLOC_LISTS];
+      Block*       quicklist[N_QUICK_LISTS];
       // A dynamically expanding, ordered array of (pointers to)
       // superblocks in the arena.  If this array is expanded, which
       // is rare, the previous space it occupies is simply abandoned.
@@ -238,6 +256,8 @@ typedef
       ULong        stats__tot_blocks; /* total # blocks alloc'd */
       ULong        stats__tot_bytes; /* total # bytes alloc'd */
       ULong        stats__nsearches; /* total # freelist checks */
+      SizeT        stats__bytes_quick; /* payload bytes in quick lists */
+      ULong        stats__nquick; /* total # blocks alloc'd from quick lists */
       // If profiling, when should the next profile happen at
       // (in terms of stats__bytes_on_loan_max) ?
       SizeT        next_profile_at;
@@ -404,6 +424,21 @@ Block* get_payload_block ( Arena* a, UByte* payload )
 //---------------------------------------------------------------------------
 
 // Set and get the next and previous link fields of a block.
+// Quick list number of a block with payload size pszB, which must be
+// between VG_MIN_MALLOC_SZB and MAX_QUICK_PSZB.
+static __inline__
+UInt pszB_to_quickNo ( SizeT pszB )
+{
+   return pszB / VG_MIN_MALLOC_SZB - 1;
+}
+
+// The quick list link of a block, in the first word of its payload.
+static __inline__
+Block** quick_next_p ( Arena* a, Block* b )
+{
+   return (Block**)get_block_payload(a, b);
+}
+
 static __inline__
 void set_prev_b ( Block* b, Block* prev_p )
 { 
@@ -595,6 +630,7 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->min_sblock_szB = min_sblock_szB;
    a->min_unsplittable_sblock_szB = min_unsplittable_sblock_szB;
    for (i = 0; i < N_MALLOC_LISTS; i++) a->freelist[i] = NULL;
+   for (i = 0; i < N_QUICK_LISTS; i++) a->quicklist[i] = NULL;
 
    a->sblocks                  = & a->sblocks_initial[0];
    a->sblocks_size             = SBLOCKS_SIZE_INITIAL;
@@ -613,6 +649,8 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->stats__tot_blocks        = 0;
    a->stats__tot_bytes         = 0;
    a->stats__nsearches         = 0;
+   a->stats__bytes_quick       = 0;
+   a->stats__nquick            = 0;
    a->next_profile_at          = 25 * 1000 * 1000;
    vg_assert(sizeof(a->sblocks_initial) 
              == SBLOCKS_SIZE_INITIAL * sizeof(Superblock*));
@@ -629,14 +667,14 @@ void VG_(print_all_arena_stats) ( void )
                    "%llu/%llu unsplit/split sb unmmap'd,  "
                    "%'13lu/%'13lu max/curr,  "
                    "%10llu/%10llu totalloc-blocks/bytes,"
-                   "  %10llu searches %lu rzB\n",
+                   "  %10llu searches %10llu quick %lu rzB\n",
                    a->name,
                    a->stats__bytes_mmaped_max, a->stats__bytes_mmaped,
                    a->stats__nreclaim_unsplit, a->stats__nreclaim_split,
                    a->stats__bytes_on_loan_max,
                    a->stats__bytes_on_loan,
                    a->stats__tot_blocks, a->stats__tot_bytes,
-                   a->stats__nsearches,
+                   a->stats__nsearches, a->stats__nquick,
                    a->rz_szB
       );
    }
@@ -819,6 +857,9 @@ void* align_upwards ( void* p, SizeT align )
 static
 void deferred_reclaimSuperblock ( Arena* a, Superblock* sb);
 
+static
+void flush_quick_lists ( Arena* a );
+
 // If not enough memory available, either aborts (for non-client memory)
 // or returns 0 (for client memory).
 static
@@ -1244,7 +1285,7 @@ static void sanity_check_malloc_arena ( ArenaId aid )
    Bool        thisFree, lastWasFree, sblockarrOK;
    Block*      b;
    Block*      b_prev;
-   SizeT       arena_bytes_on_loan;
+   SizeT       arena_bytes_on_loan, quick_bytes;
    Arena*      a;
 
 #  define BOMB VG_(core_panic)("sanity_check_malloc_arena")
@@ -1300,7 +1341,28 @@ static void sanity_check_malloc_arena ( ArenaId aid )
 
    arena_bytes_on_loan += a->stats__perm_bytes_on_loan;
 
-   if (arena_bytes_on_loan != a->stats__bytes_on_loan) {
+   // The blocks in the quick lists are in use as far as the superblocks
+   // are concerned, but not on loan.
+   quick_bytes = 0;
+   for (listno = 0; listno < N_QUICK_LISTS; listno++) {
+      for (b = a->quicklist[listno]; b != NULL; b = *quick_next_p(a, b)) {
+         b_pszB = get_pszB(a, b);
+         if (!is_inuse_block(b) || pszB_to_quickNo(b_pszB) != listno) {
+            VG_(printf)( "sanity_check_malloc_arena: quick list %u at %p: "
+                         "BAD BLOCK (%luB)\n", listno, b, b_pszB );
+            BOMB;
+         }
+         quick_bytes += b_pszB;
+      }
+   }
+   if (quick_bytes != a->stats__bytes_quick) {
+      VG_(printf)( "sanity_check_malloc_arena: a->bytes_quick %lu, "
+                   "quick_bytes %lu: MISMATCH\n",
+                   a->stats__bytes_quick, quick_bytes);
+      BOMB;
+   }
+
+   if (arena_bytes_on_loan != a->stats__bytes_on_loan + quick_bytes) {
 #     ifdef VERBOSE_MALLOC
       VG_(printf)( "sanity_check_malloc_arena: a->bytes_on_loan %lu, "
                    "arena_bytes_on_loan %lu: "
@@ -1499,6 +1561,23 @@ void VG_(sanity_check_malloc_all) ( void )
    }
 }
 
+// Is b in one of the quick lists of a ?  (Slow, only for describing
+// addresses.)
+static Bool is_quick_block ( Arena* a, Block* b )
+{
+   SizeT  pszB = get_pszB(a, b);
+   Block* qb;
+
+   if (pszB < VG_MIN_MALLOC_SZB || pszB > MAX_QUICK_PSZB)
+      return False;
+   for (qb = a->quicklist[pszB_to_quickNo(pszB)]; qb != NULL;
+        qb = *quick_next_p(a, qb)) {
+      if (qb == b)
+         return True;
+   }
+   return False;
+}
+
 void VG_(describe_arena_addr) ( Addr a, AddrArenaInfo* aai )
 {
    UInt i;
@@ -1526,7 +1605,7 @@ void VG_(describe_arena_addr) ( Addr a, AddrArenaInfo* aai )
          vg_assert (b);
          aai->block_szB = get_pszB(arena, b);
          aai->rwoffset = a - (Addr)get_block_payload(arena, b);
-         aai->free = !is_inuse_block(b);
+         aai->free = !is_inuse_block(b) || is_quick_block(arena, b);
          return;
       }
    }
@@ -1692,6 +1771,28 @@ void* VG_(arena_malloc) ( ArenaId aid, const HChar* cc, SizeT req_pszB )
    // this allocation; it isn't optional.
    vg_assert(cc);
 
+   // Small sizes are first looked for in the quick lists.
+   if (!a->clientmem
+       && req_pszB >= VG_MIN_MALLOC_SZB && req_pszB <= MAX_QUICK_PSZB) {
+      i = pszB_to_quickNo(req_pszB);
+      b = a->quicklist[i];
+      if (b != NULL) {
+         a->quicklist[i] = *quick_next_p(a, b);
+         a->stats__bytes_quick -= req_pszB;
+         a->stats__nquick++;
+         if (VG_(clo_profile_heap))
+            set_cc(b, cc);
+         add_one_block_to_stats (a, req_pszB);
+         v = get_block_payload(a, b);
+         INNER_REQUEST
+            (VALGRIND_MALLOCLIKE_BLOCK(v, 
+                                       VG_(arena_malloc_usable_size)(aid, v), 
+                                       a->rz_szB, False));
+         return v;
+      }
+   }
+
+  search_freelists:
    // Scan through all the big-enough freelists for a block.
    //
    // Nb: this scanning might be expensive in some cases.  Eg. if you
@@ -1738,8 +1839,14 @@ void* VG_(arena_malloc) ( ArenaId aid, const HChar* cc, SizeT req_pszB )
       }
    }
 
-   // If we reach here, no suitable block found, allocate a new superblock
+   // If we reach here, no suitable block found.  Give the blocks of the
+   // quick lists back to the free lists and try again, before allocating
+   // a new superblock.
    vg_assert(lno == N_MALLOC_LISTS);
+   if (a->stats__bytes_quick > 0) {
+      flush_quick_lists(a);
+      goto search_freelists;
+   }
    new_sb = newSuperblock(a, req_bszB);
    if (NULL == new_sb) {
       // Should only fail if for client, otherwise, should have aborted
@@ -2019,12 +2126,71 @@ static void mergeWithFreeNeighbours (Arena* a, Superblock* sb,
    }
 }
  
+// Put the in-use block b of the splittable superblock sb back on the
+// free lists, merging it with its free neighbours.
+static
+void release_block_to_freelists ( Arena* a, Superblock* sb,
+                                  Block* b, SizeT b_bszB )
+{
+   UInt b_listno;
+
+   b_listno = pszB_to_listNo(bszB_to_pszB(a, b_bszB));
+   mkFreeBlock( a, b, b_bszB, b_listno );
+   if (VG_(clo_profile_heap))
+      set_cc(b, "admin.free-1");
+
+   /* Possibly merge b with its predecessor or successor. */
+   mergeWithFreeNeighbours (a, sb, b, b_bszB);
+
+   // We need to (re-)establish the minimum accessibility needed
+   // for free list management. E.g. if block b has been put in a free
+   // list and a neighbour block is released afterwards, the
+   // "lo" and "hi" portions of the block b will be accessed to
+   // glue the 2 blocks together.
+   // We could mark the whole block as not accessible, and each time
+   // transiently mark accessible the needed lo/hi parts. Not done as this
+   // is quite complex, for very little expected additional bug detection.
+   // fully unaccessible. Note that the below marks the (possibly) merged
+   // block, not the block corresponding to the ptr argument.
+
+   // First mark the whole block unaccessible.
+   INNER_REQUEST(VALGRIND_MAKE_MEM_NOACCESS(b, b_bszB));
+   // Then mark the relevant administrative headers as defined.
+   // No need to mark the heap profile portion as defined, this is not
+   // used for free blocks.
+   INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(b + hp_overhead_szB(),
+                                           sizeof(SizeT) + sizeof(void*)));
+   INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(b + b_bszB
+                                           - sizeof(SizeT) - sizeof(void*),
+                                           sizeof(SizeT) + sizeof(void*)));
+}
+
+// Give all the blocks in the quick lists of a back to its free lists.
+static
+void flush_quick_lists ( Arena* a )
+{
+   UInt   qno;
+   Block* b;
+   SizeT  b_bszB;
+
+   for (qno = 0; qno < N_QUICK_LISTS; qno++) {
+      while (a->quicklist[qno] != NULL) {
+         b = a->quicklist[qno];
+         a->quicklist[qno] = *quick_next_p(a, b);
+         b_bszB = get_bszB(b);
+         a->stats__bytes_quick -= bszB_to_pszB(a, b_bszB);
+         release_block_to_freelists(a, findSb(a, b), b, b_bszB);
+      }
+   }
+   vg_assert(a->stats__bytes_quick == 0);
+}
+
 void VG_(arena_free) ( ArenaId aid, void* ptr )
 {
    Superblock* sb;
    Block*      b;
    SizeT       b_bszB, b_pszB;
-   UInt        b_listno;
+   UInt        qno;
    Arena*      a;
 
    ensure_mm_init(aid);
@@ -2043,7 +2209,6 @@ void VG_(arena_free) ( ArenaId aid, void* ptr )
 
    b_bszB   = get_bszB(b);
    b_pszB   = bszB_to_pszB(a, b_bszB);
-   sb       = findSb( a, b );
 
    a->stats__bytes_on_loan -= b_pszB;
 
@@ -2056,41 +2221,38 @@ void VG_(arena_free) ( ArenaId aid, void* ptr )
    if (aid != VG_AR_CLIENT)
       VG_(memset)(ptr, 0xDD, (SizeT)b_pszB);
 
-   if (! sb->unsplittable) {
-      // Put this chunk back on a list somewhere.
-      b_listno = pszB_to_listNo(b_pszB);
-      mkFreeBlock( a, b, b_bszB, b_listno );
+   // Keep small blocks in a quick list if there is room.  They are never
+   // in an unsplittable superblock.
+   if (!a->clientmem
+       && b_pszB >= VG_MIN_MALLOC_SZB && b_pszB <= MAX_QUICK_PSZB
+       && a->stats__bytes_quick + b_pszB <= MAX_QUICK_SZB) {
+      qno = pszB_to_quickNo(b_pszB);
+      *quick_next_p(a, b) = a->quicklist[qno];
+      a->quicklist[qno] = b;
+      a->stats__bytes_quick += b_pszB;
       if (VG_(clo_profile_heap))
-         set_cc(b, "admin.free-1");
+         set_cc(b, "admin.quick-free");
+
+      // Inform that ptr has been released, but keep the quick list
+      // link accessible.
+      INNER_REQUEST(VALGRIND_FREELIKE_BLOCK(ptr, 0));
+      INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(ptr, sizeof(Block*)));
+#     ifdef DEBUG_MALLOC
+      sanity_check_malloc_arena(aid);
+#     endif
+      return;
+   }
 
-      /* Possibly merge b with its predecessor or successor. */
-      mergeWithFreeNeighbours (a, sb, b, b_bszB);
+   sb = findSb( a, b );
 
+   if (! sb->unsplittable) {
       // Inform that ptr has been released. We give redzone size 
-      // 0 instead of a->rz_szB as proper accessibility is done just after.
+      // 0 instead of a->rz_szB as proper accessibility is done by
+      // release_block_to_freelists.
       INNER_REQUEST(VALGRIND_FREELIKE_BLOCK(ptr, 0));
-      
-      // We need to (re-)establish the minimum accessibility needed
-      // for free list management. E.g. if block ptr has been put in a free
-      // list and a neighbour block is released afterwards, the
-      // "lo" and "hi" portions of the block ptr will be accessed to
-      // glue the 2 blocks together.
-      // We could mark the whole block as not accessible, and each time
-      // transiently mark accessible the needed lo/hi parts. Not done as this
-      // is quite complex, for very little expected additional bug detection.
-      // fully unaccessible. Note that the below marks the (possibly) merged
-      // block, not the block corresponding to the ptr argument.
-
-      // First mark the whole block unaccessible.
-      INNER_REQUEST(VALGRIND_MAKE_MEM_NOACCESS(b, b_bszB));
-      // Then mark the relevant administrative headers as defined.
-      // No need to mark the heap profile portion as defined, this is not
-      // used for free blocks.
-      INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(b + hp_overhead_szB(),
-                                              sizeof(SizeT) + sizeof(void*)));
-      INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(b + b_bszB
-                                              - sizeof(SizeT) - sizeof(void*),
-                                              sizeof(SizeT) + sizeof(void*)));
+
+      // Put this chunk back on a list somewhere.
+      release_block_to_freelists(a, sb, b, b_bszB);
    } else {
       vg_assert(unsplittableBlockSane(a, sb, b));
 
@@ -85,6 +85,7 @@
 #include "pub_core_signals.h"
 #include "pub_core_stacks.h"
 #include "pub_core_stacktrace.h"    // For VG_(get_and_pp_StackTrace)()
+                                    // and VG_(shadow_call_stack_clear)()
 #include "pub_core_syscall.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
@@ -548,6 +549,8 @@ void mostly_clear_thread_record ( ThreadId tid )
 
    VG_(clear_out_queued_signals)(tid, &savedmask);
 
+   VG_(shadow_call_stack_clear)(tid);
+
    VG_(threads)[tid].sched_jmpbuf_valid = False;
 }
 
@@ -222,6 +222,7 @@
 #include "pub_core_sigframe.h"      // For VG_(sigframe_create)()
 #include "pub_core_stacks.h"        // For VG_(change_stack)()
 #include "pub_core_stacktrace.h"    // For VG_(get_and_pp_StackTrace)()
+                                    // and VG_(shadow_call_stack_signal)()
 #include "pub_core_syscall.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
@@ -1432,6 +1433,7 @@ void push_signal_frame ( ThreadId tid, const vki_siginfo_t *siginfo,
 {
    Bool         on_altstack;
    Addr         esp_top_of_frame;
+   Addr         interrupted_ip, interrupted_sp;
    ThreadState* tst;
    Int		sigNo = siginfo->si_signo;
 
@@ -1471,6 +1473,9 @@ void push_signal_frame ( ThreadId tid, const vki_siginfo_t *siginfo,
    vg_assert(scss.scss_per_sig[sigNo].scss_handler != VKI_SIG_IGN);
    vg_assert(scss.scss_per_sig[sigNo].scss_handler != VKI_SIG_DFL);
 
+   interrupted_ip = VG_(get_IP)(tid);
+   interrupted_sp = VG_(get_SP)(tid);
+
    /* This may fail if the client stack is busted; if that happens,
       the whole process will exit rather than simply calling the
       signal handler. */
@@ -1479,6 +1484,8 @@ void push_signal_frame ( ThreadId tid, const vki_siginfo_t *siginfo,
                          scss.scss_per_sig[sigNo].scss_flags,
                          &tst->sig_mask,
                          scss.scss_per_sig[sigNo].scss_restorer);
+
+   VG_(shadow_call_stack_signal)(tid, interrupted_ip, interrupted_sp);
 }
 
 
@@ -37,6 +37,7 @@
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
 #include "pub_core_machine.h"
+#include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
 #include "pub_core_stacks.h"        // VG_(stack_limits)
 #include "pub_core_stacktrace.h"
@@ -91,6 +92,141 @@ do {                                                                  \
   The fp_min must take this into account, otherwise, VG_(use_CF_info) will
   not unwind the BP. */
    
+/* ------------------ unwind cache (x86, amd64) ------------------ */
+
+#if defined(VGA_x86) || defined(VGA_amd64)
+
+/* Tools ask for the stack trace of every allocation, and deeply nested
+   code makes the same calls from the same call paths over and over
+   again.  Unwinding each of the frames in common again is costly, as
+   the CFI of each has to be found and evaluated.  So the unwinder
+   remembers the frames it found in the unwind cache.  An entry holds
+   the unwind state (ip, sp, fp) after a frame, and links to the entry
+   of the frame's caller.  When an unwind arrives at a state which is
+   in the cache, the frames of the callers are copied from the cache
+   instead of being unwound.
+
+   Arriving at the same state does not mean the callers are the same:
+   the same function can be called at the same stack depth from another
+   call path.  So a cached caller frame is only used if the return
+   address just below its sp, where the call instruction pushed it, is
+   still the cached one.  If this check fails, or the cached chain
+   ends, normal unwinding resumes from the last frame found.
+
+   The cache is direct mapped.  Each entry has a stamp, renewed when
+   the entry is given to another frame, so that links to an evicted
+   entry are recognised as broken.  As the CFI for an ip can change
+   when debuginfo is loaded or discarded, the cache is cleared each
+   time the debuginfo generation changes. */
+
+#define N_UNWIND_CACHE 8192 /* power of 2 */
+
+typedef
+   struct {
+      Addr ip;            // unwind state after the frame
+      Addr sp;
+      Addr fp;
+      UInt stamp;         // 0 if the entry is free
+      UInt parent;        // 1 + index of the caller's entry, or 0
+      UInt parent_stamp;  // stamp of the caller's entry
+   }
+   UnwindCacheEntry;
+
+static UnwindCacheEntry unwind_cache[N_UNWIND_CACHE];
+static UInt unwind_cache_stamp      = 0;
+static UInt unwind_cache_generation = 0;
+
+static inline UWord unwind_cache_hash ( Addr ip, Addr sp, Addr fp )
+{
+   UWord h = ip ^ (sp << 5) ^ (sp >> 4) ^ (fp << 11);
+   h ^= h >> 13;
+   return h & (N_UNWIND_CACHE - 1);
+}
+
+static void unwind_cache_check_generation ( void )
+{
+   if (UNLIKELY(unwind_cache_generation != VG_(debuginfo_generation)())) {
+      unwind_cache_generation = VG_(debuginfo_generation)();
+      VG_(memset)(unwind_cache, 0, sizeof(unwind_cache));
+   }
+}
+
+/* If the unwind state *ip, *sp, *fp is in the cache, append the
+   callers' frames to ips/sps/fps from index i on, as far as they are
+   still valid, and set the unwind state to that after the last frame
+   appended.  Returns the new number of frames. */
+static UInt unwind_cache_use ( /*MOD*/Addr* ip, /*MOD*/Addr* sp,
+                               /*MOD*/Addr* fp,
+                               /*OUT*/Addr* ips, /*OUT*/Addr* sps,
+                               /*OUT*/Addr* fps,
+                               UInt i, UInt max_n_ips,
+                               Addr fp_min, Addr fp_max )
+{
+   const UnwindCacheEntry* e = &unwind_cache[unwind_cache_hash(*ip,*sp,*fp)];
+   const UnwindCacheEntry* p;
+
+   if (e->stamp == 0 || e->ip != *ip || e->sp != *sp || e->fp != *fp)
+      return i;
+
+   while (e->parent != 0 && i < max_n_ips) {
+      p = &unwind_cache[e->parent - 1];
+      if (p->stamp != e->parent_stamp
+          || p->sp <= e->sp
+          || p->sp - sizeof(Addr) < fp_min
+          || p->sp - sizeof(Addr) > fp_max
+          || ((Addr*)p->sp)[-1] != p->ip + 1)
+         break;
+      ips[i] = p->ip;
+      sps[i] = p->sp;
+      fps[i] = p->fp;
+      i++;
+      e = p;
+   }
+   *ip = e->ip;
+   *sp = e->sp;
+   *fp = e->fp;
+   return i;
+}
+
+/* Record frames [from, n) of a stack trace in the cache, each linked to
+   its caller.  If the trace was cut short at max_n_ips frames, the
+   outermost frame keeps the caller it may already have in the cache. */
+static void unwind_cache_add ( const Addr* ips, const Addr* sps,
+                               const Addr* fps, UInt from, UInt n,
+                               Bool truncated )
+{
+   UInt j;
+   UInt parent = 0, parent_stamp = 0;
+   UWord h;
+   UnwindCacheEntry* e;
+
+   for (j = n; j > from; j--) {
+      h = unwind_cache_hash(ips[j-1], sps[j-1], fps[j-1]);
+      e = &unwind_cache[h];
+      if (e->stamp != 0 && e->ip == ips[j-1] && e->sp == sps[j-1]
+          && e->fp == fps[j-1]) {
+         if (j < n || !truncated) {
+            e->parent       = parent;
+            e->parent_stamp = parent_stamp;
+         }
+      } else {
+         unwind_cache_stamp++;
+         if (unwind_cache_stamp == 0)
+            unwind_cache_stamp = 1;
+         e->ip           = ips[j-1];
+         e->sp           = sps[j-1];
+         e->fp           = fps[j-1];
+         e->stamp        = unwind_cache_stamp;
+         e->parent       = parent;
+         e->parent_stamp = parent_stamp;
+      }
+      parent       = h + 1;
+      parent_stamp = e->stamp;
+   }
+}
+
+#endif
+
 /* ------------------------ x86 ------------------------- */
 
 #if defined(VGP_x86_linux) || defined(VGP_x86_darwin) \
@@ -261,6 +397,16 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
       FPO_info_present = VG_(FPO_info_present)();
    }
 
+   /* The unwind cache needs the sp and fp of each frame.  It cannot
+      be used when merging recursive frames, as that rewrites ips. */
+   const Bool use_ucache = cmrf == 0;
+   Addr l_sps[max_n_ips], l_fps[max_n_ips];
+   if (use_ucache) {
+      unwind_cache_check_generation();
+      if (!sps) sps = l_sps;
+      if (!fps) fps = l_fps;
+   }
+
 
    /* Loop unwinding the stack. Note that the IP value we get on
     * each pass (whether from CFI info or a stack frame) is a
@@ -283,11 +429,27 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
    i = 1;
    if (do_stats) stats.nr++;
 
+   const UInt i_first = i;
+   UInt i_ucache = i; // nr of frames when the cache was last looked at
+
    while (True) {
 
       if (i >= max_n_ips)
          break;
 
+      if (use_ucache && i != i_ucache) {
+         i_ucache = unwind_cache_use( &uregs.xip, &uregs.xsp, &uregs.xbp,
+                                      ips, sps, fps, i, max_n_ips,
+                                      fp_min, fp_max );
+         if (i_ucache != i) {
+            if (debug)
+               VG_(printf)("     ipsU[%d..%u] from unwind cache\n",
+                           i, i_ucache-1);
+            i = i_ucache;
+            continue;
+         }
+      }
+
       UWord hash = uregs.xip % N_FP_CF_VERIF;
       Addr xip_verif = uregs.xip ^ fp_CF_verif_cache [hash];
       if (debug)
@@ -485,6 +647,8 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
                  stats.CF, stats.xi, stats.xs, stats.xb,
                  stats.Ck, stats.MS);
    }
+   if (use_ucache)
+      unwind_cache_add(ips, sps, fps, i_first, i, i >= max_n_ips);
    n_found = i;
    return n_found;
 }
@@ -564,6 +728,16 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
    } 
 #  endif
 
+   /* The unwind cache needs the sp and fp of each frame.  It cannot
+      be used when merging recursive frames, as that rewrites ips. */
+   const Bool use_ucache = cmrf == 0;
+   Addr l_sps[max_n_ips], l_fps[max_n_ips];
+   if (use_ucache) {
+      unwind_cache_check_generation();
+      if (!sps) sps = l_sps;
+      if (!fps) fps = l_fps;
+   }
+
    /* fp is %rbp.  sp is %rsp.  ip is %rip. */
 
    ips[0] = uregs.xip;
@@ -590,6 +764,9 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
       i++;
    }
 #  endif
+
+   const UInt i_first = i;
+   UInt i_ucache = i; // nr of frames when the cache was last looked at
        
    /* Loop unwinding the stack. Note that the IP value we get on
     * each pass (whether from CFI info or a stack frame) is a
@@ -612,6 +789,19 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
       if (i >= max_n_ips)
          break;
 
+      if (use_ucache && i != i_ucache) {
+         i_ucache = unwind_cache_use( &uregs.xip, &uregs.xsp, &uregs.xbp,
+                                      ips, sps, fps, i, max_n_ips,
+                                      fp_min, fp_max );
+         if (i_ucache != i) {
+            if (debug)
+               VG_(printf)("     ipsU[%d..%u] from unwind cache\n",
+                           i, i_ucache-1);
+            i = i_ucache;
+            continue;
+         }
+      }
+
       old_xsp = uregs.xsp;
 
       /* Try to derive a new (ip,sp,fp) triple from the current set. */
@@ -707,6 +897,8 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
       break;
    }
 
+   if (use_ucache)
+      unwind_cache_add(ips, sps, fps, i_first, i, i >= max_n_ips);
    n_found = i;
    return n_found;
 }
@@ -1682,6 +1874,248 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
 /*---                                                      ---*/
 /*------------------------------------------------------------*/
 
+/*------------------------------------------------------------*/
+/*--- Shadow call stack (--shadow-call-stack=yes)          ---*/
+/*------------------------------------------------------------*/
+
+/* With --shadow-call-stack=yes, each block ending in a call reports
+   the call to VG_(shadow_call_stack_push), with the SP pointing at
+   the return address just pushed.  For each thread, these return
+   address slots are kept in a shadow stack, from which
+   VG_(get_StackTrace) copies the frames without unwinding anything.
+   This relies on the call instruction storing the return address on
+   the stack, so it is only available on x86 and amd64.
+
+   Each block ending in a return reports the SP after the return to
+   VG_(shadow_call_stack_ret), which pops the frames whose slot is now
+   below the SP.  Frames left without returning, by longjmp or a C++
+   exception, are popped lazily, once the SP is above their slot when
+   a call is made or a stack trace is taken.  A frame whose slot no
+   longer holds its return address has been left in some other way
+   (and could not be unwound either): it is dropped when found.
+
+   A signal handler is not called, so VG_(shadow_call_stack_signal)
+   pushes a frame for the interrupted code when the signal frame is
+   built.  The handler may run on another stack.
+
+   A call made far below the newest frame, or far above the frames it
+   pops, means that the thread switched stacks, e.g. to run a
+   coroutine.  As the frames of the other stack are not all known,
+   the thread's shadow stack is then given up, and its stack traces
+   are unwound as usual. */
+
+typedef
+   struct {
+      Addr sp;       // address of the return address
+      Addr ra;       // the return address
+      Addr ip;       // what to show for the frame
+      Addr cfa;      // the SP after returning
+      Bool signal;   // signal frame: ip and cfa are the interrupted ones
+   }
+   ShadowFrame;
+
+typedef
+   struct {
+      ShadowFrame* frames;
+      UInt n_frames;
+      UInt size;
+      Bool used;     // has had frames
+      Bool broken;   // switched stacks, do not use
+   }
+   ShadowCallStack;
+
+static ShadowCallStack* shadow_call_stacks = NULL; // [VG_N_THREADS]
+
+static ShadowCallStack* get_shadow_call_stack ( ThreadId tid )
+{
+   if (UNLIKELY(shadow_call_stacks == NULL))
+      shadow_call_stacks = VG_(calloc)("stacktrace.gscs.1", VG_N_THREADS,
+                                       sizeof(ShadowCallStack));
+   return &shadow_call_stacks[tid];
+}
+
+static void push_shadow_frame ( ShadowCallStack* scs, Addr sp, Addr ra,
+                                Addr ip, Addr cfa, Bool signal )
+{
+   ShadowFrame* f;
+
+   if (scs->n_frames == scs->size) {
+      scs->size = scs->size == 0 ? 256 : 2 * scs->size;
+      scs->frames = VG_(realloc)("stacktrace.psf.1", scs->frames,
+                                 scs->size * sizeof(ShadowFrame));
+   }
+   f = &scs->frames[scs->n_frames++];
+   f->sp     = sp;
+   f->ra     = ra;
+   f->ip     = ip;
+   f->cfa    = cfa;
+   f->signal = signal;
+   scs->used = True;
+}
+
+VG_REGPARM(1)
+void VG_(shadow_call_stack_push) ( Addr sp )
+{
+   ShadowCallStack* scs = get_shadow_call_stack(VG_(get_running_tid)());
+   const Addr max_frame = (Addr)VG_(clo_max_stackframe);
+   Addr ra;
+   UInt j;
+
+   if (scs->broken)
+      return;
+
+   while (True) {
+      /* Pop the frames which have returned. */
+      const ShadowFrame* popped = NULL;
+      Bool popped_signal = False;
+      while (scs->n_frames > 0 && scs->frames[scs->n_frames-1].sp <= sp) {
+         popped = &scs->frames[--scs->n_frames];
+         popped_signal |= popped->signal;
+      }
+      if (popped && !popped_signal && sp - popped->sp > max_frame) {
+         scs->broken = True;
+         return;
+      }
+      if (scs->n_frames == 0
+          || scs->frames[scs->n_frames-1].sp - sp <= max_frame)
+         break;
+
+      /* Far below the newest frame.  Unless this is the code
+         interrupted by a signal, back from a handler which ran on
+         another stack, the thread has switched stacks. */
+      for (j = scs->n_frames; j > 0 && !scs->frames[j-1].signal; j--)
+         ;
+      if (j == 0) {
+         scs->broken = True;
+         return;
+      }
+      scs->n_frames = j - 1;
+   }
+
+   ra = *(Addr*)sp;
+   push_shadow_frame(scs, sp, ra, ra - 1, sp + sizeof(Addr), False);
+}
+
+VG_REGPARM(1)
+void VG_(shadow_call_stack_ret) ( Addr sp )
+{
+   ShadowCallStack* scs = get_shadow_call_stack(VG_(get_running_tid)());
+   const Addr max_frame = (Addr)VG_(clo_max_stackframe);
+   const ShadowFrame* popped = NULL;
+
+   if (scs->broken)
+      return;
+
+   /* Pop the frames which have returned.  The frames under a signal
+      frame are those of the interrupted code, which may be on another
+      stack: they are left to the next call. */
+   while (scs->n_frames > 0 && scs->frames[scs->n_frames-1].sp < sp) {
+      popped = &scs->frames[--scs->n_frames];
+      if (popped->signal)
+         return;
+   }
+
+   /* Far above the frame returned from: the thread has switched
+      stacks. */
+   if (popped && sp - popped->sp > max_frame)
+      scs->broken = True;
+}
+
+void VG_(shadow_call_stack_signal) ( ThreadId tid, Addr ip, Addr sp )
+{
+   ShadowCallStack* scs;
+   Addr handler_sp;
+
+   if (!VG_(clo_shadow_call_stack))
+      return;
+   scs = get_shadow_call_stack(tid);
+   if (scs->broken)
+      return;
+
+   /* Pop the frames which have returned.  The handler may be on
+      another stack, so go by the interrupted sp. */
+   while (scs->n_frames > 0 && scs->frames[scs->n_frames-1].sp < sp)
+      scs->n_frames--;
+
+   /* The signal frame starts with the address the handler returns to. */
+   handler_sp = VG_(get_SP)(tid);
+   push_shadow_frame(scs, handler_sp, *(Addr*)handler_sp, ip, sp, True);
+}
+
+void VG_(shadow_call_stack_clear) ( ThreadId tid )
+{
+   ShadowCallStack* scs;
+
+   if (shadow_call_stacks == NULL)
+      return;
+   scs = &shadow_call_stacks[tid];
+   scs->n_frames = 0;
+   scs->used     = False;
+   scs->broken   = False;
+}
+
+/* Take the stack trace of thread tid, at ip and sp, from its shadow
+   call stack.  Returns 0 if the shadow call stack cannot be used. */
+static UInt get_StackTrace_from_shadow_call_stack ( ThreadId tid,
+                                                    /*OUT*/Addr* ips,
+                                                    UInt max_n_ips,
+                                                    /*OUT*/Addr* sps,
+                                                    Addr ip, Addr sp,
+                                                    Addr stack_highest_byte )
+{
+   const Int  cmrf      = VG_(clo_merge_recursive_frames);
+   const Addr max_frame = (Addr)VG_(clo_max_stackframe);
+   ShadowCallStack* scs;
+   const ShadowFrame* f;
+   Addr newer_sp;
+   Bool newer_signal;
+   UInt i, j;
+
+   if (shadow_call_stacks == NULL)
+      return 0;
+   scs = &shadow_call_stacks[tid];
+   if (scs->broken || !scs->used)
+      return 0;
+
+   /* Pop the frames which have returned. */
+   while (scs->n_frames > 0 && scs->frames[scs->n_frames-1].sp < sp)
+      scs->n_frames--;
+
+   ips[0] = ip;
+   if (sps) sps[0] = sp;
+   i = 1;
+   newer_sp     = sp;
+   newer_signal = False;
+   j = scs->n_frames;
+   while (j > 0 && i < max_n_ips) {
+      f = &scs->frames[j-1];
+      /* Frames too far apart mean the thread is not on the stack the
+         shadow stack thinks it is on, e.g. it just returned from a
+         signal handler which ran on another stack. */
+      if (!newer_signal && f->sp - newer_sp > max_frame)
+         return 0;
+      if (!((f->sp >= sp && f->sp <= stack_highest_byte + 1 - sizeof(Addr))
+            || VG_(am_is_valid_for_client)(f->sp, sizeof(Addr),
+                                           VKI_PROT_READ))
+          || *(Addr*)f->sp != f->ra) {
+         /* Left without returning. */
+         VG_(memmove)(&scs->frames[j-1], &scs->frames[j],
+                      (scs->n_frames - j) * sizeof(ShadowFrame));
+         scs->n_frames--;
+         j--;
+         continue;
+      }
+      ips[i] = f->ip;
+      if (sps) sps[i] = f->cfa;
+      i++;
+      RECURSIVE_MERGE(cmrf,ips,i);
+      newer_sp     = f->sp;
+      newer_signal = f->signal;
+      j--;
+   }
+   return i;
+}
+
 /*------------------------------------------------------------*/
 /*--- Exported functions.                                  ---*/
 /*------------------------------------------------------------*/
@@ -1735,6 +2169,16 @@ UInt VG_(get_StackTrace) ( ThreadId tid,
    /* Take into account the first_ip_delta. */
    startRegs.r_pc += (Long)(Word)first_ip_delta;
 
+   if (VG_(clo_shadow_call_stack) && fps == NULL) {
+      UInt n_found
+         = get_StackTrace_from_shadow_call_stack( tid, ips, max_n_ips, sps,
+                                                  (Addr)startRegs.r_pc,
+                                                  (Addr)startRegs.r_sp,
+                                                  stack_highest_byte );
+      if (n_found > 0)
+         return n_found;
+   }
+
    if (0)
       VG_(printf)("tid %u: stack_highest=0x%08lx ip=0x%010llx "
                   "sp=0x%010llx\n",
@@ -46,6 +46,7 @@
 
 #include "pub_core_signals.h"    // VG_(synth_fault_{perms,mapping}
 #include "pub_core_stacks.h"     // VG_(unknown_SP_update*)()
+#include "pub_core_stacktrace.h" // VG_(shadow_call_stack_push)()
 #include "pub_core_tooliface.h"  // VG_(tdict)
 
 #include "pub_core_translate.h"
@@ -664,6 +665,70 @@ IRSB* vg_SP_update_pass ( void*             closureV,
 #undef DO_DIE
 }
 
+/* With --shadow-call-stack=yes, a block ending in a call reports the
+   call to VG_(shadow_call_stack_push), with the SP at the end of the
+   block, which points at the return address just pushed.  Calls are
+   not chased into in this case (see m_main.c), so every call ends a
+   block.  A block ending in a return reports it to
+   VG_(shadow_call_stack_ret), with the SP after the return. */
+static
+IRSB* vg_shadow_call_stack_pass ( void*             closureV,
+                                  IRSB*             sb_in, 
+                                  const VexGuestLayout*   layout, 
+                                  const VexGuestExtents*  vge,
+                                  const VexArchInfo*      vai,
+                                  IRType            gWordTy, 
+                                  IRType            hWordTy )
+{
+   IRTemp   sp;
+   IRDirty* dcall;
+
+   if (sb_in->jumpkind != Ijk_Call && sb_in->jumpkind != Ijk_Ret)
+      return sb_in;
+
+   sp = newIRTemp(sb_in->tyenv, gWordTy);
+   addStmtToIRSB( sb_in, IRStmt_WrTmp( sp, IRExpr_Get(layout->offset_SP,
+                                                      gWordTy) ) );
+   if (sb_in->jumpkind == Ijk_Call) {
+      dcall = unsafeIRDirty_0_N( 
+                 1/*regparms*/, 
+                 "VG_(shadow_call_stack_push)", 
+                 VG_(fnptr_to_fnentry)( &VG_(shadow_call_stack_push) ),
+                 mkIRExprVec_1( IRExpr_RdTmp(sp) )
+              );
+      /* It reads the return address. */
+      dcall->mFx   = Ifx_Read;
+      dcall->mAddr = IRExpr_RdTmp(sp);
+      dcall->mSize = gWordTy == Ity_I64 ? 8 : 4;
+   } else {
+      dcall = unsafeIRDirty_0_N( 
+                 1/*regparms*/, 
+                 "VG_(shadow_call_stack_ret)", 
+                 VG_(fnptr_to_fnentry)( &VG_(shadow_call_stack_ret) ),
+                 mkIRExprVec_1( IRExpr_RdTmp(sp) )
+              );
+   }
+   addStmtToIRSB( sb_in, IRStmt_Dirty(dcall) );
+   return sb_in;
+}
+
+static
+IRSB* vg_SP_update_then_shadow_call_stack_pass (
+         void*             closureV,
+         IRSB*             sb_in, 
+         const VexGuestLayout*   layout, 
+         const VexGuestExtents*  vge,
+         const VexArchInfo*      vai,
+         IRType            gWordTy, 
+         IRType            hWordTy )
+{
+   return vg_shadow_call_stack_pass
+             (closureV,
+              vg_SP_update_pass(closureV, sb_in, layout, vge, vai,
+                                gWordTy, hWordTy),
+              layout, vge, vai, gWordTy, hWordTy);
+}
+
 /*------------------------------------------------------------*/
 /*--- Main entry point for the JITter.                     ---*/
 /*------------------------------------------------------------*/
@@ -1721,7 +1786,12 @@ Bool VG_(translate) ( ThreadId tid,
      vta.instrument1     = g;
    }
    /* No need for type kludgery here. */
-   vta.instrument2       = need_to_handle_SP_assignment()
+   if (VG_(clo_shadow_call_stack))
+      vta.instrument2    = need_to_handle_SP_assignment()
+                              ? vg_SP_update_then_shadow_call_stack_pass
+                              : vg_shadow_call_stack_pass;
+   else
+      vta.instrument2    = need_to_handle_SP_assignment()
                               ? vg_SP_update_pass
                               : NULL;
    vta.finaltidy         = VG_(needs).final_IR_tidy_pass
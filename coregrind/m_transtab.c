@@ -1534,7 +1534,10 @@ static void initialiseSector ( SECno sno )
       if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1)
          VG_(dmsg)("transtab: " "allocate sector %d\n", sno);
 
-      sres = VG_(am_mmap_anon_float_valgrind)( 8 * tc_sector_szQ );
+      /* The code cache and the tables of a sector are all over the
+         place in the TLB, so ask for them to be backed by huge pages
+         if --huge-pages= allows. */
+      sres = VG_(am_mmap_anon_float_valgrind_huge)( 8 * tc_sector_szQ );
       if (sr_isError(sres)) {
          VG_(out_of_memory_NORETURN)("initialiseSector(TC)", 
                                      8 * tc_sector_szQ );
@@ -1542,7 +1545,7 @@ static void initialiseSector ( SECno sno )
       }
       sec->tc = (ULong*)(Addr)sr_Res(sres);
 
-      sres = VG_(am_mmap_anon_float_valgrind)
+      sres = VG_(am_mmap_anon_float_valgrind_huge)
                 ( N_TTES_PER_SECTOR * sizeof(TTEntryC) );
       if (sr_isError(sres)) {
          VG_(out_of_memory_NORETURN)("initialiseSector(TTC)", 
@@ -1551,7 +1554,7 @@ static void initialiseSector ( SECno sno )
       }
       sec->ttC = (TTEntryC*)(Addr)sr_Res(sres);
 
-      sres = VG_(am_mmap_anon_float_valgrind)
+      sres = VG_(am_mmap_anon_float_valgrind_huge)
                 ( N_TTES_PER_SECTOR * sizeof(TTEntryH) );
       if (sr_isError(sres)) {
          VG_(out_of_memory_NORETURN)("initialiseSector(TTH)", 
@@ -1567,7 +1570,7 @@ static void initialiseSector ( SECno sno )
          add_to_empty_tt_list(sno, ei);
       }
 
-      sres = VG_(am_mmap_anon_float_valgrind)
+      sres = VG_(am_mmap_anon_float_valgrind_huge)
                 ( N_HTTES_PER_SECTOR * sizeof(TTEno) );
       if (sr_isError(sres)) {
          VG_(out_of_memory_NORETURN)("initialiseSector(HTT)", 
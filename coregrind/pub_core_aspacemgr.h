@@ -242,6 +242,12 @@ extern SysRes VG_(am_mmap_anon_float_client) ( SizeT length, Int prot );
    itself more address space when needed. */
 extern SysRes VG_(am_mmap_anon_float_valgrind)( SizeT cszB );
 
+/* Same, but back the mapping with huge pages if --huge-pages= asks
+   for it.  The mapping is then aligned to a huge page, and its length
+   rounded up to a multiple of the huge page size.  It should only be
+   unmapped as a whole. */
+extern SysRes VG_(am_mmap_anon_float_valgrind_huge)( SizeT cszB );
+
 /* Map privately a file at an unconstrained address for V, and update the
    segment array accordingly.  This is used by V for transiently
    mapping in object files to read their debug info.  */
@@ -311,6 +311,11 @@ extern UInt VG_(clo_max_threads);
    Note that the value is changeable by a gdbsrv command. */
 extern Int VG_(clo_merge_recursive_frames);
 
+/* Keep a shadow stack of the calls of each thread, and take stack
+   traces from it instead of unwinding the stack (x86 and amd64 only).
+   Default: NO */
+extern Bool VG_(clo_shadow_call_stack);
+
 /* Max number of sectors that will be used by the translation code cache. */
 extern UInt VG_(clo_num_transtab_sectors);
 
@@ -326,6 +331,19 @@ extern Addr VG_(clo_aspacem_minAddr);
    Will be rounded up to a page.. */
 extern Word VG_(clo_valgrind_stacksize);
 
+/* Should shadow memory and the translation cache be backed by huge
+   pages?  Transparent huge pages are asked for with madvise, explicit
+   ones are mapped with MAP_HUGETLB, falling back to transparent ones
+   when none are available.  Linux only.  Default: NO */
+typedef
+   enum {
+      Vg_HugePagesNo,
+      Vg_HugePagesTransparent,
+      Vg_HugePagesExplicit
+   }
+   VgHugePages;
+extern VgHugePages VG_(clo_huge_pages);
+
 /* Delay startup to allow GDB to be attached?  Default: NO */
 extern Bool VG_(clo_wait_for_gdb);
 
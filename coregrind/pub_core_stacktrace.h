@@ -57,6 +57,17 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
                                const UnwindStartRegs* startRegs,
                                Addr fp_max_orig );
 
+// The shadow call stacks kept with --shadow-call-stack=yes.  The
+// instrumentation reports each call to VG_(shadow_call_stack_push),
+// with the SP pointing at the pushed return address, and each return
+// to VG_(shadow_call_stack_ret), with the SP after it.  The signal
+// machinery reports each signal frame built for a handler of thread
+// tid, interrupted at ip and sp.
+extern VG_REGPARM(1) void VG_(shadow_call_stack_push) ( Addr sp );
+extern VG_REGPARM(1) void VG_(shadow_call_stack_ret) ( Addr sp );
+extern void VG_(shadow_call_stack_signal) ( ThreadId tid, Addr ip, Addr sp );
+extern void VG_(shadow_call_stack_clear) ( ThreadId tid );
+
 #endif   // __PUB_CORE_STACKTRACE_H
 
 /*--------------------------------------------------------------------*/
@@ -355,7 +355,7 @@ void acquire_lock (int fd, int valgrind_pid)
       assert(0);
 }
 
-#define PBUFSIZ 16384 /* keep in sync with server.h */
+#define PBUFSIZ 65536 /* keep in sync with server.h */
 
 /* read some characters from fd.
    Returns the nr of characters read, -1 if error.
@@ -151,7 +151,6 @@ void DRD_(bm_access_range_load)(struct bitmap* const bm, Addr a1, Addr a2)
       Addr b_start;
       Addr b_end;
       struct bitmap2* bm2;
-      UWord b0;
 
       b_next = first_address_with_higher_msb(b);
       if (b_next > a2)
@@ -181,19 +180,16 @@ void DRD_(bm_access_range_load)(struct bitmap* const bm, Addr a1, Addr a2)
 
       if (address_lsb(b_start) == 0 && address_lsb(b_end) == 0)
       {
-         unsigned k;
-
-         for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+         if (! (bm2->full & BM2_FULL_R))
          {
-            bm2->bm1.bm0_r[k] = ~(UWord)0;
+            VG_(memset)(bm2->bm1.bm0_r, ~0, sizeof(bm2->bm1.bm0_r));
+            bm2->full |= BM2_FULL_R;
          }
       }
       else
       {
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         {
-            bm0_set(bm2->bm1.bm0_r, b0);
-         }
+         bm0_set_run(bm2->bm1.bm0_r, address_lsb(b_start),
+                     address_lsb(b_end - 1) + 1);
       }
    }
 }
@@ -248,7 +244,6 @@ void DRD_(bm_access_range_store)(struct bitmap* const bm,
       Addr b_start;
       Addr b_end;
       struct bitmap2* bm2;
-      UWord b0;
 
       b_next = first_address_with_higher_msb(b);
       if (b_next > a2)
@@ -278,19 +273,16 @@ void DRD_(bm_access_range_store)(struct bitmap* const bm,
 
       if (address_lsb(b_start) == 0 && address_lsb(b_end) == 0)
       {
-         unsigned k;
-
-         for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+         if (! (bm2->full & BM2_FULL_W))
          {
-            bm2->bm1.bm0_w[k] = ~(UWord)0;
+            VG_(memset)(bm2->bm1.bm0_w, ~0, sizeof(bm2->bm1.bm0_w));
+            bm2->full |= BM2_FULL_W;
          }
       }
       else
       {
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         {
-            bm0_set(bm2->bm1.bm0_w, b0);
-         }
+         bm0_set_run(bm2->bm1.bm0_w, address_lsb(b_start),
+                     address_lsb(b_end - 1) + 1);
       }
    }
 }
@@ -348,17 +340,9 @@ Bool DRD_(bm_has_any_load_g)(struct bitmap* const bm)
 
    VG_(OSetGen_ResetIter)(bm->oset);
    for ( ; (bm2 = VG_(OSetGen_Next)(bm->oset)) != NULL; ) {
-      Addr b_start;
-      Addr b_end;
-      UWord b0;
-      const struct bitmap1* const p1 = &bm2->bm1;
-
-      b_start = make_address(bm2->addr, 0);
-      b_end = make_address(bm2->addr + 1, 0);
-
-      for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         if (bm0_is_set(p1->bm0_r, b0))
-            return True;
+      if ((bm2->full & BM2_FULL_R)
+          || bm0_is_any_set_run(bm2->bm1.bm0_r, 0, 1U << ADDR_LSB_BITS))
+         return True;
    }
    return False;
 }
@@ -384,7 +368,6 @@ DRD_(bm_has_any_load)(struct bitmap* const bm, const Addr a1, const Addr a2)
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
          if (make_address(bm2->addr, 0) < a1)
@@ -404,12 +387,11 @@ DRD_(bm_has_any_load)(struct bitmap* const bm, const Addr a1, const Addr a2)
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if ((bm2->full & BM2_FULL_R)
+             || bm0_is_any_set_run(p1->bm0_r, address_lsb(b_start),
+                                   address_lsb(b_end - 1) + 1))
          {
-            if (bm0_is_set(p1->bm0_r, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -437,7 +419,6 @@ Bool DRD_(bm_has_any_store)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
          if (make_address(bm2->addr, 0) < a1)
@@ -457,12 +438,11 @@ Bool DRD_(bm_has_any_store)(struct bitmap* const bm,
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if ((bm2->full & BM2_FULL_W)
+             || bm0_is_any_set_run(p1->bm0_w, address_lsb(b_start),
+                                   address_lsb(b_end - 1) + 1))
          {
-            if (bm0_is_set(p1->bm0_w, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -492,7 +472,6 @@ Bool DRD_(bm_has_any_access)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
          if (make_address(bm2->addr, 0) < a1)
@@ -512,16 +491,13 @@ Bool DRD_(bm_has_any_access)(struct bitmap* const bm,
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if (bm2->full
+             || bm0_is_any_set_run(p1->bm0_r, address_lsb(b_start),
+                                   address_lsb(b_end - 1) + 1)
+             || bm0_is_any_set_run(p1->bm0_w, address_lsb(b_start),
+                                   address_lsb(b_end - 1) + 1))
          {
-            /*
-             * Note: the statement below uses a binary or instead of a logical
-             * or on purpose.
-             */
-            if (bm0_is_set(p1->bm0_r, b0) | bm0_is_set(p1->bm0_w, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -582,6 +558,8 @@ void DRD_(bm_clear)(struct bitmap* const bm, Addr a1, Addr a2)
       if (p2 == 0)
          continue;
 
+      p2->full = 0;
+
       c = b;
       /* If the first address in the bitmap that must be cleared does not */
       /* start on an UWord boundary, start clearing the first addresses.  */
@@ -659,6 +637,8 @@ void DRD_(bm_clear_load)(struct bitmap* const bm, Addr a1, Addr a2)
       if (p2 == 0)
          continue;
 
+      p2->full &= ~BM2_FULL_R;
+
       c = b;
       /* If the first address in the bitmap that must be cleared does not */
       /* start on an UWord boundary, start clearing the first addresses.  */
@@ -741,6 +721,8 @@ void DRD_(bm_clear_store)(struct bitmap* const bm,
       if (p2 == 0)
          continue;
 
+      p2->full &= ~BM2_FULL_W;
+
       c = b;
       /* If the first address in the bitmap that must be cleared does not */
       /* start on an UWord boundary, start clearing the first addresses.  */
@@ -825,7 +807,6 @@ Bool DRD_(bm_has_conflict_with)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
          if (make_address(bm2->addr, 0) < a1)
@@ -845,23 +826,25 @@ Bool DRD_(bm_has_conflict_with)(struct bitmap* const bm,
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if (access_type == eLoad)
          {
-            if (access_type == eLoad)
+            if ((bm2->full & BM2_FULL_W)
+                || bm0_is_any_set_run(p1->bm0_w, address_lsb(b_start),
+                                      address_lsb(b_end - 1) + 1))
             {
-               if (bm0_is_set(p1->bm0_w, b0))
-               {
-                  return True;
-               }
+               return True;
             }
-            else
+         }
+         else
+         {
+            tl_assert(access_type == eStore);
+            if (bm2->full
+                || bm0_is_any_set_run(p1->bm0_r, address_lsb(b_start),
+                                      address_lsb(b_end - 1) + 1)
+                || bm0_is_any_set_run(p1->bm0_w, address_lsb(b_start),
+                                      address_lsb(b_end - 1) + 1))
             {
-               tl_assert(access_type == eStore);
-               if (bm0_is_set(p1->bm0_r, b0)
-                   | bm0_is_set(p1->bm0_w, b0))
-               {
-                  return True;
-               }
+               return True;
             }
          }
       }
@@ -1151,6 +1134,36 @@ void DRD_(bm_remove_cleared_marked)(struct bitmap* bm)
    }
 }
 
+/**
+ * Compute a mask with one bit set for each address in UWord k of bm1l and
+ * bm1r for which the access pattern is RW, WR or WW. This is the word-
+ * parallel equivalent of applying HAS_RACE() to each address.
+ */
+static __inline__
+UWord bm1_race_mask(const struct bitmap1* const bm1l,
+                    const struct bitmap1* const bm1r, const unsigned k)
+{
+   return (bm1l->bm0_w[k] & (bm1r->bm0_r[k] | bm1r->bm0_w[k]))
+      | (bm1r->bm0_w[k] & (bm1l->bm0_r[k] | bm1l->bm0_w[k]));
+}
+
+/**
+ * Report whether there is any address for which bm1l and bm1r have a
+ * conflicting access. The loop below has no data-dependent branches such that
+ * the compiler can vectorize it.
+ */
+static
+Bool bm1_has_any_race(const struct bitmap1* const bm1l,
+                      const struct bitmap1* const bm1r)
+{
+   UWord result = 0;
+   unsigned k;
+
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+      result |= bm1_race_mask(bm1l, bm1r, k);
+   return result != 0;
+}
+
 /**
  * Report whether there are any RW / WR / WW patterns in lhs and rhs.
  * @param lhs First bitmap.
@@ -1185,18 +1198,20 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
       bm1l = &bm2l->bm1;
       bm1r = &bm2r->bm1;
 
+      if (! bm1_has_any_race(bm1l, bm1r))
+         continue;
+
       for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
       {
+         UWord const race_mask = bm1_race_mask(bm1l, bm1r, k);
          unsigned b;
+
+         if (race_mask == 0)
+            continue;
          for (b = 0; b < BITS_PER_UWORD; b++)
          {
-            UWord const access_mask
-               = ((bm1l->bm0_r[k] & bm0_mask(b)) ? LHS_R : 0)
-               | ((bm1l->bm0_w[k] & bm0_mask(b)) ? LHS_W : 0)
-               | ((bm1r->bm0_r[k] & bm0_mask(b)) ? RHS_R : 0)
-               | ((bm1r->bm0_w[k] & bm0_mask(b)) ? RHS_W : 0);
             Addr const a = make_address(bm2l->addr, k * BITS_PER_UWORD | b);
-            if (HAS_RACE(access_mask) && ! DRD_(is_suppressed)(a, a + 1))
+            if ((race_mask & bm0_mask(b)) && ! DRD_(is_suppressed)(a, a + 1))
             {
                return 1;
             }
@@ -1269,12 +1284,27 @@ void bm2_merge(struct bitmap2* const bm2l, const struct bitmap2* const bm2r)
 
    s_bitmap2_merge_count++;
 
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   if (bm2l->full & BM2_FULL_R)
+      ;
+   else if (bm2r->full & BM2_FULL_R)
+      VG_(memset)(bm2l->bm1.bm0_r, ~0, sizeof(bm2l->bm1.bm0_r));
+   else
    {
-      bm2l->bm1.bm0_r[k] |= bm2r->bm1.bm0_r[k];
+      for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+      {
+         bm2l->bm1.bm0_r[k] |= bm2r->bm1.bm0_r[k];
+      }
    }
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   if (bm2l->full & BM2_FULL_W)
+      ;
+   else if (bm2r->full & BM2_FULL_W)
+      VG_(memset)(bm2l->bm1.bm0_w, ~0, sizeof(bm2l->bm1.bm0_w));
+   else
    {
-      bm2l->bm1.bm0_w[k] |= bm2r->bm1.bm0_w[k];
+      for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+      {
+         bm2l->bm1.bm0_w[k] |= bm2r->bm1.bm0_w[k];
+      }
    }
+   bm2l->full |= bm2r->full;
 }
@@ -297,6 +297,40 @@ static __inline__ void bm0_clear_range(UWord* bm0,
    }
 }
 
+/**
+ * Set the bits corresponding to all of the addresses in range
+ * [ a0_start << ADDR_IGNORED_BITS .. a0_end << ADDR_IGNORED_BITS [
+ * in bitmap bm0, one UWord at a time. In contrast with bm0_set_range() the
+ * range may span multiple UWords, and a0_end may be equal to
+ * 1 << ADDR_LSB_BITS.
+ */
+static __inline__ void bm0_set_run(UWord* bm0,
+                                   const UWord a0_start, const UWord a0_end)
+{
+   UWord first, last, lo_mask, hi_mask, k;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a0_start <= a0_end);
+   tl_assert(a0_end <= (1U << ADDR_LSB_BITS));
+#endif
+   if (a0_start == a0_end)
+      return;
+
+   first   = uword_msb(a0_start);
+   last    = uword_msb(a0_end - 1);
+   lo_mask = ~(UWord)0 << uword_lsb(a0_start);
+   hi_mask = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a0_end - 1));
+   if (first == last)
+   {
+      bm0[first] |= lo_mask & hi_mask;
+      return;
+   }
+   bm0[first] |= lo_mask;
+   for (k = first + 1; k < last; k++)
+      bm0[k] = ~(UWord)0;
+   bm0[last] |= hi_mask;
+}
+
 /** Test whether the bit corresponding to address a is set in bitmap bm0. */
 static __inline__ UWord bm0_is_set(const UWord* bm0, const UWord a)
 {
@@ -323,6 +357,36 @@ static __inline__ UWord bm0_is_any_set(const UWord* bm0,
    return (bm0[uword_msb(a)] & ((((UWord)1 << size) - 1) << uword_lsb(a)));
 }
 
+/**
+ * Return a nonzero value if a bit corresponding to any of the addresses in
+ * range [ a0_start << ADDR_IGNORED_BITS .. a0_end << ADDR_IGNORED_BITS [
+ * is set in bm0. The range may span multiple UWords.
+ */
+static __inline__ UWord bm0_is_any_set_run(const UWord* bm0,
+                                           const UWord a0_start,
+                                           const UWord a0_end)
+{
+   UWord first, last, lo_mask, hi_mask, k, result;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a0_start <= a0_end);
+   tl_assert(a0_end <= (1U << ADDR_LSB_BITS));
+#endif
+   if (a0_start == a0_end)
+      return 0;
+
+   first   = uword_msb(a0_start);
+   last    = uword_msb(a0_end - 1);
+   lo_mask = ~(UWord)0 << uword_lsb(a0_start);
+   hi_mask = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a0_end - 1));
+   if (first == last)
+      return bm0[first] & lo_mask & hi_mask;
+   result = (bm0[first] & lo_mask) | (bm0[last] & hi_mask);
+   for (k = first + 1; k < last; k++)
+      result |= bm0[k];
+   return result;
+}
+
 
 
 /*********************************************************************/
@@ -330,11 +394,22 @@ static __inline__ UWord bm0_is_any_set(const UWord* bm0,
 /*********************************************************************/
 
 
+/*
+ * Run summary flags for bitmap2::full. A flag is only set if all the bits of
+ * the corresponding bitmap1 array are set. Since a large contiguous access
+ * sets all bits of a second level bitmap at once, these flags allow to skip
+ * scanning and merging such bitmaps word by word. A flag may be clear even
+ * if all bits are set.
+ */
+#define BM2_FULL_R (1U << 0) ///< All bits of bm1.bm0_r are set.
+#define BM2_FULL_W (1U << 1) ///< All bits of bm1.bm0_w are set.
+
 /* Second level bitmap. */
 struct bitmap2
 {
    Addr           addr;   ///< address_msb(...)
    Bool           recalc;
+   UChar          full;   ///< Zero or more BM2_FULL_* flags.
    struct bitmap1 bm1;
 };
 
@@ -548,6 +623,7 @@ void bm2_clear(struct bitmap2* const bm2)
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(bm2);
 #endif
+   bm2->full = 0;
    VG_(memset)(&bm2->bm1, 0, sizeof(bm2->bm1));
 }
 
@@ -572,6 +648,7 @@ struct bitmap2* bm2_insert(struct bitmap* const bm, const UWord a1)
 
    bm2 = VG_(OSetGen_AllocNode)(bm->oset, sizeof(*bm2));
    bm2->addr = a1;
+   bm2->full = 0;
    VG_(OSetGen_Insert)(bm->oset, bm2);
 
    bm_update_cache(bm, a1, bm2);
@@ -586,6 +663,7 @@ struct bitmap2* bm2_insert_copy(struct bitmap* const bm,
    struct bitmap2* bm2_copy;
 
    bm2_copy = bm2_insert(bm, bm2->addr);
+   bm2_copy->full = bm2->full;
    VG_(memcpy)(&bm2_copy->bm1, &bm2->bm1, sizeof(bm2->bm1));
    return bm2_copy;
 }
@@ -793,6 +793,9 @@ static void DRD_(fini)(Int exitcode)
                    "           %llu partial updates because of thread join"
                    " operations.\n",
                    pu_join);
+      VG_(message)(Vg_UserMsg,
+                   "           %llu partial updates only added segments.\n",
+                   DRD_(thread_get_update_conflict_set_add_only_count)());
       VG_(message)(Vg_UserMsg,
                    " segments: created %llu segments, max %llu alive,\n",
                    DRD_(sg_get_segments_created_count)(),
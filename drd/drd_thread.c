@@ -43,6 +43,12 @@
 
 
 
+/* Local type definitions. */
+
+/** Action performed by thread_conflict_set_delta(). */
+typedef enum { eCsCount, eCsMerge, eCsMark } ConflictSetDeltaOp;
+
+
 /* Local functions. */
 
 static void thread_append_segment(const DrdThreadId tid, Segment* const sg);
@@ -58,6 +64,7 @@ static ULong    s_context_switch_count;
 static ULong    s_discard_ordered_segments_count;
 static ULong    s_compute_conflict_set_count;
 static ULong    s_update_conflict_set_count;
+static ULong    s_update_conflict_set_add_only_count;
 static ULong    s_update_conflict_set_new_sg_count;
 static ULong    s_update_conflict_set_sync_count;
 static ULong    s_update_conflict_set_join_count;
@@ -1521,6 +1528,12 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
                                   "conflict set: [%u] ignoring segment %s\n",
                                   j, str);
                      VG_(free)(str);
+                  } else if (DRD_(vc_lte)(&q->vc, &p->vc)) {
+                     /*
+                      * The segments of a thread are ordered, so all segments
+                      * that precede q also precede p.
+                      */
+                     break;
                   }
                }
             }
@@ -1541,37 +1554,23 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
 }
 
 /**
- * Update the conflict set after the vector clock of thread tid has been
- * updated from old_vc to its current value, either because a new segment has
- * been created or because of a synchronization operation.
+ * Iterate over all segments of threads other than tid that either left or
+ * entered the conflict set of thread tid because its vector clock changed
+ * from old_vc into new_vc. Count the segments that entered the conflict set
+ * in *added and those that left it in *removed. Depending on op, either
+ * merge the bitmaps of the entered segments into the conflict set or mark
+ * the second-level bitmaps of the conflict set that are affected.
  */
-void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
-                                      const VectorClock* const old_vc)
+static void thread_conflict_set_delta(const DrdThreadId tid,
+                                      const VectorClock* const old_vc,
+                                      const VectorClock* const new_vc,
+                                      const ConflictSetDeltaOp op,
+                                      UInt* const added, UInt* const removed)
 {
-   const VectorClock* new_vc;
-   Segment* p;
    unsigned j;
 
-   tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
-             && tid != DRD_INVALID_THREADID);
-   tl_assert(old_vc);
-   tl_assert(tid == DRD_(g_drd_running_tid));
-   tl_assert(DRD_(g_conflict_set));
-
-   if (s_trace_conflict_set) {
-      HChar* str;
-
-      str = DRD_(vc_aprint)(DRD_(thread_get_vc)(tid));
-      VG_(message)(Vg_DebugMsg,
-                   "updating conflict set for thread %u with vc %s\n",
-                   tid, str);
-      VG_(free)(str);
-   }
-
-   new_vc = DRD_(thread_get_vc)(tid);
-   tl_assert(DRD_(vc_lte)(old_vc, new_vc));
-
-   DRD_(bm_unmark)(DRD_(g_conflict_set));
+   *added = 0;
+   *removed = 0;
 
    for (j = 0; j < DRD_N_THREADS; j++)
    {
@@ -1581,36 +1580,15 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
          continue;
 
       for (q = DRD_(g_threadinfo)[j].sg_last;
-           q && !DRD_(vc_lte)(&q->vc, new_vc);
+           q && !DRD_(vc_lte)(&q->vc, old_vc);
            q = q->thr_prev) {
-         const Bool included_in_old_conflict_set
-            = !DRD_(vc_lte)(old_vc, &q->vc);
-         const Bool included_in_new_conflict_set
-            = !DRD_(vc_lte)(new_vc, &q->vc);
-
-         if (UNLIKELY(s_trace_conflict_set)) {
-            HChar* str;
-
-            str = DRD_(vc_aprint)(&q->vc);
-            VG_(message)(Vg_DebugMsg,
-                         "conflict set: [%u] %s segment %s\n", j,
-                         included_in_old_conflict_set
-                         != included_in_new_conflict_set
-                         ? "merging" : "ignoring", str);
-            VG_(free)(str);
-         }
-         if (included_in_old_conflict_set != included_in_new_conflict_set)
-            DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
-      }
-
-      for ( ; q && !DRD_(vc_lte)(&q->vc, old_vc); q = q->thr_prev) {
          const Bool included_in_old_conflict_set
             = !DRD_(vc_lte)(old_vc, &q->vc);
          const Bool included_in_new_conflict_set
             = !DRD_(vc_lte)(&q->vc, new_vc)
             && !DRD_(vc_lte)(new_vc, &q->vc);
 
-         if (UNLIKELY(s_trace_conflict_set)) {
+         if (UNLIKELY(s_trace_conflict_set) && op == eCsCount) {
             HChar* str;
 
             str = DRD_(vc_aprint)(&q->vc);
@@ -1621,30 +1599,93 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
                          ? "merging" : "ignoring", str);
             VG_(free)(str);
          }
-         if (included_in_old_conflict_set != included_in_new_conflict_set)
+         if (included_in_old_conflict_set == included_in_new_conflict_set)
+            continue;
+         if (included_in_new_conflict_set)
+            (*added)++;
+         else
+            (*removed)++;
+         if (op == eCsMerge && included_in_new_conflict_set)
+            DRD_(bm_merge2)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+         else if (op == eCsMark)
             DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
       }
    }
+}
 
-   DRD_(bm_clear_marked)(DRD_(g_conflict_set));
+/**
+ * Update the conflict set after the vector clock of thread tid has been
+ * updated from old_vc to its current value, either because a new segment has
+ * been created or because of a synchronization operation. Only the segments
+ * that entered or left the conflict set are processed. If no segment left
+ * the conflict set, the bitmaps of the segments that entered it are merged
+ * into the conflict set directly. Otherwise all second-level bitmaps that
+ * may have been affected are recomputed.
+ */
+void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
+                                      const VectorClock* const old_vc)
+{
+   const VectorClock* new_vc;
+   Segment* p;
+   unsigned j;
+   UInt added, removed;
 
-   p = DRD_(g_threadinfo)[tid].sg_last;
-   for (j = 0; j < DRD_N_THREADS; j++) {
-      if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
-         Segment* q;
-         for (q = DRD_(g_threadinfo)[j].sg_last;
-              q && !DRD_(vc_lte)(&q->vc, &p->vc);
-              q = q->thr_prev) {
-            if (!DRD_(vc_lte)(&p->vc, &q->vc))
-               DRD_(bm_merge2_marked)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
-         }
-      }
+   tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
+             && tid != DRD_INVALID_THREADID);
+   tl_assert(old_vc);
+   tl_assert(tid == DRD_(g_drd_running_tid));
+   tl_assert(DRD_(g_conflict_set));
+
+   if (s_trace_conflict_set) {
+      HChar* str;
+
+      str = DRD_(vc_aprint)(DRD_(thread_get_vc)(tid));
+      VG_(message)(Vg_DebugMsg,
+                   "updating conflict set for thread %u with vc %s\n",
+                   tid, str);
+      VG_(free)(str);
    }
 
-   DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+   new_vc = DRD_(thread_get_vc)(tid);
+   tl_assert(DRD_(vc_lte)(old_vc, new_vc));
 
    s_update_conflict_set_count++;
 
+   thread_conflict_set_delta(tid, old_vc, new_vc, eCsCount, &added, &removed);
+
+   if (removed == 0)
+   {
+      s_update_conflict_set_add_only_count++;
+      if (added)
+         thread_conflict_set_delta(tid, old_vc, new_vc, eCsMerge,
+                                   &added, &removed);
+   }
+   else
+   {
+      DRD_(bm_unmark)(DRD_(g_conflict_set));
+
+      thread_conflict_set_delta(tid, old_vc, new_vc, eCsMark,
+                                &added, &removed);
+
+      DRD_(bm_clear_marked)(DRD_(g_conflict_set));
+
+      p = DRD_(g_threadinfo)[tid].sg_last;
+      for (j = 0; j < DRD_N_THREADS; j++) {
+         if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
+            Segment* q;
+            for (q = DRD_(g_threadinfo)[j].sg_last;
+                 q && !DRD_(vc_lte)(&q->vc, &p->vc);
+                 q = q->thr_prev) {
+               if (!DRD_(vc_lte)(&p->vc, &q->vc))
+                  DRD_(bm_merge2_marked)(DRD_(g_conflict_set),
+                                         DRD_(sg_bm)(q));
+            }
+         }
+      }
+
+      DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+   }
+
    if (s_trace_conflict_set_bm)
    {
       VG_(message)(Vg_DebugMsg, "[%u] updated conflict set:\n", tid);
@@ -1679,6 +1720,15 @@ ULong DRD_(thread_get_update_conflict_set_count)(void)
    return s_update_conflict_set_count;
 }
 
+/**
+ * Return how many partial conflict set updates only had to merge the bitmaps
+ * of segments that entered the conflict set.
+ */
+ULong DRD_(thread_get_update_conflict_set_add_only_count)(void)
+{
+   return s_update_conflict_set_add_only_count;
+}
+
 /**
  * Return how many times the conflict set has been updated partially
  * because a new segment has been created.
@@ -30,14 +30,71 @@
 #include "pub_tool_mallocfree.h"  // VG_(malloc), VG_(free)
 
 
+/* Local type definitions. */
+
+/**
+ * Header in front of the element array of a vector clock whose elements do
+ * not fit in VectorClock::preallocated. Has the same size as a VCElem such
+ * that the elements following it are properly aligned.
+ */
+typedef struct
+{
+   UInt refcnt; /**< number of vector clocks that share the array. */
+   UInt unused;
+} VCArrayHeader;
+
+
 /* Local function declarations. */
 
 static
 void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity);
+static void DRD_(vc_flatten)(VectorClock* const vc);
 
 
 /* Function definitions. */
 
+static __inline__ VCArrayHeader* vc_array_header(VCElem* const elem)
+{
+   return (VCArrayHeader*)elem - 1;
+}
+
+/** Allocate an unshared element array with room for capacity elements. */
+static VCElem* vc_array_new(const unsigned capacity)
+{
+   VCArrayHeader* hdr;
+
+   tl_assert(sizeof(VCArrayHeader) == sizeof(VCElem));
+   hdr = VG_(malloc)("drd.vc.van.1",
+                     sizeof(*hdr) + capacity * sizeof(VCElem));
+   hdr->refcnt = 1;
+   return (VCElem*)(hdr + 1);
+}
+
+/** Drop a reference to an element array allocated by vc_array_new(). */
+static void vc_array_put(VCElem* const elem)
+{
+   VCArrayHeader* const hdr = vc_array_header(elem);
+
+   tl_assert(hdr->refcnt >= 1);
+   if (--hdr->refcnt == 0)
+      VG_(free)(hdr);
+}
+
+/** @return True if the element array of vc is shared with another clock. */
+static __inline__ Bool vc_is_shared(const VectorClock* const vc)
+{
+   return vc->capacity > VC_PREALLOCATED
+      && vc_array_header(vc->vc)->refcnt > 1;
+}
+
+/** @return The counter stored in element i of vc, taking the epoch into
+ *  account. */
+static __inline__ UInt vc_elem_count(const VectorClock* const vc,
+                                     const unsigned i)
+{
+   return vc->vc[i].threadid == vc->owner ? vc->epoch : vc->vc[i].count;
+}
+
 /**
  * Initialize the memory 'vc' points at as a vector clock with size 'size'.
  * If the pointer 'vcelem' is not null, it is assumed to be an array with
@@ -51,6 +108,8 @@ void DRD_(vc_init)(VectorClock* const vc,
    vc->size = 0;
    vc->capacity = 0;
    vc->vc = 0;
+   vc->owner = VC_NO_OWNER;
+   vc->epoch = 0;
    DRD_(vc_reserve)(vc, size);
    tl_assert(size == 0 || vc->vc != 0);
    if (vcelem)
@@ -69,10 +128,25 @@ void DRD_(vc_cleanup)(VectorClock* const vc)
    DRD_(vc_reserve)(vc, 0);
 }
 
-/** Copy constructor -- initializes *new. */
+/**
+ * Copy constructor -- initializes *new. Element arrays that have been
+ * allocated dynamically are shared instead of copied.
+ */
 void DRD_(vc_copy)(VectorClock* const new, const VectorClock* const rhs)
 {
-   DRD_(vc_init)(new, rhs->vc, rhs->size);
+   if (rhs->capacity > VC_PREALLOCATED)
+   {
+      new->capacity = rhs->capacity;
+      new->size = rhs->size;
+      new->vc = rhs->vc;
+      vc_array_header(rhs->vc)->refcnt++;
+   }
+   else
+   {
+      DRD_(vc_init)(new, rhs->vc, rhs->size);
+   }
+   new->owner = rhs->owner;
+   new->epoch = rhs->epoch;
 }
 
 /** Assignment operator -- *lhs is already a valid vector clock. */
@@ -82,20 +156,37 @@ void DRD_(vc_assign)(VectorClock* const lhs, const VectorClock* const rhs)
    DRD_(vc_copy)(lhs, rhs);
 }
 
-/** Increment the clock of thread 'tid' in vector clock 'vc'. */
+/**
+ * Increment the clock of thread 'tid' in vector clock 'vc', and make 'tid'
+ * the owner of 'vc'. If 'tid' already owned 'vc', only the epoch changes.
+ */
 void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid)
 {
-   unsigned i;
-   for (i = 0; i < vc->size; i++)
+   int i;
+
+   tl_assert(tid != VC_NO_OWNER);
+
+   if (vc->owner == tid)
    {
-      if (vc->vc[i].threadid == tid)
-      {
-         typeof(vc->vc[i].count) const oldcount = vc->vc[i].count;
-         vc->vc[i].count++;
-         // Check for integer overflow.
-         tl_assert(oldcount < vc->vc[i].count);
-         return;
-      }
+      typeof(vc->epoch) const oldcount = vc->epoch;
+      vc->epoch++;
+      // Check for integer overflow.
+      tl_assert(oldcount < vc->epoch);
+      return;
+   }
+
+   DRD_(vc_flatten)(vc);
+
+   i = DRD_(vc_find)(vc, tid);
+   if (i >= 0)
+   {
+      typeof(vc->vc[i].count) const oldcount = vc->vc[i].count;
+      vc->vc[i].count++;
+      // Check for integer overflow.
+      tl_assert(oldcount < vc->vc[i].count);
+      vc->owner = tid;
+      vc->epoch = vc->vc[i].count;
+      return;
    }
 
    /*
@@ -108,6 +199,8 @@ void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid)
       DRD_(vc_init)(&vc2, &vcelem, 1);
       DRD_(vc_combine)(vc, &vc2);
       DRD_(vc_cleanup)(&vc2);
+      vc->owner = tid;
+      vc->epoch = 1;
    }
 }
 
@@ -121,7 +214,10 @@ Bool DRD_(vc_ordered)(const VectorClock* const vc1,
    return DRD_(vc_lte)(vc1, vc2) || DRD_(vc_lte)(vc2, vc1);
 }
 
-/** Compute elementwise minimum. */
+/**
+ * Compute elementwise minimum. The result is not the clock of any thread and
+ * hence has no owner.
+ */
 void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
 {
    unsigned i;
@@ -132,6 +228,10 @@ void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
 
    DRD_(vc_check)(result);
 
+   DRD_(vc_flatten)(result);
+   result->owner = VC_NO_OWNER;
+   result->epoch = 0;
+
    /* Next, combine both vector clocks into one. */
    i = 0;
    for (j = 0; j < rhs->size; j++)
@@ -151,9 +251,9 @@ void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
          /* The thread ID is present in both vector clocks. Compute the */
          /* minimum of vc[i].count and vc[j].count. */
          tl_assert(result->vc[i].threadid == rhs->vc[j].threadid);
-         if (rhs->vc[j].count < result->vc[i].count)
+         if (vc_elem_count(rhs, j) < result->vc[i].count)
          {
-            result->vc[i].count = rhs->vc[j].count;
+            result->vc[i].count = vc_elem_count(rhs, j);
          }
       }
    }
@@ -188,6 +288,8 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
 
    DRD_(vc_check)(result);
 
+   DRD_(vc_flatten)(result);
+
    new_size = result->size + rhs->size - shared;
    if (new_size > result->capacity)
       DRD_(vc_reserve)(result, new_size);
@@ -208,7 +310,8 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
       if (i >= result->size)
       {
          result->size++;
-         result->vc[i] = rhs->vc[j];
+         result->vc[i].threadid = rhs->vc[j].threadid;
+         result->vc[i].count = vc_elem_count(rhs, j);
       }
       /* If clock rhs->vc[j] is not in *result, insert it. */
       else if (result->vc[i].threadid > rhs->vc[j].threadid)
@@ -219,19 +322,25 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
             result->vc[k] = result->vc[k - 1];
          }
          result->size++;
-         result->vc[i] = rhs->vc[j];
+         result->vc[i].threadid = rhs->vc[j].threadid;
+         result->vc[i].count = vc_elem_count(rhs, j);
       }
       /* Otherwise, both *result and *rhs have a clock for thread            */
       /* result->vc[i].threadid == rhs->vc[j].threadid. Compute the maximum. */
       else
       {
          tl_assert(result->vc[i].threadid == rhs->vc[j].threadid);
-         if (rhs->vc[j].count > result->vc[i].count)
+         if (vc_elem_count(rhs, j) > result->vc[i].count)
          {
-            result->vc[i].count = rhs->vc[j].count;
+            result->vc[i].count = vc_elem_count(rhs, j);
          }
       }
    }
+   if (result->owner != VC_NO_OWNER)
+   {
+      /* The array of *result has been flattened, so it is up to date. */
+      result->epoch = result->vc[DRD_(vc_find)(result, result->owner)].count;
+   }
    DRD_(vc_check)(result);
    tl_assert(result->size == new_size);
 }
@@ -278,7 +387,7 @@ HChar* DRD_(vc_aprint)(const VectorClock* const vc)
       }
       size += VG_(snprintf)(str + size, reserved - size,
                             "%s %u: %u", i > 0 ? "," : "",
-                            vc->vc[i].threadid, vc->vc[i].count);
+                            vc->vc[i].threadid, vc_elem_count(vc, i));
    }
    size += VG_(snprintf)(str + size, reserved - size, " ]");
 
@@ -292,6 +401,7 @@ HChar* DRD_(vc_aprint)(const VectorClock* const vc)
  * satisfied:
  * - size <= capacity.
  * - Vector clock elements are stored in thread ID order.
+ * - If the vector clock has an owner, it has an element for the owner.
  *
  * If one of these conditions is not met, an assertion failure is triggered.
  */
@@ -303,6 +413,27 @@ void DRD_(vc_check)(const VectorClock* const vc)
 
    for (i = 1; i < vc->size; i++)
       tl_assert(vc->vc[i-1].threadid < vc->vc[i].threadid);
+
+   tl_assert(vc->owner == VC_NO_OWNER || DRD_(vc_find)(vc, vc->owner) >= 0);
+}
+
+/**
+ * Fold the epoch into the element array of vc, and make sure that the element
+ * array is not shared with any other vector clock such that it may be
+ * modified. The owner and epoch of vc are not changed.
+ */
+static void DRD_(vc_flatten)(VectorClock* const vc)
+{
+   if (vc_is_shared(vc))
+   {
+      VCElem* const elem = vc_array_new(vc->capacity);
+
+      VG_(memcpy)(elem, vc->vc, vc->size * sizeof(vc->vc[0]));
+      vc_array_put(vc->vc);
+      vc->vc = elem;
+   }
+   if (vc->owner != VC_NO_OWNER)
+      vc->vc[DRD_(vc_find)(vc, vc->owner)].count = vc->epoch;
 }
 
 /**
@@ -325,16 +456,29 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
          tl_assert(vc->vc
                    && vc->vc != vc->preallocated
                    && vc->capacity > VC_PREALLOCATED);
-         vc->vc = VG_(realloc)("drd.vc.vr.1",
-                               vc->vc, new_capacity * sizeof(vc->vc[0]));
+         if (vc_is_shared(vc))
+         {
+            VCElem* const elem = vc_array_new(new_capacity);
+
+            VG_(memcpy)(elem, vc->vc, vc->size * sizeof(vc->vc[0]));
+            vc_array_put(vc->vc);
+            vc->vc = elem;
+         }
+         else
+         {
+            VCArrayHeader* const hdr
+               = VG_(realloc)("drd.vc.vr.1", vc_array_header(vc->vc),
+                              sizeof(*hdr)
+                              + new_capacity * sizeof(vc->vc[0]));
+            vc->vc = (VCElem*)(hdr + 1);
+         }
       }
       else if (vc->vc && new_capacity > VC_PREALLOCATED)
       {
          tl_assert((vc->vc == 0 || vc->vc == vc->preallocated)
                    && new_capacity > VC_PREALLOCATED
                    && vc->capacity <= VC_PREALLOCATED);
-         vc->vc = VG_(malloc)("drd.vc.vr.2",
-                              new_capacity * sizeof(vc->vc[0]));
+         vc->vc = vc_array_new(new_capacity);
          VG_(memcpy)(vc->vc, vc->preallocated,
                      vc->capacity * sizeof(vc->vc[0]));
       }
@@ -349,8 +493,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
          tl_assert(vc->vc == 0
                    && new_capacity > VC_PREALLOCATED
                    && vc->capacity == 0);
-         vc->vc = VG_(malloc)("drd.vc.vr.3",
-                              new_capacity * sizeof(vc->vc[0]));
+         vc->vc = vc_array_new(new_capacity);
       }
       else
       {
@@ -364,7 +507,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
    else if (new_capacity == 0 && vc->vc)
    {
       if (vc->capacity > VC_PREALLOCATED)
-         VG_(free)(vc->vc);
+         vc_array_put(vc->vc);
       vc->vc = 0;
       vc->capacity = 0;
    }
@@ -43,6 +43,22 @@
  * - A vector clock is incremented during actions such as
  *   pthread_create(), pthread_mutex_unlock(), sem_post(). (Actions where
  *   an inter-thread ordering "arrow" starts).
+ *
+ * Epochs:
+ * - The counter of the thread that incremented a vector clock most recently
+ *   (the owner) is stored separately as an epoch, and overrides the counter
+ *   for that thread in the element array. Incrementing the clock of the owner
+ *   only changes the epoch.
+ * - Element arrays that do not fit in the preallocated space are reference
+ *   counted and shared by copies of a vector clock until one of the copies
+ *   is modified in another way than by incrementing its epoch. Hence the
+ *   vector clocks of consecutive segments of a thread share one array until
+ *   that thread synchronizes with another thread.
+ * - Since the counter of a thread is only propagated to other vector clocks
+ *   by combining it with a vector clock of that thread that will no longer
+ *   change, vc1 <= vc2 holds if and only if the epoch of vc1 is less than or
+ *   equal to the counter in vc2 of the owner of vc1. This is the FastTrack
+ *   observation and makes vc_lte() independent of the number of threads.
  */
 
 
@@ -53,6 +69,9 @@
 
 #define VC_PREALLOCATED 8
 
+/** Value of VectorClock::owner if the vector clock has no owner. */
+#define VC_NO_OWNER ((DrdThreadId)0)
+
 
 /** Vector clock element. */
 typedef struct
@@ -63,10 +82,12 @@ typedef struct
 
 typedef struct
 {
-   unsigned capacity; /**< number of elements allocated for array vc. */
-   unsigned size;     /**< number of elements used of array vc. */
-   VCElem*  vc;       /**< vector clock elements. */
-   VCElem   preallocated[VC_PREALLOCATED];
+   unsigned    capacity; /**< number of elements allocated for array vc. */
+   unsigned    size;     /**< number of elements used of array vc. */
+   VCElem*     vc;       /**< vector clock elements. */
+   DrdThreadId owner;    /**< thread the epoch belongs to, or VC_NO_OWNER. */
+   UInt        epoch;    /**< counter of 'owner', overrides the one in vc. */
+   VCElem      preallocated[VC_PREALLOCATED];
 } VectorClock;
 
 
@@ -78,6 +99,13 @@ void DRD_(vc_copy)(VectorClock* const new, const VectorClock* const rhs);
 void DRD_(vc_assign)(VectorClock* const lhs, const VectorClock* const rhs);
 void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid);
 static __inline__
+int DRD_(vc_find)(const VectorClock* const vc, const DrdThreadId tid);
+static __inline__
+UInt DRD_(vc_get_count)(const VectorClock* const vc, const DrdThreadId tid);
+static __inline__
+Bool DRD_(vc_lte_full)(const VectorClock* const vc1,
+                       const VectorClock* const vc2);
+static __inline__
 Bool DRD_(vc_lte)(const VectorClock* const vc1,
                   const VectorClock* const vc2);
 Bool DRD_(vc_ordered)(const VectorClock* const vc1,
@@ -93,35 +121,97 @@ void DRD_(vc_test)(void);
 
 
 
+/**
+ * @return The index of the element for thread tid in the element array of
+ *    vector clock vc, or -1 if there is no such element.
+ */
+static __inline__
+int DRD_(vc_find)(const VectorClock* const vc, const DrdThreadId tid)
+{
+   unsigned lo = 0;
+   unsigned hi = vc->size;
+
+   while (lo < hi)
+   {
+      const unsigned mid = (lo + hi) / 2;
+
+      if (vc->vc[mid].threadid < tid)
+         lo = mid + 1;
+      else if (vc->vc[mid].threadid > tid)
+         hi = mid;
+      else
+         return mid;
+   }
+   return -1;
+}
+
+/**
+ * @return The counter of thread tid in vector clock vc, or zero if vc does not
+ *    have a counter for thread tid.
+ */
+static __inline__
+UInt DRD_(vc_get_count)(const VectorClock* const vc, const DrdThreadId tid)
+{
+   int i;
+
+   if (tid == vc->owner)
+      return vc->epoch;
+   i = DRD_(vc_find)(vc, tid);
+   return i >= 0 ? vc->vc[i].count : 0;
+}
+
 /**
  * @return True if all thread id's that are present in vc1 also exist in
  *    vc2, and if additionally all corresponding counters in v2 are higher or
- *    equal.
+ *    equal. Compares all counters and hence does not rely on the epoch of vc1.
  */
 static __inline__
-Bool DRD_(vc_lte)(const VectorClock* const vc1, const VectorClock* const vc2)
+Bool DRD_(vc_lte_full)(const VectorClock* const vc1,
+                       const VectorClock* const vc2)
 {
    unsigned i;
    unsigned j = 0;
 
    for (i = 0; i < vc1->size; i++)
    {
-      while (j < vc2->size && vc2->vc[j].threadid < vc1->vc[i].threadid)
+      const DrdThreadId tid = vc1->vc[i].threadid;
+
+      while (j < vc2->size && vc2->vc[j].threadid < tid)
          j++;
-      if (j >= vc2->size || vc2->vc[j].threadid > vc1->vc[i].threadid)
+      if (j >= vc2->size || vc2->vc[j].threadid > tid)
          return False;
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
       /*
        * This assert statement has been commented out because of performance
        * reasons.
        */
-      tl_assert(j < vc2->size && vc2->vc[j].threadid == vc1->vc[i].threadid);
+      tl_assert(j < vc2->size && vc2->vc[j].threadid == tid);
 #endif
-      if (vc1->vc[i].count > vc2->vc[j].count)
+      if ((tid == vc1->owner ? vc1->epoch : vc1->vc[i].count)
+          > (tid == vc2->owner ? vc2->epoch : vc2->vc[j].count))
          return False;
    }
    return True;
 }
 
+/**
+ * @return True if vc1 happened before or is equal to vc2. If vc1 has an owner,
+ *    only the counter of that owner has to be compared.
+ */
+static __inline__
+Bool DRD_(vc_lte)(const VectorClock* const vc1, const VectorClock* const vc2)
+{
+   if (vc1->owner != VC_NO_OWNER)
+   {
+      const Bool result
+         = vc1->epoch <= DRD_(vc_get_count)(vc2, vc1->owner);
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+      tl_assert(result == DRD_(vc_lte_full)(vc1, vc2));
+#endif
+      return result;
+   }
+   return DRD_(vc_lte_full)(vc1, vc2);
+}
+
 
 #endif /* __DRD_VC_H */
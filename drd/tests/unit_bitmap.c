@@ -57,7 +57,7 @@ UInt VG_(printf)(const HChar *format, ...)
 UInt VG_(message)(VgMsgKind kind, const HChar* format, ...)
 { UInt ret; va_list vargs; va_start(vargs, format); ret = vprintf(format, vargs); va_end(vargs); printf("\n"); return ret; }
 Bool DRD_(is_suppressed)(const Addr a1, const Addr a2)
-{ assert(0); }
+{ return False; }
 void VG_(vcbprintf)(void(*char_sink)(HChar, void* opaque),
                     void* opaque,
                     const HChar* format, va_list vargs)
@@ -317,6 +317,59 @@ void bm_test3(const int outer_loop_step, const int inner_loop_step)
   DRD_(bm_delete)(bm1);
 }
 
+/**
+ * Test merging of and race detection on second level bitmaps that have been
+ * filled entirely by a single range access.
+ */
+void bm_test4(void)
+{
+  struct bitmap* bm1;
+  struct bitmap* bm2;
+  struct bitmap* bm3;
+
+  bm1 = DRD_(bm_new)();
+  bm2 = DRD_(bm_new)();
+  bm3 = DRD_(bm_new)();
+
+  DRD_(bm_access_range_store)(bm1, make_address(1, 0), make_address(3, 0));
+  assert(! DRD_(bm_has_any_load_g)(bm1));
+  DRD_(bm_access_load_4)(bm2, make_address(2, 0) + 16);
+  DRD_(bm_access_load_4)(bm3, make_address(5, 0) + 16);
+  assert(DRD_(bm_has_any_load_g)(bm2));
+  assert(DRD_(bm_has_races)(bm1, bm2));
+  assert(DRD_(bm_has_races)(bm2, bm1));
+  assert(! DRD_(bm_has_races)(bm1, bm3));
+  assert(! DRD_(bm_has_races)(bm2, bm3));
+  assert(DRD_(bm_store_has_conflict_with)(bm1, make_address(2, 0) + 7,
+                                          make_address(2, 0) + 9));
+  assert(DRD_(bm_load_has_conflict_with)(bm1, make_address(3, 0) - 1,
+                                         make_address(3, 0) + 1));
+  assert(! DRD_(bm_load_has_conflict_with)(bm1, make_address(3, 0),
+                                           make_address(3, 0) + 64));
+
+  DRD_(bm_merge2)(bm3, bm1);
+  DRD_(bm_merge2)(bm3, bm2);
+  assert(DRD_(bm_has_any_store)(bm3, make_address(1, 0),
+                                make_address(1, 0) + 1));
+  assert(DRD_(bm_has_any_store)(bm3, make_address(3, 0) - 1,
+                                make_address(3, 0)));
+  assert(! DRD_(bm_has_any_store)(bm3, make_address(3, 0),
+                                  make_address(4, 0)));
+  assert(DRD_(bm_has_1)(bm3, make_address(2, 0) + 16, eLoad));
+  assert(DRD_(bm_has_1)(bm3, make_address(5, 0) + 19, eLoad));
+
+  DRD_(bm_clear_store)(bm3, make_address(2, 0) + 64, make_address(2, 0) + 128);
+  assert(! DRD_(bm_has_any_store)(bm3, make_address(2, 0) + 64,
+                                  make_address(2, 0) + 128));
+  DRD_(bm_merge2)(bm3, bm1);
+  assert(DRD_(bm_has_any_store)(bm3, make_address(2, 0) + 64,
+                                make_address(2, 0) + 65));
+
+  DRD_(bm_delete)(bm3);
+  DRD_(bm_delete)(bm2);
+  DRD_(bm_delete)(bm1);
+}
+
 int main(int argc, char** argv)
 {
   int outer_loop_step = ADDR_GRANULARITY;
@@ -350,6 +403,7 @@ int main(int argc, char** argv)
   bm_test1();
   bm_test2();
   bm_test3(outer_loop_step, inner_loop_step);
+  bm_test4();
   DRD_(bm_module_cleanup)();
 
   fprintf(stderr, "End of DRD BM unit test.\n");
@@ -64,6 +64,7 @@ static void vc_unittest(void)
   VectorClock vc4;
   VCElem vc5elem[] = { { 1, 4 }, };
   VectorClock vc5;
+  VectorClock vc6;
 
   DRD_(vc_init)(&vc1, vc1elem, sizeof(vc1elem)/sizeof(vc1elem[0]));
   DRD_(vc_init)(&vc2, vc2elem, sizeof(vc2elem)/sizeof(vc2elem[0]));
@@ -93,6 +94,20 @@ static void vc_unittest(void)
   fprintf(stderr, ") = %d sw %d\n",
           DRD_(vc_lte)(&vc4, &vc5), DRD_(vc_lte)(&vc5, &vc4));
 
+  /* Epochs and element arrays shared between copies. */
+  for (i = 1; i <= 2 * VC_PREALLOCATED; i++)
+    DRD_(vc_increment)(&vc4, i);
+  DRD_(vc_copy)(&vc6, &vc4);
+  DRD_(vc_increment)(&vc6, 2 * VC_PREALLOCATED);
+  DRD_(vc_increment)(&vc6, 1);
+  fprintf(stderr, "%s", (str = DRD_(vc_aprint)(&vc6)));
+  free(str);
+  fprintf(stderr, "\nvc_lte(vc4, vc6) = %d sw %d\n",
+          DRD_(vc_lte)(&vc4, &vc6), DRD_(vc_lte)(&vc6, &vc4));
+  DRD_(vc_cleanup)(&vc6);
+  fprintf(stderr, "%s\n", (str = DRD_(vc_aprint)(&vc4)));
+  free(str);
+
   for (i = 0; i < 64; i++)
     DRD_(vc_reserve)(&vc1, i);
   for (i = 64; i > 0; i--)
@@ -101,6 +116,8 @@ static void vc_unittest(void)
   DRD_(vc_cleanup)(&vc1);
   DRD_(vc_cleanup)(&vc2);
   DRD_(vc_cleanup)(&vc3);
+  DRD_(vc_cleanup)(&vc4);
+  DRD_(vc_cleanup)(&vc5);
 }
 
 int main(int argc, char** argv)
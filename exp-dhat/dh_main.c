@@ -31,6 +31,7 @@
 
 
 #include "pub_tool_basics.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
@@ -40,9 +41,16 @@
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_wordfm.h"
+#include "pub_tool_xarray.h"
 
 #define HISTOGRAM_SIZE_LIMIT 1024
 
+// Accesses are also counted per cache-line-sized chunk of each block, for
+// the first N_LINE_BUCKETS chunks.  Accesses beyond that are counted in the
+// last bucket.
+#define DH_LINE_SZB     64
+#define N_LINE_BUCKETS  32
+
 
 //------------------------------------------------------------//
 //--- Globals                                              ---//
@@ -76,6 +84,7 @@ typedef
       ULong       allocd_at; /* instruction number */
       ULong       n_reads;
       ULong       n_writes;
+      struct _APInfo* api;  /* APInfo of 'ap', set by intro_Block */
       /* Approx histogram, one byte per payload byte.  Counts latch up
          therefore at 0xFFFF.  Can be NULL if the block is resized or if
          the block is larger than HISTOGRAM_SIZE_LIMIT. */
@@ -101,66 +110,192 @@ static Word interval_tree_Cmp ( UWord k1, UWord k2 )
    return 0;
 }
 
-// 2-entry cache for find_Block_containing
-static Block* fbc_cache0 = NULL;
-static Block* fbc_cache1 = NULL;
+//------------------------------------------------------------//
+//--- a shadow map from addresses to live blocks           ---//
+//------------------------------------------------------------//
+
+/* find_Block_containing is called for every memory access, so it must
+   be fast however many blocks are live.  The interval tree above is
+   only used when blocks come and go; accesses are looked up here.
+
+   The address space is split into regions of 2^BM_REGION_BITS bytes.
+   Each region overlapping a live block has a BMSec, found through a
+   hash table with a small direct-mapped cache in front of it (which
+   also remembers regions without a BMSec, as most accesses are not to
+   the heap).  A region lying entirely inside one block just points to
+   that block.  Otherwise the BMSec has an entry per granule.  Heap
+   blocks are aligned to at least the granule size (2 words, no more
+   than VG_MIN_MALLOC_SZB on any platform) and do not overlap, so no
+   granule belongs to more than one block.  BMSecs are freed when their
+   last block goes away, so the map only costs memory for live blocks. */
+
+#define BM_REGION_BITS   16
+#define BM_GRANULE_BITS  (sizeof(void*) == 8 ? 4 : 3)
+#define BM_N_GRANULES    ((UWord)1 << (BM_REGION_BITS - BM_GRANULE_BITS))
+#define BM_CACHE_SIZE    256
 
-static UWord stats__n_fBc_cached = 0;
-static UWord stats__n_fBc_uncached = 0;
+typedef
+   struct _BMSec {
+      struct _BMSec* next;  /* for the VgHashTable */
+      UWord    key;         /* region number: address >> BM_REGION_BITS */
+      Block*   cover;       /* block covering the whole region, or NULL */
+      Block**  granules;    /* [BM_N_GRANULES] if 'cover' is NULL */
+      UWord    n_live;      /* number of non-NULL entries in 'granules' */
+   }
+   BMSec;
+
+static VgHashTable* block_map = NULL;  /* VgHashTable* BMSec* */
+
+static struct {
+   UWord  key;
+   BMSec* sec;   /* NULL if the region has no BMSec */
+} bm_cache[BM_CACHE_SIZE];
+
+static UWord stats__n_fBc_found = 0;
 static UWord stats__n_fBc_notfound = 0;
+static UWord stats__n_bm_cache_misses = 0;
+static UWord stats__n_bm_secs = 0;
+static UWord stats__n_bm_covered = 0;
 
-static Block* find_Block_containing ( Addr a )
+static void bm_cache_invalidate ( UWord key )
 {
-   if (LIKELY(fbc_cache0
-              && fbc_cache0->payload <= a 
-              && a < fbc_cache0->payload + fbc_cache0->req_szB)) {
-      // found at 0
-      stats__n_fBc_cached++;
-      return fbc_cache0;
-   }
-   if (LIKELY(fbc_cache1
-              && fbc_cache1->payload <= a 
-              && a < fbc_cache1->payload + fbc_cache1->req_szB)) {
-      // found at 1; swap 0 and 1
-      Block* tmp = fbc_cache0;
-      fbc_cache0 = fbc_cache1;
-      fbc_cache1 = tmp;
-      stats__n_fBc_cached++;
-      return fbc_cache0;
+   UWord i = key & (BM_CACHE_SIZE-1);
+   if (bm_cache[i].key == key)
+      bm_cache[i].key = ~(UWord)0;
+}
+
+static inline BMSec* bm_lookup_sec ( UWord key )
+{
+   UWord  i = key & (BM_CACHE_SIZE-1);
+   BMSec* sec;
+   if (LIKELY(bm_cache[i].key == key))
+      return bm_cache[i].sec;
+   stats__n_bm_cache_misses++;
+   sec = VG_(HT_lookup)( block_map, key );
+   bm_cache[i].key = key;
+   bm_cache[i].sec = sec;
+   return sec;
+}
+
+static BMSec* bm_new_sec ( UWord key )
+{
+   BMSec* sec = VG_(malloc)( "dh.bm_new_sec.1", sizeof(BMSec) );
+   sec->key      = key;
+   sec->cover    = NULL;
+   sec->granules = NULL;
+   sec->n_live   = 0;
+   VG_(HT_add_node)( block_map, sec );
+   bm_cache_invalidate(key);
+   stats__n_bm_secs++;
+   return sec;
+}
+
+static void bm_del_sec ( BMSec* sec )
+{
+   BMSec* removed = VG_(HT_remove)( block_map, sec->key );
+   tl_assert(removed == sec);
+   bm_cache_invalidate(sec->key);
+   if (sec->granules)
+      VG_(free)(sec->granules);
+   VG_(free)(sec);
+}
+
+/* Enter 'bk' into the map if 'present', else remove it. */
+static void bm_set_Block ( Block* bk, Bool present )
+{
+   Addr a    = bk->payload;
+   Addr last = bk->payload + bk->req_szB - 1;
+   tl_assert(bk->req_szB > 0);
+
+   while (True) {
+      UWord  key   = a >> BM_REGION_BITS;
+      Addr   rbase = (Addr)key << BM_REGION_BITS;
+      Addr   rlast = rbase + (((Addr)1 << BM_REGION_BITS) - 1);
+      Addr   lim   = last < rlast ? last : rlast;
+      BMSec* sec   = bm_lookup_sec(key);
+
+      if (a == rbase && lim == rlast) {
+         // The block covers the whole region.
+         if (present) {
+            tl_assert(!sec);
+            sec = bm_new_sec(key);
+            sec->cover = bk;
+            stats__n_bm_covered++;
+         } else {
+            tl_assert(sec && sec->cover == bk);
+            bm_del_sec(sec);
+         }
+      } else {
+         UWord i;
+         UWord iLo = (a   - rbase) >> BM_GRANULE_BITS;
+         UWord iHi = (lim - rbase) >> BM_GRANULE_BITS;
+         if (present) {
+            if (!sec)
+               sec = bm_new_sec(key);
+            tl_assert(!sec->cover);
+            if (!sec->granules) {
+               sec->granules = VG_(malloc)( "dh.bm_set_Block.1",
+                                            BM_N_GRANULES * sizeof(Block*) );
+               VG_(memset)(sec->granules, 0, BM_N_GRANULES * sizeof(Block*));
+            }
+            for (i = iLo; i <= iHi; i++) {
+               tl_assert(sec->granules[i] == NULL);
+               sec->granules[i] = bk;
+            }
+            sec->n_live += iHi - iLo + 1;
+         } else {
+            tl_assert(sec && sec->granules);
+            for (i = iLo; i <= iHi; i++) {
+               tl_assert(sec->granules[i] == bk);
+               sec->granules[i] = NULL;
+            }
+            tl_assert(sec->n_live >= iHi - iLo + 1);
+            sec->n_live -= iHi - iLo + 1;
+            if (sec->n_live == 0)
+               bm_del_sec(sec);
+         }
+      }
+
+      if (lim == last)
+         break;
+      a = lim + 1;
    }
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
-   UWord foundkey = 1;
-   UWord foundval = 1;
-   Bool found = VG_(lookupFM)( interval_tree,
-                               &foundkey, &foundval, (UWord)&fake );
-   if (!found) {
+}
+
+static inline Block* find_Block_containing ( Addr a )
+{
+   BMSec* sec = bm_lookup_sec(a >> BM_REGION_BITS);
+   Block* bk;
+   if (LIKELY(!sec)) {
       stats__n_fBc_notfound++;
       return NULL;
    }
-   tl_assert(foundval == 0); // we don't store vals in the interval tree
-   tl_assert(foundkey != 1);
-   Block* res = (Block*)foundkey;
-   tl_assert(res != &fake);
-   // put at the top position
-   fbc_cache1 = fbc_cache0;
-   fbc_cache0 = res;
-   stats__n_fBc_uncached++;
-   return res;
+   bk = sec->cover
+        ? sec->cover
+        : sec->granules[(a >> BM_GRANULE_BITS) & (BM_N_GRANULES-1)];
+   // The last granule of a block may extend past its end.
+   if (bk && bk->payload <= a && a < bk->payload + bk->req_szB) {
+      stats__n_fBc_found++;
+      return bk;
+   }
+   stats__n_fBc_notfound++;
+   return NULL;
+}
+
+static void add_Block ( Block* bk )
+{
+   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
+   tl_assert(!present);
+   bm_set_Block(bk, True/*present*/);
 }
 
-// delete a block; asserts if not found.  (viz, 'a' must be
-// known to be present.)
-static void delete_Block_starting_at ( Addr a )
+// delete a block; asserts if not found.
+static void delete_Block ( Block* bk )
 {
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
    Bool found = VG_(delFromFM)( interval_tree,
-                                NULL, NULL, (Addr)&fake );
+                                NULL, NULL, (UWord)bk );
    tl_assert(found);
-   fbc_cache0 = fbc_cache1 = NULL;
+   bm_set_Block(bk, False/*!present*/);
 }
 
 
@@ -169,7 +304,7 @@ static void delete_Block_starting_at ( Addr a )
 //------------------------------------------------------------//
 
 typedef
-   struct {
+   struct _APInfo {
       // the allocation point that we're summarising stats for
       ExeContext* ap;
       // used when printing results
@@ -210,6 +345,11 @@ typedef
       enum { Unknown=999, Exactly, Mixed } xsize_tag;
       SizeT xsize;
       UInt* histo; /* [0 .. xsize-1] */
+      /* Number of accesses to each DH_LINE_SZB-sized chunk of the blocks
+         allocated here, counted by offset from the start of the block.
+         Allocated at the first access.  Unlike 'histo', this is kept for
+         blocks of any size. */
+      ULong* line_histo; /* [0 .. N_LINE_BUCKETS-1] */
    }
    APInfo;
 
@@ -250,6 +390,7 @@ static void intro_Block ( Block* bk )
    }
 
    tl_assert(api->ap == bk->ap);
+   bk->api = api;
 
    /* So: update stats to reflect an allocation */
 
@@ -481,6 +622,7 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    bk->allocd_at = g_guest_instrs_executed;
    bk->n_reads   = 0;
    bk->n_writes  = 0;
+   bk->api       = NULL;
    // set up histogram array, if the block isn't too large
    bk->histoW = NULL;
    if (req_szB <= HISTOGRAM_SIZE_LIMIT) {
@@ -488,9 +630,7 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
       VG_(memset)(bk->histoW, 0, req_szB * sizeof(UShort));
    }
 
-   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
-   tl_assert(!present);
-   fbc_cache0 = fbc_cache1 = NULL;
+   add_Block(bk);
 
    intro_Block(bk);
 
@@ -525,7 +665,7 @@ void die_block ( void* p, Bool custom_free )
    retire_Block(bk, True/*because_freed*/);
 
    VG_(cli_free)( (void*)bk->payload );
-   delete_Block_starting_at( bk->payload );
+   delete_Block( bk );
    if (bk->histoW) {
       VG_(free)( bk->histoW );
       bk->histoW = NULL;
@@ -567,10 +707,13 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    // Actually do the allocation, if necessary.
    if (new_req_szB <= bk->req_szB) {
 
-      // New size is smaller or same; block not moved.
+      // New size is smaller or same; block not moved.  Its tail has to
+      // go from the block map, though.
       apinfo_change_cur_bytes_live(bk->ap,
                                    (Long)new_req_szB - (Long)bk->req_szB);
+      bm_set_Block(bk, False/*!present*/);
       bk->req_szB = new_req_szB;
+      bm_set_Block(bk, True/*present*/);
       return p_old;
 
    } else {
@@ -588,9 +731,9 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       VG_(cli_free)(p_old);
 
       // Since the block has moved, we need to re-insert it into the
-      // interval tree at the new place.  Do this by removing
-      // and re-adding it.
-      delete_Block_starting_at( (Addr)p_old );
+      // interval tree and the block map at the new place.  Do this by
+      // removing and re-adding it.
+      delete_Block( bk );
       // now 'bk' is no longer in the tree, but the Block itself
       // is still alive
 
@@ -601,10 +744,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       bk->req_szB = new_req_szB;
 
       // and re-add
-      Bool present
-         = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/); 
-      tl_assert(!present);
-      fbc_cache0 = fbc_cache1 = NULL;
+      add_Block( bk );
 
       return p_new;
    }
@@ -697,6 +837,23 @@ void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
    }
 }
 
+// Count the access in the line histogram of the block's AP.  An access
+// spanning two chunks is counted in the first one only.
+static inline
+void inc_line_histo_for_block ( Block* bk, Addr addr )
+{
+   APInfo* api  = bk->api;
+   UWord   line = (addr - bk->payload) / DH_LINE_SZB;
+   if (UNLIKELY(!api->line_histo)) {
+      api->line_histo = VG_(malloc)("dh.inc_line_histo_for_block.1",
+                                    N_LINE_BUCKETS * sizeof(ULong));
+      VG_(memset)(api->line_histo, 0, N_LINE_BUCKETS * sizeof(ULong));
+   }
+   if (line >= N_LINE_BUCKETS)
+      line = N_LINE_BUCKETS-1;
+   api->line_histo[line]++;
+}
+
 static VG_REGPARM(2)
 void dh_handle_write ( Addr addr, UWord szB )
 {
@@ -705,6 +862,7 @@ void dh_handle_write ( Addr addr, UWord szB )
       bk->n_writes += szB;
       if (bk->histoW)
          inc_histo_for_block(bk, addr, szB);
+      inc_line_histo_for_block(bk, addr);
    }
 }
 
@@ -716,6 +874,7 @@ void dh_handle_read ( Addr addr, UWord szB )
       bk->n_reads += szB;
       if (bk->histoW)
          inc_histo_for_block(bk, addr, szB);
+      inc_line_histo_for_block(bk, addr);
    }
 }
 
@@ -1091,6 +1250,130 @@ static void show_N_div_100( /*OUT*/HChar* buf, ULong n )
                 nR);
 }
 
+static void show_line_histo ( APInfo* api )
+{
+   UWord i, n_lines;
+   ULong tot = 0;
+
+   // Don't show the trailing unaccessed lines.
+   for (n_lines = N_LINE_BUCKETS; n_lines > 0; n_lines--) {
+      if (api->line_histo[n_lines-1] > 0)
+         break;
+   }
+   for (i = 0; i < n_lines; i++)
+      tot += api->line_histo[i];
+   if (tot == 0)
+      return;
+
+   VG_(umsg)("\nAccess counts by %d-byte line (offset from block start):\n",
+             DH_LINE_SZB);
+   VG_(umsg)("\n");
+   for (i = 0; i < n_lines; i++) {
+      HChar buf[80];   // large enough
+      show_N_div_100(buf, (10000ULL * api->line_histo[i]) / tot);
+      VG_(umsg)("[%4lu%s]  %'llu (%s%%)\n",
+                i * DH_LINE_SZB, i == N_LINE_BUCKETS-1 ? "+" : "",
+                api->line_histo[i], buf);
+   }
+}
+
+/* A run of bytes with the same, non-zero, aggregated access count.  All
+   the bytes of a field are accessed together, so each such run is a
+   field, or several fields that are always accessed together -- which
+   is just as good for deciding on a layout. */
+typedef
+   struct {
+      UWord off;
+      UWord szB;
+      UInt  count;
+   }
+   Field;
+
+#define N_HOT_FIELDS 8
+
+static Int cmp_Field_by_count ( const void* v1, const void* v2 )
+{
+   const Field* f1 = v1;
+   const Field* f2 = v2;
+   if (f1->count > f2->count) return -1;
+   if (f1->count < f2->count) return  1;
+   if (f1->off < f2->off) return -1;
+   if (f1->off > f2->off) return  1;
+   return 0;
+}
+
+/* Shows the fields taking 90% of the accesses (at most N_HOT_FIELDS of
+   them), and how many lines they are spread over compared to how many
+   they would fill if they were next to each other. */
+static void show_hot_fields ( APInfo* api )
+{
+   XArray* fields = VG_(newXA)( VG_(malloc), "dh.show_hot_fields.1",
+                                VG_(free), sizeof(Field) );
+   ULong tot = 0, hot = 0;
+   UWord i = 0, n_hot, hot_szB = 0;
+   UInt  lines_used = 0;
+   Int   n_lines_used = 0, n_lines_packed;
+
+   tl_assert(api->xsize <= HISTOGRAM_SIZE_LIMIT);
+   tl_assert(HISTOGRAM_SIZE_LIMIT / DH_LINE_SZB <= 32); // fits 'lines_used'
+
+   while (i < api->xsize) {
+      UWord j = i + 1;
+      if (api->histo[i] == 0) {
+         i++;
+         continue;
+      }
+      while (j < api->xsize && api->histo[j] == api->histo[i])
+         j++;
+      Field f = { i, j - i, api->histo[i] };
+      VG_(addToXA)( fields, &f );
+      tot += f.count;
+      i = j;
+   }
+   if (tot == 0 || VG_(sizeXA)(fields) < 2) {
+      VG_(deleteXA)( fields );
+      return;
+   }
+
+   VG_(setCmpFnXA)( fields, cmp_Field_by_count );
+   VG_(sortXA)( fields );
+
+   VG_(umsg)("\nHot fields (most accessed first):\n");
+   VG_(umsg)("\n");
+   for (n_hot = 0;
+        n_hot < VG_(sizeXA)(fields) && n_hot < N_HOT_FIELDS
+           && hot * 10 < tot * 9;
+        n_hot++) {
+      Field* f = VG_(indexXA)( fields, n_hot );
+      HChar buf[80];   // large enough
+      UWord line;
+      show_N_div_100(buf, (10000ULL * f->count) / tot);
+      VG_(umsg)("[%4lu]  %lu byte%s: %'u accesses (%s%%)\n",
+                f->off, f->szB, f->szB == 1 ? "" : "s", f->count, buf);
+      hot += f->count;
+      hot_szB += f->szB;
+      for (line = f->off / DH_LINE_SZB;
+           line <= (f->off + f->szB - 1) / DH_LINE_SZB; line++) {
+         if (!(lines_used & (1U << line))) {
+            lines_used |= 1U << line;
+            n_lines_used++;
+         }
+      }
+   }
+
+   n_lines_packed = (hot_szB + DH_LINE_SZB - 1) / DH_LINE_SZB;
+   if (n_lines_used > n_lines_packed) {
+      HChar buf[80];   // large enough
+      show_N_div_100(buf, (10000ULL * hot) / tot);
+      VG_(umsg)("\nThese fields take %s%% of the accesses and are spread "
+                "over %d %d-byte lines;\n", buf, n_lines_used, DH_LINE_SZB);
+      VG_(umsg)("placed next to each other, they would fit in %d.\n",
+                n_lines_packed);
+   }
+
+   VG_(deleteXA)( fields );
+}
+
 static void show_APInfo ( APInfo* api )
 {
    HChar bufA[80];   // large enough
@@ -1147,6 +1430,9 @@ static void show_APInfo ( APInfo* api )
 
    VG_(pp_ExeContext)(api->ap);
 
+   if (api->line_histo)
+      show_line_histo(api);
+
    if (api->histo && api->xsize_tag == Exactly) {
       VG_(umsg)("\nAggregated access counts by offset:\n");
       VG_(umsg)("\n");
@@ -1161,6 +1447,8 @@ static void show_APInfo ( APInfo* api )
          VG_(umsg)("%u ", api->histo[i]);
       }
       VG_(umsg)("\n");
+
+      show_hot_fields(api);
    }
 }
 
@@ -1324,11 +1612,14 @@ static void dh_fini(Int exit_status)
 
    if (VG_(clo_stats)) {
       VG_(dmsg)(" dhat: find_Block_containing:\n");
-      VG_(dmsg)("             found: %'lu (%'lu cached + %'lu uncached)\n",
-                stats__n_fBc_cached + stats__n_fBc_uncached,
-                stats__n_fBc_cached,
-                stats__n_fBc_uncached);
+      VG_(dmsg)("             found: %'lu\n", stats__n_fBc_found);
       VG_(dmsg)("          notfound: %'lu\n", stats__n_fBc_notfound);
+      VG_(dmsg)(" dhat: block map:\n");
+      VG_(dmsg)("      cache misses: %'lu\n", stats__n_bm_cache_misses);
+      VG_(dmsg)("   regions created: %'lu (%'lu covered by one block)\n",
+                stats__n_bm_secs, stats__n_bm_covered);
+      VG_(dmsg)("      regions live: %'u\n",
+                VG_(HT_count_nodes)(block_map));
       VG_(dmsg)("\n");
    }
 }
@@ -1382,14 +1673,20 @@ static void dh_pre_clo_init(void)
    VG_(track_post_mem_write)      ( dh_handle_noninsn_write );
 
    tl_assert(!interval_tree);
-   tl_assert(!fbc_cache0);
-   tl_assert(!fbc_cache1);
+   tl_assert(!block_map);
 
    interval_tree = VG_(newFM)( VG_(malloc),
                                "dh.main.interval_tree.1",
                                VG_(free),
                                interval_tree_Cmp );
 
+   block_map = VG_(HT_construct)( "dh.main.block_map.1" );
+   UWord i;
+   for (i = 0; i < BM_CACHE_SIZE; i++) {
+      bm_cache[i].key = ~(UWord)0;   // not a valid region number
+      bm_cache[i].sec = NULL;
+   }
+
    apinfo = VG_(newFM)( VG_(malloc),
                         "dh.main.apinfo.1",
                         VG_(free),
@@ -133,7 +133,8 @@ typedef
       _VG_USERREQ__HG_PTHREAD_COND_SIGNAL_POST,   /* pth_cond_t* */
       _VG_USERREQ__HG_PTHREAD_COND_BROADCAST_POST,/* pth_cond_t* */
       _VG_USERREQ__HG_RTLD_BIND_GUARD,            /* int flags */
-      _VG_USERREQ__HG_RTLD_BIND_CLEAR             /* int flags */
+      _VG_USERREQ__HG_RTLD_BIND_CLEAR,            /* int flags */
+      _VG_USERREQ__HG_ADD_HOT_CODE_RANGE          /* Addr a, ulong len */
    } Vg_TCheckClientRequest;
 
 
@@ -398,6 +399,17 @@ typedef
                  unsigned long,(_qzz_len))
 
 
+/* Only race check memory accesses made by code in the hot regions:
+   the address ranges given with this request, and those given with
+   the --hot-objs, --hot-srcs and --hot-range command line options.
+   If no hot region has been given, all code is checked.  The first
+   use of this request therefore turns checking off for all code
+   outside [_qzz_start, _qzz_start+_qzz_len). */
+#define VALGRIND_HG_ADD_HOT_CODE_RANGE(_qzz_start, _qzz_len) \
+   DO_CREQ_v_WW(_VG_USERREQ__HG_ADD_HOT_CODE_RANGE,          \
+                 void*,(_qzz_start),                         \
+                 unsigned long,(_qzz_len))
+
 /*  Checks the accessibility bits for addresses [zza..zza+zznbytes-1].
     If zzabits array is provided, copy the accessibility bits in zzabits.
    Return values:
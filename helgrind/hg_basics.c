@@ -83,6 +83,8 @@ Bool  HG_(clo_free_is_write) = False;
 
 UWord HG_(clo_vts_pruning) = 1;
 
+UWord HG_(clo_wordset_memo_size) = 4096;
+
 Bool  HG_(clo_check_stack_refs) = True;
 
 /*--------------------------------------------------------------------*/
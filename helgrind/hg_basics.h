@@ -122,6 +122,11 @@ extern Bool HG_(clo_free_is_write);
       mostly a big time waster, but minimises space use. */
 extern UWord HG_(clo_vts_pruning);
 
+/* Number of entries of the memo tables that remember the results of
+   recent lock set operations (see hg_wordset.c).  0 disables them.
+   Default: 4096. */
+extern UWord HG_(clo_wordset_memo_size);
+
 /* When False, race checking ignores memory references which are to
    the stack, which speeds things up a bit.  Default: True. */
 extern Bool HG_(clo_check_stack_refs); 
@@ -51,6 +51,8 @@
 #include "pub_tool_stacktrace.h"
 #include "pub_tool_wordfm.h"
 #include "pub_tool_debuginfo.h" // VG_(find_seginfo), VG_(seginfo_soname)
+#include "pub_tool_seqmatch.h"  // VG_(string_match)
+#include "pub_tool_transtab.h"  // VG_(discard_translations_safely)
 #include "pub_tool_redir.h"     // sonames for the dynamic linkers
 #include "pub_tool_vki.h"       // VKI_PAGE_SIZE
 #include "pub_tool_libcproc.h"
@@ -615,7 +617,8 @@ static void initialise_data_structures ( Thr* hbthr_root )
 
    tl_assert(univ_lsets == NULL);
    univ_lsets = HG_(newWordSetU)( HG_(zalloc), "hg.ids.4", HG_(free),
-                                  8/*cacheSize*/ );
+                                  8/*cacheSize*/,
+                                  HG_(clo_wordset_memo_size) );
    tl_assert(univ_lsets != NULL);
    /* Ensure that univ_lsets is non-empty, with lockset zero being the
       empty lockset.  hg_errors.c relies on the assumption that
@@ -626,7 +629,8 @@ static void initialise_data_structures ( Thr* hbthr_root )
    tl_assert(univ_laog == NULL);
    if (HG_(clo_track_lockorders)) {
       univ_laog = HG_(newWordSetU)( HG_(zalloc), "hg.ids.5 (univ_laog)",
-                                    HG_(free), 24/*cacheSize*/ );
+                                    HG_(free), 24/*cacheSize*/,
+                                    HG_(clo_wordset_memo_size) );
       tl_assert(univ_laog != NULL);
    }
 
@@ -4600,6 +4604,99 @@ static Bool is_in_dynamic_linker_shared_object( Addr ga )
    return VG_(is_soname_ld_so)(soname);
 }
 
+
+/*--------------------------------------------------------------*/
+/*--- "Hot region" mode                                      ---*/
+/*--------------------------------------------------------------*/
+
+/* If any of the following is non-empty, only memory accesses done by
+   code inside one of the given object files, source files or code
+   address ranges are race checked.  Instructions elsewhere are not
+   instrumented for memory accesses at all, so they run at close to
+   --tool=none speed.  Synchronisation events are still observed
+   everywhere, so happens-before relations stay correct. */
+
+typedef  struct { Addr start; Addr end; }  HotRange; /* [start, end) */
+
+static XArray* hot_objs   = NULL; /* of HChar*: object file patterns */
+static XArray* hot_srcs   = NULL; /* of HChar*: source file patterns */
+static XArray* hot_ranges = NULL; /* of HotRange */
+
+static Bool hot_regions_enabled ( void )
+{
+   return hot_objs != NULL || hot_srcs != NULL || hot_ranges != NULL;
+}
+
+static void add_hot_pattern ( XArray** xa, const HChar* cc,
+                              const HChar* pattern )
+{
+   HChar* copy = HG_(strdup)( cc, pattern );
+   if (*xa == NULL)
+      *xa = VG_(newXA)( HG_(zalloc), cc, HG_(free), sizeof(HChar*) );
+   VG_(addToXA)( *xa, &copy );
+}
+
+static void add_hot_range ( Addr start, Addr end )
+{
+   HotRange r;
+   r.start = start;
+   r.end   = end;
+   if (hot_ranges == NULL)
+      hot_ranges = VG_(newXA)( HG_(zalloc), "hg.ahr.1", HG_(free),
+                               sizeof(HotRange) );
+   VG_(addToXA)( hot_ranges, &r );
+}
+
+static Bool matches_any_pattern ( XArray* xa, const HChar* name )
+{
+   Word i, n = VG_(sizeXA)( xa );
+   for (i = 0; i < n; i++) {
+      if (VG_(string_match)( *(HChar**)VG_(indexXA)( xa, i ), name ))
+         return True;
+   }
+   return False;
+}
+
+/* Is the guest code address GA inside a hot region?  Only called at
+   instrumentation time, and only if hot_regions_enabled(). */
+static Bool is_in_hot_region ( Addr ga )
+{
+   if (hot_ranges) {
+      Word i, n = VG_(sizeXA)( hot_ranges );
+      for (i = 0; i < n; i++) {
+         HotRange* r = VG_(indexXA)( hot_ranges, i );
+         if (ga >= r->start && ga < r->end)
+            return True;
+      }
+   }
+   if (hot_objs) {
+      DebugInfo* dinfo = VG_(find_DebugInfo)( ga );
+      if (dinfo && matches_any_pattern( hot_objs,
+                                        VG_(DebugInfo_get_filename)(dinfo) ))
+         return True;
+   }
+   if (hot_srcs) {
+      const HChar* file;
+      if (VG_(get_filename)( ga, &file )
+          && matches_any_pattern( hot_srcs, file ))
+         return True;
+   }
+   return False;
+}
+
+/* Handle --hot-range=<start>-<end>.  Returns False if malformed. */
+static Bool parse_hot_range ( const HChar* str )
+{
+   Addr start, end;
+   if (!VG_(parse_Addr)( &str, &start ) || *str != '-')
+      return False;
+   str++;
+   if (!VG_(parse_Addr)( &str, &end ) || *str != 0 || end <= start)
+      return False;
+   add_hot_range( start, end );
+   return True;
+}
+
 static
 IRSB* hg_instrument ( VgCallbackClosure* closure,
                       IRSB* bbIn,
@@ -4614,6 +4711,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    IRStmt* st;
    Bool    inLDSO = False;
    Addr    inLDSOmask4K = 1; /* mismatches on first check */
+   Bool    inHot = True;
+   const Bool checkHot = hot_regions_enabled();
 
    const Int goff_sp = layout->offset_SP;
 
@@ -4678,6 +4777,11 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             } else {
                if (0) VG_(printf)("old %#lx\n", cia);
             }
+            /* In hot region mode, also skip everything outside the
+               hot regions.  Source files need not be page aligned, so
+               this is checked for each instruction. */
+            if (checkHot)
+               inHot = is_in_hot_region(cia);
             break;
 
          case Ist_MBE:
@@ -4703,7 +4807,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                tl_assert(!cas->dataHi);
             }
             /* Just be boring about it. */
-            if (!inLDSO) {
+            if (!inLDSO && inHot) {
                instrument_mem_access(
                   bbOut,
                   cas->addr,
@@ -4725,7 +4829,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             if (st->Ist.LLSC.storedata == NULL) {
                /* LL */
                dataTy = typeOfIRTemp(bbIn->tyenv, st->Ist.LLSC.result);
-               if (!inLDSO) {
+               if (!inLDSO && inHot) {
                   instrument_mem_access(
                      bbOut,
                      st->Ist.LLSC.addr,
@@ -4743,7 +4847,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
          }
 
          case Ist_Store:
-            if (!inLDSO) {
+            if (!inLDSO && inHot) {
                instrument_mem_access( 
                   bbOut, 
                   st->Ist.Store.addr, 
@@ -4785,7 +4889,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
          case Ist_WrTmp: {
             IRExpr* data = st->Ist.WrTmp.data;
             if (data->tag == Iex_Load) {
-               if (!inLDSO) {
+               if (!inLDSO && inHot) {
                   instrument_mem_access(
                      bbOut,
                      data->Iex.Load.addr,
@@ -4809,7 +4913,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                tl_assert(d->mSize != 0);
                dataSize = d->mSize;
                if (d->mFx == Ifx_Read || d->mFx == Ifx_Modify) {
-                  if (!inLDSO) {
+                  if (!inLDSO && inHot) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, False/*!isStore*/,
                         sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
@@ -4817,7 +4921,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   }
                }
                if (d->mFx == Ifx_Write || d->mFx == Ifx_Modify) {
-                  if (!inLDSO) {
+                  if (!inLDSO && inHot) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, True/*isStore*/,
                         sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
@@ -5057,6 +5161,25 @@ Bool hg_handle_client_request ( ThreadId tid, UWord* args, UWord* ret)
          }
          break;
 
+      case _VG_USERREQ__HG_ADD_HOT_CODE_RANGE: {
+         /* Addr start, ulong len */
+         Bool was_enabled = hot_regions_enabled();
+         if (args[2] == 0 || args[1] + args[2] < args[1])
+            break;
+         add_hot_range( args[1], args[1] + args[2] );
+         /* Existing translations were instrumented under the old
+            settings.  If this is the first hot region, code outside it
+            must now go uninstrumented; otherwise only the new range
+            changes. */
+         if (was_enabled)
+            VG_(discard_translations_safely)( args[1], args[2],
+                                              "helgrind" );
+         else
+            VG_(discard_translations_safely)( (Addr)0x1000, ~(SizeT)0xfff,
+                                              "helgrind" );
+         break;
+      }
+
       case _VG_USERREQ__HG_GET_ABITS:
          if (0) VG_(printf)("HG_GET_ABITS(%#lx,%#lx,%lu)\n",
                             args[1], args[2], args[3]);
@@ -5551,6 +5674,21 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
    else if VG_XACT_CLO(arg, "--vts-pruning=always",
                             HG_(clo_vts_pruning), 2);
 
+   else if VG_BINT_CLO(arg, "--wordset-memo-size",
+                       HG_(clo_wordset_memo_size), 0, 1024*1024) {}
+
+   else if VG_STR_CLO(arg, "--hot-objs", tmp_str)
+      add_hot_pattern( &hot_objs, "hg.pclo.1", tmp_str );
+   else if VG_STR_CLO(arg, "--hot-srcs", tmp_str)
+      add_hot_pattern( &hot_srcs, "hg.pclo.2", tmp_str );
+   else if VG_STR_CLO(arg, "--hot-range", tmp_str) {
+      if (!parse_hot_range( tmp_str )) {
+         VG_(message)(Vg_UserMsg, "--hot-range argument must be of the "
+                                  "form <start>-<end>, e.g. 0x4000-0x5000\n");
+         return False;
+      }
+   }
+
    else if VG_BOOL_CLO(arg, "--check-stack-refs",
                             HG_(clo_check_stack_refs)) {}
    else if VG_BOOL_CLO(arg, "--ignore-thread-creation",
@@ -5574,6 +5712,12 @@ static void hg_print_usage ( void )
 "    --conflict-cache-size=N   size of 'full' history cache [2000000]\n"
 "    --check-stack-refs=no|yes race-check reads and writes on the\n"
 "                              main stack and thread stacks? [yes]\n"
+"    --hot-objs=<pattern>      only race-check accesses made by code in\n"
+"                              object files matching <pattern> [all]\n"
+"    --hot-srcs=<pattern>      only race-check accesses made by code in\n"
+"                              source files matching <pattern> [all]\n"
+"    --hot-range=<start>-<end> only race-check accesses made by code in\n"
+"                              the given address range [all]\n"
 "    --ignore-thread-creation=yes|no Ignore activities during thread\n"
 "                              creation [%s]\n",
 HG_(clo_ignore_thread_creation) ? "yes" : "no"
@@ -5599,6 +5743,8 @@ static void hg_print_debug_usage ( void )
 "       never:   is never done (may cause big space leaks in Helgrind)\n"
 "       auto:    done just often enough to keep space usage under control\n"
 "       always:  done after every VTS GC (mostly just a big time waster)\n"
+"    --wordset-memo-size=<number> entries of the lock set operation\n"
+"                              memo tables (0 disables them) [4096]\n"
     );
 }
 
@@ -39,7 +39,6 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_threadstate.h"
-#include "pub_tool_wordfm.h"
 
 #include "hg_basics.h"
 #include "hg_wordset.h"     /* self */
@@ -126,42 +125,98 @@ typedef
    } while (0)
 
 
+//------------------------------------------------------------------//
+//--- Memo table                                                 ---//
+//------------------------------------------------------------------//
+
+/* The WCaches above are searched linearly and hence have to be
+   small.  Behind them sits a direct-mapped memo table, which can be
+   much bigger since a lookup costs a single probe.  Entries are
+   tagged with a generation number, so that all of them can be
+   invalidated in O(1) when a WordSet dies and its number may be
+   re-used. */
+typedef
+   enum { WMemo_addTo=1, WMemo_delFrom, WMemo_union,
+          WMemo_intersect, WMemo_minus }
+   WMemoOp;
+
+typedef
+   struct { UWord arg2; WordSet arg1; WordSet res; UInt gen; UInt op; }
+   WMemoEnt;
+
+#if VG_WORDSIZE == 8
+#  define WS_HASH_MUL 0x9E3779B97F4A7C15UL
+#else
+#  define WS_HASH_MUL 0x9E3779B9UL
+#endif
+
+static inline UWord hash_mix ( UWord h )
+{
+   h *= WS_HASH_MUL;
+   return h ^ (h >> (4 * VG_WORDSIZE));
+}
+
+
 //------------------------------------------------------------------//
 //---                          WordSet                           ---//
 //---                       Implementation                       ---//
 //------------------------------------------------------------------//
 
+/* Number of distinct elements which can get a bit number, see
+   elem_to_bit below. */
+#define WS_N_BITS (8 * VG_WORDSIZE)
+
 typedef
    struct {
       WordSetU* owner; /* for sanity checking */
       UWord*    words;
       UWord     size; /* Really this should be SizeT */
+      UWord     hash; /* of the contents, see finish_WV */
+      UWord     bits; /* bitset representation, if has_bits */
+      Bool      has_bits;
    }
    WordVec;
 
+/* Marks a free slot in vec2ix. */
+#define WS_NONE ((WordSet)(-1))
+
 /* ix2vec[0 .. ix2vec_used-1] are pointers to the lock sets (WordVecs)
-   really.  vec2ix is the inverse mapping, mapping WordVec* to the
-   corresponding ix2vec entry number.  The two mappings are mutually
-   redundant. 
+   really.  vec2ix is the inverse mapping: an open addressing hash
+   table (linear probing) of the live WordSets, hashed on the contents
+   of their WordVecs.  The two mappings are mutually redundant.
 
    If a WordVec WV is marked as dead by HG(dieWS), WV is removed from
    vec2ix. The entry of the dead WVs in ix2vec are used to maintain a
-   linked list of free (to be re-used) ix2vec entries. */
+   linked list of free (to be re-used) ix2vec entries.
+
+   The first WS_N_BITS distinct words that appear in any WordSet of
+   the universe are given a bit number.  WordSets that only contain
+   such words additionally carry a bitset, which makes membership
+   tests and many set operations a few word-sized instructions. */
 struct _WordSetU {
       void*     (*alloc)(const HChar*,SizeT);
       const HChar* cc;
       void      (*dealloc)(void*);
-      WordFM*   vec2ix; /* WordVec-to-WordSet mapping tree */
+      WordSet*  vec2ix; /* WordVec-to-WordSet hash table */
+      UWord     vec2ix_size; /* number of slots, a power of 2 */
+      UWord     vec2ix_used;
       WordVec** ix2vec; /* WordSet-to-WordVec mapping array */
       UWord     ix2vec_size;
       UWord     ix2vec_used;
       WordVec** ix2vec_free;
       WordSet   empty; /* cached, for speed */
+      /* Word to bit number mapping (open addressing, never full) */
+      UWord     bit_elem[2 * WS_N_BITS];
+      UChar     bit_ix[2 * WS_N_BITS]; /* 0: free, else bit number + 1 */
+      UWord     n_bits;
       /* Caches for some operations */
       WCache    cache_addTo;
       WCache    cache_delFrom;
       WCache    cache_intersect;
       WCache    cache_minus;
+      WMemoEnt* memo;
+      UWord     memo_size; /* 0 (disabled) or a power of 2 */
+      UInt      memo_gen;
       /* Stats */
       UWord     n_add;
       UWord     n_add_uncached;
@@ -169,10 +224,13 @@ struct _WordSetU {
       UWord     n_del_uncached;
       UWord     n_die;
       UWord     n_union;
+      UWord     n_union_uncached;
       UWord     n_intersect;
       UWord     n_intersect_uncached;
       UWord     n_minus;
       UWord     n_minus_uncached;
+      UWord     n_memo_hits;
+      UWord     n_bits_fast;
       UWord     n_elem;
       UWord     n_doubleton;
       UWord     n_isEmpty;
@@ -191,6 +249,9 @@ static WordVec* new_WV_of_size ( WordSetU* wsu, UWord sz )
    wv->owner = wsu;
    wv->words = NULL;
    wv->size = sz;
+   wv->hash = 0;
+   wv->bits = 0;
+   wv->has_bits = False;
    if (sz > 0) {
      wv->words = wsu->alloc( wsu->cc, (SizeT)sz * sizeof(UWord) );
    }
@@ -205,35 +266,161 @@ static void delete_WV ( WordVec* wv )
    }
    dealloc(wv);
 }
-static void delete_WV_for_FM ( UWord wv ) {
-   delete_WV( (WordVec*)wv );
+/* Returns the bit number of w, or -1 if w does not have one.  If
+   'assign' and there is a bit number left, w gets one. */
+static Int elem_to_bit ( WordSetU* wsu, UWord w, Bool assign )
+{
+   const UWord mask = 2 * WS_N_BITS - 1;
+   UWord i = hash_mix(w) & mask;
+   /* At most half of the slots are in use, so this terminates. */
+   while (wsu->bit_ix[i] != 0) {
+      if (wsu->bit_elem[i] == w)
+         return wsu->bit_ix[i] - 1;
+      i = (i + 1) & mask;
+   }
+   if (!assign || wsu->n_bits == WS_N_BITS)
+      return -1;
+   wsu->bit_elem[i] = w;
+   wsu->bit_ix[i] = ++wsu->n_bits;
+   return wsu->n_bits - 1;
 }
 
-static Word cmp_WordVecs_for_FM ( UWord wv1W, UWord wv2W )
+static inline UWord hash_bits ( UWord bits )
 {
-   UWord    i;
-   WordVec* wv1    = (WordVec*)wv1W;
-   WordVec* wv2    = (WordVec*)wv2W;
+   return hash_mix(bits ^ (bits >> 7));
+}
 
-   // WordVecs with smaller size are smaller.
-   if (wv1->size < wv2->size) {
-      return -1;
+/* Compute the bitset and the hash of a WordVec whose words have been
+   filled in.  Whether or not a WordVec has a bitset only depends on
+   its contents: a word gets its bit number the first time it shows
+   up in any WordVec or never. */
+static void finish_WV ( WordSetU* wsu, WordVec* wv )
+{
+   UWord i, h;
+   Int   b;
+   wv->bits = 0;
+   wv->has_bits = True;
+   for (i = 0; i < wv->size; i++) {
+      b = elem_to_bit( wsu, wv->words[i], True );
+      if (b < 0) {
+         wv->has_bits = False;
+         break;
+      }
+      wv->bits |= (UWord)1 << b;
    }
-   if (wv1->size > wv2->size) {
-      return 1;
+   if (wv->has_bits) {
+      wv->hash = hash_bits(wv->bits);
+   } else {
+      h = wv->size;
+      for (i = 0; i < wv->size; i++)
+         h = hash_mix(h ^ wv->words[i]);
+      wv->hash = h;
    }
+}
 
-   // Sizes are equal => order based on content.
+static Bool eq_WordVecs ( const WordVec* wv1, const WordVec* wv2 )
+{
+   UWord i;
+   if (wv1->hash != wv2->hash || wv1->has_bits != wv2->has_bits)
+      return False;
+   if (wv1->has_bits)
+      return wv1->bits == wv2->bits;
+   if (wv1->size != wv2->size)
+      return False;
    for (i = 0; i < wv1->size; i++) {
-      if (wv1->words[i] == wv2->words[i])
-         continue;
-      if (wv1->words[i] < wv2->words[i])
-         return -1;
-      if (wv1->words[i] > wv2->words[i])
-         return 1;
-      tl_assert(0);
+      if (wv1->words[i] != wv2->words[i])
+         return False;
+   }
+   return True;
+}
+
+/* Return the live WordSet equal to wv, or WS_NONE. */
+static WordSet lookup_WordVec ( WordSetU* wsu, const WordVec* wv )
+{
+   const UWord mask = wsu->vec2ix_size - 1;
+   UWord   i = wv->hash & mask;
+   WordSet ws;
+   while ((ws = wsu->vec2ix[i]) != WS_NONE) {
+      if (eq_WordVecs(wsu->ix2vec[ws], wv))
+         return ws;
+      i = (i + 1) & mask;
+   }
+   return WS_NONE;
+}
+
+/* Return the live WordSet whose bitset is 'bits', or WS_NONE. */
+static WordSet lookup_bits ( WordSetU* wsu, UWord bits )
+{
+   const UWord mask = wsu->vec2ix_size - 1;
+   UWord   i = hash_bits(bits) & mask;
+   WordSet ws;
+   WordVec* wv;
+   while ((ws = wsu->vec2ix[i]) != WS_NONE) {
+      wv = wsu->ix2vec[ws];
+      if (wv->has_bits && wv->bits == bits)
+         return ws;
+      i = (i + 1) & mask;
    }
-   return 0; /* identical */
+   return WS_NONE;
+}
+
+static void insert_vec2ix ( WordSetU* wsu, WordSet ws )
+{
+   UWord i, mask;
+
+   /* Keep the load factor at or below 3/4. */
+   if (4 * (wsu->vec2ix_used + 1) > 3 * wsu->vec2ix_size) {
+      WordSet* old      = wsu->vec2ix;
+      UWord    old_size = wsu->vec2ix_size;
+      UWord    j;
+      wsu->vec2ix_size = 2 * old_size;
+      wsu->vec2ix = wsu->alloc( wsu->cc,
+                                wsu->vec2ix_size * sizeof(WordSet) );
+      for (j = 0; j < wsu->vec2ix_size; j++)
+         wsu->vec2ix[j] = WS_NONE;
+      wsu->vec2ix_used = 0;
+      for (j = 0; j < old_size; j++) {
+         if (old[j] != WS_NONE)
+            insert_vec2ix( wsu, old[j] );
+      }
+      wsu->dealloc(old);
+   }
+
+   mask = wsu->vec2ix_size - 1;
+   i = wsu->ix2vec[ws]->hash & mask;
+   while (wsu->vec2ix[i] != WS_NONE)
+      i = (i + 1) & mask;
+   wsu->vec2ix[i] = ws;
+   wsu->vec2ix_used++;
+}
+
+/* Remove ws, whose WordVec has hash 'hash', from vec2ix.  Entries
+   following it in the same cluster are shifted back, so that no
+   tombstones are needed. */
+static void remove_vec2ix ( WordSetU* wsu, WordSet ws, UWord hash )
+{
+   const UWord mask = wsu->vec2ix_size - 1;
+   UWord i = hash & mask;
+   UWord j, k;
+   while (wsu->vec2ix[i] != ws) {
+      tl_assert(wsu->vec2ix[i] != WS_NONE);
+      i = (i + 1) & mask;
+   }
+   j = i;
+   while (1) {
+      j = (j + 1) & mask;
+      if (wsu->vec2ix[j] == WS_NONE)
+         break;
+      k = wsu->ix2vec[wsu->vec2ix[j]]->hash & mask;
+      /* Move the entry at j into the hole at i, unless its home slot
+         k lies cyclically in (i, j]. */
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+         wsu->vec2ix[i] = wsu->vec2ix[j];
+         i = j;
+      }
+   }
+   wsu->vec2ix[i] = WS_NONE;
+   wsu->vec2ix_used--;
 }
 
 static void ensure_ix2vec_space ( WordSetU* wsu )
@@ -311,71 +498,164 @@ static WordVec* do_ix2vec_with_dead ( WordSetU* wsu, WordSet ws )
 */
 static WordSet add_or_dealloc_WordVec( WordSetU* wsu, WordVec* wv_new )
 {
-   Bool     have;
-   WordVec* wv_old;
-   UWord/*Set*/ ix_old = -1;
-   /* Really WordSet, but need something that can safely be casted to
-      a Word* in the lookupFM.  Making it WordSet (which is 32 bits)
-      causes failures on a 64-bit platform. */
+   WordSet ws;
    tl_assert(wv_new->owner == wsu);
-   have = VG_(lookupFM)( wsu->vec2ix, 
-                         (UWord*)&wv_old, (UWord*)&ix_old,
-                         (UWord)wv_new );
-   if (have) {
-      tl_assert(wv_old != wv_new);
-      tl_assert(wv_old);
-      tl_assert(wv_old->owner == wsu);
-      tl_assert(ix_old < wsu->ix2vec_used);
-      tl_assert(wsu->ix2vec[ix_old] == wv_old);
+   finish_WV( wsu, wv_new );
+   ws = lookup_WordVec( wsu, wv_new );
+   if (ws != WS_NONE) {
+      tl_assert(ws < wsu->ix2vec_used);
+      tl_assert(wsu->ix2vec[ws] != wv_new);
+      tl_assert(wsu->ix2vec[ws]->owner == wsu);
       delete_WV( wv_new );
-      return (WordSet)ix_old;
+      return ws;
    } else if (wsu->ix2vec_free) {
-      WordSet ws;
       tl_assert(is_dead(wsu,(WordVec*)wsu->ix2vec_free));
       ws = wsu->ix2vec_free - &(wsu->ix2vec[0]);
       tl_assert(wsu->ix2vec[ws] == NULL || is_dead(wsu,wsu->ix2vec[ws]));
       wsu->ix2vec_free = (WordVec **) wsu->ix2vec[ws];
       wsu->ix2vec[ws] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (UWord)wv_new, ws );
+      insert_vec2ix( wsu, ws );
       if (HG_DEBUG) VG_(printf)("aodW %s re-use free %d %p\n", wsu->cc, (Int)ws, wv_new );
       return ws;
    } else {
       ensure_ix2vec_space( wsu );
       tl_assert(wsu->ix2vec);
       tl_assert(wsu->ix2vec_used < wsu->ix2vec_size);
-      wsu->ix2vec[wsu->ix2vec_used] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (Word)wv_new, (Word)wsu->ix2vec_used );
-      if (HG_DEBUG) VG_(printf)("aodW %s %d %p\n", wsu->cc, (Int)wsu->ix2vec_used, wv_new  );
+      ws = (WordSet)wsu->ix2vec_used;
+      wsu->ix2vec[ws] = wv_new;
       wsu->ix2vec_used++;
       tl_assert(wsu->ix2vec_used <= wsu->ix2vec_size);
-      return (WordSet)(wsu->ix2vec_used - 1);
+      insert_vec2ix( wsu, ws );
+      if (HG_DEBUG) VG_(printf)("aodW %s %d %p\n", wsu->cc, (Int)ws, wv_new  );
+      return ws;
    }
 }
 
+/* Memo table lookup and update.  arg1 is a WordSet, arg2 is either a
+   WordSet or an element, depending on op. */
+static inline WMemoEnt* memo_ent ( WordSetU* wsu, WMemoOp op,
+                                   WordSet arg1, UWord arg2 )
+{
+   UWord h = hash_mix(arg2 ^ ((UWord)arg1 << 3) ^ (UWord)op);
+   return &wsu->memo[h & (wsu->memo_size - 1)];
+}
+
+static inline Bool memo_lookup ( WordSetU* wsu, WMemoOp op,
+                                 WordSet arg1, UWord arg2,
+                                 /*OUT*/WordSet* res )
+{
+   WMemoEnt* ent;
+   if (wsu->memo_size == 0)
+      return False;
+   ent = memo_ent( wsu, op, arg1, arg2 );
+   if (ent->gen == wsu->memo_gen && ent->op == op
+       && ent->arg1 == arg1 && ent->arg2 == arg2) {
+      wsu->n_memo_hits++;
+      *res = ent->res;
+      return True;
+   }
+   return False;
+}
+
+static inline void memo_update ( WordSetU* wsu, WMemoOp op,
+                                 WordSet arg1, UWord arg2, WordSet res )
+{
+   WMemoEnt* ent;
+   if (wsu->memo_size == 0)
+      return;
+   ent = memo_ent( wsu, op, arg1, arg2 );
+   ent->arg1 = arg1;
+   ent->arg2 = arg2;
+   ent->res  = res;
+   ent->gen  = wsu->memo_gen;
+   ent->op   = op;
+}
+
+static void memo_invalidate ( WordSetU* wsu )
+{
+   wsu->memo_gen++;
+   if (wsu->memo_gen == 0) {
+      /* Wrapped around; old entries could look valid again. */
+      if (wsu->memo_size > 0)
+         VG_(memset)( wsu->memo, 0, wsu->memo_size * sizeof(WMemoEnt) );
+      wsu->memo_gen = 1;
+   }
+}
+
+/* Number of elements of a bitset. */
+static inline UWord bits_count ( UWord bits )
+{
+   UWord n = 0;
+   while (bits) {
+      bits &= bits - 1;
+      n++;
+   }
+   return n;
+}
+
+/* The WordSet whose bitset is 'bits', given that 'bits' is a subset
+   of the bitset of wv.  This avoids building a new WordVec when the
+   result already exists. */
+static WordSet ws_from_bits ( WordSetU* wsu, WordVec* wv, UWord bits )
+{
+   WordVec* wv_new;
+   WordSet  ws;
+   UWord    i, k;
+   tl_assert(wv->has_bits);
+   tl_assert((bits & ~wv->bits) == 0);
+   ws = lookup_bits( wsu, bits );
+   if (ws != WS_NONE)
+      return ws;
+   wv_new = new_WV_of_size( wsu, bits_count(bits) );
+   k = 0;
+   for (i = 0; i < wv->size; i++) {
+      if (bits & ((UWord)1 << elem_to_bit( wsu, wv->words[i], False )))
+         wv_new->words[k++] = wv->words[i];
+   }
+   tl_assert(k == wv_new->size);
+   return add_or_dealloc_WordVec( wsu, wv_new );
+}
+
 
 WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              const HChar* cc,
                              void  (*dealloc)(void*),
-                             Word  cacheSize )
+                             Word  cacheSize,
+                             UWord memoSize )
 {
    WordSetU* wsu;
    WordVec*  empty;
+   UWord     i;
 
    wsu          = alloc_nofail( cc, sizeof(WordSetU) );
    VG_(memset)( wsu, 0, sizeof(WordSetU) );
    wsu->alloc   = alloc_nofail;
    wsu->cc      = cc;
    wsu->dealloc = dealloc;
-   wsu->vec2ix  = VG_(newFM)( alloc_nofail, cc,
-                              dealloc, cmp_WordVecs_for_FM );
+   wsu->vec2ix_size = 64;
+   wsu->vec2ix_used = 0;
+   wsu->vec2ix      = alloc_nofail( cc, wsu->vec2ix_size * sizeof(WordSet) );
+   for (i = 0; i < wsu->vec2ix_size; i++)
+      wsu->vec2ix[i] = WS_NONE;
    wsu->ix2vec_used = 0;
    wsu->ix2vec_size = 0;
    wsu->ix2vec      = NULL;
    wsu->ix2vec_free = NULL;
+   wsu->n_bits      = 0;
    WCache_INIT(wsu->cache_addTo,     cacheSize);
    WCache_INIT(wsu->cache_delFrom,   cacheSize);
    WCache_INIT(wsu->cache_intersect, cacheSize);
    WCache_INIT(wsu->cache_minus,     cacheSize);
+   /* Round the memo table size down to a power of 2. */
+   wsu->memo_size = 0;
+   if (memoSize > 0) {
+      wsu->memo_size = 1;
+      while (wsu->memo_size <= memoSize / 2)
+         wsu->memo_size *= 2;
+      wsu->memo = alloc_nofail( cc, wsu->memo_size * sizeof(WMemoEnt) );
+      VG_(memset)( wsu->memo, 0, wsu->memo_size * sizeof(WMemoEnt) );
+   }
+   wsu->memo_gen = 1;
    empty = new_WV_of_size( wsu, 0 );
    wsu->empty = add_or_dealloc_WordVec( wsu, empty );
 
@@ -385,10 +665,17 @@ WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
 void HG_(deleteWordSetU) ( WordSetU* wsu )
 {
    void (*dealloc)(void*) = wsu->dealloc;
+   UWord i;
    tl_assert(wsu->vec2ix);
-   VG_(deleteFM)( wsu->vec2ix, delete_WV_for_FM, NULL/*val-finalizer*/ );
+   for (i = 0; i < wsu->ix2vec_used; i++) {
+      if (!is_dead(wsu, wsu->ix2vec[i]))
+         delete_WV( wsu->ix2vec[i] );
+   }
+   dealloc(wsu->vec2ix);
    if (wsu->ix2vec)
       dealloc(wsu->ix2vec);
+   if (wsu->memo)
+      dealloc(wsu->memo);
    dealloc(wsu);
 }
 
@@ -459,8 +746,6 @@ void HG_(getPayloadWS) ( /*OUT*/UWord** words, /*OUT*/UWord* nWords,
 void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
 {
    WordVec* wv = do_ix2vec_with_dead( wsu, ws );
-   WordVec* wv_in_vec2ix;
-   UWord/*Set*/ wv_ix = -1;
 
    if (HG_DEBUG) VG_(printf)("dieWS %s %d %p\n", wsu->cc, (Int)ws, wv);
 
@@ -472,24 +757,18 @@ void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
 
    wsu->n_die++;
    
-   
+   remove_vec2ix( wsu, ws, wv->hash );
+
    wsu->ix2vec[ws] = (WordVec*) wsu->ix2vec_free;
    wsu->ix2vec_free = &wsu->ix2vec[ws];
 
-   VG_(delFromFM) ( wsu->vec2ix, 
-                    (UWord*)&wv_in_vec2ix, (UWord*)&wv_ix,
-                    (UWord)wv );
-
-   if (HG_DEBUG) VG_(printf)("dieWS wv_ix %d\n", (Int)wv_ix);
-   tl_assert (wv_ix);
-   tl_assert (wv_ix == ws);
-
    delete_WV( wv );
 
    wsu->cache_addTo.inUse = 0;
    wsu->cache_delFrom.inUse = 0;
    wsu->cache_intersect.inUse = 0;
    wsu->cache_minus.inUse = 0;
+   memo_invalidate( wsu );
 }
 
 Bool HG_(plausibleWS) ( WordSetU* wsu, WordSet ws )
@@ -523,8 +802,14 @@ Bool HG_(saneWS_SLOW) ( WordSetU* wsu, WordSet ws )
 Bool HG_(elemWS) ( WordSetU* wsu, WordSet ws, UWord w )
 {
    UWord    i;
+   Int      b;
    WordVec* wv = do_ix2vec( wsu, ws );
    wsu->n_elem++;
+   if (wv->has_bits) {
+      /* A word without a bit number is in no set that has a bitset. */
+      b = elem_to_bit( wsu, w, False );
+      return b >= 0 && (wv->bits & ((UWord)1 << b)) != 0;
+   }
    for (i = 0; i < wv->size; i++) {
       if (wv->words[i] == w)
          return True;
@@ -561,7 +846,13 @@ WordSet HG_(singletonWS) ( WordSetU* wsu, UWord w )
 
 WordSet HG_(isSubsetOf) ( WordSetU* wsu, WordSet small, WordSet big )
 {
+   WordVec* wv_small;
+   WordVec* wv_big;
    wsu->n_isSubsetOf++;
+   wv_small = do_ix2vec( wsu, small );
+   wv_big   = do_ix2vec( wsu, big );
+   if (wv_small->has_bits && wv_big->has_bits)
+      return (wv_small->bits & ~wv_big->bits) == 0;
    return small == HG_(intersectWS)( wsu, small, big );
 }
 
@@ -587,7 +878,8 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
                wsu->n_add, wsu->n_add_uncached);
    VG_(printf)("      delFrom      %10lu (%lu uncached)\n", 
                wsu->n_del, wsu->n_del_uncached);
-   VG_(printf)("      union        %10lu\n", wsu->n_union);
+   VG_(printf)("      union        %10lu (%lu uncached)\n",
+               wsu->n_union, wsu->n_union_uncached);
    VG_(printf)("      intersect    %10lu (%lu uncached) "
                "[nb. incl isSubsetOf]\n", 
                wsu->n_intersect, wsu->n_intersect_uncached);
@@ -600,6 +892,10 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
    VG_(printf)("      anyElementOf %10lu\n",   wsu->n_anyElementOf);
    VG_(printf)("      isSubsetOf   %10lu\n",   wsu->n_isSubsetOf);
    VG_(printf)("      dieWS        %10lu\n",   wsu->n_die);
+   VG_(printf)("      memo hits    %10lu (%lu entries)\n",
+               wsu->n_memo_hits, wsu->memo_size);
+   VG_(printf)("      bitset ops   %10lu (%lu of %d elements numbered)\n",
+               wsu->n_bits_fast, wsu->n_bits, WS_N_BITS);
 }
 
 WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
@@ -612,15 +908,27 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
    wsu->n_add++;
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_addTo, ws, w);
    wsu->n_add_uncached++;
+   if (memo_lookup(wsu, WMemo_addTo, ws, w, &result))
+      goto out;
 
    /* If already present, this is a no-op. */
    wv = do_ix2vec( wsu, ws );
+   if (wv->has_bits) {
+      Int b = elem_to_bit( wsu, w, False );
+      wsu->n_bits_fast++;
+      if (b >= 0 && (wv->bits & ((UWord)1 << b))) {
+         result = ws;
+         goto out;
+      }
+      goto build;
+   }
    for (k = 0; k < wv->size; k++) {
       if (wv->words[k] == w) {
          result = ws;
          goto out;
       }
    }
+  build:
    /* Ok, not present.  Build a new one ... */
    wv_new = new_WV_of_size( wsu, wv->size + 1 );
    k = j = 0;
@@ -637,6 +945,7 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
    /* Find any existing copy, or add the new one. */
    result = add_or_dealloc_WordVec( wsu, wv_new );
    tl_assert(result != (WordSet)(-1));
+   memo_update( wsu, WMemo_addTo, ws, w, result );
 
   out:
    WCache_UPDATE(wsu->cache_addTo, ws, w, result);
@@ -660,8 +969,20 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_delFrom, ws, w);
    wsu->n_del_uncached++;
+   if (memo_lookup(wsu, WMemo_delFrom, ws, w, &result))
+      goto out;
 
    /* If not already present, this is a no-op. */
+   if (wv->has_bits) {
+      Int b = elem_to_bit( wsu, w, False );
+      wsu->n_bits_fast++;
+      if (b < 0 || (wv->bits & ((UWord)1 << b)) == 0) {
+         result = ws;
+         goto out;
+      }
+      result = ws_from_bits( wsu, wv, wv->bits & ~((UWord)1 << b) );
+      goto memo;
+   }
    for (i = 0; i < wv->size; i++) {
       if (wv->words[i] == w)
          break;
@@ -685,9 +1006,11 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
    tl_assert(k == wv_new->size);
 
    result = add_or_dealloc_WordVec( wsu, wv_new );
+  memo:
    if (wv->size == 1) {
       tl_assert(result == wsu->empty);
    }
+   memo_update( wsu, WMemo_delFrom, ws, w, result );
 
   out:
    WCache_UPDATE(wsu->cache_delFrom, ws, w, result);
@@ -697,10 +1020,34 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
    UWord    i1, i2, k, sz;
+   WordSet  ws_new;
    WordVec* wv_new;
-   WordVec* wv1 = do_ix2vec( wsu, ws1 );
-   WordVec* wv2 = do_ix2vec( wsu, ws2 );
+   WordVec* wv1;
+   WordVec* wv2;
    wsu->n_union++;
+
+   if (ws1 == ws2)
+      return ws1;
+   /* Normalise the query, as for intersectWS. */
+   if (ws1 > ws2) {
+      WordSet wst = ws1; ws1 = ws2; ws2 = wst;
+   }
+   if (memo_lookup(wsu, WMemo_union, ws1, ws2, &ws_new))
+      return ws_new;
+   wsu->n_union_uncached++;
+
+   wv1 = do_ix2vec( wsu, ws1 );
+   wv2 = do_ix2vec( wsu, ws2 );
+   if (wv1->has_bits && wv2->has_bits) {
+      /* If either set contains the other, the result is known. */
+      UWord bits = wv1->bits | wv2->bits;
+      wsu->n_bits_fast++;
+      if (bits == wv1->bits || bits == wv2->bits) {
+         ws_new = bits == wv1->bits ? ws1 : ws2;
+         memo_update( wsu, WMemo_union, ws1, ws2, ws_new );
+         return ws_new;
+      }
+   }
    sz = 0;
    i1 = i2 = 0;
    while (1) {
@@ -761,7 +1108,9 @@ WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
    tl_assert(k == sz);
 
-   return add_or_dealloc_WordVec( wsu, wv_new );
+   ws_new = add_or_dealloc_WordVec( wsu, wv_new );
+   memo_update( wsu, WMemo_union, ws1, ws2, ws_new );
+   return ws_new;
 }
 
 WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
@@ -787,9 +1136,16 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_intersect, ws1, ws2);
    wsu->n_intersect_uncached++;
+   if (memo_lookup(wsu, WMemo_intersect, ws1, ws2, &ws_new))
+      goto out;
 
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
+   if (wv1->has_bits && wv2->has_bits) {
+      wsu->n_bits_fast++;
+      ws_new = ws_from_bits( wsu, wv1, wv1->bits & wv2->bits );
+      goto memo;
+   }
    sz = 0;
    i1 = i2 = 0;
    while (1) {
@@ -839,7 +1195,10 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       tl_assert(ws_new == wsu->empty);
    }
 
+  memo:
    tl_assert(ws_new != (WordSet)(-1));
+   memo_update( wsu, WMemo_intersect, ws1, ws2, ws_new );
+  out:
    WCache_UPDATE(wsu->cache_intersect, ws1, ws2, ws_new);
 
    return ws_new;
@@ -856,9 +1215,16 @@ WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
    wsu->n_minus++;
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_minus, ws1, ws2);
    wsu->n_minus_uncached++;
+   if (memo_lookup(wsu, WMemo_minus, ws1, ws2, &ws_new))
+      goto out;
 
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
+   if (wv1->has_bits && wv2->has_bits) {
+      wsu->n_bits_fast++;
+      ws_new = ws_from_bits( wsu, wv1, wv1->bits & ~wv2->bits );
+      goto memo;
+   }
    sz = 0;
    i1 = i2 = 0;
    while (1) {
@@ -915,7 +1281,10 @@ WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       tl_assert(ws_new == wsu->empty);
    }
 
+  memo:
    tl_assert(ws_new != (WordSet)(-1));
+   memo_update( wsu, WMemo_minus, ws1, ws2, ws_new );
+  out:
    WCache_UPDATE(wsu->cache_minus, ws1, ws2, ws_new);
 
    return ws_new;
@@ -46,11 +46,15 @@ typedef  struct _WordSetU  WordSetU;  /* opaque */
 
 typedef  UInt              WordSet;   /* opaque, small int index */
 
-/* Allocate and initialise a WordSetU */
+/* Allocate and initialise a WordSetU.  cacheSize is the number of
+   entries of the small per-operation caches (1 .. 32), memoSize the
+   number of entries of the memo table behind them (0 to disable; it
+   is rounded down to a power of 2). */
 WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              const HChar* cc,
                              void  (*dealloc)(void*),
-                             Word  cacheSize );
+                             Word  cacheSize,
+                             UWord memoSize );
 
 /* Free up the WordSetU. */
 void HG_(deleteWordSetU) ( WordSetU* );
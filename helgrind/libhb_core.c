@@ -596,6 +596,8 @@ static UWord stats__secmaps_in_map_shmem = 0; // # SecMaps 'live'
 static UWord stats__secmaps_scanGC       = 0; // # nr of scan GC done.
 static UWord stats__secmaps_scanGCed     = 0; // # SecMaps GC-ed via scan
 static UWord stats__secmaps_ssetGCed     = 0; // # SecMaps GC-ed via setnoaccess
+static UWord stats__secmaps_pending_made = 0; // # SecMaps made from pending
+static ULong stats__pending_bytes        = 0; // # ga bytes made New lazily
 static UWord stats__secmap_ga_space_covered = 0; // # ga bytes covered
 static UWord stats__secmap_linesZ_allocd = 0; // # LineZ's issued
 static UWord stats__secmap_linesZ_bytes  = 0; // .. using this much storage
@@ -680,6 +682,7 @@ static void* shmem__bigchunk_alloc ( SizeT n )
       if (0)
       VG_(printf)("XXXXX bigchunk: abandoning %d bytes\n",
                   (Int)(shmem__bigchunk_end1 - shmem__bigchunk_next));
+      /* With --huge-pages, the chunk is backed by huge pages. */
       shmem__bigchunk_next = VG_(am_shadow_alloc)( sHMEM__BIGCHUNK_SIZE );
       if (shmem__bigchunk_next == NULL)
          VG_(out_of_memory_NORETURN)(
@@ -917,6 +920,114 @@ static UWord shmem__SecMap_do_GC(Bool really)
    return ok_GCed;
 }
 
+/* Pending ranges.
+
+   Making a large range New (e.g. a big anonymous mmap) would allocate a
+   SecMap for each N_SECMAP_ARANGE bytes of it and fill it in, although
+   most of such a range is often never accessed.  Instead, the SecMap
+   aligned middle part of the range is recorded as pending in
+   map_pending (WordFM Addr PendingRange*), with the SVal it should
+   have.  When a SecMap is created for an address in a pending range,
+   it is initialised with that SVal instead of SVal_NOACCESS, and its
+   part of the range stops being pending.
+
+   Invariants: pending ranges are SecMap aligned, do not overlap each
+   other, and do not overlap any SecMap in map_shmem.  Each pending
+   range holds a reference (SVal__rcinc) on its SVal. */
+typedef
+   struct {
+      Addr start;
+      Addr end;  /* one past the last byte */
+      SVal sv;
+   }
+   PendingRange;
+
+static WordFM* map_pending = NULL; /* WordFM Addr PendingRange* */
+static UWord   n_pending_ranges = 0;
+
+static void pending_add ( Addr start, Addr end, SVal sv )
+{
+   PendingRange* pr;
+   tl_assert(start < end);
+   tl_assert(shmem__round_to_SecMap_base(start) == start);
+   tl_assert(shmem__round_to_SecMap_base(end) == end);
+   pr = HG_(zalloc)( "libhb.pending_add.1", sizeof(PendingRange) );
+   pr->start = start;
+   pr->end   = end;
+   pr->sv    = sv;
+   SVal__rcinc(sv);
+   VG_(addToFM)( map_pending, (UWord)start, (UWord)pr );
+   n_pending_ranges++;
+}
+
+/* Returns the pending range containing ga, or NULL. */
+static PendingRange* pending_find ( Addr ga )
+{
+   UWord keyW, valW;
+   if (LIKELY(n_pending_ranges == 0))
+      return NULL;
+   if (VG_(lookupFM)( map_pending, NULL, &valW, (UWord)ga ))
+      return (PendingRange*)valW;
+   if (!VG_(findBoundsFM)( map_pending, &keyW, &valW, NULL, NULL,
+                           0, 0, ~(UWord)0, 0, (UWord)ga ))
+      tl_assert(0);
+   if (valW != 0 && ((PendingRange*)valW)->end > ga)
+      return (PendingRange*)valW;
+   return NULL;
+}
+
+/* Returns the lowest pending range overlapping [start, end), or NULL. */
+static PendingRange* pending_find_overlap ( Addr start, Addr end )
+{
+   PendingRange* pr = pending_find(start);
+   UWord         valW;
+   if (pr != NULL || n_pending_ranges == 0)
+      return pr;
+   VG_(initIterAtFM)( map_pending, (UWord)start );
+   if (VG_(nextIterFM)( map_pending, NULL, &valW )
+       && ((PendingRange*)valW)->start < end)
+      pr = (PendingRange*)valW;
+   VG_(doneIterFM)( map_pending );
+   return pr;
+}
+
+/* Stop [start, end) (SecMap aligned) from being pending. */
+static void pending_remove ( Addr start, Addr end )
+{
+   PendingRange* pr;
+   UWord         keyW, valW;
+   while ((pr = pending_find_overlap(start, end)) != NULL) {
+      if (!VG_(delFromFM)( map_pending, &keyW, &valW, (UWord)pr->start ))
+         tl_assert(0);
+      tl_assert(valW == (UWord)pr);
+      n_pending_ranges--;
+      if (pr->start < start)
+         pending_add( pr->start, start, pr->sv );
+      if (pr->end > end)
+         pending_add( end, pr->end, pr->sv );
+      SVal__rcdec(pr->sv);
+      HG_(free)(pr);
+   }
+}
+
+/* sm has just been created for gaKey : give it the SVal of the pending
+   range it is in, if any. */
+static void pending_init_SecMap ( SecMap* sm, Addr gaKey )
+{
+   PendingRange* pr = pending_find(gaKey);
+   UWord         i;
+   if (pr == NULL)
+      return;
+   for (i = 0; i < N_SECMAP_ZLINES; i++) {
+      /* shmem__alloc_or_recycle_SecMap made all lines SVal_NOACCESS,
+         i.e. all referencing dict[0]. */
+      sm->linesZ[i].dict[0] = pr->sv;
+      SVal__rcinc(pr->sv);
+   }
+   stats__secmaps_pending_made++;
+   pending_remove( gaKey, gaKey + N_SECMAP_ARANGE );
+}
+
 static SecMap* shmem__find_or_alloc_SecMap ( Addr ga )
 {
    SecMap* sm = shmem__find_SecMap ( ga );
@@ -928,6 +1039,8 @@ static SecMap* shmem__find_or_alloc_SecMap ( Addr ga )
       Addr gaKey = shmem__round_to_SecMap_base(ga);
       sm = shmem__alloc_or_recycle_SecMap();
       tl_assert(sm);
+      if (UNLIKELY(n_pending_ranges > 0))
+         pending_init_SecMap( sm, gaKey );
       VG_(addToFM)( map_shmem, (UWord)gaKey, (UWord)sm );
       stats__secmaps_in_map_shmem++;
       if (CHECK_ZSM) tl_assert(is_sane_SecMap(sm));
@@ -1954,6 +2067,10 @@ static void zsm_init ( void )
    map_shmem = VG_(newFM)( HG_(zalloc), "libhb.zsm_init.1 (map_shmem)",
                            HG_(free), 
                            NULL/*unboxed UWord cmp*/);
+   tl_assert(map_pending == NULL);
+   map_pending = VG_(newFM)( HG_(zalloc), "libhb.zsm_init.2 (map_pending)",
+                             HG_(free),
+                             NULL/*unboxed UWord cmp*/);
    /* Invalidate all cache entries. */
    tl_assert(!is_valid_scache_tag(1));
    for (UWord wix = 0; wix < N_WAY_NENT; wix++) {
@@ -3216,7 +3333,8 @@ static void vts_tab__do_GC ( Bool show_stats )
    /* Now actually apply the mapping. */
    /* Visit all the VtsIDs in the entire system.  Where do we expect
       to find them?
-      (a) in shadow memory -- the LineZs and LineFs
+      (a) in shadow memory -- the LineZs and LineFs, and the pending
+          ranges
       (b) in our collection of struct _Thrs.
       (c) in our collection of struct _SOs.
       Nowhere else, AFAICS.  Not in the zsm cache, because that just
@@ -3251,6 +3369,14 @@ static void vts_tab__do_GC ( Bool show_stats )
       }
    }
    VG_(doneIterFM)( map_shmem );
+   /* and the SVals of the pending ranges. */
+   UWord pendingW = 0;
+   VG_(initIterFM)( map_pending );
+   while (VG_(nextIterFM)( map_pending, NULL, &pendingW )) {
+      PendingRange* pr = (PendingRange*)pendingW;
+      remap_VtsIDs_in_SVal(vts_tab, new_tab, &pr->sv);
+   }
+   VG_(doneIterFM)( map_pending );
 
    /* Do the mappings for (b) above: visit our collection of struct
       _Thrs. */
@@ -5867,6 +5993,58 @@ static void zsm_sset_range ( Addr a, SizeT len, SVal svNew )
    }
 }
 
+/* Ranges at least this big are set with zsm_sset_range_lazy. */
+#define LAZY_SSET_MIN_SZB (8 * N_SECMAP_ARANGE)
+
+/* As zsm_sset_range, but the SecMap aligned parts of the range which
+   have no SecMap yet are only made pending (see map_pending), so that
+   the cost does not depend on the size of the range, but only on how
+   much of it has been accessed before. */
+static void zsm_sset_range_lazy ( Addr a, SizeT len, SVal svNew )
+{
+   Addr  FSM = ROUNDUP(a, N_SECMAP_ARANGE);
+   Addr  AFC = ROUNDDN(a + len, N_SECMAP_ARANGE);
+   Addr  next;
+   UWord gaKey;
+   Bool  found;
+
+   if (FSM >= AFC) {
+      zsm_sset_range( a, len, svNew );
+      return;
+   }
+
+   /* Forget what was pending before in the aligned part. */
+   pending_remove( FSM, AFC );
+
+   /* The partial SecMaps at both ends are done the usual way. */
+   if (FSM > a)
+      zsm_sset_range( a, FSM - a, svNew );
+   if (a + len > AFC)
+      zsm_sset_range( AFC, a + len - AFC, svNew );
+
+   /* So are the existing SecMaps in between, and the gaps between them
+      become pending.  map_shmem is searched again for each SecMap, as
+      zsm_sset_range may write back cache lines and so modify it. */
+   next = FSM;
+   while (next < AFC) {
+      VG_(initIterAtFM)( map_shmem, (UWord)next );
+      found = VG_(nextIterFM)( map_shmem, &gaKey, NULL );
+      VG_(doneIterFM)( map_shmem );
+      if (!found || gaKey >= AFC)
+         break;
+      if (gaKey > next) {
+         pending_add( next, gaKey, svNew );
+         stats__pending_bytes += gaKey - next;
+      }
+      zsm_sset_range( gaKey, N_SECMAP_ARANGE, svNew );
+      next = gaKey + N_SECMAP_ARANGE;
+   }
+   if (next < AFC) {
+      pending_add( next, AFC, svNew );
+      stats__pending_bytes += AFC - next;
+   }
+}
+
 
 /////////////////////////////////////////////////////////
 //                                                     //
@@ -6343,6 +6521,10 @@ void libhb_shutdown ( Bool show_stats )
                   stats__secmaps_ssetGCed);
       VG_(printf)(" secmaps: %'10lu searches (%'12lu slow)\n",
                   stats__secmaps_search, stats__secmaps_search_slow);
+      VG_(printf)(" pending: %'10lu ranges, %'lu secmaps made from them,"
+                  " %'llu bytes made New lazily\n",
+                  n_pending_ranges, stats__secmaps_pending_made,
+                  stats__pending_bytes);
 
       VG_(printf)("%s","\n");
       VG_(printf)("   cache: %'lu totrefs (%'lu misses)\n",
@@ -6747,7 +6929,10 @@ void libhb_srange_new ( Thr* thr, Addr a, SizeT szB )
    SVal sv = SVal__mkC(thr->viW, thr->viW);
    tl_assert(is_sane_SVal_C(sv));
    if (0 && TRACEME(a,szB)) trace(thr,a,szB,"nw-before");
-   zsm_sset_range( a, szB, sv );
+   if (szB >= LAZY_SSET_MIN_SZB)
+      zsm_sset_range_lazy( a, szB, sv );
+   else
+      zsm_sset_range( a, szB, sv );
    Filter__clear_range( thr->filter, a, szB );
    if (0 && TRACEME(a,szB)) trace(thr,a,szB,"nw-after ");
 }
@@ -6869,6 +7054,18 @@ static void zsm_sset_range_noaccess (Addr addr, SizeT len)
 
    tl_assert (Plen == 0);
 
+   /* The full SecMaps of the range stop being pending.  The partial
+      SecMaps at both ends are created if pending, so that the part
+      outside of the range keeps its pending SVal. */
+   if (UNLIKELY(n_pending_ranges > 0)) {
+      if (FSM < AFC)
+         pending_remove (FSM, AFC);
+      if (BPC != FSM && pending_find (BPC))
+         (void) shmem__find_or_alloc_SecMap (BPC);
+      if (ARE != AFC && pending_find (ARE - 1))
+         (void) shmem__find_or_alloc_SecMap (ARE - 1);
+   }
+
    /* Set to NOACCESS pieces before and after not covered by entire SecMaps. */
 
    /* First we set the partial cachelines. This is done through the cache. */
@@ -6988,9 +7185,10 @@ UWord libhb_srange_get_abits (Addr a, UChar *abits, SizeT len)
          /* Byte not found in the cacheline. Search for a SecMap. */
          SecMap *sm = shmem__find_SecMap(b);
          LineZ *lineZ;
-         if (sm == NULL)
-            sv = SVal_NOACCESS;
-         else {
+         if (sm == NULL) {
+            PendingRange *pr = pending_find(b);
+            sv = pr ? pr->sv : SVal_NOACCESS;
+         } else {
             UWord zix = shmem__get_SecMap_offset(b) >> N_LINE_BITS;
             lineZ = &sm->linesZ[zix];
             if (lineZ->dict[0] == SVal_INVALID) {
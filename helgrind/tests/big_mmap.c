@@ -0,0 +1,73 @@
+/* Checks the shadow state of a large anonymous mapping, which helgrind
+   makes New lazily, and that accesses deep inside it are tracked
+   normally: a write by a child thread followed by a read by the parent
+   after the join must not be reported as a race. */
+
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "helgrind/helgrind.h"
+
+#define SZB   (64 * 1024 * 1024)
+#define CHUNK 4096
+
+static char* big;
+static unsigned char shadow[CHUNK];
+
+static void check (const char* what, char* p, unsigned char access)
+{
+   long int r;
+   int i;
+
+   r = VALGRIND_HG_GET_ABITS (p, shadow, CHUNK);
+   if (r != (access == 0xff ? CHUNK : 0)) {
+      fprintf (stderr, "%s: unexpected result %ld\n", what, r);
+      return;
+   }
+   for (i = 0; i < CHUNK; i++)
+      if (shadow[i] != access) {
+         fprintf (stderr, "%s: unexpected shadow at %d\n", what, i);
+         return;
+      }
+}
+
+static void* child_fn (void* arg)
+{
+   big[SZB / 2 + 100] = 42;
+   return NULL;
+}
+
+int main (void)
+{
+   pthread_t child;
+
+   big = mmap (NULL, SZB, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert (big != MAP_FAILED);
+
+   fprintf (stderr, "fresh mapping\n");
+   check ("start", big, 0xff);
+   check ("middle", big + SZB / 3, 0xff);
+   check ("end", big + SZB - CHUNK, 0xff);
+
+   fprintf (stderr, "access from two threads\n");
+   if (pthread_create (&child, NULL, child_fn, NULL)) {
+      perror ("pthread_create");
+      return 1;
+   }
+   if (pthread_join (child, NULL)) {
+      perror ("pthread join");
+      return 1;
+   }
+   if (big[SZB / 2 + 100] != 42)
+      fprintf (stderr, "lost the child's write\n");
+
+   fprintf (stderr, "partial unmap\n");
+   assert (munmap (big + SZB / 4 + CHUNK, SZB / 4) == 0);
+   check ("before hole", big + SZB / 4, 0xff);
+   check ("hole", big + SZB / 4 + CHUNK, 0x00);
+   check ("after hole", big + SZB / 2 + CHUNK, 0xff);
+
+   return 0;
+}
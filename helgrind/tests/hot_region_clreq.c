@@ -0,0 +1,38 @@
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../helgrind/helgrind.h"
+
+/* As tc01_simple_race, but all code is made a hot region with
+   VALGRIND_HG_ADD_HOT_CODE_RANGE first: the race must still be found. */
+
+int x = 0;
+
+void* child_fn ( void* arg )
+{
+   /* Unprotected relative to parent */
+   x++;
+   return NULL;
+}
+
+int main ( void )
+{
+   const struct timespec delay = { 0, 100 * 1000 * 1000 };
+   pthread_t child;
+   VALGRIND_HG_ADD_HOT_CODE_RANGE( (void*)0x1000, ~0x1fffUL );
+   if (pthread_create(&child, NULL, child_fn, NULL)) {
+      perror("pthread_create");
+      exit(1);
+   }
+   nanosleep(&delay, 0);
+   /* Unprotected relative to child */
+   x++;
+
+   if (pthread_join(child, NULL)) {
+      perror("pthread join");
+      exit(1);
+   }
+
+   return 0;
+}
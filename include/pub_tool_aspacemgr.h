@@ -151,9 +151,17 @@ extern const HChar* VG_(am_get_filename)( NSegment const * );
 extern Bool VG_(am_is_valid_for_client) ( Addr start, SizeT len, 
                                           UInt prot );
 
-/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
+/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind_huge):
+   with --huge-pages=, an allocation of at least VG_(am_huge_page_szB)()
+   bytes is backed by huge pages. */
 extern void* VG_(am_shadow_alloc)(SizeT size);
 
+/* The size of the huge pages used for shadow memory, or 0 if
+   --huge-pages=no.  Tools allocating many small pieces of shadow
+   memory can carve them out of allocations of this size, so that
+   they share TLB entries. */
+extern SizeT VG_(am_huge_page_szB)( void );
+
 /* Unmap the given address range and update the segment array
    accordingly.  This fails if the range isn't valid for valgrind. */
 extern SysRes VG_(am_munmap_valgrind)( Addr start, SizeT length );
@@ -69,11 +69,6 @@
 //   [Introduction of --time-unit=i as the default slowed things down by
 //   roughly 0--20%.]
 //
-// - get_XCon accounts for about 9% of konqueror startup time.  Try
-//   keeping XPt children sorted by 'ip' and use binary search in get_XCon.
-//   Requires factoring out binary search code from various places into a
-//   VG_(bsearch) function.  
-//
 // Todo -- low priority:
 // - In each XPt, record both bytes and the number of allocations, and
 //   possibly the global number of allocations.
@@ -244,6 +239,7 @@ static UInt n_stack_frees           = 0;
 static UInt n_xpts                  = 0;
 static UInt n_xpt_init_expansions   = 0;
 static UInt n_xpt_later_expansions  = 0;
+static UInt n_xpt_flushes           = 0;
 static UInt n_sxpt_allocs           = 0;
 static UInt n_sxpt_frees            = 0;
 static UInt n_skipped_snapshots     = 0;
@@ -400,6 +396,7 @@ static Int    clo_time_unit       = TimeI;
 static Int    clo_detailed_freq   = 10;
 static Int    clo_max_snapshots   = 100;
 static const HChar* clo_massif_out_file = "massif.out.%p";
+static Bool   clo_stream_snapshots = False;
 
 static XArray* args_for_massif;
 
@@ -445,6 +442,8 @@ static Bool ms_process_cmd_line_option(const HChar* arg)
 
    else if VG_STR_CLO(arg, "--massif-out-file", clo_massif_out_file) {}
 
+   else if VG_BOOL_CLO(arg, "--stream-snapshots", clo_stream_snapshots) {}
+
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -469,6 +468,8 @@ static void ms_print_usage(void)
 "    --detailed-freq=<N>       every Nth snapshot should be detailed [10]\n"
 "    --max-snapshots=<N>       maximum number of snapshots recorded [100]\n"
 "    --massif-out-file=<file>  output file name [massif.out.%%p]\n"
+"    --stream-snapshots=no|yes append each snapshot to the output file when\n"
+"                              it is taken, instead of at exit [no]\n"
    );
 }
 
@@ -522,6 +523,14 @@ static void ms_print_debug_usage(void)
 // and aggregates up insignificant nodes.  This is important as an SXTree is
 // typically much smaller than an XTree.
 
+// Allocations and deallocations don't update the sizes of the whole XCon
+// immediately.  Their space delta is only added to 'pending_szB' of the
+// XPt returned by get_XCon, which is put on a list of dirty XPts.  The
+// pending deltas are percolated up the tree (see flush_XTree) when the
+// sizes are needed, ie. when a detailed snapshot is taken.  Many
+// allocations and frees at the same point cancel out before that, and the
+// cost of an allocation does not depend on the depth of the tree.
+
 // XXX: make XPt and SXPt extensible arrays, to avoid having to do two
 // allocations per Pt.
 
@@ -531,18 +540,27 @@ struct _XPt {
 
    // Bottom-XPts: space for the precise context.
    // Other XPts:  space of all the descendent bottom-XPts.
-   // Nb: this value goes up and down as the program executes.
+   // Nb: this value goes up and down as the program executes.  It does not
+   // include the pending deltas, see flush_XTree.
    SizeT szB;
 
+   // Space delta not yet percolated up from this XPt.
+   SSizeT pending_szB;
+   Bool   is_dirty;        // is it in dirty_xpts?
+
    XPt*  parent;           // pointer to parent XPt
 
    // Children.
    // n_children and max_children are 32-bit integers.  16-bit integers
    // are too small -- a very big program might have more than 65536
    // allocation points (ie. top-XPts) -- Konqueror starting up has 1800.
+   // 'children' is in order of creation, which determines the order of
+   // equally sized entries in the output.  'children_by_ip' holds the
+   // same children sorted by ip, for the binary search in get_XCon.
    UInt  n_children;       // number of children
-   UInt  max_children;     // capacity of children array
+   UInt  max_children;     // capacity of children arrays
    XPt** children;         // pointers to children XPts
+   XPt** children_by_ip;
 };
 
 typedef
@@ -556,6 +574,7 @@ typedef struct _SXPt SXPt;
 struct _SXPt {
    SXPtTag tag;
    SizeT szB;              // memory size for the node, be it Sig or Insig
+   ULong hash;             // hash of the whole subtree, see hash_SXPt()
    union {
       // An SXPt representing a single significant code location.  Much like
       // an XPt, minus the fields that aren't necessary.
@@ -579,6 +598,9 @@ struct _SXPt {
 // parent node to all top-XPts.
 static XPt* alloc_xpt;
 
+// XPts with a pending space delta.
+static XArray* dirty_xpts;
+
 static XPt* new_XPt(Addr ip, XPt* parent)
 {
    // XPts are never freed, so we can use VG_(perm_malloc) to allocate them.
@@ -587,14 +609,17 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    XPt* xpt    = VG_(perm_malloc)(sizeof(XPt), vg_alignof(XPt));
    xpt->ip     = ip;
    xpt->szB    = 0;
+   xpt->pending_szB = 0;
+   xpt->is_dirty    = False;
    xpt->parent = parent;
 
    // We don't initially allocate any space for children.  We let that
    // happen on demand.  Many XPts (ie. all the bottom-XPts) don't have any
    // children anyway.
-   xpt->n_children   = 0;
-   xpt->max_children = 0;
-   xpt->children     = NULL;
+   xpt->n_children     = 0;
+   xpt->max_children   = 0;
+   xpt->children       = NULL;
+   xpt->children_by_ip = NULL;
 
    // Update statistics
    n_xpts++;
@@ -602,8 +627,26 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    return xpt;
 }
 
-static void add_child_xpt(XPt* parent, XPt* child)
+// Returns the position of 'ip' in parent's children_by_ip, or the position
+// where it would be inserted if no child has this ip.
+static UInt find_child_pos(XPt* parent, Addr ip)
 {
+   UInt lo = 0, hi = parent->n_children;
+
+   while (lo < hi) {
+      UInt mid = lo + (hi - lo) / 2;
+      if (parent->children_by_ip[mid]->ip < ip)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+static void add_child_xpt(XPt* parent, XPt* child, UInt pos)
+{
+   UInt i;
+
    // Expand 'children' if necessary.
    tl_assert(parent->n_children <= parent->max_children);
    if (parent->n_children == parent->max_children) {
@@ -611,17 +654,29 @@ static void add_child_xpt(XPt* parent, XPt* child)
          parent->max_children = 4;
          parent->children = VG_(malloc)( "ms.main.acx.1",
                                          parent->max_children * sizeof(XPt*) );
+         parent->children_by_ip =
+            VG_(malloc)( "ms.main.acx.3",
+                         parent->max_children * sizeof(XPt*) );
          n_xpt_init_expansions++;
       } else {
          parent->max_children *= 2;    // Double size
          parent->children = VG_(realloc)( "ms.main.acx.2",
                                           parent->children,
                                           parent->max_children * sizeof(XPt*) );
+         parent->children_by_ip =
+            VG_(realloc)( "ms.main.acx.4",
+                          parent->children_by_ip,
+                          parent->max_children * sizeof(XPt*) );
          n_xpt_later_expansions++;
       }
    }
 
-   // Insert new child XPt in parent's children list.
+   // Insert new child XPt in parent's children list, and at 'pos' in the
+   // sorted index.
+   tl_assert(pos <= parent->n_children);
+   for (i = parent->n_children; i > pos; i--)
+      parent->children_by_ip[i] = parent->children_by_ip[i-1];
+   parent->children_by_ip[pos] = child;
    parent->children[ parent->n_children++ ] = child;
 }
 
@@ -639,6 +694,37 @@ static Int SXPt_revcmp_szB(const void* n1, const void* n2)
 //--- XTree Operations                                     ---//
 //------------------------------------------------------------//
 
+// Each SXPt carries a hash of its whole subtree: of its own ip and size,
+// and of the hashes of its children.  The children are combined by
+// addition, so the order they are in does not matter.  With
+// --stream-snapshots=yes, two subtrees with the same hash are taken to be
+// identical, and only one line is written for the newer one.
+static ULong mix_hash(ULong x)
+{
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   x ^= x >> 33;
+   return x;
+}
+
+static void hash_SXPt(SXPt* sxpt)
+{
+   Int   i;
+   ULong h;
+
+   if (InsigSXPt == sxpt->tag) {
+      h = mix_hash((ULong)sxpt->Insig.n_xpts) ^ 0x5bd1e995ULL;
+   } else {
+      h = mix_hash((ULong)sxpt->Sig.ip);
+      for (i = 0; i < sxpt->Sig.n_children; i++) {
+         h += mix_hash(sxpt->Sig.children[i]->hash);
+      }
+   }
+   sxpt->hash = mix_hash(h ^ mix_hash((ULong)sxpt->szB));
+}
+
 // Duplicates an XTree as an SXTree.
 static SXPt* dup_XTree(XPt* xpt, SizeT total_szB)
 {
@@ -714,11 +800,13 @@ static SXPt* dup_XTree(XPt* xpt, SizeT total_szB)
          insig_sxpt->tag = InsigSXPt;
          insig_sxpt->szB = insig_children_szB;
          insig_sxpt->Insig.n_xpts = n_insig_children;
+         hash_SXPt(insig_sxpt);
          sxpt->Sig.children[n_sig_children] = insig_sxpt;
       }
    } else {
       sxpt->Sig.children = NULL;
    }
+   hash_SXPt(sxpt);
 
    return sxpt;
 }
@@ -753,6 +841,8 @@ static void free_SXTree(SXPt* sxpt)
 // ms_expensive_sanity_check.
 static void sanity_check_XTree(XPt* xpt, XPt* parent)
 {
+   UInt i;
+
    tl_assert(xpt != NULL);
 
    // Check back-pointer.
@@ -762,6 +852,10 @@ static void sanity_check_XTree(XPt* xpt, XPt* parent)
    // Check children counts look sane.
    tl_assert(xpt->n_children <= xpt->max_children);
 
+   // Check the sorted children index.
+   for (i = 1; i < xpt->n_children; i++)
+      tl_assert(xpt->children_by_ip[i-1]->ip < xpt->children_by_ip[i]->ip);
+
    // Unfortunately, xpt's size is not necessarily equal to the sum of xpt's
    // children's sizes.  See comment at the bottom of get_XCon.
 }
@@ -907,25 +1001,18 @@ static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
    // Now do the search/insertion of the XCon.
    for (i = 0; i < n_ips; i++) {
       Addr ip = ips[i];
-      Int ch;
-      // Look for IP in xpt's children.
-      // Linear search, ugh -- about 10% of time for konqueror startup tried
-      // caching last result, only hit about 4% for konqueror.
+      // Look for IP in xpt's children, by binary search.
       // Nb:  this search hits about 98% of the time for konqueror
-      for (ch = 0; True; ch++) {
-         if (ch == xpt->n_children) {
-            // IP not found in the children.
-            // Create and add new child XPt, then stop.
-            XPt* new_child_xpt = new_XPt(ip, xpt);
-            add_child_xpt(xpt, new_child_xpt);
-            xpt = new_child_xpt;
-            break;
-
-         } else if (ip == xpt->children[ch]->ip) {
-            // Found the IP in the children, stop.
-            xpt = xpt->children[ch];
-            break;
-         }
+      UInt pos = find_child_pos(xpt, ip);
+      if (pos < xpt->n_children && ip == xpt->children_by_ip[pos]->ip) {
+         // Found the IP in the children.
+         xpt = xpt->children_by_ip[pos];
+      } else {
+         // IP not found in the children.
+         // Create and add new child XPt.
+         XPt* new_child_xpt = new_XPt(ip, xpt);
+         add_child_xpt(xpt, new_child_xpt, pos);
+         xpt = new_child_xpt;
       }
    }
 
@@ -970,7 +1057,8 @@ static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
    return xpt;
 }
 
-// Update 'szB' of every XPt in the XCon, by percolating upwards.
+// Record a space delta for the XCon.  The 'szB' of the XPts in the XCon
+// is only updated by flush_XTree.
 static void update_XCon(XPt* xpt, SSizeT space_delta)
 {
    tl_assert(clo_heap);
@@ -979,13 +1067,39 @@ static void update_XCon(XPt* xpt, SSizeT space_delta)
    if (0 == space_delta)
       return;
 
-   while (xpt != alloc_xpt) {
-      if (space_delta < 0) tl_assert(xpt->szB >= -space_delta);
-      xpt->szB += space_delta;
-      xpt = xpt->parent;
+   xpt->pending_szB += space_delta;
+   if (space_delta < 0)
+      tl_assert((SSizeT)xpt->szB + xpt->pending_szB >= 0);
+   if (!xpt->is_dirty) {
+      xpt->is_dirty = True;
+      VG_(addToXA)(dirty_xpts, &xpt);
+   }
+}
+
+// Update 'szB' of every XPt by percolating the pending deltas upwards.
+static void flush_XTree(void)
+{
+   Word i, n = VG_(sizeXA)(dirty_xpts);
+
+   for (i = 0; i < n; i++) {
+      XPt*   xpt = *(XPt**)VG_(indexXA)(dirty_xpts, i);
+      SSizeT space_delta = xpt->pending_szB;
+
+      xpt->pending_szB = 0;
+      xpt->is_dirty    = False;
+      if (0 == space_delta)
+         continue;
+
+      while (xpt != alloc_xpt) {
+         if (space_delta < 0) tl_assert(xpt->szB >= -space_delta);
+         xpt->szB += space_delta;
+         xpt = xpt->parent;
+      }
+      if (space_delta < 0) tl_assert(alloc_xpt->szB >= -space_delta);
+      alloc_xpt->szB += space_delta;
    }
-   if (space_delta < 0) tl_assert(alloc_xpt->szB >= -space_delta);
-   alloc_xpt->szB += space_delta;
+   VG_(dropTailXA)(dirty_xpts, n);
+   n_xpt_flushes++;
 }
 
 
@@ -1309,6 +1423,7 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
       snapshot->heap_szB = heap_szB;
       if (is_detailed) {
          SizeT total_szB = heap_szB + heap_extra_szB + stacks_szB;
+         flush_XTree();
          snapshot->alloc_sxpt = dup_XTree(alloc_xpt, total_szB);
          tl_assert(           alloc_xpt->szB == heap_szB);
          tl_assert(snapshot->alloc_sxpt->szB == heap_szB);
@@ -1333,6 +1448,8 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
 }
 
 
+static void stream_snapshot(Snapshot* snapshot);
+
 // Take a snapshot, if it's time, or if we've hit a peak.
 static void
 maybe_take_snapshot(SnapshotKind kind, const HChar* what)
@@ -1426,10 +1543,18 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
    VERB_snapshot(2, what, next_snapshot_i);
    n_skipped_snapshots_since_last_snapshot = 0;
 
-   // Cull the entries, if our snapshot table is full.
-   next_snapshot_i++;
-   if (clo_max_snapshots == next_snapshot_i) {
-      min_time_interval = cull_snapshots();
+   if (clo_stream_snapshots) {
+      // Nothing is culled, so instead keep the interval at a fixed
+      // fraction of the elapsed time:  about 0.7 * --max-snapshots
+      // snapshots are written each time the run time doubles.
+      stream_snapshot(snapshot);
+      min_time_interval = my_time / clo_max_snapshots;
+   } else {
+      // Cull the entries, if our snapshot table is full.
+      next_snapshot_i++;
+      if (clo_max_snapshots == next_snapshot_i) {
+         min_time_interval = cull_snapshots();
+      }
    }
 
    // Work out the earliest time when the next snapshot can happen.
@@ -2109,11 +2234,33 @@ IRSB* ms_instrument ( VgCallbackClosure* closure,
 
 #define FP(format, args...) ({ VG_(fprintf)(fp, format, ##args); })
 
-static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
-                             HChar* depth_str, Int depth_str_len,
+// Finds the child of 'base_sxpt' that stands for the same code location as
+// 'sxpt', if any.  The number of significant children is bounded by the
+// threshold, so a linear search is fine.
+static SXPt* find_base_child(SXPt* base_sxpt, SXPt* sxpt)
+{
+   Int i;
+
+   if (NULL == base_sxpt || SigSXPt != sxpt->tag)
+      return NULL;
+   for (i = 0; i < base_sxpt->Sig.n_children; i++) {
+      SXPt* base_child = base_sxpt->Sig.children[i];
+      if (SigSXPt == base_child->tag && base_child->Sig.ip == sxpt->Sig.ip)
+         return base_child;
+   }
+   return NULL;
+}
+
+// 'base_sxpt' is the SXPt for the same code location in the previously
+// streamed detailed snapshot, or NULL.  If the subtree has not changed since
+// then, only its node line is printed, with an 's' instead of the 'n', and
+// the reader copies the children from the previous tree.
+static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, SXPt* base_sxpt,
+                             Int depth, HChar* depth_str, Int depth_str_len,
                              SizeT snapshot_heap_szB, SizeT snapshot_total_szB)
 {
    Int   i, j, n_insig_children_sxpts;
+   Bool  is_unchanged;
    SXPt* child = NULL;
 
    // Used for printing function names.  Is made static to keep it out
@@ -2152,8 +2299,13 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
          ip_desc = VG_(describe_IP)(sxpt->Sig.ip-1, NULL);
       }
       
+      is_unchanged = base_sxpt != NULL
+                     && base_sxpt->hash == sxpt->hash
+                     && base_sxpt->szB  == sxpt->szB;
+
       // Do the non-ip_desc part first...
-      FP("%sn%u: %lu ", depth_str, sxpt->Sig.n_children, sxpt->szB);
+      FP("%s%c%u: %lu ", depth_str, is_unchanged ? 's' : 'n',
+         sxpt->Sig.n_children, sxpt->szB);
 
       // For ip_descs beginning with "0xABCD...:" addresses, we first
       // measure the length of the "0xabcd: " address at the start of the
@@ -2178,6 +2330,9 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
       // Anyhow, we spit out the full-length string now.
       FP("%s\n", ip_desc);
 
+      if (is_unchanged)
+         break;
+
       // Indent.
       tl_assert(depth+1 < depth_str_len-1);    // -1 for end NUL char
       depth_str[depth+0] = ' ';
@@ -2203,7 +2358,8 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
          // Ok, print the child.  NB: contents of ip_desc will be
          // trashed by this recursive call.  Doesn't matter currently,
          // but worth noting.
-         pp_snapshot_SXPt(fp, child, depth+1, depth_str, depth_str_len,
+         pp_snapshot_SXPt(fp, child, find_base_child(base_sxpt, child),
+            depth+1, depth_str, depth_str_len,
             snapshot_heap_szB, snapshot_total_szB);
       }
 
@@ -2227,7 +2383,8 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
    }
 }
 
-static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
+static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n,
+                        SXPt* base_sxpt)
 {
    sanity_check_snapshot(snapshot);
 
@@ -2249,7 +2406,7 @@ static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
       depth_str[0] = '\0';   // Initialise depth_str to "".
 
       FP("heap_tree=%s\n", ( Peak == snapshot->kind ? "peak" : "detailed" ));
-      pp_snapshot_SXPt(fp, snapshot->alloc_sxpt, 0, depth_str,
+      pp_snapshot_SXPt(fp, snapshot->alloc_sxpt, base_sxpt, 0, depth_str,
                        depth_str_len, snapshot->heap_szB,
                        snapshot_total_szB);
 
@@ -2260,22 +2417,9 @@ static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
    }
 }
 
-static void write_snapshots_to_file(const HChar* massif_out_file, 
-                                    Snapshot snapshots_array[], 
-                                    Int nr_elements)
+static void write_header(VgFile *fp)
 {
    Int i;
-   VgFile *fp;
-
-   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                    VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
-      VG_(umsg)("       ... so profiling results will be missing.\n");
-      return;
-   }
 
    // Print massif-specific options that were used.
    // XXX: is it worth having a "desc:" line?  Could just call it "options:"
@@ -2299,14 +2443,127 @@ static void write_snapshots_to_file(const HChar* massif_out_file,
    FP("\n");
 
    FP("time_unit: %s\n", TimeUnit_to_string(clo_time_unit));
+}
+
+static VgFile* open_out_file(const HChar* massif_out_file)
+{
+   VgFile *fp;
+
+   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                    VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      // If the file can't be opened for whatever reason (conflict
+      // between multiple cachegrinded processes?), give up now.
+      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
+      VG_(umsg)("       ... so profiling results will be missing.\n");
+   }
+   return fp;
+}
+
+static void write_snapshots_to_file(const HChar* massif_out_file, 
+                                    Snapshot snapshots_array[], 
+                                    Int nr_elements)
+{
+   Int i;
+   VgFile *fp;
+
+   fp = open_out_file(massif_out_file);
+   if (fp == NULL)
+      return;
+
+   write_header(fp);
 
    for (i = 0; i < nr_elements; i++) {
       Snapshot* snapshot = & snapshots_array[i];
-      pp_snapshot(fp, snapshot, i);     // Detailed snapshot!
+      pp_snapshot(fp, snapshot, i, NULL);     // Detailed snapshot!
    }
    VG_(fclose) (fp);
 }
 
+//------------------------------------------------------------//
+//--- Streaming output                                     ---//
+//------------------------------------------------------------//
+
+// With --stream-snapshots=yes, every snapshot is appended to the output
+// file as soon as it is taken, and then deleted.  Nothing is culled, so
+// the whole run is recorded, with memory use that does not grow with the
+// number of snapshots.  Only the heap tree of the last detailed snapshot
+// written is kept: the next detailed snapshot is written as a delta
+// against it, see pp_snapshot_SXPt().
+//
+// The output file is opened when the first snapshot is taken, for the same
+// reason that write_snapshots_array_to_file() expands the name late.  The
+// file is flushed after each snapshot, so that at a fork the child does
+// not inherit buffered output of the parent;  the child then starts its
+// own file, with a full tree for its first detailed snapshot.
+static VgFile* stream_fp        = NULL;
+static Int     stream_pid       = 0;
+static Bool    stream_failed    = False;
+static Int     stream_n         = 0;   // Number of the next snapshot.
+static SXPt*   stream_base_sxpt = NULL;
+
+static Bool open_stream(void)
+{
+   HChar* massif_out_file;
+
+   if (stream_fp != NULL && stream_pid == VG_(getpid)())
+      return True;
+
+   if (stream_fp != NULL) {
+      // We are the child of a fork.  Nothing is buffered, see above.
+      VG_(fclose)(stream_fp);
+      stream_fp = NULL;
+      stream_failed = False;
+      stream_n = 0;
+      if (stream_base_sxpt) {
+         free_SXTree(stream_base_sxpt);
+         stream_base_sxpt = NULL;
+      }
+   }
+   if (stream_failed)
+      return False;
+
+   massif_out_file =
+      VG_(expand_file_name)("--massif-out-file", clo_massif_out_file);
+   stream_fp = open_out_file(massif_out_file);
+   VG_(free)(massif_out_file);
+   if (stream_fp == NULL) {
+      stream_failed = True;
+      return False;
+   }
+   stream_pid = VG_(getpid)();
+   write_header(stream_fp);
+   VG_(fflush)(stream_fp);
+   return True;
+}
+
+// Writes the snapshot and clears it.  A detailed snapshot's tree becomes
+// the base for the next delta.
+static void stream_snapshot(Snapshot* snapshot)
+{
+   if (open_stream()) {
+      pp_snapshot(stream_fp, snapshot, stream_n++, stream_base_sxpt);
+      VG_(fflush)(stream_fp);
+   }
+
+   if (is_detailed_snapshot(snapshot)) {
+      if (stream_base_sxpt)
+         free_SXTree(stream_base_sxpt);
+      stream_base_sxpt = snapshot->alloc_sxpt;
+      snapshot->alloc_sxpt = NULL;
+   }
+   clear_snapshot(snapshot, /*do_sanity_check*/False);
+}
+
+static void close_stream(void)
+{
+   // Make sure the file exists, even if no snapshot was ever taken.
+   if (open_stream()) {
+      VG_(fclose)(stream_fp);
+      stream_fp = NULL;
+   }
+}
+
 static void write_snapshots_array_to_file(void)
 {
    // Setup output filename.  Nb: it's important to do this now, ie. as late
@@ -2349,6 +2606,11 @@ static void handle_all_snapshots_monitor_command (const HChar *filename)
          ("error: cannot take snapshot before execution has started\n");
       return;
    }
+   if (clo_stream_snapshots) {
+      VG_(gdb_printf)
+         ("error: --stream-snapshots=yes: snapshots are in the output file\n");
+      return;
+   }
 
    write_snapshots_to_file ((filename == NULL) ? 
                             "massif.vgdb.out" : filename,
@@ -2416,6 +2678,7 @@ static void ms_print_stats (void)
       ( n_xpts ? alloc_xpt->n_children * 100 / n_xpts : 0));
    STATS("XPt init expansions:   %u\n", n_xpt_init_expansions);
    STATS("XPt later expansions:  %u\n", n_xpt_later_expansions);
+   STATS("XPt tree flushes:      %u\n", n_xpt_flushes);
    STATS("SXPt allocs:           %u\n", n_sxpt_allocs);
    STATS("SXPt frees:            %u\n", n_sxpt_frees);
    STATS("skipped snapshots:     %u\n", n_skipped_snapshots);
@@ -2434,7 +2697,10 @@ static void ms_print_stats (void)
 static void ms_fini(Int exit_status)
 {
    // Output.
-   write_snapshots_array_to_file();
+   if (clo_stream_snapshots)
+      close_stream();
+   else
+      write_snapshots_array_to_file();
 
    // Stats
    tl_assert(n_xpts > 0);  // always have alloc_xpt
@@ -2594,6 +2860,8 @@ static void ms_pre_clo_init(void)
 
    // Dummy node at top of the context structure.
    alloc_xpt = new_XPt(/*ip*/0, /*parent*/NULL);
+   dirty_xpts = VG_(newXA)(VG_(malloc), "ms.main.mpoci.2",
+                           VG_(free), sizeof(XPt*));
 
    // Initialise alloc_fns and ignore_fns.
    init_alloc_fns();
@@ -264,6 +264,7 @@ enum {
    MCPE_MAKE_MEM_UNDEFINED,
    MCPE_MAKE_MEM_UNDEFINED_W_OTAG,
    MCPE_MAKE_MEM_DEFINED,
+   MCPE_MAKE_MEM_DEFINED_IF_NOACCESS_SM,
    MCPE_CHEAP_SANITY_CHECK,
    MCPE_EXPENSIVE_SANITY_CHECK,
    MCPE_COPY_ADDRESS_RANGE_STATE,
@@ -296,6 +296,51 @@ static INLINE Bool is_distinguished_sm ( SecMap* sm ) {
 // Forward declaration
 static void update_SM_counts(SecMap* oldSM, SecMap* newSM);
 
+/* Non-distinguished secondaries are normally mapped one by one.  With
+   --huge-pages, they are instead carved out of huge page sized chunks,
+   so that neighbouring secondaries share a TLB entry.  A secondary in a
+   chunk cannot be unmapped on its own, so freed ones are kept in a
+   list, linked through their first word, for reuse. */
+static HChar*  sm_chunk_next = NULL;
+static HChar*  sm_chunk_end1 = NULL;
+static SecMap* sm_free_list  = NULL;
+
+static SecMap* alloc_SecMap ( void )
+{
+   SizeT   chunk_szB = VG_(am_huge_page_szB)();
+   SecMap* sm;
+
+   if (chunk_szB == 0)
+      return VG_(am_shadow_alloc)(sizeof(SecMap));
+
+   if (sm_free_list != NULL) {
+      sm = sm_free_list;
+      sm_free_list = *(SecMap**)sm;
+      return sm;
+   }
+   if (sm_chunk_next == sm_chunk_end1) {
+      tl_assert(chunk_szB % sizeof(SecMap) == 0);
+      sm_chunk_next = VG_(am_shadow_alloc)(chunk_szB);
+      if (sm_chunk_next == NULL)
+         return NULL;
+      sm_chunk_end1 = sm_chunk_next + chunk_szB;
+   }
+   sm = (SecMap*)sm_chunk_next;
+   sm_chunk_next += sizeof(SecMap);
+   return sm;
+}
+
+static void free_SecMap ( SecMap* sm )
+{
+   if (VG_(am_huge_page_szB)() == 0) {
+      SysRes sres = VG_(am_munmap_valgrind)((Addr)sm, sizeof(SecMap));
+      tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+   } else {
+      *(SecMap**)sm = sm_free_list;
+      sm_free_list = sm;
+   }
+}
+
 /* dist_sm points to one of our three distinguished secondaries.  Make
    a copy of it so that we can write to it.
 */
@@ -306,7 +351,7 @@ static SecMap* copy_for_writing ( SecMap* dist_sm )
           || dist_sm == &sm_distinguished[1]
           || dist_sm == &sm_distinguished[2]);
 
-   new_sm = VG_(am_shadow_alloc)(sizeof(SecMap));
+   new_sm = alloc_SecMap();
    if (new_sm == NULL)
       VG_(out_of_memory_NORETURN)( "memcheck:allocate new SecMap", 
                                    sizeof(SecMap) );
@@ -1735,8 +1780,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP64K_FREE_DIST_SM);
          // Free the non-distinguished sec-map that we're replacing.  This
          // case happens moderately often, enough to be worthwhile.
-         SysRes sres = VG_(am_munmap_valgrind)((Addr)*sm_ptr, sizeof(SecMap));
-         tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+         free_SecMap(*sm_ptr);
       }
       update_SM_counts(*sm_ptr, example_dsm);
       // Make the sec-map entry point to the example DSM
@@ -1883,10 +1927,30 @@ static void make_mem_defined_if_addressable ( Addr a, SizeT len )
 /* Similarly (needed for mprotect handling ..) */
 static void make_mem_defined_if_noaccess ( Addr a, SizeT len )
 {
-   SizeT i;
-   UChar vabits2;
+   SizeT    i;
+   UChar    vabits2;
+   SecMap** sm_ptr;
    DEBUG("make_mem_defined_if_noaccess(%p, %llu)\n", a, (ULong)len);
    for (i = 0; i < len; i++) {
+      // A whole sec-map which is distinguished is done in one go, so
+      // that mprotect-ing a big area which is mostly not accessed (e.g.
+      // an arena reserved with PROT_NONE) does not go byte by byte, nor
+      // allocate sec-maps.
+      if (is_start_of_sm(a+i) && len - i >= SM_SIZE) {
+         sm_ptr = get_secmap_ptr(a+i);
+         if (*sm_ptr == &sm_distinguished[SM_DIST_NOACCESS]) {
+            PROF_EVENT(MCPE_MAKE_MEM_DEFINED_IF_NOACCESS_SM);
+            update_SM_counts(*sm_ptr, &sm_distinguished[SM_DIST_DEFINED]);
+            *sm_ptr = &sm_distinguished[SM_DIST_DEFINED];
+            if (UNLIKELY(MC_(clo_mc_level) >= 3))
+               ocache_sarp_Clear_Origins( a+i, SM_SIZE );
+         }
+         if (is_distinguished_sm(*sm_ptr)) {
+            // Now nothing in it is noaccess.
+            i += SM_SIZE - 1;
+            continue;
+         }
+      }
       vabits2 = get_vabits2( a+i );
       if (LIKELY(VA_BITS2_NOACCESS == vabits2)) {
          set_vabits2(a+i, VA_BITS2_DEFINED);
@@ -7160,6 +7224,8 @@ static const HChar* MC_(event_ctr_name)[MCPE_LAST] = {
    [MCPE_MAKE_MEM_UNDEFINED] = "make_mem_undefined",
    [MCPE_MAKE_MEM_UNDEFINED_W_OTAG] = "make_mem_undefined_w_otag",
    [MCPE_MAKE_MEM_DEFINED] = "make_mem_defined",
+   [MCPE_MAKE_MEM_DEFINED_IF_NOACCESS_SM] =
+        "make_mem_defined_if_noaccess(secmap)",
    [MCPE_CHEAP_SANITY_CHECK] = "cheap_sanity_check",
    [MCPE_EXPENSIVE_SANITY_CHECK] = "expensive_sanity_check",
    [MCPE_COPY_ADDRESS_RANGE_STATE] = "copy_address_range_state",
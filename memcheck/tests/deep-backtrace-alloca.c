@@ -0,0 +1,24 @@
+// With --shadow-call-stack=yes, a function which has returned must not
+// show up in the stack traces of its caller, even when the caller then
+// lowers the stack pointer below the return address slot of the callee
+// (here with alloca), which still holds the return address.
+#include <alloca.h>
+
+static volatile int size = 4096;
+
+__attribute__((noinline)) int callee(void) { return size; }
+
+__attribute__((noinline)) int caller(void)
+{
+   char* p;
+   callee();
+   p = alloca(size);
+   if (p[0])   // uninitialised
+      return 1;
+   return 0;
+}
+
+int main(void)
+{
+   return caller();
+}
@@ -0,0 +1,213 @@
+// This module does unit testing of the quick lists of m_mallocfree,
+// with heap profiling (--profile-heap=yes) enabled.
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pub_core_basics.h"
+#include "pub_core_vki.h"
+#include "pub_core_libcbase.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_aspacemgr.h"
+#include "pub_core_options.h"
+#include "pub_core_tooliface.h"
+#include "pub_core_syscall.h"
+
+// Crudely redirect various VG_(foo)() functions to their libc equivalents.
+#undef vg_assert
+#define vg_assert(e)                   assert(e)
+#undef vg_assert2
+#define vg_assert2(e, fmt, args...)    assert(e)
+
+#define vgPlain_printf                 printf
+#define vgPlain_memset                 memset
+#define vgPlain_memcpy                 memcpy
+#define vgPlain_strlen                 strlen
+#define vgPlain_strcmp                 strcmp
+#define vgPlain_ssort                  qsort
+
+#include "coregrind/m_syscall.c"
+#include "coregrind/m_mallocfree.c"
+
+// Stubs for what m_mallocfree.c needs from the rest of the core.  The
+// superblocks come straight from mmap.
+static ULong anon_total = 0;
+
+ULong VG_(am_get_anonsize_total)( void ) { return anon_total; }
+void VG_(am_show_nsegments) ( Int logLevel, const HChar* who ) { }
+
+SysRes VG_(am_mmap_anon_float_valgrind)( SizeT cszB )
+{
+   void* p = mmap(NULL, cszB, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (p == MAP_FAILED)
+      return VG_(mk_SysRes_Error)(VKI_ENOMEM);
+   anon_total += cszB;
+   return VG_(mk_SysRes_Success)((UWord)p);
+}
+
+SysRes VG_(am_mmap_client_heap) ( SizeT length, Int prot )
+{
+   return VG_(am_mmap_anon_float_valgrind)(length);
+}
+
+SysRes VG_(am_munmap_valgrind)( Addr start, SizeT length )
+{
+   munmap((void*)start, length);
+   return VG_(mk_SysRes_Success)(0);
+}
+
+SysRes VG_(am_munmap_client)( /*OUT*/Bool* need_discard,
+                              Addr start, SizeT length )
+{
+   *need_discard = False;
+   return VG_(am_munmap_valgrind)(start, length);
+}
+
+void VG_(assert_fail) ( Bool isCore, const HChar* expr, const HChar* file,
+                        Int line, const HChar* fn, const HChar* format, ... )
+{
+   fprintf(stderr, "%s:%d (%s): Assertion '%s' failed.\n",
+           file, line, fn, expr);
+   abort();
+}
+
+void VG_(core_panic) ( const HChar* str )
+{
+   fprintf(stderr, "panic: %s\n", str);
+   abort();
+}
+
+UInt VG_(message) ( VgMsgKind kind, const HChar* format, ... )
+{
+   UInt n;
+   va_list vargs;
+   va_start(vargs, format);
+   n = vfprintf(stderr, format, vargs);
+   va_end(vargs);
+   return n;
+}
+
+void VG_(debugLog) ( Int level, const HChar* modulename,
+                     const HChar* format, ... ) { }
+void VG_(discard_translations) ( Addr start, ULong range,
+                                 const HChar* who ) { }
+void VG_(print_all_stats) ( Bool memory_stats, Bool tool_stats ) { }
+void VG_(show_sched_status) ( Bool host_stacktrace,
+                              Bool stack_usage, Bool exited_threads ) { }
+void VG_(exit)( Int status ) { exit(status); }
+
+Int VG_(log2) ( UInt x )
+{
+   Int i;
+   for (i = 0; i < 32; i++)
+      if ((1U << i) == x) return i;
+   return -1;
+}
+
+Int  VG_(clo_verbosity)         = 1;
+Bool VG_(clo_profile_heap)      = False;
+Int  VG_(clo_core_redzone_size) = CORE_REDZONE_DEFAULT_SZB;
+Int  VG_(clo_redzone_size)      = -1;
+VgNeeds         VG_(needs);
+VgToolInterface VG_(tdict);
+
+
+//---------------------------------------------------------------------------
+// Tests
+//---------------------------------------------------------------------------
+
+// The demangle arena has small superblocks, so that the tests soon
+// need new ones.
+#define AID    VG_AR_DEMANGLE
+#define SMALL  24      // in a quick list on all platforms
+#define BIG    512     // never in a quick list
+#define NN     20000
+
+static void* ps[NN];
+
+static void test_reuse(void)
+{
+   Arena* a = arenaId_to_ArenaP(AID);
+   void *p, *q;
+   ULong nquick;
+
+   printf("-- quick list reuse\n");
+   p = VG_(arena_malloc)(AID, "unit.1", SMALL);
+   VG_(arena_free)(AID, p);
+   assert(0 == strcmp(get_cc(get_payload_block(a, p)), "admin.quick-free"));
+   assert(a->stats__bytes_quick > 0);
+
+   nquick = a->stats__nquick;
+   q = VG_(arena_malloc)(AID, "unit.2", SMALL);
+   assert(q == p);
+   assert(a->stats__nquick == nquick + 1);
+   assert(0 == strcmp(get_cc(get_payload_block(a, q)), "unit.2"));
+   VG_(arena_free)(AID, q);
+   sanity_check_malloc_arena(AID);
+}
+
+static void test_bounded(void)
+{
+   Arena* a = arenaId_to_ArenaP(AID);
+   Int i;
+
+   printf("-- quick lists are bounded\n");
+   for (i = 0; i < NN; i++)
+      ps[i] = VG_(arena_malloc)(AID, "unit.3", SMALL);
+   for (i = 0; i < NN; i++)
+      VG_(arena_free)(AID, ps[i]);
+   assert(a->stats__bytes_quick > 0);
+   assert(a->stats__bytes_quick <= MAX_QUICK_SZB);
+   sanity_check_malloc_arena(AID);
+}
+
+// The quick lists are full of small blocks now.  Allocating big blocks
+// must first use up the free lists, then flush the quick lists, and
+// only then allocate new superblocks.
+static void test_flush(void)
+{
+   Arena* a = arenaId_to_ArenaP(AID);
+   Bool   flushed = False, grown = False;
+   Int    i, n;
+
+   printf("-- quick lists are flushed before a new superblock\n");
+   assert(a->stats__bytes_quick > 0);
+   for (n = 0; n < NN && !grown; n++) {
+      // Flushing can give back empty superblocks, so only compare with
+      // the count just before each allocation.
+      UInt sbs = a->sblocks_used;
+      ps[n] = VG_(arena_malloc)(AID, "unit.4", BIG);
+      if (a->stats__bytes_quick == 0)
+         flushed = True;
+      if (a->sblocks_used > sbs) {
+         assert(flushed);
+         grown = True;
+      }
+   }
+   assert(grown);
+   sanity_check_malloc_arena(AID);
+
+   for (i = 0; i < n; i++)
+      VG_(arena_free)(AID, ps[i]);
+   sanity_check_malloc_arena(AID);
+}
+
+int main(void)
+{
+   // Blocks then have a cost center, and freed blocks in the quick
+   // lists are marked as such.
+   VG_(clo_profile_heap) = True;
+
+   test_reuse();
+   test_bounded();
+   test_flush();
+   VG_(sanity_check_malloc_all)();
+   printf("-- done\n");
+   return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+
+// This test does a lot of allocations from deep in a recursion.  The stack
+// traces of the allocations are long, and all share most of their frames
+// with each other, as in recursive-descent parsers and tree walkers.  Most
+// of the time of a tool goes into unwinding the stack for each allocation.
+
+#define DEPTH    300
+#define N_ALLOCS 100000
+
+static void* blocks[16];
+
+// Don't let gcc turn the recursion into a loop.
+__attribute__((noinline))
+int descend(int depth, int n)
+{
+   int i, r;
+
+   if (depth > 0) {
+      r = descend(depth - 1, n);
+      return r + depth;
+   }
+
+   for (i = 0; i < n; i++) {
+      free(blocks[i % 16]);
+      blocks[i % 16] = malloc(16 + i % 64);
+   }
+   return 0;
+}
+
+int main(void)
+{
+   int i, r = 0;
+
+   // Allocate at a few different depths, so that each new stack trace
+   // shares its outer frames with the previous ones.
+   for (i = 0; i < 100; i++)
+      r += descend(DEPTH - i % 4, N_ALLOCS / 100);
+
+   for (i = 0; i < 16; i++)
+      free(blocks[i]);
+
+   return r == 42 ? 1 : 0;
+}
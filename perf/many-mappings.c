@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// This test creates a lot of mappings, up to 1M of them, to stress the
+// address space manager.  It reserves one big area, then makes every
+// other page in it readable, so that the kernel (and Valgrind) have to
+// keep each page as a separate mapping.  Then it punches holes in the
+// area, maps pages back into the holes, and finally unmaps everything,
+// page by page.
+//
+// The kernel limits the number of mappings a process can have to
+// vm.max_map_count, 65530 by default.  The test stays a bit below that
+// limit; to get the full 1M mappings, raise it first, e.g. with
+// "sysctl -w vm.max_map_count=1100000".
+
+#define N_MAPPINGS_MAX  1000000
+#define N_MAPPINGS_SPARE   1000
+
+static long max_map_count(void)
+{
+   long n = 65530;
+   FILE* f = fopen("/proc/sys/vm/max_map_count", "r");
+   if (f) {
+      if (fscanf(f, "%ld", &n) != 1)
+         n = 65530;
+      fclose(f);
+   }
+   return n;
+}
+
+int main(int argc, char* argv[])
+{
+   long  i, n, pg = sysconf(_SC_PAGESIZE);
+   char* base;
+
+   n = argc > 1 ? atol(argv[1]) : N_MAPPINGS_MAX;
+   if (n > max_map_count() - N_MAPPINGS_SPARE)
+      n = max_map_count() - N_MAPPINGS_SPARE;
+   if (n < 2)
+      n = 2;
+
+   base = mmap(NULL, n * pg, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (base == MAP_FAILED) {
+      perror("mmap");
+      return 1;
+   }
+
+   // Split the reservation into n mappings.
+   for (i = 1; i < n; i += 2) {
+      if (mprotect(base + i * pg, pg, PROT_READ) != 0) {
+         perror("mprotect");
+         return 1;
+      }
+   }
+
+   // Replace every fourth page with a new mapping, which leaves the
+   // number of mappings the same.
+   for (i = 0; i < n; i += 4) {
+      if (munmap(base + i * pg, pg) != 0) {
+         perror("munmap");
+         return 1;
+      }
+   }
+   for (i = 0; i < n; i += 4) {
+      if (mmap(base + i * pg, pg, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+          == MAP_FAILED) {
+         perror("mmap");
+         return 1;
+      }
+   }
+
+   // Make all pages readable, so that the mappings can merge again,
+   // then unmap the area from the top down, page by page.
+   for (i = 0; i < n; i += 2)
+      mprotect(base + i * pg, pg, PROT_READ);
+   for (i = n - 1; i >= 0; i--)
+      munmap(base + i * pg, pg);
+
+   return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// This test reads and writes words at random places in a large heap
+// block, so that nearly every access touches a different page.  Natively
+// that costs a TLB miss per access; under a tool, the lookup of the shadow
+// memory of the accessed address costs another one, as the shadow memory
+// is as scattered as the data.  It shows how much backing the shadow
+// memory with huge pages (--huge-pages=) helps.
+
+#define MB          (1024 * 1024)
+#define DEFAULT_MB  256
+#define N_ACCESSES  4000000
+
+int main(int argc, char* argv[])
+{
+   unsigned long  i, n_words, x = 12345, sum = 0;
+   unsigned long* buf;
+   int            mb = argc > 1 ? atoi(argv[1]) : DEFAULT_MB;
+
+   n_words = (unsigned long)mb * MB / sizeof(unsigned long);
+   buf = malloc(n_words * sizeof(unsigned long));
+   if (buf == NULL) {
+      fprintf(stderr, "malloc of %d MB failed\n", mb);
+      return 1;
+   }
+
+   // Initialise the whole block, so that all of its shadow memory is
+   // allocated.
+   for (i = 0; i < n_words; i++)
+      buf[i] = i;
+
+   for (i = 0; i < N_ACCESSES; i++) {
+      // A simple linear congruential generator.
+      x = x * 1103515245 + 12345;
+      if (i & 1)
+         sum += buf[(x >> 8) % n_words];
+      else
+         buf[(x >> 8) % n_words] = i;
+   }
+
+   free(buf);
+   return sum == 42;
+}
@@ -0,0 +1,38 @@
+// Allocates and frees lots of small heap blocks of random sizes and
+// lifetimes.  Tools which keep a record of each heap block (Helgrind,
+// Massif, DHAT, ...) then spend much of their time allocating and
+// freeing small objects of their own.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NLIVE  50000
+#define NITERS (4*1000*1000)
+
+static void* arr[NLIVE];
+
+// Consistent random number generator, so the allocation pattern is the
+// same everywhere.
+static unsigned int seed = 0;
+static unsigned int myrandom ( void )
+{
+   seed = 1103515245 * seed + 12345;
+   return seed >> 8;
+}
+
+int main ( void )
+{
+   int i, j;
+
+   for (i = 0; i < NITERS; i++) {
+      j = myrandom() % NLIVE;
+      free(arr[j]);
+      arr[j] = malloc(1 + myrandom() % 200);
+   }
+
+   for (i = 0; i < NLIVE; i++)
+      free(arr[i]);
+
+   printf("done\n");
+   return 0;
+}